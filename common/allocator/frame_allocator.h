@@ -0,0 +1,232 @@
+#ifndef _frame_allocator_h_
+#define _frame_allocator_h_
+#pragma once
+#include "common/allocator/egal_allocator.h"
+#include "common/egal_string.h"
+#include "common/math/egal_math.h"
+#include "common/thread/atomic.h"
+#include "common/type.h"
+namespace egal
+{
+	/**
+	 * Linear allocator for memory living at most until the end of the next frame. It owns two arenas, frame()
+	 * switches to the other one and rewinds it, so memory allocated during a frame stays valid during the
+	 * following one. Every thread carves its allocations from its own slab of the current arena, slabs are
+	 * taken with a single atomic add, so job workers never contend on a lock. Deallocation is a no-op, the
+	 * last allocation of a thread's slab grows in place, which keeps per-frame array growth cheap.
+	 * When an arena runs out, allocations fall back to the source allocator and are freed one by one.
+	 * Containers must not keep a buffer from this allocator for longer than one frame boundary.
+	 */
+	class FrameAllocator : public IAllocator
+	{
+	public:
+		enum
+		{
+			SLAB_SIZE = 64 * 1024,
+			DEFAULT_ALIGN = 8
+		};
+
+		struct Stats
+		{
+			e_int32 used_bytes;
+			e_int32 slab_count;
+			e_int32 fallback_count;
+		};
+
+	public:
+		FrameAllocator(IAllocator& source, e_int32 arena_size)
+			: m_source(source)
+			, m_arena_size(arena_size)
+			, m_frame(1)
+			, m_current_arena(0)
+		{
+			for (e_int32 i = 0; i < 2; ++i)
+			{
+				m_arenas[i] = (e_uint8*)source.allocate_aligned(arena_size, 16);
+				m_offsets[i] = 0;
+			}
+			m_slab_count = 0;
+			m_fallback_count = 0;
+			m_last_stats = {};
+		}
+
+
+		~FrameAllocator()
+		{
+			for (e_int32 i = 0; i < 2; ++i)
+			{
+				m_source.deallocate_aligned(m_arenas[i]);
+			}
+		}
+
+
+		/** switches arenas, must be called when no other thread allocates from this allocator */
+		void frame()
+		{
+			m_last_stats.used_bytes = Math::minimum((e_int32)m_offsets[m_current_arena], m_arena_size);
+			m_last_stats.slab_count = m_slab_count;
+			m_last_stats.fallback_count = m_fallback_count;
+			m_slab_count = 0;
+			m_fallback_count = 0;
+
+			++m_frame;
+			m_current_arena = m_frame & 1;
+			m_offsets[m_current_arena] = 0;
+		}
+
+
+		const Stats& getLastFrameStats() const { return m_last_stats; }
+
+
+		void* allocate(size_t size) override { return allocate_aligned(size, DEFAULT_ALIGN); }
+		void deallocate(void* ptr) override { deallocate_aligned(ptr); }
+		void* reallocate(void* ptr, size_t size) override { return reallocate_aligned(ptr, size, DEFAULT_ALIGN); }
+
+
+		void* allocate_aligned(size_t size, size_t align) override
+		{
+			align = Math::maximum(align, (size_t)DEFAULT_ALIGN);
+			size_t needed = size + align - 1 + sizeof(Header);
+
+			e_uint8* mem = nullptr;
+			if (needed <= SLAB_SIZE / 4)
+			{
+				ThreadSlab& slab = getThreadSlab();
+				if (slab.owner != this || slab.frame != m_frame || slab.current + needed > slab.end)
+				{
+					e_uint8* new_slab = allocateFromArena(SLAB_SIZE);
+					if (new_slab)
+					{
+						MT::atomicIncrement(&m_slab_count);
+						slab.owner = this;
+						slab.frame = m_frame;
+						slab.current = new_slab;
+						slab.end = new_slab + SLAB_SIZE;
+					}
+				}
+				if (slab.owner == this && slab.frame == m_frame && slab.current + needed <= slab.end)
+				{
+					mem = slab.current;
+					e_uint8* ptr = alignPointer(mem + sizeof(Header), align);
+					slab.current = ptr + size;
+					return initHeader(ptr, size, nullptr);
+				}
+			}
+			else
+			{
+				mem = allocateFromArena((e_int32)needed);
+			}
+
+			if (!mem)
+			{
+				MT::atomicIncrement(&m_fallback_count);
+				mem = (e_uint8*)m_source.allocate(needed);
+				return initHeader(alignPointer(mem + sizeof(Header), align), size, mem);
+			}
+			return initHeader(alignPointer(mem + sizeof(Header), align), size, nullptr);
+		}
+
+
+		void deallocate_aligned(void* ptr) override
+		{
+			if (!ptr || isInArena(ptr)) return;
+
+			m_source.deallocate(getHeader(ptr)->fallback);
+		}
+
+
+		void* reallocate_aligned(void* ptr, size_t size, size_t align) override
+		{
+			if (!ptr) return allocate_aligned(size, align);
+			if (size == 0)
+			{
+				deallocate_aligned(ptr);
+				return nullptr;
+			}
+
+			Header* header = getHeader(ptr);
+			ThreadSlab& slab = getThreadSlab();
+			e_uint8* end = (e_uint8*)ptr + header->size;
+			if (slab.owner == this && slab.frame == m_frame && slab.current == end && (e_uint8*)ptr + size <= slab.end)
+			{
+				/** the last allocation of this thread's slab, grow or shrink it in place */
+				slab.current = (e_uint8*)ptr + size;
+				header->size = size;
+				return ptr;
+			}
+
+			void* new_ptr = allocate_aligned(size, align);
+			StringUnitl::copyMemory(new_ptr, ptr, Math::minimum(size, header->size));
+			deallocate_aligned(ptr);
+			return new_ptr;
+		}
+
+	private:
+		struct Header
+		{
+			size_t		size;
+			e_uint8*	fallback;	/** block from the source allocator, nullptr for arena memory */
+		};
+
+		struct ThreadSlab
+		{
+			FrameAllocator* owner;
+			e_uint32		frame;
+			e_uint8*		current;
+			e_uint8*		end;
+		};
+
+		static ThreadSlab& getThreadSlab()
+		{
+			static thread_local ThreadSlab slab = { nullptr, 0, nullptr, nullptr };
+			return slab;
+		}
+
+		static e_uint8* alignPointer(e_uint8* ptr, size_t align)
+		{
+			return (e_uint8*)(((uintptr)ptr + align - 1) & ~(uintptr)(align - 1));
+		}
+
+		static Header* getHeader(void* ptr) { return (Header*)ptr - 1; }
+
+		static void* initHeader(e_uint8* ptr, size_t size, e_uint8* fallback)
+		{
+			Header* header = getHeader(ptr);
+			header->size = size;
+			header->fallback = fallback;
+			return ptr;
+		}
+
+		e_uint8* allocateFromArena(e_int32 size)
+		{
+			e_int32 arena = m_current_arena;
+			/** checked before the add, so failing callers can not overflow the offset */
+			if (m_offsets[arena] + size > m_arena_size) return nullptr;
+
+			e_int32 start = MT::atomicAdd(&m_offsets[arena], size);
+			if (start + size > m_arena_size) return nullptr;
+			return m_arenas[arena] + start;
+		}
+
+		e_bool isInArena(void* ptr) const
+		{
+			for (e_int32 i = 0; i < 2; ++i)
+			{
+				if (ptr >= m_arenas[i] && ptr < m_arenas[i] + m_arena_size) return true;
+			}
+			return false;
+		}
+
+	private:
+		IAllocator&			m_source;
+		e_uint8*			m_arenas[2];
+		volatile e_int32	m_offsets[2];
+		e_int32				m_arena_size;
+		e_uint32			m_frame;
+		e_int32				m_current_arena;
+		volatile e_int32	m_slab_count;
+		volatile e_int32	m_fallback_count;
+		Stats				m_last_stats;
+	};
+}
+#endif
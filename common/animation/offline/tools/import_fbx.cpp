@@ -2,6 +2,11 @@
 
 #include "common/animation/offline/skeleton_builder.h"
 #include "common/animation/offline/raw_skeleton.h"
+#include "common/animation/offline/raw_animation.h"
+#include "common/animation/offline/animation_builder.h"
+#include "common/animation/offline/animation_optimizer.h"
+#include "common/animation/animation.h"
+#include "common/animation/skeleton.h"
 
 #include "common/animation/offline/fbx/fbx_base.h"
 #include "common/animation/offline/fbx/fbx.h"
@@ -12,6 +17,7 @@
 
 
 #include "common/animation/io/archive.h"
+#include "common/animation/io/stream.h"
 #include "common/animation/offline/mesh.h"
 
 #include "editor/tools/import_assert/import_asset_dialog.h"
@@ -55,6 +61,102 @@ namespace egal
 		}
 	}
 
+	static Endianness getOutputEndianness(const ImportOption& option)
+	{
+		return option.m_endian == native ? GetNativeEndianness() : option.m_endian;
+	}
+
+	/** runtime skeleton (.ske) consumed by SkeletonResource */
+	static void writeSkeleton(const animation::Skeleton& skeleton, ImportOption& option)
+	{
+		StaticString<MAX_PATH_LENGTH> path;
+		if (option.out_skeleton_path_name[0] != '\0')
+		{
+			path = option.out_skeleton_path_name;
+		}
+		else
+		{
+			char basename[MAX_PATH_LENGTH];
+			StringUnitl::getBasename(basename, sizeof(basename), option.file_path_name);
+			path << option.out_dir << basename << ".ske";
+		}
+
+		io::File file(path, "wb");
+		if (!file.opened())
+		{
+			log_error("Failed to open output file: %s.", (const char*)path);
+			return;
+		}
+		io::OArchive archive(&file, getOutputEndianness(option));
+		archive << skeleton;
+		log_info("Outputs Skeleton binary end. at %s.", (const char*)path);
+	}
+
+	/** every animation stack is optimized and built into a SoA runtime clip (.ani) consumed by AnimationManager */
+	static void writeAnimations(animation::offline::fbx::FbxSceneLoader& scene_loader,
+		const animation::Skeleton& skeleton,
+		ImportOption& option)
+	{
+		animation::offline::fbx::Animations raw_animations;
+		if (!animation::offline::fbx::ExtractAnimations(&scene_loader, skeleton, option.m_sampling_rate, &raw_animations))
+		{
+			log_info("the fbx file has no animation.");
+			return;
+		}
+
+		/** stored after each clip, AnimationManager derives the frame count from it */
+		float fps = option.m_sampling_rate;
+		if (fps <= 0.f)
+		{
+			FbxScene* scene = scene_loader.scene();
+			FbxTime::EMode mode = scene->GetGlobalSettings().GetTimeMode();
+			fps = static_cast<float>((mode == FbxTime::eCustom)
+				? scene->GetGlobalSettings().GetCustomFrameRate()
+				: FbxTime::GetFrameRate(mode));
+		}
+
+		for (const animation::offline::RawAnimation& raw : raw_animations)
+		{
+			animation::offline::RawAnimation optimized;
+			const animation::offline::RawAnimation* source = &raw;
+			if (option.m_optimize)
+			{
+				animation::offline::AnimationOptimizer optimizer;
+				optimizer.rotation_tolerance = option.m_rotation;
+				optimizer.translation_tolerance = option.m_translation;
+				optimizer.scale_tolerance = option.m_scale;
+				optimizer.hierarchical_tolerance = option.m_hierarchical;
+				if (optimizer(raw, skeleton, &optimized)) source = &optimized;
+				else log_error("Failed to optimize animation %s.", raw.name.c_str());
+			}
+
+			animation::offline::AnimationBuilder builder;
+			animation::Animation* runtime_animation = builder(*source);
+			if (!runtime_animation)
+			{
+				log_error("Failed to build runtime animation %s.", raw.name.c_str());
+				continue;
+			}
+
+			StaticString<MAX_PATH_LENGTH> path(option.out_dir, raw.name.c_str(), ".ani");
+			io::File file(path, "wb");
+			if (file.opened())
+			{
+				io::OArchive archive(&file, getOutputEndianness(option));
+				archive << *runtime_animation;
+				archive << fps;
+				log_info("Outputs Animation binary end. at %s.", (const char*)path);
+			}
+			else
+			{
+				log_error("Failed to open output file: %s.", (const char*)path);
+			}
+
+			runtime_animation->~Animation();
+			g_allocator->deallocate(runtime_animation);
+		}
+	}
+
 	ImportFbx::ImportFbx(ImportAssetDialog& dialog)
 		: importAssetDialog(dialog)
 	{
@@ -111,6 +213,12 @@ namespace egal
 				log_info("the fbx file has no skeleton.");
 		}
 
+		if (skeleton)
+		{
+			writeSkeleton(*skeleton, option);
+			writeAnimations(scene_loader, *skeleton, option);
+		}
+
 		FbxNode* lNode = scene->GetRootNode();
 		if (lNode)
 		{
@@ -174,41 +282,6 @@ namespace egal
 		}
 	}
 
-	void writeSkeleton()
-	{
-		//create skeleton file
-		//io::File file(option.out_skeleton_path_name.c_str(), "wb");
-		//if (!file.opened())
-		//{
-		//	log_error("Failed to open output file: %s.", option.out_skeleton_path_name.c_str());
-
-		//	if (skeleton)
-		//		g_allocator->deallocate(skeleton);
-		//	return;
-		//}
-
-		//// Initializes output endianness from options.
-		//Endianness endianness = option.m_endian;
-		//log_info(endianness == Endianness::little ? "Little Endian output binary format selected." : "Big Endian output binary format selected.");
-
-		//// Initializes output archive.
-		//io::OArchive archive(&file, endianness);
-
-		//// Fills output archive with the skeleton.
-		//if (option.m_raw && raw_skeleton.Validate())
-		//{
-		//	log_info("Outputs RawSkeleton to binary archive.");
-		//	archive << raw_skeleton;
-		//	log_info("Outputs RawSkeleton binary end. at %s.", option.out_skeleton_path_name.c_str());
-		//}
-		//else if (skeleton)
-		//{
-		//	log_info("Outputs Skeleton to binary archive.");
-		//	archive << *skeleton;
-		//	log_info("Outputs Skeleton binary end. at %s.", option.out_skeleton_path_name.c_str());
-		//}
-	}
-
 	void writemesh(import_mesh& mesh, ImportOption& option)
 	{
 		FS::OsFile out_file;
@@ -297,6 +297,14 @@ namespace egal
 			lods_distances[1] = -100;
 			lods_distances[2] = -1000;
 			lods_distances[3] = -10000;
+			auto_lod_count = 0;
+			auto_lod_ratios[0] = 0.5f;
+			auto_lod_ratios[1] = 0.25f;
+			auto_lod_ratios[2] = 0.1f;
+			auto_lod_screen_sizes[0] = 0.5f;
+			auto_lod_screen_sizes[1] = 0.25f;
+			auto_lod_screen_sizes[2] = 0.1f;
+			auto_lod_max_error = 0.02f;
 
 			mesh_scale = 1.0f;
 			time_scale = 1.0f;
@@ -343,6 +351,10 @@ namespace egal
 		std::vector<import_material> m_materials;
 
 		e_float lods_distances[4];
+		e_int32 auto_lod_count;
+		e_float auto_lod_ratios[3];
+		e_float auto_lod_screen_sizes[3];
+		e_float auto_lod_max_error;
 		e_float mesh_scale;
 		e_float time_scale;
 		e_float position_error;
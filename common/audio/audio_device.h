@@ -29,7 +29,9 @@ public:
 	enum class BufferFlags
 	{
 		IS3D = 1,
-		LOOPED = 1 << 1
+		LOOPED = 1 << 1,
+		// data is a whole Ogg Vorbis file decoded while playing, it must outlive the buffer
+		VORBIS = 1 << 2
 	};
 
 	static const int MAX_PLAYING_SOUNDS = 256;
@@ -75,6 +77,7 @@ public:
 		float up_z) = 0;
 	virtual void setSourcePosition(BufferHandle buffer, float x, float y, float z) = 0;
 	virtual void update(float time_delta) = 0;
+	virtual bool canStreamVorbis() const { return false; }
 };
 
 
@@ -771,6 +771,7 @@ struct AudioSceneImpl LUMIX_FINAL : public AudioScene
 				if (!clip->isReady()) return -1;
 
 				int flags = is_3d ? (int)AudioDevice::BufferFlags::IS3D : 0;
+				if (clip->isStreamed()) flags |= (int)AudioDevice::BufferFlags::VORBIS;
 				auto buffer = m_device.createBuffer(
 					clip->getData(), clip->getSize(), clip->getChannels(), clip->getSampleRate(), flags);
 				if (buffer == AudioDevice::INVALID_BUFFER_HANDLE) return -1;
@@ -52,6 +52,7 @@ struct AudioSystemImpl LUMIX_FINAL : public AudioSystem
 		registerProperties(engine.getAllocator());
 		AudioScene::registerLuaAPI(m_engine.getState());
 		m_device = AudioDevice::create(m_engine);
+		m_manager.setStreaming(m_device->canStreamVorbis());
 		m_manager.create(CLIP_TYPE, m_engine.getResourceManager());
 	}
 
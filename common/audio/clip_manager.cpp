@@ -22,14 +22,35 @@ void Clip::unload()
 bool Clip::load(FS::IFile& file)
 {
 	PROFILE_FUNCTION();
+	if (static_cast<ClipManager&>(getResourceManager()).isStreaming())
+	{
+		// only the headers are parsed here
+		int error;
+		stb_vorbis* vorbis = stb_vorbis_open_memory((unsigned char*)file.getBuffer(), (int)file.size(), &error, nullptr);
+		if (!vorbis) return false;
+
+		stb_vorbis_info info = stb_vorbis_get_info(vorbis);
+		m_channels = info.channels;
+		m_sample_rate = info.sample_rate;
+		m_length_frames = stb_vorbis_stream_length_in_samples(vorbis);
+		stb_vorbis_close(vorbis);
+
+		m_data.resize((int)file.size());
+		copyMemory(&m_data[0], file.getBuffer(), file.size());
+		m_is_streamed = true;
+		return true;
+	}
+
 	short* output = nullptr;
 	auto res = stb_vorbis_decode_memory(
 		(unsigned char*)file.getBuffer(), (int)file.size(), &m_channels, &m_sample_rate, &output);
 	if (res <= 0) return false;
 
-	m_data.resize(res * m_channels);
-	copyMemory(&m_data[0], output, res * m_channels * sizeof(m_data[0]));
+	m_length_frames = res;
+	m_data.resize(res * m_channels * sizeof(short));
+	copyMemory(&m_data[0], output, res * m_channels * sizeof(short));
 	free(output);
+	m_is_streamed = false;
 
 	return true;
 }
@@ -16,6 +16,7 @@ public:
 	Clip(const Path& path, ResourceManagerBase& manager, IAllocator& allocator)
 		: Resource(path, manager, allocator)
 		, m_data(allocator)
+		, m_is_streamed(false)
 	{
 	}
 
@@ -23,14 +24,18 @@ public:
 	bool load(FS::IFile& file) override;
 	int getChannels() const { return m_channels; }
 	int getSampleRate() const { return m_sample_rate; }
-	int getSize() const { return m_data.size() * sizeof(m_data[0]); }
-	u16* getData() { return &m_data[0]; }
-	float getLengthSeconds() const { return m_data.size() / float(m_channels * m_sample_rate); }
+	// streamed clips keep the encoded file, the others 16 bit pcm
+	bool isStreamed() const { return m_is_streamed; }
+	int getSize() const { return m_data.size(); }
+	const void* getData() const { return &m_data[0]; }
+	float getLengthSeconds() const { return m_length_frames / float(m_sample_rate); }
 
 private:
 	int m_channels;
 	int m_sample_rate;
-	Array<u16> m_data;
+	int m_length_frames;
+	bool m_is_streamed;
+	Array<u8> m_data;
 };
 
 
@@ -40,17 +45,23 @@ public:
 	explicit ClipManager(IAllocator& allocator)
 		: ResourceManagerBase(allocator)
 		, m_allocator(allocator)
+		, m_is_streaming(false)
 	{
 	}
 
 	~ClipManager() {}
 
+	// clips loaded afterwards keep their encoded data and are decoded by the device while playing
+	void setStreaming(bool is_streaming) { m_is_streaming = is_streaming; }
+	bool isStreaming() const { return m_is_streaming; }
+
 protected:
 	Resource* createResource(const Path& path) override;
 	void destroyResource(Resource& resource) override;
 
 private:
 	IAllocator& m_allocator;
+	bool m_is_streaming;
 };
 
 
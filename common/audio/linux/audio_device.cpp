@@ -3,16 +3,264 @@
 #include "engine/log.h"
 #include "engine/engine.h"
 #include "engine/iplugin.h"
-#include "engine/log.h"
+#include "engine/math_utils.h"
+#include "engine/mt/atomic.h"
 #include "engine/mt/task.h"
+#include "engine/mt/thread.h"
 #include "engine/system.h"
+#define STB_VORBIS_HEADER_ONLY
+#include "stb/stb_vorbis.cpp"
 #include <alsa/asoundlib.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
 
 
 namespace Lumix
 {
 
 
+static const int OUTPUT_SAMPLE_RATE = 44100;
+static const int OUTPUT_CHANNELS = 2;
+static const int PERIOD_FRAMES = 1024;
+// decoded frames kept ahead for each streamed voice
+static const int STREAM_RING_FRAMES = 4096;
+static const int COMMAND_QUEUE_SIZE = 1024;
+static const float MAX_PITCH = 4;
+// setFrequency takes 0..1 mapped to the same range as DirectSound
+static const float FREQUENCY_MIN = 100;
+static const float FREQUENCY_MAX = 200000;
+// 3d voices closer than this play at full volume
+static const float REFERENCE_DISTANCE = 1;
+
+
+struct OutputSink
+{
+	virtual ~OutputSink() {}
+	virtual bool init() = 0;
+	virtual void write(const i16* frames, int frame_count) = 0;
+};
+
+
+struct AlsaSink : OutputSink
+{
+	~AlsaSink()
+	{
+		if (m_device) m_api.snd_pcm_close(m_device);
+		if (m_alsa_lib) unloadLibrary(m_alsa_lib);
+	}
+
+
+	bool loadAlsa()
+	{
+		m_alsa_lib = loadLibrary("libasound.so");
+		if (!m_alsa_lib) return false;
+
+		#define API(func) \
+			do { \
+				m_api.func = (decltype(m_api.func))getLibrarySymbol(m_alsa_lib, #func);\
+				if(!m_api.func)\
+				{\
+					unloadLibrary(m_alsa_lib);\
+					m_alsa_lib = nullptr;\
+					return false;\
+				}\
+			} while(false)
+
+		API(snd_pcm_open);
+		API(snd_pcm_close);
+		API(snd_pcm_start);
+		API(snd_pcm_writei);
+		API(snd_strerror);
+		API(snd_pcm_hw_params);
+		API(snd_pcm_hw_params_any);
+		API(snd_pcm_hw_params_sizeof);
+		API(snd_pcm_hw_params_set_format);
+		API(snd_pcm_hw_params_set_channels);
+		API(snd_pcm_hw_params_set_rate_near);
+		API(snd_pcm_hw_params_set_access);
+		API(snd_pcm_hw_params_set_buffer_size_near);
+		API(snd_pcm_name);
+		API(snd_pcm_state);
+		API(snd_pcm_wait);
+		API(snd_pcm_avail_update);
+		API(snd_pcm_recover);
+		API(snd_pcm_reset);
+		API(snd_pcm_delay);
+
+		#undef API
+
+		return true;
+	}
+
+
+	bool init() override
+	{
+		if (!loadAlsa()) return false;
+
+		unsigned int rate = OUTPUT_SAMPLE_RATE;
+		snd_pcm_hw_params_t* hw_params;
+		snd_pcm_uframes_t buffer_size = PERIOD_FRAMES * 2;
+
+		int res = m_api.snd_pcm_open(&m_device, "default", SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
+		if(res < 0) goto error;
+
+		hw_params = (snd_pcm_hw_params_t*)alloca(m_api.snd_pcm_hw_params_sizeof());
+		res = m_api.snd_pcm_hw_params_any(m_device, hw_params);
+		if(res < 0) goto error;
+
+		if (m_api.snd_pcm_hw_params_set_access(m_device, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED) < 0) goto error;
+		if (m_api.snd_pcm_hw_params_set_format(m_device, hw_params, SND_PCM_FORMAT_S16_LE) < 0)  goto error;
+		if (m_api.snd_pcm_hw_params_set_channels(m_device, hw_params, OUTPUT_CHANNELS) < 0) goto error;
+		if (m_api.snd_pcm_hw_params_set_rate_near(m_device, hw_params, &rate, 0) < 0) goto error;
+		if (m_api.snd_pcm_hw_params_set_buffer_size_near(m_device, hw_params, &buffer_size) < 0) goto error;
+		res = m_api.snd_pcm_hw_params(m_device, hw_params);
+		if(res < 0) goto error;
+
+		res = m_api.snd_pcm_start(m_device);
+		if(res < 0) goto error;
+
+		g_log_info.log("Audio") << "PCM name: '" << m_api.snd_pcm_name(m_device) << "'";
+		g_log_info.log("Audio") << "PCM state: '" << m_api.snd_pcm_state(m_device) << "'";
+
+		return true;
+
+		error:
+			const char* error_msg = m_api.snd_strerror(res);
+			g_log_error.log("Audio") << error_msg;
+			return false;
+	}
+
+
+	void write(const i16* frames, int frame_count) override
+	{
+		while (frame_count > 0)
+		{
+			snd_pcm_sframes_t frames_written = m_api.snd_pcm_writei(m_device, frames, frame_count);
+			if (frames_written == -EAGAIN)
+			{
+				m_api.snd_pcm_wait(m_device, 100);
+				continue;
+			}
+			if (frames_written < 0)
+			{
+				int recover_result = m_api.snd_pcm_recover(m_device, (int)frames_written, 1);
+				if (recover_result < 0)
+				{
+					// drop the rest of the period rather than stall the mixer
+					g_log_error.log("Audio") << m_api.snd_strerror(recover_result);
+					return;
+				}
+				continue;
+			}
+			frame_count -= (int)frames_written;
+			frames += frames_written * OUTPUT_CHANNELS;
+		}
+	}
+
+
+	struct API
+	{
+		int	(*snd_pcm_open)(snd_pcm_t** pcm, const char* name, snd_pcm_stream_t stream, int mode);
+		int (*snd_pcm_close)(snd_pcm_t* handle);
+		int (*snd_pcm_start)(snd_pcm_t* pcm);
+		int (*snd_pcm_hw_params_any)(snd_pcm_t* pcm, snd_pcm_hw_params_t* params);
+		int (*snd_pcm_hw_params)(snd_pcm_t* pcm, snd_pcm_hw_params_t* params);
+		const char* (*snd_strerror)(int error_num);
+		int (*snd_pcm_delay)(snd_pcm_t* pcm, snd_pcm_sframes_t* delayp);
+		int (*snd_pcm_reset)(snd_pcm_t*	pcm);
+		int (*snd_pcm_recover)(snd_pcm_t* pcm, int err, int silent);
+		size_t (*snd_pcm_hw_params_sizeof)();
+		int (*snd_pcm_hw_params_set_access)(snd_pcm_t* pcm, snd_pcm_hw_params_t* params, snd_pcm_access_t _access);
+		int (*snd_pcm_hw_params_set_format)(snd_pcm_t* pcm, snd_pcm_hw_params_t* params, snd_pcm_format_t val);
+		int (*snd_pcm_hw_params_set_channels)(snd_pcm_t* pcm, snd_pcm_hw_params_t* params, unsigned int val);
+		int (*snd_pcm_hw_params_set_rate_near)(snd_pcm_t* pcm, snd_pcm_hw_params_t* params, unsigned int* val, int* dir);
+		const char* (*snd_pcm_name)(snd_pcm_t* pcm);
+		snd_pcm_state_t (*snd_pcm_state)(snd_pcm_t* pcm);
+		int (*snd_pcm_wait)(snd_pcm_t* pcm, int timeout_ms);
+		snd_pcm_sframes_t (*snd_pcm_writei)(snd_pcm_t* pcm, const void* buffer, snd_pcm_uframes_t size);
+		snd_pcm_sframes_t (*snd_pcm_avail_update)(snd_pcm_t* pcm);
+		int (*snd_pcm_hw_params_set_buffer_size_near)(snd_pcm_t* pcm, snd_pcm_hw_params_t* params, snd_pcm_uframes_t* val);
+	};
+
+
+	void* m_alsa_lib = nullptr;
+	snd_pcm_t* m_device = nullptr;
+	API m_api;
+};
+
+
+// writes the mix into a wav file in real time, lets the mixer run on machines without a sound card
+struct WavFileSink : OutputSink
+{
+	explicit WavFileSink(const char* path)
+		: m_path(path)
+	{}
+
+
+	~WavFileSink()
+	{
+		if (!m_file) return;
+
+		// patch the sizes left empty by writeHeader
+		fseek(m_file, 4, SEEK_SET);
+		writeU32(36 + m_data_size);
+		fseek(m_file, 40, SEEK_SET);
+		writeU32(m_data_size);
+		fclose(m_file);
+	}
+
+
+	bool init() override
+	{
+		m_file = fopen(m_path, "wb");
+		if (!m_file)
+		{
+			g_log_error.log("Audio") << "Could not create " << m_path;
+			return false;
+		}
+
+		fwrite("RIFF", 4, 1, m_file);
+		writeU32(0);
+		fwrite("WAVEfmt ", 8, 1, m_file);
+		writeU32(16);
+		writeU16(1); // pcm
+		writeU16(OUTPUT_CHANNELS);
+		writeU32(OUTPUT_SAMPLE_RATE);
+		writeU32(OUTPUT_SAMPLE_RATE * OUTPUT_CHANNELS * sizeof(i16));
+		writeU16(OUTPUT_CHANNELS * sizeof(i16));
+		writeU16(16);
+		fwrite("data", 4, 1, m_file);
+		writeU32(0);
+
+		g_log_info.log("Audio") << "Writing output to " << m_path;
+		return true;
+	}
+
+
+	void write(const i16* frames, int frame_count) override
+	{
+		size_t size = frame_count * OUTPUT_CHANNELS * sizeof(i16);
+		if (fwrite(frames, size, 1, m_file) == 1) m_data_size += (u32)size;
+
+		// paces the mixer like a sound card would
+		MT::sleep(u32(frame_count * 1000 / OUTPUT_SAMPLE_RATE));
+	}
+
+
+	void writeU32(u32 value) { fwrite(&value, sizeof(value), 1, m_file); }
+	void writeU16(u16 value) { fwrite(&value, sizeof(value), 1, m_file); }
+
+
+	const char* m_path;
+	FILE* m_file = nullptr;
+	u32 m_data_size = 0;
+};
+
+
 struct AudioTask : MT::Task
 {
 	AudioTask(class AudioDeviceImpl& device, IAllocator& allocator)
@@ -21,33 +269,134 @@ struct AudioTask : MT::Task
 	{}
 
 	virtual int task() override;
-	void handleError(int error_code);
 
 	volatile bool m_finished = false;
 	AudioDeviceImpl& m_device;
 };
 
 
+// gains are interpolated over the period, so volume and panning changes do not click
+static void accumulate(float* accumulator, const float* samples, int frame_count, const float* gains_from, const float* gains_to)
+{
+	float delta_left = (gains_to[0] - gains_from[0]) / frame_count;
+	float delta_right = (gains_to[1] - gains_from[1]) / frame_count;
+	int i = 0;
+#if defined(__SSE2__)
+	__m128 gain = _mm_setr_ps(gains_from[0], gains_from[1], gains_from[0] + delta_left, gains_from[1] + delta_right);
+	__m128 gain_step = _mm_setr_ps(2 * delta_left, 2 * delta_right, 2 * delta_left, 2 * delta_right);
+	for (; i + 2 <= frame_count; i += 2)
+	{
+		__m128 sample = _mm_loadu_ps(samples + i * 2);
+		__m128 sum = _mm_loadu_ps(accumulator + i * 2);
+		_mm_storeu_ps(accumulator + i * 2, _mm_add_ps(sum, _mm_mul_ps(sample, gain)));
+		gain = _mm_add_ps(gain, gain_step);
+	}
+#endif
+	for (; i < frame_count; ++i)
+	{
+		accumulator[i * 2] += samples[i * 2] * (gains_from[0] + delta_left * i);
+		accumulator[i * 2 + 1] += samples[i * 2 + 1] * (gains_from[1] + delta_right * i);
+	}
+}
+
+
+static void convertToPCM(i16* output, const float* accumulator, int sample_count, float volume)
+{
+	float scale = volume * 32767;
+	int i = 0;
+#if defined(__SSE2__)
+	__m128 scale4 = _mm_set1_ps(scale);
+	__m128 max4 = _mm_set1_ps(32767);
+	__m128 min4 = _mm_set1_ps(-32768);
+	for (; i + 8 <= sample_count; i += 8)
+	{
+		// clamped before the conversion, out of range floats would turn into INT_MIN
+		__m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(accumulator + i), scale4), min4), max4);
+		__m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(accumulator + i + 4), scale4), min4), max4);
+		__m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+		_mm_storeu_si128((__m128i*)(output + i), packed);
+	}
+#endif
+	for (; i < sample_count; ++i)
+	{
+		float value = Math::clamp(accumulator[i] * scale, -32768.0f, 32767.0f);
+		output[i] = (i16)lrintf(value);
+	}
+}
+
+
 class AudioDeviceImpl : public AudioDevice
 {
 public:
-	struct Buffer
+	struct Command
 	{
-		enum class RuntimeFlags
+		enum class Type : u8
 		{
-			READY = 1 << 0,
-			PLAYING = 1 << 1,
-			LOOPED = 1 << 2
+			CREATE,
+			PLAY,
+			STOP,
+			PAUSE,
+			SET_VOLUME,
+			SET_FREQUENCY,
+			SET_TIME,
+			SET_POSITION,
+			SET_LISTENER_POSITION,
+			SET_LISTENER_ORIENTATION,
+			SET_MASTER_VOLUME
 		};
 
-		Buffer(IAllocator& allocator) : data(allocator) {}
-		
-		Array<u8> data;
+		Type type;
+		BufferHandle handle;
+		u32 generation;
+		void* memory;
+		void* encoded;
+		stb_vorbis* vorbis;
+		int frame_count;
 		int channels;
 		int sample_rate;
 		int flags;
-		int cursor;
-		u8 runtime_flags;
+		float values[6];
+	};
+
+
+	// owned by the mixer thread
+	struct Voice
+	{
+		u8* memory; // pcm copy or the stream ring
+		u8* encoded; // copy of the vorbis data, the decoder reads from it
+		stb_vorbis* vorbis;
+		int channels;
+		int frame_count;
+		int frame;
+		int ring_read;
+		int ring_count;
+		bool stream_end;
+		bool is_draining; // source is exhausted, the last frame fades into silence
+		bool is_primed;
+		bool is_3d;
+		bool is_looped;
+		bool is_playing;
+		bool is_end;
+		float sample_rate;
+		float frequency;
+		float fraction;
+		float current[2];
+		float next[2];
+		float volume;
+		float gains[2];
+		float position[3];
+		u32 generation;
+	};
+
+
+	// owned by the game thread
+	struct Slot
+	{
+		bool is_used;
+		bool is_playing;
+		u32 generation;
+		int sample_rate;
+		float pending_time;
 	};
 
 
@@ -57,24 +406,62 @@ public:
 		int sample_rate,
 		int flags) override
 	{
-		MT::SpinLock lock(m_mutex);
-		ASSERT(flags == 0); // nothing else supported yet
-		for(int i = 0, c = m_buffers.size(); i < c; ++i)
+		int idx = -1;
+		for (int i = 0; i < MAX_PLAYING_SOUNDS; ++i)
 		{
-			Buffer& buffer = m_buffers[i];
-			if((buffer.runtime_flags & (u8)Buffer::RuntimeFlags::READY)) continue;
-
-			buffer.channels = channels;
-			buffer.sample_rate = sample_rate;
-			buffer.flags = flags;
-			buffer.data.resize(size_bytes);
-			buffer.runtime_flags = (u8)Buffer::RuntimeFlags::READY;
-			buffer.cursor = 0;
-			copyMemory(&buffer.data[0], data, size_bytes);
-
-			return i;
+			if (!m_slots[i].is_used)
+			{
+				idx = i;
+				break;
+			}
 		}
-		return INVALID_BUFFER_HANDLE;
+		if (idx < 0) return INVALID_BUFFER_HANDLE;
+
+		Command cmd = {};
+		cmd.type = Command::Type::CREATE;
+		cmd.flags = flags;
+		if (flags & (int)BufferFlags::VORBIS)
+		{
+			// opened here, so the mixer thread only decodes
+			// the voice outlives the clip's data because stop is asynchronous, the decoder gets its own copy
+			void* encoded = m_allocator.allocate(size_bytes);
+			copyMemory(encoded, data, size_bytes);
+			int error;
+			stb_vorbis* vorbis = stb_vorbis_open_memory((const unsigned char*)encoded, size_bytes, &error, nullptr);
+			if (!vorbis)
+			{
+				g_log_error.log("Audio") << "Could not open vorbis stream, error " << error;
+				m_allocator.deallocate(encoded);
+				return INVALID_BUFFER_HANDLE;
+			}
+			cmd.encoded = encoded;
+			stb_vorbis_info info = stb_vorbis_get_info(vorbis);
+			cmd.vorbis = vorbis;
+			cmd.channels = OUTPUT_CHANNELS;
+			cmd.sample_rate = info.sample_rate;
+			cmd.frame_count = stb_vorbis_stream_length_in_samples(vorbis);
+			cmd.memory = m_allocator.allocate(STREAM_RING_FRAMES * OUTPUT_CHANNELS * sizeof(i16));
+		}
+		else
+		{
+			cmd.channels = channels;
+			cmd.sample_rate = sample_rate;
+			cmd.frame_count = size_bytes / (channels * sizeof(i16));
+			cmd.memory = m_allocator.allocate(size_bytes);
+			copyMemory(cmd.memory, data, size_bytes);
+		}
+
+		Slot& slot = m_slots[idx];
+		slot.is_used = true;
+		slot.is_playing = false;
+		++slot.generation;
+		slot.sample_rate = cmd.sample_rate;
+		slot.pending_time = 0;
+
+		cmd.handle = idx;
+		cmd.generation = slot.generation;
+		pushCommand(cmd);
+		return idx;
 	}
 
 
@@ -82,144 +469,120 @@ public:
 		float wet_dry_mix,
 		float feedback,
 		float left_delay,
-		float right_delay) override 
+		float right_delay) override
 	{
-		MT::SpinLock lock(m_mutex);
-		ASSERT(false); // not implemented yet
+		// effects are not supported by this device, the dry signal is played
 	}
 
 
-	void mix(u16* output, int size_bytes)
+	void setChorus(BufferHandle handle,
+		float wet_dry_mix,
+		float depth,
+		float feedback,
+		float frequency,
+		float delay,
+		i32 phase) override
 	{
-		setMemory(output, 0, size_bytes);
-
-		MT::SpinLock lock(m_mutex);
-		for (Buffer& buffer : m_buffers)
-		{
-			if((buffer.runtime_flags & (u8)Buffer::RuntimeFlags::PLAYING) == 0) continue;
-			
-			mixBuffer(output, size_bytes, buffer);
-		}
 	}
 
 
-	void mixBuffer(u16* output, int size_bytes, Buffer& buffer)
+	void play(BufferHandle buffer, bool looped) override
 	{
-		ASSERT(buffer.runtime_flags & (u8)Buffer::RuntimeFlags::PLAYING);
-		ASSERT(buffer.channels == 1); // nothing else supported yet
-		if (buffer.cursor >= buffer.data.size()) return;
-		int total = size_bytes;
-		bool is_looped = buffer.runtime_flags & (u8)Buffer::RuntimeFlags::LOOPED;
-		do
-		{
-			int to_copy = Math::minimum(total, buffer.data.size() - buffer.cursor);
-			copyMemory(output, &buffer.data[buffer.cursor], to_copy);
-			buffer.cursor += to_copy;
-			if(is_looped) buffer.cursor = buffer.cursor % buffer.data.size();
-			total -= to_copy;
-		} while(total > 0 && is_looped);
+		ASSERT(m_slots[buffer].is_used);
+		m_slots[buffer].is_playing = true;
+		Command cmd = makeCommand(Command::Type::PLAY, buffer);
+		cmd.values[0] = looped ? 1.0f : 0.0f;
+		pushCommand(cmd);
 	}
 
-	void play(BufferHandle buffer, bool looped) override 
-	{
-		MT::SpinLock lock(m_mutex);
-		ASSERT(m_buffers[buffer].runtime_flags & (u8)Buffer::RuntimeFlags::READY);
-		m_buffers[buffer].runtime_flags |= (u8)Buffer::RuntimeFlags::PLAYING;
-		if(looped)
-		{
-			m_buffers[buffer].runtime_flags |= (u8)Buffer::RuntimeFlags::LOOPED;
-		}
-		else
-		{
-			m_buffers[buffer].runtime_flags &= ~(u8)Buffer::RuntimeFlags::LOOPED;
-		}
-	}
 
-
-	bool isPlaying(BufferHandle buffer) override 
+	bool isPlaying(BufferHandle buffer) override
 	{
-		MT::SpinLock lock(m_mutex);
-		ASSERT(m_buffers[buffer].runtime_flags & (u8)Buffer::RuntimeFlags::READY);
-		return m_buffers[buffer].runtime_flags & (u8)Buffer::RuntimeFlags::PLAYING;
+		ASSERT(m_slots[buffer].is_used);
+		return m_slots[buffer].is_playing && !isEnd(buffer);
 	}
 
 
+	// releases the buffer, the handle must not be used afterwards
 	void stop(BufferHandle buffer) override
 	{
-		MT::SpinLock lock(m_mutex);
-		ASSERT(m_buffers[buffer].runtime_flags & (u8)Buffer::RuntimeFlags::READY);
-		m_buffers[buffer].runtime_flags &= ~(u8)Buffer::RuntimeFlags::PLAYING;
-		m_buffers[buffer].cursor = 0;
+		ASSERT(m_slots[buffer].is_used);
+		pushCommand(makeCommand(Command::Type::STOP, buffer));
+		m_slots[buffer].is_used = false;
+		m_slots[buffer].is_playing = false;
 	}
 
 
 	bool isEnd(BufferHandle buffer) override
-	{ 
-		MT::SpinLock lock(m_mutex);
-		ASSERT(m_buffers[buffer].runtime_flags & (u8)Buffer::RuntimeFlags::READY);
-		return m_buffers[buffer].cursor >= m_buffers[buffer].data.size();
+	{
+		ASSERT(m_slots[buffer].is_used);
+		if ((u32)m_published_generation[buffer] != m_slots[buffer].generation) return false;
+		MT::memoryBarrier();
+		return m_published_end[buffer] != 0;
 	}
 
 
 	void pause(BufferHandle buffer) override
 	{
-		MT::SpinLock lock(m_mutex);
-		ASSERT(m_buffers[buffer].runtime_flags & (u8)Buffer::RuntimeFlags::READY);
-		m_buffers[buffer].runtime_flags &= ~(u8)Buffer::RuntimeFlags::PLAYING;
+		ASSERT(m_slots[buffer].is_used);
+		m_slots[buffer].is_playing = false;
+		pushCommand(makeCommand(Command::Type::PAUSE, buffer));
 	}
 
 
-	void setMasterVolume(float volume) override 
+	void setMasterVolume(float volume) override
 	{
-		MT::SpinLock lock(m_mutex);
-		ASSERT(false); // not implemented yet
+		Command cmd = makeCommand(Command::Type::SET_MASTER_VOLUME, INVALID_BUFFER_HANDLE);
+		cmd.values[0] = volume;
+		pushCommand(cmd);
 	}
 
 
-	void setVolume(BufferHandle buffer, float volume) override 
+	void setVolume(BufferHandle buffer, float volume) override
 	{
-		MT::SpinLock lock(m_mutex);
-		ASSERT(m_buffers[buffer].runtime_flags & (u8)Buffer::RuntimeFlags::READY);
-		ASSERT(false); // not implemented yet
+		ASSERT(m_slots[buffer].is_used);
+		Command cmd = makeCommand(Command::Type::SET_VOLUME, buffer);
+		cmd.values[0] = volume;
+		pushCommand(cmd);
 	}
 
 
-	void setFrequency(BufferHandle buffer, float frequency) override 
+	void setFrequency(BufferHandle buffer, float frequency) override
 	{
-		MT::SpinLock lock(m_mutex);
-		ASSERT(m_buffers[buffer].runtime_flags & (u8)Buffer::RuntimeFlags::READY);
-		ASSERT(false); // not implemented yet
+		ASSERT(m_slots[buffer].is_used);
+		Command cmd = makeCommand(Command::Type::SET_FREQUENCY, buffer);
+		cmd.values[0] = FREQUENCY_MIN + frequency * (FREQUENCY_MAX - FREQUENCY_MIN);
+		pushCommand(cmd);
 	}
 
 
-	void setCurrentTime(BufferHandle handle, float time_seconds) override 
+	void setCurrentTime(BufferHandle handle, float time_seconds) override
 	{
-		MT::SpinLock lock(m_mutex);
-		ASSERT(m_buffers[handle].runtime_flags & (u8)Buffer::RuntimeFlags::READY);
-		
-		Buffer& buffer = m_buffers[handle];
-		float length = float(buffer.data.size() / double(buffer.sample_rate * 2 * buffer.channels));
-		float rel = time_seconds / length;
-		buffer.cursor = rel * buffer.data.size();
-		buffer.cursor = Math::clamp(buffer.cursor, 0, buffer.data.size());
+		ASSERT(m_slots[handle].is_used);
+		m_slots[handle].pending_time = time_seconds;
+		Command cmd = makeCommand(Command::Type::SET_TIME, handle);
+		cmd.values[0] = time_seconds;
+		pushCommand(cmd);
 	}
 
 
 	float getCurrentTime(BufferHandle handle) override
 	{
-		MT::SpinLock lock(m_mutex);
-		ASSERT(m_buffers[handle].runtime_flags & (u8)Buffer::RuntimeFlags::READY);
-		
-		Buffer& buffer = m_buffers[handle];
-		float length = float(buffer.data.size() / double(buffer.sample_rate * 2 * buffer.channels));
-		return float(length * double(buffer.cursor) / buffer.data.size());
+		ASSERT(m_slots[handle].is_used);
+		const Slot& slot = m_slots[handle];
+		if ((u32)m_published_generation[handle] != slot.generation) return slot.pending_time;
+		MT::memoryBarrier();
+		return m_published_frame[handle] / float(slot.sample_rate);
 	}
 
 
 	void setListenerPosition(float x, float y, float z) override
 	{
-		MT::SpinLock lock(m_mutex);
-		ASSERT(false); // not implemented yet
+		Command cmd = makeCommand(Command::Type::SET_LISTENER_POSITION, INVALID_BUFFER_HANDLE);
+		cmd.values[0] = x;
+		cmd.values[1] = y;
+		cmd.values[2] = z;
+		pushCommand(cmd);
 	}
 
 
@@ -230,225 +593,419 @@ public:
 		float up_y,
 		float up_z) override
 	{
-		MT::SpinLock lock(m_mutex);
-		ASSERT(false); // not implemented yet
+		Command cmd = makeCommand(Command::Type::SET_LISTENER_ORIENTATION, INVALID_BUFFER_HANDLE);
+		cmd.values[0] = front_x;
+		cmd.values[1] = front_y;
+		cmd.values[2] = front_z;
+		cmd.values[3] = up_x;
+		cmd.values[4] = up_y;
+		cmd.values[5] = up_z;
+		pushCommand(cmd);
 	}
-	
+
 
 	void setSourcePosition(BufferHandle buffer, float x, float y, float z) override
 	{
-		MT::SpinLock lock(m_mutex);
-		ASSERT(m_buffers[buffer].runtime_flags & (u8)Buffer::RuntimeFlags::READY);
-		ASSERT(false); // not implemented yet
+		ASSERT(m_slots[buffer].is_used);
+		Command cmd = makeCommand(Command::Type::SET_POSITION, buffer);
+		cmd.values[0] = x;
+		cmd.values[1] = y;
+		cmd.values[2] = z;
+		pushCommand(cmd);
 	}
-	
-	
-	void update(float time_delta) override 
+
+
+	void update(float time_delta) override
 	{
 	}
 
 
-	AudioDeviceImpl(Engine& engine)
-		: m_allocator(engine.getAllocator())
-		, m_engine(engine)
-		, m_buffers(m_allocator)
-		, m_mutex(false)
+	bool canStreamVorbis() const override { return true; }
+
+
+	Command makeCommand(Command::Type type, BufferHandle handle)
 	{
-		m_buffers.reserve(MAX_BUFFERS_COUNT);
-		for (int i = 0; i < MAX_BUFFERS_COUNT; ++i)
+		Command cmd = {};
+		cmd.type = type;
+		cmd.handle = handle;
+		if (handle != INVALID_BUFFER_HANDLE) cmd.generation = m_slots[handle].generation;
+		return cmd;
+	}
+
+
+	// single producer, all setters are called from the game thread
+	void pushCommand(const Command& cmd)
+	{
+		while (m_command_write - m_command_read >= COMMAND_QUEUE_SIZE)
 		{
-			Buffer& buffer = m_buffers.emplace(m_allocator);
-			buffer.runtime_flags = 0;
+			MT::sleep(1);
 		}
+		m_commands[m_command_write % COMMAND_QUEUE_SIZE] = cmd;
+		MT::memoryBarrier();
+		m_command_write = m_command_write + 1;
 	}
 
 
-	~AudioDeviceImpl()
+	void processCommands()
 	{
-		if (m_task)
+		while (m_command_read != m_command_write)
 		{
-			m_task->m_finished = true;
-			m_task->destroy();
-			LUMIX_DELETE(m_allocator, m_task);
+			MT::memoryBarrier();
+			const Command& cmd = m_commands[m_command_read % COMMAND_QUEUE_SIZE];
+			processCommand(cmd);
+			MT::memoryBarrier();
+			m_command_read = m_command_read + 1;
 		}
-		if (m_device) m_api.snd_pcm_close(m_device);
-		if (m_alsa_lib) unloadLibrary(m_alsa_lib);
 	}
 
 
-	bool loadAlsa()
+	void releaseVoice(Voice& voice)
 	{
-		m_alsa_lib = loadLibrary("libasound.so");
-		if (!m_alsa_lib) return false;
+		if (voice.vorbis) stb_vorbis_close(voice.vorbis);
+		if (voice.memory) m_allocator.deallocate(voice.memory);
+		if (voice.encoded) m_allocator.deallocate(voice.encoded);
+		voice.vorbis = nullptr;
+		voice.memory = nullptr;
+		voice.encoded = nullptr;
+		voice.is_playing = false;
+	}
 
-		#define API(func) \
-			do { \
-				m_api.func = (decltype(m_api.func))getLibrarySymbol(m_alsa_lib, #func);\
-				if(!m_api.func)\
-				{\
-					unloadLibrary(m_alsa_lib);\
-					m_alsa_lib = nullptr;\
-					return false;\
-				}\
-			} while(false)
 
-		API(snd_pcm_open);
-		API(snd_pcm_close);
-		API(snd_pcm_start);
-		API(snd_pcm_writei);
-		API(snd_strerror);
-		API(snd_pcm_hw_params);
-		API(snd_pcm_hw_params_any);
-		API(snd_pcm_hw_params_sizeof);
-		API(snd_pcm_hw_params_set_format);
-		API(snd_pcm_hw_params_set_channels);
-		API(snd_pcm_hw_params_set_rate_near);
-		API(snd_pcm_hw_params_set_access);
-		API(snd_pcm_hw_params_set_buffer_size_near);
-		API(snd_pcm_name);
-		API(snd_pcm_state);
-		API(snd_pcm_wait);
-		API(snd_pcm_avail_update);
-		API(snd_pcm_recover);
-		API(snd_pcm_reset);
-		API(snd_pcm_delay);
+	void seek(Voice& voice, float time_seconds)
+	{
+		int frame = Math::clamp(int(time_seconds * voice.sample_rate), 0, voice.frame_count);
+		voice.frame = frame;
+		voice.is_primed = false;
+		voice.is_draining = false;
+		voice.is_end = false;
+		if (voice.vorbis)
+		{
+			stb_vorbis_seek(voice.vorbis, frame);
+			voice.ring_read = 0;
+			voice.ring_count = 0;
+			voice.stream_end = false;
+		}
+	}
 
-		#undef API
 
+	void processCommand(const Command& cmd)
+	{
+		switch (cmd.type)
+		{
+			case Command::Type::SET_MASTER_VOLUME: m_master_volume = cmd.values[0]; return;
+			case Command::Type::SET_LISTENER_POSITION: copyMemory(m_listener_position, cmd.values, sizeof(float) * 3); return;
+			case Command::Type::SET_LISTENER_ORIENTATION:
+				copyMemory(m_listener_front, cmd.values, sizeof(float) * 3);
+				copyMemory(m_listener_up, cmd.values + 3, sizeof(float) * 3);
+				return;
+			default: break;
+		}
+
+		Voice& voice = m_voices[cmd.handle];
+		if (cmd.type == Command::Type::CREATE)
+		{
+			releaseVoice(voice);
+			voice.memory = (u8*)cmd.memory;
+			voice.encoded = (u8*)cmd.encoded;
+			voice.vorbis = cmd.vorbis;
+			voice.channels = cmd.channels;
+			voice.frame_count = cmd.frame_count;
+			voice.frame = 0;
+			voice.ring_read = 0;
+			voice.ring_count = 0;
+			voice.stream_end = false;
+			voice.is_draining = false;
+			voice.is_primed = false;
+			voice.is_3d = (cmd.flags & (int)BufferFlags::IS3D) != 0;
+			voice.is_looped = false;
+			voice.is_playing = false;
+			voice.is_end = false;
+			voice.sample_rate = (float)cmd.sample_rate;
+			voice.frequency = (float)cmd.sample_rate;
+			voice.volume = 1;
+			voice.gains[0] = voice.gains[1] = 0;
+			setMemory(voice.position, 0, sizeof(voice.position));
+			voice.generation = cmd.generation;
+			publish(cmd.handle);
+			return;
+		}
+
+		// commands of a released buffer still in the queue
+		if (voice.generation != cmd.generation || !voice.memory) return;
+
+		switch (cmd.type)
+		{
+			case Command::Type::PLAY:
+				// replaying a finished voice starts it over
+				if (voice.is_end) seek(voice, 0);
+				voice.is_playing = true;
+				voice.is_looped = cmd.values[0] != 0;
+				break;
+			case Command::Type::STOP: releaseVoice(voice); break;
+			case Command::Type::PAUSE: voice.is_playing = false; break;
+			case Command::Type::SET_VOLUME: voice.volume = cmd.values[0]; break;
+			case Command::Type::SET_FREQUENCY: voice.frequency = cmd.values[0]; break;
+			case Command::Type::SET_TIME:
+				seek(voice, cmd.values[0]);
+				publish(cmd.handle);
+				break;
+			case Command::Type::SET_POSITION: copyMemory(voice.position, cmd.values, sizeof(voice.position)); break;
+			default: ASSERT(false); break;
+		}
+	}
+
+
+	void publish(int idx)
+	{
+		const Voice& voice = m_voices[idx];
+		m_published_frame[idx] = voice.frame_count > 0 ? voice.frame % voice.frame_count : voice.frame;
+		m_published_end[idx] = voice.is_end ? 1 : 0;
+		MT::memoryBarrier();
+		m_published_generation[idx] = (i32)voice.generation;
+	}
+
+
+	void refillStream(Voice& voice)
+	{
+		bool is_rewound = false;
+		i16* ring = (i16*)voice.memory;
+		while (voice.ring_count < STREAM_RING_FRAMES && !voice.stream_end)
+		{
+			int write = (voice.ring_read + voice.ring_count) % STREAM_RING_FRAMES;
+			int free_frames = Math::minimum(STREAM_RING_FRAMES - write, STREAM_RING_FRAMES - voice.ring_count);
+			int decoded = stb_vorbis_get_samples_short_interleaved(
+				voice.vorbis, OUTPUT_CHANNELS, ring + write * OUTPUT_CHANNELS, free_frames * OUTPUT_CHANNELS);
+			if (decoded == 0)
+			{
+				if (!voice.is_looped || is_rewound)
+				{
+					voice.stream_end = true;
+					break;
+				}
+				stb_vorbis_seek_start(voice.vorbis);
+				is_rewound = true;
+				continue;
+			}
+			is_rewound = false;
+			voice.ring_count += decoded;
+		}
+	}
+
+
+	bool pullFrame(Voice& voice, float* out)
+	{
+		static const float SCALE = 1.0f / 32768;
+		const i16* src;
+		if (voice.vorbis)
+		{
+			if (voice.ring_count == 0)
+			{
+				refillStream(voice);
+				if (voice.ring_count == 0) return false;
+			}
+			src = (const i16*)voice.memory + voice.ring_read * OUTPUT_CHANNELS;
+			voice.ring_read = (voice.ring_read + 1) % STREAM_RING_FRAMES;
+			--voice.ring_count;
+		}
+		else
+		{
+			if (voice.frame >= voice.frame_count)
+			{
+				if (!voice.is_looped || voice.frame_count == 0) return false;
+				voice.frame = 0;
+			}
+			src = (const i16*)voice.memory + voice.frame * voice.channels;
+		}
+		++voice.frame;
+		out[0] = src[0] * SCALE;
+		out[1] = (voice.channels > 1 ? src[1] : src[0]) * SCALE;
 		return true;
 	}
 
 
-	bool init()
+	void computeGains(const Voice& voice, float* gains)
 	{
-		if (!loadAlsa()) return false;
-		
-		unsigned int rate = 44100;
-		int channels = 1;
-		snd_pcm_hw_params_t* hw_params;
-		snd_pcm_uframes_t buffer_size = 1024;
+		if (!voice.is_3d)
+		{
+			gains[0] = gains[1] = voice.volume;
+			return;
+		}
 
-		int res = m_api.snd_pcm_open(&m_device, "default", SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
-		if(res < 0) goto error;
+		// listener right, left handed like DirectSound
+		const float* up = m_listener_up;
+		const float* front = m_listener_front;
+		float right[3] = {
+			up[1] * front[2] - up[2] * front[1],
+			up[2] * front[0] - up[0] * front[2],
+			up[0] * front[1] - up[1] * front[0]
+		};
+		float dir[3] = {
+			voice.position[0] - m_listener_position[0],
+			voice.position[1] - m_listener_position[1],
+			voice.position[2] - m_listener_position[2]
+		};
+		float distance = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+		float pan = distance > 0.0001f ? (dir[0] * right[0] + dir[1] * right[1] + dir[2] * right[2]) / distance : 0;
+		pan = Math::clamp(pan, -1.0f, 1.0f);
+		float attenuation = REFERENCE_DISTANCE / Math::maximum(distance, REFERENCE_DISTANCE);
+
+		// equal power panning
+		float angle = (pan + 1) * Math::PI * 0.25f;
+		gains[0] = cosf(angle) * attenuation * voice.volume;
+		gains[1] = sinf(angle) * attenuation * voice.volume;
+	}
 
-		hw_params = (snd_pcm_hw_params_t*)alloca(m_api.snd_pcm_hw_params_sizeof());
-		res = m_api.snd_pcm_hw_params_any(m_device, hw_params);
-		if(res < 0) goto error;
 
-		if (m_api.snd_pcm_hw_params_set_access(m_device, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED) < 0) goto error;
-		if (m_api.snd_pcm_hw_params_set_format(m_device, hw_params, SND_PCM_FORMAT_S16_LE) < 0)  goto error;
-		if (m_api.snd_pcm_hw_params_set_channels(m_device, hw_params, channels) < 0) goto error; 
-		if (m_api.snd_pcm_hw_params_set_rate_near(m_device, hw_params, &rate, 0) < 0) goto error;
-		if (m_api.snd_pcm_hw_params_set_buffer_size_near(m_device, hw_params, &buffer_size) < 0) goto error;
-		res = m_api.snd_pcm_hw_params(m_device, hw_params);
-		if(res < 0) goto error;
-		
-		res = m_api.snd_pcm_start(m_device);
-		if(res < 0) goto error;
+	void mixVoice(Voice& voice, int frame_count)
+	{
+		if (voice.vorbis && voice.ring_count < STREAM_RING_FRAMES / 2) refillStream(voice);
+		if (!voice.is_primed)
+		{
+			voice.fraction = 0;
+			if (!pullFrame(voice, voice.current)) voice.is_end = true;
+			if (!pullFrame(voice, voice.next))
+			{
+				voice.next[0] = voice.next[1] = 0;
+				voice.is_draining = true;
+			}
+			voice.is_primed = true;
+		}
 
-		g_log_info.log("Audio") << "PCM name: '" << m_api.snd_pcm_name(m_device) << "'";
-		g_log_info.log("Audio") << "PCM state: '" << m_api.snd_pcm_state(m_device) << "'";
+		// resampled with linear interpolation, pitch comes from the frequency
+		float step = Math::minimum(voice.frequency / OUTPUT_SAMPLE_RATE, MAX_PITCH);
+		float* samples = m_voice_samples;
+		int i = 0;
+		for (; i < frame_count && !voice.is_end; ++i)
+		{
+			samples[i * 2] = voice.current[0] + (voice.next[0] - voice.current[0]) * voice.fraction;
+			samples[i * 2 + 1] = voice.current[1] + (voice.next[1] - voice.current[1]) * voice.fraction;
+			voice.fraction += step;
+			while (voice.fraction >= 1)
+			{
+				voice.fraction -= 1;
+				voice.current[0] = voice.next[0];
+				voice.current[1] = voice.next[1];
+				if (!pullFrame(voice, voice.next))
+				{
+					// the last frame still plays, the voice ends once it is consumed
+					if (voice.is_draining) voice.is_end = true;
+					voice.next[0] = voice.next[1] = 0;
+					voice.is_draining = true;
+				}
+			}
+		}
+		setMemory(samples + i * 2, 0, (frame_count - i) * 2 * sizeof(float));
 
-		m_task = LUMIX_NEW(m_allocator, AudioTask)(*this, m_allocator);
-		m_task->create("AudioTask");
+		float gains[2];
+		computeGains(voice, gains);
+		accumulate(m_accumulator, samples, frame_count, voice.gains, gains);
+		voice.gains[0] = gains[0];
+		voice.gains[1] = gains[1];
+	}
 
-		return true;
 
-		error:
-			const char* error_msg = m_api.snd_strerror(res);
-			g_log_error.log("Audio") << error_msg;
-			return false;
+	void mix(i16* output, int frame_count)
+	{
+		ASSERT(frame_count <= PERIOD_FRAMES);
+		processCommands();
+
+		setMemory(m_accumulator, 0, sizeof(float) * frame_count * OUTPUT_CHANNELS);
+		for (int i = 0; i < MAX_PLAYING_SOUNDS; ++i)
+		{
+			Voice& voice = m_voices[i];
+			if (!voice.is_playing || voice.is_end) continue;
+
+			mixVoice(voice, frame_count);
+			publish(i);
+		}
+
+		convertToPCM(output, m_accumulator, frame_count * OUTPUT_CHANNELS, m_master_volume);
 	}
 
 
-	struct API
+	AudioDeviceImpl(Engine& engine)
+		: m_allocator(engine.getAllocator())
+		, m_engine(engine)
 	{
-		int	(*snd_pcm_open)(snd_pcm_t** pcm, const char* name, snd_pcm_stream_t stream, int mode);
-		int (*snd_pcm_close)(snd_pcm_t* handle);
-		int (*snd_pcm_start)(snd_pcm_t* pcm); 	
-		int (*snd_pcm_hw_params_any)(snd_pcm_t* pcm, snd_pcm_hw_params_t* params);
-		int (*snd_pcm_hw_params)(snd_pcm_t* pcm, snd_pcm_hw_params_t* params);
-		const char* (*snd_strerror)(int error_num);
-		int (*snd_pcm_delay)(snd_pcm_t* pcm, snd_pcm_sframes_t* delayp); 
-		int (*snd_pcm_reset)(snd_pcm_t*	pcm); 	
-		int (*snd_pcm_recover)(snd_pcm_t* pcm, int err, int silent);
-		size_t (*snd_pcm_hw_params_sizeof)();
-		int (*snd_pcm_hw_params_set_access)(snd_pcm_t* pcm, snd_pcm_hw_params_t* params, snd_pcm_access_t _access);
-		int (*snd_pcm_hw_params_set_format)(snd_pcm_t* pcm, snd_pcm_hw_params_t* params, snd_pcm_format_t val);
-		int (*snd_pcm_hw_params_set_channels)(snd_pcm_t* pcm, snd_pcm_hw_params_t* params, unsigned int val);
-		int (*snd_pcm_hw_params_set_rate_near)(snd_pcm_t* pcm, snd_pcm_hw_params_t* params, unsigned int* val, int* dir);
-		const char* (*snd_pcm_name)(snd_pcm_t* pcm);
-		snd_pcm_state_t (*snd_pcm_state)(snd_pcm_t* pcm);
-		int (*snd_pcm_wait)(snd_pcm_t* pcm, int timeout_ms);
-		snd_pcm_sframes_t (*snd_pcm_writei)(snd_pcm_t* pcm, const void* buffer, snd_pcm_uframes_t size);
-		snd_pcm_sframes_t (*snd_pcm_avail_update)(snd_pcm_t* pcm);
-		int (*snd_pcm_hw_params_set_buffer_size_near)(snd_pcm_t* pcm, snd_pcm_hw_params_t* params, snd_pcm_uframes_t* val);
-	};
+		setMemory(m_voices, 0, sizeof(m_voices));
+		setMemory(m_slots, 0, sizeof(m_slots));
+		for (int i = 0; i < MAX_PLAYING_SOUNDS; ++i)
+		{
+			m_published_generation[i] = 0;
+			m_published_frame[i] = 0;
+			m_published_end[i] = 0;
+		}
+	}
 
 
-	static const int MAX_BUFFERS_COUNT = 256;
+	~AudioDeviceImpl()
+	{
+		if (m_task)
+		{
+			m_task->m_finished = true;
+			m_task->destroy();
+			LUMIX_DELETE(m_allocator, m_task);
+		}
+		LUMIX_DELETE(m_allocator, m_sink);
+		processCommands();
+		for (Voice& voice : m_voices)
+		{
+			releaseVoice(voice);
+		}
+	}
+
+
+	bool init()
+	{
+		const char* output_path = getenv("LUMIX_AUDIO_OUTPUT_FILE");
+		if (output_path)
+		{
+			m_sink = LUMIX_NEW(m_allocator, WavFileSink)(output_path);
+		}
+		else
+		{
+			m_sink = LUMIX_NEW(m_allocator, AlsaSink)();
+		}
+		if (!m_sink->init()) return false;
+
+		m_task = LUMIX_NEW(m_allocator, AudioTask)(*this, m_allocator);
+		m_task->create("AudioTask");
+
+		return true;
+	}
 
 
 	IAllocator& m_allocator;
-	Array<Buffer> m_buffers;
 	AudioTask* m_task = nullptr;
+	OutputSink* m_sink = nullptr;
 	Engine& m_engine;
-	MT::SpinMutex m_mutex;
-	void* m_alsa_lib = nullptr;
-	snd_pcm_t* m_device = nullptr;
-	API m_api;
-};
 
-
-void AudioTask::handleError(int error_code)
-{
-	const char* error_msg = m_device.m_api.snd_strerror(error_code);
-	g_log_error.log("Audio") << error_msg;
-}
+	Command m_commands[COMMAND_QUEUE_SIZE];
+	volatile i32 m_command_write = 0;
+	volatile i32 m_command_read = 0;
+
+	Slot m_slots[MAX_PLAYING_SOUNDS];
+	volatile i32 m_published_generation[MAX_PLAYING_SOUNDS];
+	volatile i32 m_published_frame[MAX_PLAYING_SOUNDS];
+	volatile i32 m_published_end[MAX_PLAYING_SOUNDS];
+
+	Voice m_voices[MAX_PLAYING_SOUNDS];
+	float m_accumulator[PERIOD_FRAMES * OUTPUT_CHANNELS];
+	float m_voice_samples[PERIOD_FRAMES * OUTPUT_CHANNELS];
+	float m_master_volume = 1;
+	float m_listener_position[3] = {0, 0, 0};
+	float m_listener_front[3] = {0, 0, 1};
+	float m_listener_up[3] = {0, 1, 0};
+};
 
 
 int AudioTask::task()
 {
+	i16 buffer[PERIOD_FRAMES * OUTPUT_CHANNELS];
 	while(!m_finished)
 	{
-		u16 buffer[2*1024];
-		int frames_avail = lengthOf(buffer);
-		m_device.mix(buffer, frames_avail * 2);
-
-		u16* iter = buffer;
-		while(frames_avail > 0)
-		{		
-			snd_pcm_sframes_t frames_written = m_device.m_api.snd_pcm_writei(m_device.m_device, buffer, frames_avail);
-			if (frames_written < 0)
-			{
-				if (frames_written == -EAGAIN) continue;
-				if (frames_written == -EPIPE) 
-				{
-					int recover_result = m_device.m_api.snd_pcm_recover(m_device.m_device, frames_written, 1);
-					if (recover_result < 0)
-					{
-						handleError(recover_result);
-						break;
-					}
-
-					frames_written = m_device.m_api.snd_pcm_writei(m_device.m_device, buffer, frames_avail);
-					if (frames_written < 0)
-					{
-						handleError(recover_result);
-						break;
-					}
-				} 
-				else 
-				{
-					handleError(frames_written);
-				}
-			}
-			else
-			{
-				frames_avail -= frames_written;
-				iter += frames_written;
-			}
-		}
+		m_device.mix(buffer, PERIOD_FRAMES);
+		m_device.m_sink->write(buffer, PERIOD_FRAMES);
 	}
 	return 0;
 }
@@ -470,6 +1027,13 @@ public:
 		float feedback,
 		float left_delay,
 		float right_delay) override {}
+	void setChorus(BufferHandle handle,
+		float wet_dry_mix,
+		float depth,
+		float feedback,
+		float frequency,
+		float delay,
+		i32 phase) override {}
 	void play(BufferHandle buffer, bool looped) override {}
 	bool isPlaying(BufferHandle buffer) override { return false; }
 	void stop(BufferHandle buffer) override {}
@@ -515,4 +1079,4 @@ void AudioDevice::destroy(AudioDevice& device)
 }
 
 
-} // namespace Lumix
\ No newline at end of file
+} // namespace Lumix
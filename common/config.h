@@ -3,6 +3,9 @@
 #pragma once
 
 #define MAX_LOG_LENGTH  2048
+#define LOG_MIN_LEVEL   1		// 1:info 2:waring 3:error, lower levels are compiled out
+#define LOG_RATE_LIMIT  20		// messages per second from one call site before repeats are suppressed
+#define LOG_FLUSH_INTERVAL 0.1f	// seconds between log file flushes, errors flush at once
 #define MAX_PATH_LENGTH 1024
 
 #define USE_DEFAULT_ALLOCATOR 1
@@ -14,8 +14,6 @@
 
 #pragma comment(lib, "DbgHelp.lib")
 
-#undef _DEBUG
-
 namespace egal
 {
 	namespace Debug
@@ -225,72 +223,239 @@ namespace egal
 		static const e_uint32 UNINITIALIZED_MEMORY_PATTERN = 0xCD;
 		static const e_uint32 FREED_MEMORY_PATTERN = 0xDD;
 		static const e_uint32 ALLOCATION_GUARD = 0xFDFDFDFD;
+		/** guards, fill patterns, leak list and call stacks, on in debug builds only. tag accounting does not depend on it and runs in every build */
+#ifdef _DEBUG
+		static const bool ARE_CHECKS_ENABLED = true;
+#else
+		static const bool ARE_CHECKS_ENABLED = false;
+#endif
+		static const size_t MIN_ALIGN = 16;
+		static const e_int32 MAX_COUNTER_THREADS = 64;
+		static const e_int32 TAG_COUNT = (e_int32)MemoryTag::COUNT;
 
-		Allocator::Allocator(IAllocator& source)
-			: m_source(source)
-			, m_root(nullptr)
-			, m_mutex(false)
-			, m_total_size(0)
-			, m_is_fill_enabled(true)
-			, m_are_guards_enabled(true)
+		/** written only by the owning thread, padded so neighbouring threads do not share cache lines */
+		struct MemoryCounters
 		{
-			m_sentinels[0].next = &m_sentinels[1];
-			m_sentinels[0].previous = nullptr;
-			m_sentinels[0].stack_leaf = nullptr;
-			m_sentinels[0].size = 0;
-			m_sentinels[0].align = 0;
+			e_int64 bytes[TAG_COUNT];
+			e_int64 allocations[TAG_COUNT];
+			e_int64 padding[2];
+		};
 
-			m_sentinels[1].next = nullptr;
-			m_sentinels[1].previous = &m_sentinels[0];
-			m_sentinels[1].stack_leaf = nullptr;
-			m_sentinels[1].size = 0;
-			m_sentinels[1].align = 0;
+		static MemoryCounters s_thread_counters[MAX_COUNTER_THREADS];
+		/** threads beyond MAX_COUNTER_THREADS share these, updated with compare and exchange */
+		static MemoryCounters s_shared_counters;
+		static volatile e_int64 s_external_bytes[TAG_COUNT];
+		static e_int64 s_budgets[TAG_COUNT];
+		static volatile e_int32 s_counter_thread_count = 0;
+		static thread_local MemoryTag t_memory_tag = MemoryTag::GENERAL;
+		static thread_local e_int32 t_counter_slot = -1;
+		static thread_local e_int32 t_stack_sample_counter = 0;
 
-			m_root = &m_sentinels[1];
+		static e_int32 getCounterSlot()
+		{
+			if (t_counter_slot < 0)
+			{
+				e_int32 slot = MT::atomicIncrement(&s_counter_thread_count) - 1;
+				t_counter_slot = slot < MAX_COUNTER_THREADS ? slot : MAX_COUNTER_THREADS;
+			}
+			return t_counter_slot;
+		}
+
+		static void atomicAdd64(volatile e_int64* value, e_int64 delta)
+		{
+			for (;;)
+			{
+				e_int64 old_value = *value;
+				if (MT::compareAndExchange64(value, old_value + delta, old_value)) return;
+			}
+		}
+
+		static void addToCounters(MemoryTag tag, e_int64 bytes, e_int64 allocations)
+		{
+			e_int32 slot = getCounterSlot();
+			e_int32 idx = (e_int32)tag;
+			if (slot < MAX_COUNTER_THREADS)
+			{
+				s_thread_counters[slot].bytes[idx] += bytes;
+				s_thread_counters[slot].allocations[idx] += allocations;
+				return;
+			}
+			atomicAdd64(&s_shared_counters.bytes[idx], bytes);
+			atomicAdd64(&s_shared_counters.allocations[idx], allocations);
+		}
+
+		MemoryTagScope::MemoryTagScope(MemoryTag tag)
+			: m_previous(t_memory_tag)
+		{
+			t_memory_tag = tag;
+		}
+
+		MemoryTagScope::~MemoryTagScope()
+		{
+			t_memory_tag = m_previous;
+		}
+
+		MemoryTag getCurrentMemoryTag()
+		{
+			return t_memory_tag;
+		}
+
+		const char* getMemoryTagName(MemoryTag tag)
+		{
+			static const char* names[TAG_COUNT] = { "general", "texture", "mesh", "animation", "lua", "audio", "scene" };
+			return names[(e_int32)tag];
+		}
+
+		void trackMemory(MemoryTag tag, e_int64 bytes)
+		{
+			atomicAdd64(&s_external_bytes[(e_int32)tag], bytes);
+		}
+
+		void setMemoryBudget(MemoryTag tag, e_int64 bytes)
+		{
+			s_budgets[(e_int32)tag] = bytes;
+		}
+
+		MemoryStats getMemoryStats(MemoryTag tag)
+		{
+			e_int32 idx = (e_int32)tag;
+			MemoryStats stats;
+			stats.heap_bytes = s_shared_counters.bytes[idx];
+			stats.heap_allocations = s_shared_counters.allocations[idx];
+			e_int32 thread_count = s_counter_thread_count < MAX_COUNTER_THREADS ? s_counter_thread_count : MAX_COUNTER_THREADS;
+			for (e_int32 i = 0; i < thread_count; ++i)
+			{
+				stats.heap_bytes += s_thread_counters[i].bytes[idx];
+				stats.heap_allocations += s_thread_counters[i].allocations[idx];
+			}
+			stats.external_bytes = s_external_bytes[idx];
+			stats.budget = s_budgets[idx];
+			return stats;
+		}
+
+		bool isOverMemoryBudget(MemoryTag tag)
+		{
+			MemoryStats stats = getMemoryStats(tag);
+			return stats.budget > 0 && stats.heap_bytes + stats.external_bytes > stats.budget;
+		}
+
+		bool checkMemoryBudgets()
+		{
+			bool ok = true;
+			for (e_int32 i = 0; i < TAG_COUNT; ++i)
+			{
+				if (!isOverMemoryBudget((MemoryTag)i)) continue;
+
+				MemoryStats stats = getMemoryStats((MemoryTag)i);
+				log_error("Core Memory budget of %s exceeded, %lld of %lld bytes used",
+					getMemoryTagName((MemoryTag)i),
+					(long long)(stats.heap_bytes + stats.external_bytes),
+					(long long)stats.budget);
+				ok = false;
+			}
+			return ok;
+		}
+
+		void reportMemory()
+		{
+			for (e_int32 i = 0; i < TAG_COUNT; ++i)
+			{
+				MemoryStats stats = getMemoryStats((MemoryTag)i);
+				log_info("Core Memory %s: heap %lld KB in %lld allocations, external %lld KB, budget %lld KB",
+					getMemoryTagName((MemoryTag)i),
+					(long long)(stats.heap_bytes >> 10),
+					(long long)stats.heap_allocations,
+					(long long)(stats.external_bytes >> 10),
+					(long long)(stats.budget >> 10));
+			}
+		}
+
+		Allocator::Allocator(IAllocator& source)
+			: m_source(source)
+			, m_stack_mutex(false)
+			, m_tag(MemoryTag::GENERAL)
+			, m_is_root(true)
+			, m_is_fill_enabled(ARE_CHECKS_ENABLED)
+			, m_are_guards_enabled(ARE_CHECKS_ENABLED)
+			, m_is_leak_tracking_enabled(ARE_CHECKS_ENABLED)
+			, m_stack_sampling(ARE_CHECKS_ENABLED ? 1 : 0)
+		{
+			for (Bucket& bucket : m_buckets)
+			{
+				memset(&bucket.sentinel, 0, sizeof(bucket.sentinel));
+				bucket.sentinel.next = &bucket.sentinel;
+				bucket.sentinel.previous = &bucket.sentinel;
+			}
+		}
+
+		Allocator::Allocator(IAllocator& source, MemoryTag tag)
+			: Allocator(source)
+		{
+			m_tag = tag;
+			m_is_root = false;
 		}
 
 		Allocator::~Allocator()
 		{
-			AllocationInfo* last_sentinel = &m_sentinels[1];
-			if (m_root != last_sentinel)
+			bool has_leaks = false;
+			for (Bucket& bucket : m_buckets)
 			{
-				OutputDebugString("Memory leaks detected!\n");
-				AllocationInfo* info = m_root;
-				while (info != last_sentinel)
+				for (AllocationInfo* info = bucket.sentinel.next; info != &bucket.sentinel; info = info->next)
 				{
+					if (!has_leaks) OutputDebugString("Memory leaks detected!\n");
+					has_leaks = true;
+
 					char tmp[2048];
-					sprintf(tmp, "\nAllocation size : %Iu, memory %p\n", info->size, info + sizeof(info));
+					sprintf(tmp, "\nAllocation size : %Iu, memory %p\n", info->size, getUserPtrFromAllocationInfo(info));
 					OutputDebugString(tmp);
 					m_stack_tree.printCallstack(info->stack_leaf);
-					info = info->next;
 				}
-				ASSERT(false);
 			}
+			ASSERT(!has_leaks);
+		}
+
+		size_t Allocator::getTotalSize() const
+		{
+			if (!m_is_root) return (size_t)getMemoryStats(m_tag).heap_bytes;
+
+			e_int64 size = 0;
+			for (e_int32 i = 0; i < TAG_COUNT; ++i)
+			{
+				size += getMemoryStats((MemoryTag)i).heap_bytes;
+			}
+			return (size_t)size;
 		}
 
 		void Allocator::lock()
 		{
-			m_mutex.lock();
+			for (Bucket& bucket : m_buckets)
+			{
+				bucket.mutex.lock();
+			}
 		}
 
 		void Allocator::unlock()
 		{
-			m_mutex.unlock();
+			for (Bucket& bucket : m_buckets)
+			{
+				bucket.mutex.unlock();
+			}
 		}
 
 		void Allocator::checkGuards()
 		{
-			if (m_are_guards_enabled) return;
+			if (!m_are_guards_enabled || !m_is_leak_tracking_enabled) return;
 
-			auto* info = m_root;
-			while (info)
+			for (Bucket& bucket : m_buckets)
 			{
-				auto user_ptr = getUserPtrFromAllocationInfo(info);
-				void* system_ptr = getSystemFromUser(user_ptr);
-				ASSERT(*(e_uint32*)system_ptr == ALLOCATION_GUARD);
-				ASSERT(*(e_uint32*)((e_uint8*)user_ptr + info->size) == ALLOCATION_GUARD);
-
-				info = info->next;
+				MT::SpinLock lock(bucket.mutex);
+				for (AllocationInfo* info = bucket.sentinel.next; info != &bucket.sentinel; info = info->next)
+				{
+					auto user_ptr = getUserPtrFromAllocationInfo(info);
+					void* system_ptr = getSystemFromUser(user_ptr);
+					ASSERT(*(e_uint32*)system_ptr == ALLOCATION_GUARD);
+					ASSERT(*(e_uint32*)((e_uint8*)user_ptr + info->size) == ALLOCATION_GUARD);
+				}
 			}
 		}
 
@@ -299,23 +464,12 @@ namespace egal
 			return sizeof(AllocationInfo) + (m_are_guards_enabled ? sizeof(ALLOCATION_GUARD) : 0);
 		}
 
-		size_t Allocator::getNeededMemory(size_t size)
-		{
-			return size + sizeof(AllocationInfo) + (m_are_guards_enabled ? sizeof(ALLOCATION_GUARD) << 1 : 0);
-		}
-
 		size_t Allocator::getNeededMemory(size_t size, size_t align)
 		{
 			return size + sizeof(AllocationInfo) + (m_are_guards_enabled ? sizeof(ALLOCATION_GUARD) << 1 : 0) +
 				align;
 		}
 
-		Allocator::AllocationInfo* Allocator::getAllocationInfoFromSystem(void* system_ptr)
-		{
-			return (AllocationInfo*)(m_are_guards_enabled ? (e_uint8*)system_ptr + sizeof(ALLOCATION_GUARD)
-				: system_ptr);
-		}
-
 		void* Allocator::getUserPtrFromAllocationInfo(AllocationInfo* info)
 		{
 			return ((e_uint8*)info + sizeof(AllocationInfo));
@@ -328,70 +482,64 @@ namespace egal
 
 		e_uint8* Allocator::getUserFromSystem(void* system_ptr, size_t align)
 		{
-			size_t diff = (m_are_guards_enabled ? sizeof(ALLOCATION_GUARD) : 0) + sizeof(AllocationInfo);
-
-			if (align) diff += (align - diff % align) % align;
+			size_t diff = getAllocationOffset();
+			diff += (align - diff % align) % align;
 			return (e_uint8*)system_ptr + diff;
 		}
 
 		e_uint8* Allocator::getSystemFromUser(void* user_ptr)
 		{
 			AllocationInfo* info = getAllocationInfoFromUser(user_ptr);
-			size_t diff = (m_are_guards_enabled ? sizeof(ALLOCATION_GUARD) : 0) + sizeof(AllocationInfo);
-			if (info->align) diff += (info->align - diff % info->align) % info->align;
+			size_t diff = getAllocationOffset();
+			diff += (info->align - diff % info->align) % info->align;
 			return (e_uint8*)user_ptr - diff;
 		}
 
-		void* Allocator::reallocate(void* user_ptr, size_t size)
+		void Allocator::link(AllocationInfo* info)
 		{
-#ifndef _DEBUG
-			return m_source.reallocate(user_ptr, size);
-#else
-			if (user_ptr == nullptr) return allocate(size);
-			if (size == 0) return nullptr;
-
-			void* new_data = allocate(size);
-			if (!new_data) return nullptr;
-
-			AllocationInfo* info = getAllocationInfoFromUser(user_ptr);
-			StringUnitl::copyMemory(new_data, user_ptr, info->size < size ? info->size : size);
-
-			deallocate(user_ptr);
+			/** a thread mostly frees what it allocated, so its own bucket is rarely locked by others */
+			info->bucket = e_uint8(getCounterSlot() % BUCKET_COUNT);
+			Bucket& bucket = m_buckets[info->bucket];
 
-			return new_data;
-#endif
+			MT::SpinLock lock(bucket.mutex);
+			info->previous = &bucket.sentinel;
+			info->next = bucket.sentinel.next;
+			bucket.sentinel.next->previous = info;
+			bucket.sentinel.next = info;
 		}
 
-		void* Allocator::allocate_aligned(size_t size, size_t align)
+		void Allocator::unlink(AllocationInfo* info)
 		{
-#ifndef _DEBUG
-			return m_source.allocate_aligned(size, align);
-#else
-			void* system_ptr;
-			AllocationInfo* info;
-			e_uint8* user_ptr;
-
-			size_t system_size = getNeededMemory(size, align);
-			{
-				MT::SpinLock lock(m_mutex);
-				system_ptr = m_source.allocate_aligned(system_size, align);
-				user_ptr = getUserFromSystem(system_ptr, align);
-				info = _new(getAllocationInfoFromUser(user_ptr)) AllocationInfo();
-
-				info->previous = m_root->previous;
-				m_root->previous->next = info;
+			MT::SpinLock lock(m_buckets[info->bucket].mutex);
+			info->previous->next = info->next;
+			info->next->previous = info->previous;
+		}
 
-				info->next = m_root;
-				m_root->previous = info;
+		void* Allocator::initAllocation(void* system_ptr, size_t size, size_t align)
+		{
+			e_uint8* user_ptr = getUserFromSystem(system_ptr, align);
+			AllocationInfo* info = _new(getAllocationInfoFromUser(user_ptr)) AllocationInfo();
+			info->previous = nullptr;
+			info->next = nullptr;
+			info->size = size;
+			info->stack_leaf = nullptr;
+			info->align = e_uint16(align);
+			info->tag = m_is_root ? t_memory_tag : m_tag;
+			info->bucket = 0;
 
-				m_root = info;
+			if (m_is_root) addToCounters(info->tag, (e_int64)size, 1);
 
-				m_total_size += size;
-			} // because of the SpinLock
+			if (m_is_leak_tracking_enabled)
+			{
+				if (m_stack_sampling > 0 && ++t_stack_sample_counter >= m_stack_sampling)
+				{
+					t_stack_sample_counter = 0;
+					MT::SpinLock lock(m_stack_mutex);
+					info->stack_leaf = m_stack_tree.record();
+				}
+				link(info);
+			}
 
-			info->align = e_uint16(align);
-			info->stack_leaf = m_stack_tree.record();
-			info->size = size;
 			if (m_is_fill_enabled)
 			{
 				memset(user_ptr, UNINITIALIZED_MEMORY_PATTERN, size);
@@ -400,154 +548,99 @@ namespace egal
 			if (m_are_guards_enabled)
 			{
 				*(e_uint32*)system_ptr = ALLOCATION_GUARD;
-				*(e_uint32*)((e_uint8*)system_ptr + system_size - sizeof(ALLOCATION_GUARD)) = ALLOCATION_GUARD;
+				*(e_uint32*)(user_ptr + size) = ALLOCATION_GUARD;
 			}
 
 			return user_ptr;
-#endif
 		}
 
-		void Allocator::deallocate_aligned(void* user_ptr)
+		void Allocator::releaseAllocation(AllocationInfo* info)
 		{
-#ifndef _DEBUG
-			m_source.deallocate_aligned(user_ptr);
-#else
-			if (user_ptr)
+			void* user_ptr = getUserPtrFromAllocationInfo(info);
+			if (m_are_guards_enabled)
 			{
-				AllocationInfo* info = getAllocationInfoFromUser(user_ptr);
-				void* system_ptr = getSystemFromUser(user_ptr);
-				if (m_is_fill_enabled)
-				{
-					memset(user_ptr, FREED_MEMORY_PATTERN, info->size);
-				}
-
-				if (m_are_guards_enabled)
-				{
-					ASSERT(*(e_uint32*)system_ptr == ALLOCATION_GUARD);
-					size_t system_size = getNeededMemory(info->size, info->align);
-					ASSERT(*(e_uint32*)((e_uint8*)system_ptr + system_size - sizeof(ALLOCATION_GUARD)) == ALLOCATION_GUARD);
-				}
-
-				{
-					MT::SpinLock lock(m_mutex);
-					if (info == m_root)
-					{
-						m_root = info->next;
-					}
-					info->previous->next = info->next;
-					info->next->previous = info->previous;
-
-					m_total_size -= info->size;
-				} // because of the SpinLock
+				ASSERT(*(e_uint32*)getSystemFromUser(user_ptr) == ALLOCATION_GUARD);
+				ASSERT(*(e_uint32*)((e_uint8*)user_ptr + info->size) == ALLOCATION_GUARD);
+			}
 
-				info->~AllocationInfo();
+			if (m_is_root) addToCounters(info->tag, -(e_int64)info->size, -1);
+			if (m_is_leak_tracking_enabled) unlink(info);
 
-				m_source.deallocate_aligned((void*)system_ptr);
+			if (m_is_fill_enabled)
+			{
+				memset(user_ptr, FREED_MEMORY_PATTERN, info->size);
 			}
-#endif
+			info->~AllocationInfo();
 		}
 
-		void* Allocator::reallocate_aligned(void* user_ptr, size_t size, size_t align)
+		void* Allocator::allocate(size_t size)
 		{
-#ifndef _DEBUG
-			return m_source.reallocate_aligned(user_ptr, size, align);
-#else
-			if (user_ptr == nullptr) return allocate_aligned(size, align);
-			if (size == 0) return nullptr;
-
-			void* new_data = allocate_aligned(size, align);
-			if (!new_data) return nullptr;
-
-			AllocationInfo* info = getAllocationInfoFromUser(user_ptr);
-			StringUnitl::copyMemory(new_data, user_ptr, info->size < size ? info->size : size);
+			return allocate_aligned(size, MIN_ALIGN);
+		}
 
+		void Allocator::deallocate(void* user_ptr)
+		{
 			deallocate_aligned(user_ptr);
+		}
 
-			return new_data;
-#endif
+		void* Allocator::reallocate(void* user_ptr, size_t size)
+		{
+			return reallocate_aligned(user_ptr, size, MIN_ALIGN);
 		}
 
-		void* Allocator::allocate(size_t size)
+		void* Allocator::allocate_aligned(size_t size, size_t align)
 		{
-#ifndef _DEBUG
-			return m_source.allocate(size);
-#else
-			void* system_ptr;
-			AllocationInfo* info;
-			size_t system_size = getNeededMemory(size);
-			{
-				MT::SpinLock lock(m_mutex);
-				system_ptr = m_source.allocate(system_size);
-				info = _new(getAllocationInfoFromSystem(system_ptr)) AllocationInfo();
+			if (align < MIN_ALIGN) align = MIN_ALIGN;
 
-				info->previous = m_root->previous;
-				m_root->previous->next = info;
+			/** a tagged allocator charges its blocks to its tag in the root allocator below it */
+			MemoryTagScope scope(m_is_root ? t_memory_tag : m_tag);
+			void* system_ptr = m_source.allocate_aligned(getNeededMemory(size, align), align);
+			if (!system_ptr) return nullptr;
 
-				info->next = m_root;
-				m_root->previous = info;
+			return initAllocation(system_ptr, size, align);
+		}
 
-				m_root = info;
+		void Allocator::deallocate_aligned(void* user_ptr)
+		{
+			if (!user_ptr) return;
 
-				m_total_size += size;
-			} // because of the SpinLock
+			void* system_ptr = getSystemFromUser(user_ptr);
+			releaseAllocation(getAllocationInfoFromUser(user_ptr));
+			m_source.deallocate_aligned(system_ptr);
+		}
 
-			void* user_ptr = getUserFromSystem(system_ptr, 0);
-			info->stack_leaf = m_stack_tree.record();
-			info->size = size;
-			info->align = 0;
-			if (m_is_fill_enabled)
+		void* Allocator::reallocate_aligned(void* user_ptr, size_t size, size_t align)
+		{
+			if (user_ptr == nullptr) return allocate_aligned(size, align);
+			if (size == 0)
 			{
-				memset(user_ptr, UNINITIALIZED_MEMORY_PATTERN, size);
+				deallocate_aligned(user_ptr);
+				return nullptr;
 			}
+			if (align < MIN_ALIGN) align = MIN_ALIGN;
 
-			if (m_are_guards_enabled)
+			AllocationInfo* info = getAllocationInfoFromUser(user_ptr);
+			if (!m_is_leak_tracking_enabled && !m_are_guards_enabled && info->align == align)
 			{
-				*(e_uint32*)system_ptr = ALLOCATION_GUARD;
-				*(e_uint32*)((e_uint8*)system_ptr + system_size - sizeof(ALLOCATION_GUARD)) = ALLOCATION_GUARD;
+				/** nothing points to the header, let the source resize the block, the header offset stays the same */
+				void* system_ptr = m_source.reallocate_aligned(getSystemFromUser(user_ptr), getNeededMemory(size, align), align);
+				if (!system_ptr) return nullptr;
+
+				e_uint8* new_user_ptr = getUserFromSystem(system_ptr, align);
+				AllocationInfo* new_info = getAllocationInfoFromUser(new_user_ptr);
+				if (m_is_root) addToCounters(new_info->tag, (e_int64)size - (e_int64)new_info->size, 0);
+				new_info->size = size;
+				return new_user_ptr;
 			}
 
-			return user_ptr;
-#endif
-		}
-
-		void Allocator::deallocate(void* user_ptr)
-		{
-#ifndef _DEBUG
-			m_source.deallocate(user_ptr);
-#else
-			if (user_ptr)
-			{
-				AllocationInfo* info = getAllocationInfoFromUser(user_ptr);
-				void* system_ptr = getSystemFromUser(user_ptr);
-				if (m_is_fill_enabled)
-				{
-					memset(user_ptr, FREED_MEMORY_PATTERN, info->size);
-				}
-
-				if (m_are_guards_enabled)
-				{
-					ASSERT(*(e_uint32*)system_ptr == ALLOCATION_GUARD);
-					size_t system_size = getNeededMemory(info->size);
-					ASSERT(*(e_uint32*)((e_uint8*)system_ptr + system_size - sizeof(ALLOCATION_GUARD)) == ALLOCATION_GUARD);
-				}
-
-				{
-					MT::SpinLock lock(m_mutex);
-					if (info == m_root)
-					{
-						m_root = info->next;
-					}
-					info->previous->next = info->next;
-					info->next->previous = info->previous;
+			void* new_data = allocate_aligned(size, align);
+			if (!new_data) return nullptr;
 
-					m_total_size -= info->size;
-				} // because of the SpinLock
+			StringUnitl::copyMemory(new_data, user_ptr, info->size < size ? info->size : size);
 
-				info->~AllocationInfo();
+			deallocate_aligned(user_ptr);
 
-				m_source.deallocate((void*)system_ptr);
-			}
-#endif
+			return new_data;
 		}
 
 	} // namespace Debug
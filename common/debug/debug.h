@@ -13,6 +13,52 @@ namespace egal
 		void debugBreak();
 		void debugOutput(const char* message);
 
+		/** subsystems with their own memory budget */
+		enum class MemoryTag : e_uint8
+		{
+			GENERAL = 0,
+			TEXTURE,
+			MESH,
+			ANIMATION,
+			LUA,
+			AUDIO,
+			SCENE,
+
+			COUNT
+		};
+
+		struct MemoryStats
+		{
+			e_int64 heap_bytes;			/** live bytes from root Debug::Allocator allocations with this tag */
+			e_int64 heap_allocations;
+			e_int64 external_bytes;		/** memory reported with trackMemory, e.g. gpu textures */
+			e_int64 budget;				/** 0 means unlimited */
+		};
+
+		/** heap allocations made by the calling thread while the scope lives are charged to tag */
+		class MemoryTagScope
+		{
+		public:
+			explicit MemoryTagScope(MemoryTag tag);
+			~MemoryTagScope();
+
+		private:
+			MemoryTag m_previous;
+		};
+
+		MemoryTag getCurrentMemoryTag();
+		const char* getMemoryTagName(MemoryTag tag);
+		/** charges memory which does not live on the tracked heap, negative bytes release it */
+		void trackMemory(MemoryTag tag, e_int64 bytes);
+		void setMemoryBudget(MemoryTag tag, e_int64 bytes);
+		/** sums the per thread counters, cheap enough to be called every frame */
+		MemoryStats getMemoryStats(MemoryTag tag);
+		bool isOverMemoryBudget(MemoryTag tag);
+		/** logs every tag over its budget, returns false if there is any so tests can fail on it */
+		bool checkMemoryBudgets();
+		/** logs usage and budget of every tag */
+		void reportMemory();
+
 		class StackNode;
 		class StackTree
 		{
@@ -35,6 +81,13 @@ namespace egal
 			static e_int32 s_instances;
 		};
 
+		/**
+		 * Tracking allocator. The root one (constructed without a tag) charges allocations to the calling thread's
+		 * memory tag using per thread counters, so accounting takes no lock and can stay on in release builds.
+		 * A tagged allocator must sit on top of the root one, it charges everything it allocates to its tag.
+		 * Guards, fill patterns, leak list and sampled call stacks are only kept when checks are enabled,
+		 * the leak list is split into buckets with their own lock, so threads rarely wait for each other.
+		 */
 		class Allocator : public IAllocator
 		{
 		public:
@@ -45,10 +98,15 @@ namespace egal
 				size_t size;
 				StackNode* stack_leaf;
 				e_uint16 align;
+				MemoryTag tag;
+				e_uint8 bucket;
 			};
 
+			enum { BUCKET_COUNT = 64 };
+
 		public:
 			explicit Allocator(IAllocator& source);
+			Allocator(IAllocator& source, MemoryTag tag);
 			virtual ~Allocator();
 
 			void* allocate(size_t size) override;
@@ -57,33 +115,49 @@ namespace egal
 			void* allocate_aligned(size_t size, size_t align) override;
 			void deallocate_aligned(void* ptr) override;
 			void* reallocate_aligned(void* ptr, size_t size, size_t align) override;
-			size_t getTotalSize() const { return m_total_size; }
+			size_t getTotalSize() const;
 			void checkGuards();
 
+			/** captures the call stack of every nth allocation, 0 disables it, needs checks enabled */
+			void setStackSampling(e_int32 every_nth) { m_stack_sampling = every_nth; }
+
 			IAllocator& getSourceAllocator() { return m_source; }
-			AllocationInfo* getFirstAllocationInfo() const { return m_root; }
 			void lock();
 			void unlock();
 
+		private:
+			struct Bucket
+			{
+				Bucket() : mutex(false) {}
+
+				MT::SpinMutex mutex;
+				AllocationInfo sentinel;	/** head of a circular list */
+			};
+
 		private:
 			inline size_t getAllocationOffset();
-			inline AllocationInfo* getAllocationInfoFromSystem(void* system_ptr);
 			inline AllocationInfo* getAllocationInfoFromUser(void* user_ptr);
 			inline e_uint8* getUserFromSystem(void* system_ptr, size_t align);
 			inline e_uint8* getSystemFromUser(void* user_ptr);
-			inline size_t getNeededMemory(size_t size);
 			inline size_t getNeededMemory(size_t size, size_t align);
 			inline void* getUserPtrFromAllocationInfo(AllocationInfo* info);
 
+			void* initAllocation(void* system_ptr, size_t size, size_t align);
+			void releaseAllocation(AllocationInfo* info);
+			void link(AllocationInfo* info);
+			void unlink(AllocationInfo* info);
+
 		private:
 			IAllocator& m_source;
 			StackTree m_stack_tree;
-			MT::SpinMutex m_mutex;
-			AllocationInfo* m_root;
-			AllocationInfo m_sentinels[2];
-			size_t m_total_size;
+			MT::SpinMutex m_stack_mutex;
+			Bucket m_buckets[BUCKET_COUNT];
+			MemoryTag m_tag;
+			bool m_is_root;
 			bool m_is_fill_enabled;
 			bool m_are_guards_enabled;
+			bool m_is_leak_tracking_enabled;
+			e_int32 m_stack_sampling;
 		};
 
 	} 
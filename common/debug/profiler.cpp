@@ -1,11 +1,46 @@
 #include "common/debug/profiler.h"
 #include "common/thread/sync.h"
+#include "common/thread/atomic.h"
+#include "common/thread/task.h"
+#include "common/filesystem/os_file.h"
 #include "common/egal-d.h"
 
+#ifdef _MSC_VER
+	#include <intrin.h>
+#else
+	#include <x86intrin.h>
+#endif
+
 namespace egal
 {
 	namespace Profiler
 	{
+		/**
+		 * Every thread writes begin/end/int events into its own ring, only the owning thread moves write_pos
+		 * and only the aggregator (under g_instance.m_mutex) moves read_pos, so recording never takes a lock.
+		 * The aggregator folds the events into the block tree read by the profiler ui.
+		 */
+		enum
+		{
+			RING_SIZE = 1 << 14,
+			MAX_TRACE_EVENTS = 1 << 20
+		};
+
+		enum class EventType : e_uint8
+		{
+			BEGIN,
+			END,
+			INT
+		};
+
+		struct Event
+		{
+			e_uint64 time;
+			const e_char* name;
+			e_int32 value;
+			EventType type;
+		};
+
 		struct Block
 		{
 			struct Hit
@@ -20,6 +55,7 @@ namespace egal
 				, m_hits(allocator)
 				, m_type(BlockType::TIME)
 			{
+				m_values.int_value = 0;
 			}
 
 
@@ -114,15 +150,58 @@ namespace egal
 
 		struct ThreadData
 		{
-			ThreadData()
+			explicit ThreadData(IAllocator& allocator)
+				: trace_events(allocator)
 			{
 				root_block = current_block = nullptr;
 				name[0] = '\0';
+				thread_id = MT::getCurrentThreadID();
+				write_pos = read_pos = 0;
+				depth = overflow_depth = 0;
+				dropped = 0;
 			}
 
+			~ThreadData()
+			{
+				while (root_block)
+				{
+					Block* next = root_block->m_next;
+					_delete(root_block->allocator, root_block);
+					root_block = next;
+				}
+			}
+
+			/** written by the aggregator only */
 			Block* root_block;
 			Block* current_block;
+			TArrary<Event> trace_events;
 			e_char name[30];
+			MT::ThreadID thread_id;
+
+			/** written by the owning thread only */
+			const e_char* open_blocks[MAX_BLOCK_DEPTH];
+			e_bool open_recorded[MAX_BLOCK_DEPTH];
+			e_int32 depth;
+			e_int32 overflow_depth;
+			e_int32 dropped;
+
+			volatile e_uint32 write_pos;
+			volatile e_uint32 read_pos;
+			Event ring[RING_SIZE];
+		};
+
+
+		struct AggregatorTask : public MT::Task
+		{
+			explicit AggregatorTask(IAllocator& allocator)
+				: MT::Task(allocator)
+				, m_finished(false)
+			{
+			}
+
+			e_int32 task() override;
+
+			volatile e_bool m_finished;
 		};
 
 
@@ -132,30 +211,51 @@ namespace egal
 				: threads(allocator)
 				, frame_listeners(allocator)
 				, m_mutex(false)
+				, aggregator(nullptr)
+				, trace_capture(false)
+				, trace_start(0)
+				, frequency(1)
 			{
-				threads.insert(MT::getCurrentThreadID(), &main_thread);
 				timer = Timer::create(allocator);
+
+				/** no calibration wait during static init, every frame() refines the tsc frequency from these bases */
+				timer_base = timer->getRawTimeSinceStart();
+				tsc_base = __rdtsc();
 			}
 
 			~Instance()
 			{
-				Timer::destroy(timer);
 				for (auto* i : threads)
 				{
-					if (i != &main_thread) _delete(allocator, i);
+					_delete(allocator, i);
 				}
+				Timer::destroy(timer);
+			}
+
+			e_void updateFrequency()
+			{
+				e_uint64 raw = timer->getRawTimeSinceStart() - timer_base;
+				e_uint64 tsc = __rdtsc() - tsc_base;
+				if (raw == 0) return;
+				frequency = (e_uint64)(tsc * (double)timer->getFrequency() / raw);
 			}
 
 			DefaultAllocator allocator;
 			TDelegateList<e_void()> frame_listeners;
 			THashMap<MT::ThreadID, ThreadData*> threads;
-			ThreadData main_thread;
 			Timer* timer;
 			MT::SpinMutex m_mutex;
+			AggregatorTask* aggregator;
+			e_uint64 timer_base;
+			e_uint64 tsc_base;
+			volatile e_uint64 frequency;
+			e_bool trace_capture;
+			e_uint64 trace_start;
 		};
 
 
 		Instance g_instance;
+		static thread_local ThreadData* g_thread_data = nullptr;
 
 
 		e_float getBlockLength(Block* block)
@@ -165,104 +265,266 @@ namespace egal
 			{
 				ret += block->m_hits[i].m_length;
 			}
-			return e_float(ret / (double)g_instance.timer->getFrequency());
+			return e_float(ret / (double)g_instance.frequency);
 		}
 
 
-		struct BlockInfo
+		static ThreadData* getThreadData()
 		{
-			Block* block;
-			ThreadData* thread_data;
-		};
+			if (g_thread_data) return g_thread_data;
 
-		static BlockInfo getBlock(const e_char* name)
+			MT::ThreadID thread_id = MT::getCurrentThreadID();
+			MT::SpinLock lock(g_instance.m_mutex);
+			auto iter = g_instance.threads.find(thread_id);
+			if (iter == g_instance.threads.end())
+			{
+				g_instance.threads.insert(thread_id, _aligned_new(g_instance.allocator, ThreadData)(g_instance.allocator));
+				iter = g_instance.threads.find(thread_id);
+			}
+			g_thread_data = iter.value();
+			return g_thread_data;
+		}
+
+
+		/** ends always find room, a begin or int only goes in if every block that can be open may still end */
+		static e_bool pushEvent(ThreadData* data, EventType type, const e_char* name, e_int32 value)
 		{
-			auto thread_id = MT::getCurrentThreadID();
+			e_uint32 write_pos = data->write_pos;
+			e_uint32 reserve = type == EventType::END ? 1 : MAX_BLOCK_DEPTH + 1;
+			if (RING_SIZE - (write_pos - data->read_pos) < reserve)
+			{
+				++data->dropped;
+				return false;
+			}
+
+			Event& event = data->ring[write_pos & (RING_SIZE - 1)];
+			event.time = __rdtsc();
+			event.name = name;
+			event.value = value;
+			event.type = type;
+			MT::memoryBarrier();
+			data->write_pos = write_pos + 1;
+			return true;
+		}
+
 
-			ThreadData* thread_data;
+		static Block* getChildBlock(ThreadData* data, const e_char* name)
+		{
+			Block* parent = data->current_block;
+			Block* block = parent ? parent->m_first_child : data->root_block;
+			while (block && block->m_name != name)
 			{
-				MT::SpinLock lock(g_instance.m_mutex);
-				auto iter = g_instance.threads.find(thread_id);
-				if (iter == g_instance.threads.end())
-				{
-					g_instance.threads.insert(thread_id, _aligned_new(g_instance.allocator, ThreadData));
-					iter = g_instance.threads.find(thread_id);
-				}
+				block = block->m_next;
+			}
+			if (block) return block;
 
-				thread_data = iter.value();
+			block = _aligned_new(g_instance.allocator, Block)(g_instance.allocator);
+			block->m_parent = parent;
+			block->m_first_child = nullptr;
+			block->m_name = name;
+			if (parent)
+			{
+				block->m_next = parent->m_first_child;
+				parent->m_first_child = block;
 			}
+			else
+			{
+				block->m_next = data->root_block;
+				data->root_block = block;
+			}
+			return block;
+		}
+
 
-			if (!thread_data->current_block)
+		static e_void aggregateEvent(ThreadData* data, const Event& event)
+		{
+			switch (event.type)
 			{
-				Block* root = thread_data->root_block;
-				while (root && root->m_name != name)
+				case EventType::BEGIN:
 				{
-					root = root->m_next;
+					Block* block = getChildBlock(data, event.name);
+					Block::Hit& hit = block->m_hits.emplace();
+					hit.m_start = event.time;
+					hit.m_length = 0;
+					data->current_block = block;
+					break;
 				}
-				if (root)
+				case EventType::END:
 				{
-					thread_data->current_block = root;
+					Block* block = data->current_block;
+					if (!block) break;
+					if (!block->m_hits.empty())
+					{
+						Block::Hit& hit = block->m_hits.back();
+						hit.m_length = event.time - hit.m_start;
+					}
+					data->current_block = block->m_parent;
+					break;
 				}
-				else
+				case EventType::INT:
 				{
-					Block* root = _aligned_new(g_instance.allocator, Block)(g_instance.allocator);
-					root->m_parent = nullptr;
-					root->m_next = thread_data->root_block;
-					root->m_first_child = nullptr;
-					root->m_name = name;
-					thread_data->root_block = thread_data->current_block = root;
+					Block* block = getChildBlock(data, event.name);
+					if (block->m_type != BlockType::INT)
+					{
+						block->m_values.int_value = 0;
+						block->m_type = BlockType::INT;
+					}
+					block->m_values.int_value += event.value;
+					break;
 				}
 			}
-			else
+		}
+
+
+		/** caller holds g_instance.m_mutex */
+		static e_void drainThread(ThreadData* data)
+		{
+			e_uint32 read_pos = data->read_pos;
+			e_uint32 write_pos = data->write_pos;
+			MT::memoryBarrier();
+
+			for (; read_pos != write_pos; ++read_pos)
 			{
-				Block* child = thread_data->current_block->m_first_child;
-				while (child && child->m_name != name)
+				const Event& event = data->ring[read_pos & (RING_SIZE - 1)];
+				aggregateEvent(data, event);
+				if (g_instance.trace_capture && data->trace_events.size() < MAX_TRACE_EVENTS)
 				{
-					child = child->m_next;
+					data->trace_events.push_back(event);
 				}
-				if (!child)
+			}
+
+			MT::memoryBarrier();
+			data->read_pos = read_pos;
+		}
+
+
+		static e_void drainThreads()
+		{
+			for (auto* i : g_instance.threads)
+			{
+				drainThread(i);
+			}
+		}
+
+
+		e_int32 AggregatorTask::task()
+		{
+			while (!m_finished)
+			{
 				{
-					child = _aligned_new(g_instance.allocator, Block)(g_instance.allocator);
-					child->m_parent = thread_data->current_block;
-					child->m_first_child = nullptr;
-					child->m_name = name;
-					child->m_next = thread_data->current_block->m_first_child;
-					thread_data->current_block->m_first_child = child;
+					MT::SpinLock lock(g_instance.m_mutex);
+					drainThreads();
 				}
+				MT::sleep(1);
+			}
+			return 0;
+		}
+
+
+		e_void init()
+		{
+			if (g_instance.aggregator) return;
 
-				thread_data->current_block = child;
+			AggregatorTask* task = _aligned_new(g_instance.allocator, AggregatorTask)(g_instance.allocator);
+			if (!task->create("Profiler"))
+			{
+				_delete(g_instance.allocator, task);
+				return;
 			}
+			g_instance.aggregator = task;
+		}
 
-			return { thread_data->current_block, thread_data };
+
+		e_void shutdown()
+		{
+			AggregatorTask* task = g_instance.aggregator;
+			if (!task) return;
+
+			task->m_finished = true;
+			task->destroy();
+			_delete(g_instance.allocator, task);
+			g_instance.aggregator = nullptr;
 		}
 
 
 		e_void record(const e_char* name, e_int32 value)
 		{
-			auto data = getBlock(name);
-			if (data.block->m_type != BlockType::INT)
+			pushEvent(getThreadData(), EventType::INT, name, value);
+		}
+
+
+		e_void* beginBlock(const e_char* name)
+		{
+			ThreadData* data = getThreadData();
+			if (data->depth == MAX_BLOCK_DEPTH)
 			{
-				data.block->m_values.int_value = 0;
-				data.block->m_type = BlockType::INT;
+				++data->overflow_depth;
+				return nullptr;
 			}
-			data.block->m_values.int_value += value;
-			data.thread_data->current_block = data.block->m_parent;
+
+			data->open_blocks[data->depth] = name;
+			data->open_recorded[data->depth] = pushEvent(data, EventType::BEGIN, name, 0);
+			++data->depth;
+			return (e_void*)name;
 		}
 
 
-		e_void* beginBlock(const e_char* name)
+		e_void* endBlock()
 		{
-			BlockInfo data = getBlock(name);
+			ThreadData* data = getThreadData();
+			if (data->overflow_depth > 0)
+			{
+				--data->overflow_depth;
+				return nullptr;
+			}
+
+			ASSERT(data->depth > 0);
+			--data->depth;
+			const e_char* name = data->open_blocks[data->depth];
+			if (data->open_recorded[data->depth])
+			{
+				pushEvent(data, EventType::END, name, 0);
+			}
+			return (e_void*)name;
+		}
+
+
+		e_int32 getBlockDepth()
+		{
+			ThreadData* data = getThreadData();
+			return data->depth + data->overflow_depth;
+		}
+
+
+		e_void beforeFiberSwitch(FiberSwitchData* fiber_data)
+		{
+			ThreadData* data = getThreadData();
+			ASSERT(data->overflow_depth == 0);
+
+			fiber_data->count = data->depth;
+			for (e_int32 i = 0; i < data->depth; ++i)
+			{
+				fiber_data->blocks[i] = data->open_blocks[i];
+			}
+			while (data->depth > 0)
+			{
+				endBlock();
+			}
+		}
 
-			Block::Hit& hit = data.block->m_hits.emplace();
-			hit.m_start = g_instance.timer->getRawTimeSinceStart();
-			hit.m_length = 0;
 
-			return data.block;
+		e_void afterFiberSwitch(const FiberSwitchData& fiber_data)
+		{
+			for (e_int32 i = 0; i < fiber_data.count; ++i)
+			{
+				beginBlock(fiber_data.blocks[i]);
+			}
 		}
 
+
 		const e_char* getThreadName(MT::ThreadID thread_id)
 		{
+			MT::SpinLock lock(g_instance.m_mutex);
 			auto iter = g_instance.threads.find(thread_id);
 			if (iter == g_instance.threads.end()) return "N/A";
 			return iter.value()->name;
@@ -271,19 +533,14 @@ namespace egal
 
 		e_void setThreadName(const e_char* name)
 		{
+			ThreadData* data = getThreadData();
 			MT::SpinLock lock(g_instance.m_mutex);
-			MT::ThreadID thread_id = MT::getCurrentThreadID();
-			auto iter = g_instance.threads.find(thread_id);
-			if (iter == g_instance.threads.end())
-			{
-				g_instance.threads.insert(thread_id, _aligned_new(g_instance.allocator, ThreadData));
-				iter = g_instance.threads.find(thread_id);
-			}
-			StringUnitl::copyString(iter.value()->name, name);
+			StringUnitl::copyString(data->name, name);
 		}
 
 		MT::ThreadID getThreadID(e_int32 index)
 		{
+			MT::SpinLock lock(g_instance.m_mutex);
 			auto iter = g_instance.threads.begin();
 			auto end = g_instance.threads.end();
 			for (e_int32 i = 0; i < index; ++i)
@@ -296,6 +553,7 @@ namespace egal
 
 		e_int32 getThreadIndex(e_uint32 id)
 		{
+			MT::SpinLock lock(g_instance.m_mutex);
 			auto iter = g_instance.threads.begin();
 			auto end = g_instance.threads.end();
 			e_int32 idx = 0;
@@ -310,16 +568,18 @@ namespace egal
 
 		e_int32 getThreadCount()
 		{
+			MT::SpinLock lock(g_instance.m_mutex);
 			return g_instance.threads.size();
 		}
 
 		e_uint64 now()
 		{
-			return g_instance.timer->getRawTimeSinceStart();
+			return __rdtsc();
 		}
 
 		Block* getRootBlock(MT::ThreadID thread_id)
 		{
+			MT::SpinLock lock(g_instance.m_mutex);
 			auto iter = g_instance.threads.find(thread_id);
 			if (!iter.isValid()) return nullptr;
 
@@ -328,46 +588,35 @@ namespace egal
 
 		Block* getCurrentBlock()
 		{
-			auto thread_id = MT::getCurrentThreadID();
-
-			ThreadData* thread_data;
-			{
-				MT::SpinLock lock(g_instance.m_mutex);
-				auto iter = g_instance.threads.find(thread_id);
-				ASSERT(iter.isValid());
-				thread_data = iter.value();
-			}
-
-			return thread_data->current_block;
+			ThreadData* data = getThreadData();
+			MT::SpinLock lock(g_instance.m_mutex);
+			drainThread(data);
+			return data->current_block;
 		}
 
-		e_void* endBlock()
+		e_void frame()
 		{
-			auto thread_id = MT::getCurrentThreadID();
+			PROFILE_FUNCTION();
 
-			ThreadData* thread_data;
+			/** listeners read the profiler back, the mutex is not recursive, so they run after it is released */
+			TArrary<TDelegate<e_void()>> listeners(g_instance.allocator);
 			{
 				MT::SpinLock lock(g_instance.m_mutex);
-				auto iter = g_instance.threads.find(thread_id);
-				ASSERT(iter.isValid());
-				thread_data = iter.value();
+				drainThreads();
+				listeners.reserve(g_instance.frame_listeners.size());
+				for (e_int32 i = 0, c = g_instance.frame_listeners.size(); i < c; ++i)
+				{
+					listeners.push_back(g_instance.frame_listeners[i]);
+				}
+			}
+			for (const TDelegate<e_void()>& listener : listeners)
+			{
+				listener.invoke();
 			}
-
-			ASSERT(thread_data->current_block);
-			auto* block = thread_data->current_block;
-			e_uint64 now = g_instance.timer->getRawTimeSinceStart();
-			thread_data->current_block->m_hits.back().m_length = now - thread_data->current_block->m_hits.back().m_start;
-			thread_data->current_block = thread_data->current_block->m_parent;
-			return block;
-		}
-
-		e_void frame()
-		{
-			PROFILE_FUNCTION();
 
 			MT::SpinLock lock(g_instance.m_mutex);
-			g_instance.frame_listeners.invoke();
-			e_uint64 now = g_instance.timer->getRawTimeSinceStart();
+			g_instance.updateFrequency();
+			e_uint64 now = __rdtsc();
 
 			for (auto* i : g_instance.threads)
 			{
@@ -389,5 +638,87 @@ namespace egal
 			return g_instance.frame_listeners;
 		}
 
+
+		e_void startTraceCapture()
+		{
+			MT::SpinLock lock(g_instance.m_mutex);
+			drainThreads();
+			for (auto* i : g_instance.threads)
+			{
+				i->trace_events.clear();
+			}
+			g_instance.trace_start = __rdtsc();
+			g_instance.trace_capture = true;
+		}
+
+
+		static e_void writeJsonString(FS::OsFile& file, const e_char* str)
+		{
+			file << '"';
+			for (const e_char* c = str; *c; ++c)
+			{
+				if (*c == '"' || *c == '\\') file << '\\';
+				if ((e_uint8)*c >= 0x20) file << *c;
+			}
+			file << '"';
+		}
+
+
+		/** microseconds with three decimals, a float would lose precision on long captures */
+		static e_void writeTimestamp(FS::OsFile& file, e_uint64 time)
+		{
+			e_uint64 delta = time > g_instance.trace_start ? time - g_instance.trace_start : 0;
+			e_uint64 ns = (e_uint64)(delta * 1e9 / (double)g_instance.frequency);
+			e_char tmp[32];
+			StringUnitl::toCString(ns / 1000, tmp, sizeof(tmp));
+			file << tmp << '.';
+			e_uint32 frac = e_uint32(ns % 1000);
+			file << e_char('0' + frac / 100) << e_char('0' + frac / 10 % 10) << e_char('0' + frac % 10);
+		}
+
+
+		e_bool saveTraceCapture(const e_char* path)
+		{
+			MT::SpinLock lock(g_instance.m_mutex);
+			drainThreads();
+			g_instance.trace_capture = false;
+
+			FS::OsFile file;
+			if (!file.open(path, FS::Mode::CREATE_AND_WRITE)) return false;
+
+			file << "{\"traceEvents\":[\n";
+			e_bool first = true;
+			for (auto* i : g_instance.threads)
+			{
+				e_char tid[16];
+				StringUnitl::toCString((e_uint32)i->thread_id, tid, sizeof(tid));
+
+				if (!first) file << ",\n";
+				first = false;
+				file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << tid << ",\"args\":{\"name\":";
+				writeJsonString(file, i->name[0] ? i->name : "N/A");
+				file << "}}";
+
+				for (const Event& event : i->trace_events)
+				{
+					file << ",\n{\"name\":";
+					writeJsonString(file, event.type == EventType::END ? "" : event.name);
+					file << ",\"ph\":\"" << (event.type == EventType::BEGIN ? "B" : event.type == EventType::END ? "E" : "C");
+					file << "\",\"pid\":0,\"tid\":" << tid << ",\"ts\":";
+					writeTimestamp(file, event.time);
+					if (event.type == EventType::INT)
+					{
+						e_char value[16];
+						StringUnitl::toCString(event.value, value, sizeof(value));
+						file << ",\"args\":{\"value\":" << value << "}";
+					}
+					file << "}";
+				}
+				i->trace_events.clear();
+			}
+			file << "\n]}\n";
+			file.close();
+			return true;
+		}
 	}
 }
@@ -18,6 +18,19 @@ namespace egal
 			INT
 		};
 
+		enum { MAX_BLOCK_DEPTH = 32 };
+
+		/** blocks left open by a fiber when it is switched out, reopened on the thread it resumes on */
+		struct FiberSwitchData
+		{
+			const e_char* blocks[MAX_BLOCK_DEPTH];
+			e_int32 count;
+		};
+
+		/** starts the background thread draining per thread event buffers into the block tree */
+		e_void init();
+		e_void shutdown();
+
 		MT::ThreadID getThreadID(e_int32 index);
 		e_void setThreadName(const e_char* name);
 		const e_char* getThreadName(MT::ThreadID thread_id);
@@ -40,9 +53,17 @@ namespace egal
 		e_void record(const e_char* name, e_int32 value);
 		e_void* beginBlock(const e_char* name);
 		e_void* endBlock();
+		/** number of blocks the calling thread has open, unlike getCurrentBlock it does not wait for aggregation */
+		e_int32 getBlockDepth();
+		e_void beforeFiberSwitch(FiberSwitchData* data);
+		e_void afterFiberSwitch(const FiberSwitchData& data);
 		e_void frame();
 		TDelegateList<e_void()>& getFrameListeners();
 
+		/** events recorded between start and save are written as chrome://tracing json */
+		e_void startTraceCapture();
+		e_bool saveTraceCapture(const e_char* path);
+
 
 #ifdef _DEBUG
 		struct Scope
@@ -25,6 +25,8 @@ namespace egal
 	static const ResourceType RESOURCE_ENTITY_TYPE("entity");
 	static const ResourceType RESOURCE_SHADER_TYPE("shader");
 	static const ResourceType RESOURCE_SHADER_BINARY_TYPE("shader_binary");
+	static const ResourceType RESOURCE_ANIMATION_TYPE("animation");
+	static const ResourceType RESOURCE_SKELETON_TYPE("skeleton");
 
 	/** Component Type */
 	static const ComponentType COMPONENT_CAMERA_TYPE					= Reflection::getComponentType("camera");
@@ -34,6 +36,7 @@ namespace egal
 	static const ComponentType COMPONENT_ENVIRONMENT_PROBE_TYPE			= Reflection::getComponentType("environment_probe");
 	static const ComponentType COMPONENT_ENTITY_INSTANCE_TYPE			= Reflection::getComponentType("render_able");
 	static const ComponentType COMPONENT_DECAL_TYPE						= Reflection::getComponentType("decal");
+	static const ComponentType COMPONENT_ANIMABLE_TYPE					= Reflection::getComponentType("animable");
 
 	static const ComponentType COMPONENT_PARTICLE_EMITTER_TYPE			= Reflection::getComponentType("particle_emitter");
 	static const ComponentType COMPONENT_SCRIPTED_PARTICLE_EMITTER_TYPE = Reflection::getComponentType("scripted_particle_emitter");
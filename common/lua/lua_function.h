@@ -10,6 +10,7 @@ namespace egal
 		static void* luaAllocator(void* ud, void* ptr, size_t osize, size_t nsize)
 		{
 			auto& allocator = *static_cast<IAllocator*>(ud);
+			Debug::MemoryTagScope memory_tag(Debug::MemoryTag::LUA);
 			if (nsize == 0)
 			{
 				allocator.deallocate(ptr);
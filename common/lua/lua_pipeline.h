@@ -24,35 +24,25 @@ namespace egal
 	}
 
 
+	/** framebuffers are passed either by name or by the handle from addFramebuffer or getFramebufferHandle */
+	static int lua_checkFramebuffer(lua_State* L, Pipeline* pipeline, int idx)
+	{
+		if (lua_type(L, idx) == LUA_TNUMBER) return (int)lua_tointeger(L, idx);
+		return pipeline->getFramebufferHandle(lua_manager::checkArg<const char*>(L, idx));
+	}
+
+
 	int lua_bindFramebufferTexture(lua_State* L)
 	{
 		Pipeline* that = lua_manager::checkArg<Pipeline*>(L, 1);
 		if (!that->m_current_view) 
 			return 0;
-		const char* framebuffer_name = lua_manager::checkArg<const char*>(L, 2);
+		int framebuffer = lua_checkFramebuffer(L, that, 2);
 		int renderbuffer_idx = lua_manager::checkArg<int>(L, 3);
 		int uniform_idx = lua_manager::checkArg<int>(L, 4);
 		e_uint32 flags = lua_gettop(L) > 4 ? lua_manager::checkArg<e_uint32>(L, 5) : 0xffffFFFF;
 
-		FrameBuffer* fb = that->getFramebuffer(framebuffer_name);
-		if (!fb) return 0;
-
-		float4 size;
-		size.x = (float)fb->getWidth();
-		size.y = (float)fb->getHeight();
-		size.z = 1.0f / (float)fb->getWidth();
-		size.w = 1.0f / (float)fb->getHeight();
-		that->m_current_view->command_buffer.beginAppend();
-		if (that->m_global_textures_count == 0)
-		{
-			that->m_current_view->command_buffer.setUniform(that->m_texture_size_uniform, size);
-		}
-		that->m_current_view->command_buffer.setTexture(15 - that->m_global_textures_count,
-			that->m_uniforms[uniform_idx],
-			fb->getRenderbufferHandle(renderbuffer_idx),
-			flags);
-		++that->m_global_textures_count;
-		that->m_current_view->command_buffer.end();
+		that->bindFramebufferTexture(framebuffer, renderbuffer_idx, uniform_idx, flags);
 		return 0;
 	}
 
@@ -111,14 +101,20 @@ namespace egal
 	{
 		auto* pipeline = lua_manager::checkArg<Pipeline*>(L, 1);
 		const char* debug_name = lua_manager::checkArg<const char*>(L, 2);
-		const char* framebuffer_name = lua_manager::checkArg<const char*>(L, 3);
 		e_uint64 layer_mask = 0;
 		if (lua_gettop(L) > 3) layer_mask = lua_manager::checkArg<e_uint64>(L, 4);
 
 		pipeline->m_layer_mask |= layer_mask;
 
 		lua_manager::push(L, pipeline->newView(debug_name, layer_mask));
-		pipeline->setFramebuffer(framebuffer_name);
+		if (lua_type(L, 3) == LUA_TNUMBER)
+		{
+			pipeline->setFramebuffer((int)lua_tointeger(L, 3));
+		}
+		else
+		{
+			pipeline->setFramebuffer(lua_manager::checkArg<const char*>(L, 3));
+		}
 		return 1;
 	}
 
@@ -152,6 +148,11 @@ namespace egal
 						buf.m_format = bgfx::TextureFormat::RGBA8;
 						log_error("Renderer Can not share render buffer from %s , it does not exist.", fb_name);
 					}
+					else if (shared_fb->isTransient())
+					{
+						buf.m_format = bgfx::TextureFormat::RGBA8;
+						log_error("Renderer Can not share render buffer from %s , it is transient.", fb_name);
+					}
 					else
 					{
 						buf.m_shared = &shared_fb->getRenderbuffer(rb_idx);
@@ -169,13 +170,6 @@ namespace egal
 	{
 		auto* pipeline = lua_manager::checkArg<Pipeline*>(L, 1);
 		const char* name = lua_manager::checkArg<const char*>(L, 2);
-		FrameBuffer* framebuffer = pipeline->getFramebuffer(name);
-		if (framebuffer)
-		{
-			log_waring("Renderer Trying to create already existing framebuffer %s.", name);
-			return 0;
-		}
-
 		lua_manager::checkTableArg(L, 3);
 		FrameBuffer::Declaration decl;
 		StringUnitl::copyString(decl.m_name, name);
@@ -194,23 +188,16 @@ namespace egal
 		}
 		lua_pop(L, 1);
 		lua_manager::getOptionalField(L, 3, "height", &decl.m_height);
+		lua_manager::getOptionalField(L, 3, "transient", &decl.m_is_transient);
 
 		if (lua_getfield(L, 3, "render_buffers") == LUA_TTABLE)
 		{
 			lua_parseRenderbuffers(L, decl, pipeline);
 		}
 		lua_pop(L, 1);
-		if ((decl.m_size_ratio.x > 0 || decl.m_size_ratio.y > 0) && pipeline->m_height > 0)
-		{
-			decl.m_width = int(pipeline->m_width * decl.m_size_ratio.x);
-			decl.m_height = int(pipeline->m_height * decl.m_size_ratio.y);
-		}
-		auto* fb = _aligned_new(pipeline->m_allocator, FrameBuffer)(decl);
-		pipeline->m_framebuffers.push_back(fb);
-		if (StringUnitl::equalStrings(decl.m_name, "default")) 
-			pipeline->m_default_framebuffer = fb;
 
-		return 0;
+		lua_manager::push(L, pipeline->createFramebuffer(decl));
+		return 1;
 	}
 
 
@@ -268,10 +255,13 @@ namespace egal
 	int lua_getRenderbuffer(lua_State* L)
 	{
 		auto* pipeline = lua_manager::checkArg<Pipeline*>(L, 1);
-		const char* fb_name = lua_manager::checkArg<const char*>(L, 2);
+		int framebuffer = lua_checkFramebuffer(L, pipeline, 2);
 		int rb_idx = lua_manager::checkArg<int>(L, 3);
 
-		void* rb = &pipeline->getRenderbuffer(fb_name, rb_idx);
+		FrameBuffer* fb = pipeline->getFramebuffer(framebuffer);
+		if (!fb) return 0;
+		pipeline->touchFramebuffer(framebuffer);
+		void* rb = &fb->getRenderbufferHandle(rb_idx);
 		lua_manager::push(L, rb);
 		return 1;
 	}
@@ -282,7 +272,8 @@ namespace egal
 		auto* pipeline = lua_manager::checkArg<Pipeline*>(L, 1);
 		const char* camera_slot = lua_manager::checkArg<const char*>(L, 2);
 
-		FrameBuffer* fbs[16];
+		/** the framebuffers are pages of the local light shadow atlas */
+		FrameBuffer* fbs[16] = {};
 		int len = Math::minimum((int)lua_rawlen(L, 3), TlengthOf(fbs));
 		for (int i = 0; i < len; ++i)
 		{
@@ -435,6 +426,7 @@ namespace egal
 		REGISTER_FUNCTION(removeFramebuffer);
 		REGISTER_FUNCTION(setMaterialDefine);
 		REGISTER_FUNCTION(saveRenderbuffer);
+		REGISTER_FUNCTION(getFramebufferHandle);
 
 #undef REGISTER_FUNCTION
 
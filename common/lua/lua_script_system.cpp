@@ -1,10 +1,19 @@
 #include "runtime/lua/lua_script_system.h"
+#include "renderer/render_scene.h"
 
 namespace egal
 {
 	static const ComponentType LUA_SCRIPT_TYPE = Reflection::getComponentType("lua_script");
 	static const ResourceType LUA_SCRIPT_RESOURCE_TYPE("lua_script");
 
+	/**
+	 * scripts whose source starts with this line run in a pool of lua states, one per worker, in parallel with
+	 * each other; they can read entity transforms and queue transform writes through the Isolated table, the
+	 * writes are applied after all isolated updates finished
+	 */
+	static const char ISOLATED_SCRIPT_DIRECTIVE[] = "--!isolated";
+	static const int MAX_ISOLATED_STATES = 64;
+
 	enum class LuaSceneVersion : int
 	{
 		PROPERTY_TYPE,
@@ -45,6 +54,58 @@ namespace egal
 		};
 
 
+		struct UpdateData
+		{
+			LuaScript* script;
+			lua_State* state;
+			int environment;
+			int function; // registry reference to env.update, resolved when the script starts or reloads
+			int isolated_state; // -1 for scripts running in the engine state
+			Entity entity;
+			float interval;
+			float lod_distance;
+			float lod_interval;
+			float time_since_update;
+		};
+
+
+		struct DeferredCommand
+		{
+			enum Type : u8
+			{
+				SET_POSITION,
+				SET_ROTATION,
+				SET_SCALE
+			};
+
+			Type type;
+			Entity entity;
+			float value[4];
+			// merge order, independent of the number of states and job timing
+			u32 source_entity;
+			u32 source_script;
+			u32 sequence;
+		};
+
+
+		struct IsolatedState
+		{
+			explicit IsolatedState(IAllocator& allocator)
+				: commands(allocator)
+				, state(nullptr)
+				, scene(nullptr)
+			{
+			}
+
+			LuaScriptSceneImpl* scene;
+			lua_State* state;
+			Array<DeferredCommand> commands;
+			u32 source_entity;
+			u32 source_script;
+			u32 sequence;
+		};
+
+
 		struct ScriptInstance
 		{
 			explicit ScriptInstance(IAllocator& allocator)
@@ -53,6 +114,7 @@ namespace egal
 				, m_state(nullptr)
 				, m_environment(-1)
 				, m_thread_ref(-1)
+				, m_isolated_state(-1)
 			{
 			}
 
@@ -60,6 +122,7 @@ namespace egal
 			lua_State* m_state;
 			int m_environment;
 			int m_thread_ref;
+			int m_isolated_state;
 			Array<Property> m_properties;
 		};
 
@@ -168,9 +231,11 @@ namespace egal
 					{
 						is_reload = false;
 						script.m_environment = -1;
+						script.m_isolated_state = m_scene.isIsolatedScript(*script.m_script) ? m_scene.getIsolatedStateIndex(m_entity) : -1;
+						lua_State* parent_state = script.m_isolated_state < 0 ? L : m_scene.m_isolated_states[script.m_isolated_state]->state;
 
-						script.m_state = lua_newthread(L); // [thread]
-						script.m_thread_ref = luaL_ref(L, LUA_REGISTRYINDEX); // []
+						script.m_state = lua_newthread(parent_state); // [thread]
+						script.m_thread_ref = luaL_ref(parent_state, LUA_REGISTRYINDEX); // []
 						lua_newtable(script.m_state); // [env]
 						// reference environment
 						lua_pushvalue(script.m_state, -1); // [env, env]
@@ -210,6 +275,7 @@ namespace egal
 
 					m_scene.m_current_script_instance = &script;
 					errors = errors || lua_pcall(script.m_state, 0, 0, 0) != LUA_OK; // [env]
+					m_scene.m_current_script_instance = nullptr;
 					if (errors)
 					{
 						g_log_error.log("Lua Script") << script.m_script->getPath() << ": "
@@ -220,7 +286,7 @@ namespace egal
 
 					detectProperties(script);
 
-					if (m_scene.m_is_game_running) m_scene.startScript(script, is_reload);
+					if (m_scene.m_is_game_running) m_scene.startScript(script, m_entity, is_reload);
 				}
 			}
 
@@ -288,6 +354,9 @@ namespace egal
 			, m_property_names(system.m_allocator)
 			, m_is_game_running(false)
 			, m_is_api_registered(false)
+			, m_isolated_states(system.m_allocator)
+			, m_deferred_commands(system.m_allocator)
+			, m_update_lod_origin(0, 0, 0)
 		{
 			m_function_call.is_in_progress = false;
 			
@@ -296,6 +365,16 @@ namespace egal
 		}
 
 
+		~LuaScriptSceneImpl()
+		{
+			for (IsolatedState* iso : m_isolated_states)
+			{
+				lua_close(iso->state);
+				LUMIX_DELETE(m_system.m_allocator, iso);
+			}
+		}
+
+
 		int getVersion() const override { return (int)LuaSceneVersion::LATEST; }
 
 
@@ -472,6 +551,8 @@ namespace egal
 			int tmp = lua_getglobal(L, "g_scene_lua_script");
 			ASSERT(tmp == LUA_TLIGHTUSERDATA);
 			auto* scene = LuaWrapper::toType<LuaScriptSceneImpl*>(L, -1);
+			// isolated scripts run their updates in jobs, properties can only be declared while the script loads
+			if (!scene->m_current_script_instance) return luaL_error(L, "setPropertyType can only be called while the script is loading");
 			u32 prop_name_hash = crc32(prop_name);
 			for (auto& prop : scene->m_current_script_instance->m_properties)
 			{
@@ -496,9 +577,8 @@ namespace egal
 		}
 
 
-		void registerPropertyAPI()
+		static void registerPropertyAPI(lua_State* L)
 		{
-			lua_State* L = m_system.m_engine.getState();
 			auto f = &LuaWrapper::wrap<decltype(&setPropertyType), &setPropertyType>;
 			LuaWrapper::createSystemFunction(L, "Editor", "setPropertyType", f);
 			LuaWrapper::createSystemVariable(L, "Editor", "BOOLEAN_PROPERTY", Property::BOOLEAN);
@@ -527,8 +607,9 @@ namespace egal
 				return 1;
 			}
 
+			// the environment of an isolated script lives in the registry of its own state, not in the caller's one
 			int env = scene->getEnvironment(cmp, scr_index);
-			if (env < 0)
+			if (env < 0 || static_cast<LuaScriptSceneImpl*>(scene)->isIsolatedInstance(cmp, scr_index))
 			{
 				lua_pushnil(L);
 			}
@@ -805,7 +886,7 @@ namespace egal
 			lua_State* engine_state = m_system.m_engine.getState();
 			
 			registerProperties();
-			registerPropertyAPI();
+			registerPropertyAPI(engine_state);
 			LuaWrapper::createSystemFunction(
 				engine_state, "LuaScript", "getEnvironment", &LuaScriptSceneImpl::getEnvironment);
 			
@@ -834,6 +915,12 @@ namespace egal
 		}
 
 
+		bool isIsolatedInstance(ComponentHandle cmp, int scr_index)
+		{
+			return m_scripts[{cmp.index}]->m_scripts[scr_index].m_isolated_state >= 0;
+		}
+
+
 		const char* getPropertyName(u32 name_hash) const
 		{
 			int idx = m_property_names.find(name_hash);
@@ -977,14 +1064,7 @@ namespace egal
 				}
 			}
 
-			for (int i = 0; i < m_updates.size(); ++i)
-			{
-				if (m_updates[i].state == inst.m_state)
-				{
-					m_updates.eraseFast(i);
-					break;
-				}
-			}
+			removeUpdate(inst.m_state);
 			
 			for (int i = 0; i < m_input_handlers.size(); ++i)
 			{
@@ -1021,18 +1101,35 @@ namespace egal
 		}
 
 
-		void startScript(ScriptInstance& instance, bool is_restart)
+		void removeUpdate(lua_State* state)
 		{
-			if (is_restart)
+			for (int i = 0; i < m_updates.size(); ++i)
 			{
-				for (int i = 0; i < m_updates.size(); ++i)
+				if (m_updates[i].state == state)
 				{
-					if (m_updates[i].state == instance.m_state)
-					{
-						m_updates.eraseFast(i);
-						break;
-					}
+					luaL_unref(state, LUA_REGISTRYINDEX, m_updates[i].function);
+					m_updates.eraseFast(i);
+					m_is_updates_sorted = false;
+					break;
 				}
+			}
+		}
+
+
+		static float getEnvironmentNumber(lua_State* L, const char* name, float default_value)
+		{
+			// [env]
+			float value = lua_getfield(L, -1, name) == LUA_TNUMBER ? (float)lua_tonumber(L, -1) : default_value;
+			lua_pop(L, 1);
+			return value;
+		}
+
+
+		void startScript(ScriptInstance& instance, Entity entity, bool is_restart)
+		{
+			if (is_restart)
+			{
+				removeUpdate(instance.m_state);
 				for (int i = 0; i < m_input_handlers.size(); ++i)
 				{
 					if (m_input_handlers[i].state == instance.m_state)
@@ -1049,14 +1146,25 @@ namespace egal
 				lua_pop(instance.m_state, 1);
 				return;
 			}
-			if (lua_getfield(instance.m_state, -1, "update") == LUA_TFUNCTION)
+			if (lua_getfield(instance.m_state, -1, "update") == LUA_TFUNCTION) // [env, update]
 			{
 				auto& update_data = m_updates.emplace();
 				update_data.script = instance.m_script;
 				update_data.state = instance.m_state;
 				update_data.environment = instance.m_environment;
+				update_data.function = luaL_ref(instance.m_state, LUA_REGISTRYINDEX); // [env]
+				update_data.isolated_state = instance.m_isolated_state;
+				update_data.entity = entity;
+				update_data.interval = getEnvironmentNumber(instance.m_state, "update_interval", 0);
+				update_data.lod_distance = getEnvironmentNumber(instance.m_state, "update_lod_distance", 0);
+				update_data.lod_interval = getEnvironmentNumber(instance.m_state, "update_lod_interval", 0.5f);
+				update_data.time_since_update = 0;
+				m_is_updates_sorted = false;
+			}
+			else
+			{
+				lua_pop(instance.m_state, 1);
 			}
-			lua_pop(instance.m_state, 1);
 			if (lua_getfield(instance.m_state, -1, "onInputEvent") == LUA_TFUNCTION)
 			{
 				auto& callback = m_input_handlers.emplace();
@@ -1094,6 +1202,10 @@ namespace egal
 		{
 			m_scripts_init_called = false;
 			m_is_game_running = false;
+			for (const UpdateData& update_item : m_updates)
+			{
+				luaL_unref(update_item.state, LUA_REGISTRYINDEX, update_item.function);
+			}
 			m_updates.clear();
 			m_input_handlers.clear();
 			m_timers.clear();
@@ -1421,7 +1533,7 @@ namespace egal
 					if (!instance.m_script) continue;
 					if (!instance.m_script->isReady()) continue;
 
-					startScript(instance, false);
+					startScript(instance, scr->m_entity, false);
 				}
 			}
 			m_scripts_init_called = true;
@@ -1562,30 +1674,320 @@ namespace egal
 			processInputEvents();
 			updateTimers(time_delta);
 
-			for (int i = 0; i < m_updates.size(); ++i)
+			if (!m_is_update_lod_origin_set) updateLODOriginFromCamera();
+			updateScripts(time_delta);
+		}
+
+
+		void updateLODOriginFromCamera()
+		{
+			auto* render_scene = static_cast<RenderScene*>(m_universe.getScene(crc32("renderer")));
+			if (!render_scene) return;
+
+			ComponentHandle camera = render_scene->getCameraInSlot("main");
+			if (!camera.isValid()) return;
+
+			m_update_lod_origin = m_universe.getPosition(render_scene->getCameraEntity(camera));
+		}
+
+
+		static int compareUpdates(const void* a, const void* b)
+		{
+			const UpdateData* update_a = (const UpdateData*)a;
+			const UpdateData* update_b = (const UpdateData*)b;
+			if (update_a->isolated_state != update_b->isolated_state) return update_a->isolated_state < update_b->isolated_state ? -1 : 1;
+			return update_a->script < update_b->script ? -1 : (update_a->script > update_b->script ? 1 : 0);
+		}
+
+
+		static int compareDeferredCommands(const void* a, const void* b)
+		{
+			const DeferredCommand* cmd_a = (const DeferredCommand*)a;
+			const DeferredCommand* cmd_b = (const DeferredCommand*)b;
+			if (cmd_a->source_entity != cmd_b->source_entity) return cmd_a->source_entity < cmd_b->source_entity ? -1 : 1;
+			if (cmd_a->source_script != cmd_b->source_script) return cmd_a->source_script < cmd_b->source_script ? -1 : 1;
+			return cmd_a->sequence < cmd_b->sequence ? -1 : (cmd_a->sequence > cmd_b->sequence ? 1 : 0);
+		}
+
+
+		bool isIsolatedScript(LuaScript& script) const
+		{
+			const char* source = script.getSourceCode();
+			int len = stringLength(ISOLATED_SCRIPT_DIRECTIVE);
+			return compareStringN(source, ISOLATED_SCRIPT_DIRECTIVE, len) == 0;
+		}
+
+
+		int getIsolatedStateIndex(Entity entity)
+		{
+			if (m_isolated_states.empty())
 			{
-				CallbackData update_item = m_updates[i];
-				if (lua_rawgeti(update_item.state, LUA_REGISTRYINDEX, update_item.environment) != LUA_TTABLE)
+				int count = Math::clamp((int)MT::getCPUsCount(), 1, MAX_ISOLATED_STATES);
+				for (int i = 0; i < count; ++i)
 				{
-					ASSERT(false);
+					m_isolated_states.push(createIsolatedState());
 				}
-				if (lua_getfield(update_item.state, -1, "update") != LUA_TFUNCTION)
+			}
+			return entity.index % m_isolated_states.size();
+		}
+
+
+		IsolatedState* createIsolatedState()
+		{
+			IsolatedState* iso = LUMIX_NEW(m_system.m_allocator, IsolatedState)(m_system.m_allocator);
+			iso->scene = this;
+			iso->state = lua_newstate(luaAllocator, &m_system.m_allocator);
+			luaL_openlibs(iso->state);
+
+			static const struct { const char* name; lua_CFunction function; } functions[] = {
+				{ "getPosition", &LuaScriptSceneImpl::isolatedGetPosition },
+				{ "getRotation", &LuaScriptSceneImpl::isolatedGetRotation },
+				{ "setPosition", &LuaScriptSceneImpl::isolatedSetPosition },
+				{ "setRotation", &LuaScriptSceneImpl::isolatedSetRotation },
+				{ "setScale", &LuaScriptSceneImpl::isolatedSetScale }
+			};
+			lua_newtable(iso->state); // [Isolated]
+			for (const auto& f : functions)
+			{
+				lua_pushlightuserdata(iso->state, iso); // [Isolated, iso]
+				lua_pushcclosure(iso->state, f.function, 1); // [Isolated, closure]
+				lua_setfield(iso->state, -2, f.name); // [Isolated]
+			}
+			lua_setglobal(iso->state, "Isolated"); // []
+
+			// property declarations run on the main thread while the script loads, same as in the engine state
+			lua_pushlightuserdata(iso->state, this); // [scene]
+			lua_setglobal(iso->state, "g_scene_lua_script"); // []
+			registerPropertyAPI(iso->state);
+
+			// the LuaScript API changes the scene, isolated scripts get an error instead of an unknown global
+			static const char* const unavailable_functions[] = {
+				"getEnvironment", "addScript", "getScriptCount", "setScriptSource", "cancelTimer", "setTimer"
+			};
+			lua_newtable(iso->state); // [LuaScript]
+			for (const char* name : unavailable_functions)
+			{
+				lua_pushstring(iso->state, name); // [LuaScript, name]
+				lua_pushcclosure(iso->state, &LuaScriptSceneImpl::isolatedUnavailable, 1); // [LuaScript, closure]
+				lua_setfield(iso->state, -2, name); // [LuaScript]
+			}
+			lua_setglobal(iso->state, "LuaScript"); // []
+			return iso;
+		}
+
+
+		static int isolatedUnavailable(lua_State* L)
+		{
+			return luaL_error(L, "LuaScript.%s is not available in isolated scripts", lua_tostring(L, lua_upvalueindex(1)));
+		}
+
+
+		static IsolatedState* getIsolatedState(lua_State* L)
+		{
+			return (IsolatedState*)lua_touserdata(L, lua_upvalueindex(1));
+		}
+
+
+		// reads run while no transform is written, writes are queued
+		static int isolatedGetPosition(lua_State* L)
+		{
+			Entity entity = {(int)luaL_checkinteger(L, 1)};
+			Vec3 pos = getIsolatedState(L)->scene->m_universe.getPosition(entity);
+			lua_pushnumber(L, pos.x);
+			lua_pushnumber(L, pos.y);
+			lua_pushnumber(L, pos.z);
+			return 3;
+		}
+
+
+		static int isolatedGetRotation(lua_State* L)
+		{
+			Entity entity = {(int)luaL_checkinteger(L, 1)};
+			Quat rot = getIsolatedState(L)->scene->m_universe.getRotation(entity);
+			lua_pushnumber(L, rot.x);
+			lua_pushnumber(L, rot.y);
+			lua_pushnumber(L, rot.z);
+			lua_pushnumber(L, rot.w);
+			return 4;
+		}
+
+
+		static int queueCommand(lua_State* L, DeferredCommand::Type type, int value_count)
+		{
+			Entity entity = {(int)luaL_checkinteger(L, 1)};
+			float value[4] = {};
+			for (int i = 0; i < value_count; ++i)
+			{
+				value[i] = (float)luaL_checknumber(L, i + 2);
+			}
+
+			IsolatedState* iso = getIsolatedState(L);
+			DeferredCommand& cmd = iso->commands.emplace();
+			cmd.type = type;
+			cmd.entity = entity;
+			copyMemory(cmd.value, value, sizeof(value));
+			cmd.source_entity = iso->source_entity;
+			cmd.source_script = iso->source_script;
+			cmd.sequence = iso->sequence++;
+			return 0;
+		}
+
+
+		static int isolatedSetPosition(lua_State* L) { return queueCommand(L, DeferredCommand::SET_POSITION, 3); }
+		static int isolatedSetRotation(lua_State* L) { return queueCommand(L, DeferredCommand::SET_ROTATION, 4); }
+		static int isolatedSetScale(lua_State* L) { return queueCommand(L, DeferredCommand::SET_SCALE, 1); }
+
+
+		bool isBeyondUpdateLOD(const UpdateData& update_item) const
+		{
+			auto pos = m_universe.getPosition(update_item.entity);
+			float dx = pos.x - m_update_lod_origin.x;
+			float dy = pos.y - m_update_lod_origin.y;
+			float dz = pos.z - m_update_lod_origin.z;
+			return dx * dx + dy * dy + dz * dz > update_item.lod_distance * update_item.lod_distance;
+		}
+
+
+		void sortUpdates()
+		{
+			// engine state scripts first, then the isolated states, instances of one script are kept together
+			if (m_is_updates_sorted) return;
+			if (!m_updates.empty()) qsort(&m_updates[0], m_updates.size(), sizeof(m_updates[0]), compareUpdates);
+			m_is_updates_sorted = true;
+		}
+
+
+		bool tickUpdate(UpdateData& update_item, float time_delta)
+		{
+			update_item.time_since_update += time_delta;
+			float interval = update_item.interval;
+			if (update_item.lod_distance > 0 && isBeyondUpdateLOD(update_item))
+			{
+				interval = Math::maximum(interval, update_item.lod_interval);
+			}
+			if (update_item.time_since_update < interval) return false;
+
+			// update may add or remove scripts, do not touch update_item after the call
+			lua_State* state = update_item.state;
+			float dt = update_item.time_since_update;
+			update_item.time_since_update = 0;
+			lua_rawgeti(state, LUA_REGISTRYINDEX, update_item.function);
+			lua_pushnumber(state, dt);
+			if (lua_pcall(state, 1, 0, 0) != LUA_OK)
+			{
+				g_log_error.log("Lua Script") << lua_tostring(state, -1);
+				lua_pop(state, 1);
+			}
+			return true;
+		}
+
+
+		void updateScripts(float time_delta)
+		{
+			sortUpdates();
+
+			// each script gets one profiler block per frame, the profiler keeps the name pointer after the script
+			// can be unloaded, so the block has a static name and the script is identified by its path hash
+			int called = 0;
+			int i = 0;
+			while (i < m_updates.size() && m_updates[i].isolated_state < 0)
+			{
+				LuaScript* script = m_updates[i].script;
+				Profiler::beginBlock("lua script update");
+				PROFILE_INT("script path hash", (int)script->getPath().getHash());
+				for (; i < m_updates.size() && m_updates[i].isolated_state < 0 && m_updates[i].script == script; ++i)
+				{
+					if (tickUpdate(m_updates[i], time_delta)) ++called;
+				}
+				Profiler::endBlock();
+			}
+			PROFILE_INT("lua updates", called);
+
+			updateIsolatedScripts(time_delta);
+		}
+
+
+		void updateIsolatedScripts(float time_delta)
+		{
+			if (m_isolated_states.empty()) return;
+
+			PROFILE_FUNCTION();
+			// scripts in the engine state could have added or removed updates
+			sortUpdates();
+
+			JobSystem::JobDecl jobs[MAX_ISOLATED_STATES];
+			JobSystem::LambdaJob job_storage[MAX_ISOLATED_STATES];
+			int job_count = 0;
+			int i = 0;
+			while (i < m_updates.size() && m_updates[i].isolated_state < 0) ++i;
+			while (i < m_updates.size())
+			{
+				IsolatedState* iso = m_isolated_states[m_updates[i].isolated_state];
+				int from = i;
+				while (i < m_updates.size() && m_updates[i].isolated_state == m_updates[from].isolated_state) ++i;
+				int to = i;
+				JobSystem::fromLambda(
+					[this, iso, from, to, time_delta]()
+					{
+						PROFILE_BLOCK("isolated lua scripts");
+						for (int j = from; j < to; ++j)
+						{
+							UpdateData& update_item = m_updates[j];
+							iso->source_entity = update_item.entity.index;
+							iso->source_script = update_item.script->getPath().getHash();
+							iso->sequence = 0;
+							tickUpdate(update_item, time_delta);
+						}
+					},
+					&job_storage[job_count],
+					&jobs[job_count],
+					nullptr);
+				++job_count;
+			}
+			if (job_count == 0) return;
+
+			volatile int counter = 0;
+			JobSystem::runJobs(jobs, job_count, &counter);
+			JobSystem::wait(&counter);
+
+			applyDeferredCommands();
+		}
+
+
+		void applyDeferredCommands()
+		{
+			m_deferred_commands.clear();
+			for (IsolatedState* iso : m_isolated_states)
+			{
+				for (const DeferredCommand& cmd : iso->commands)
 				{
-					lua_pop(update_item.state, 2);
-					continue;
+					m_deferred_commands.push(cmd);
 				}
+				iso->commands.clear();
+			}
+			if (m_deferred_commands.empty()) return;
 
-				lua_pushnumber(update_item.state, time_delta);
-				if (lua_pcall(update_item.state, 1, 0, 0) != LUA_OK)
+			qsort(&m_deferred_commands[0], m_deferred_commands.size(), sizeof(m_deferred_commands[0]), compareDeferredCommands);
+			for (const DeferredCommand& cmd : m_deferred_commands)
+			{
+				if (!m_universe.hasEntity(cmd.entity)) continue;
+				switch (cmd.type)
 				{
-					g_log_error.log("Lua Script") << lua_tostring(update_item.state, -1);
-					lua_pop(update_item.state, 1);
+					case DeferredCommand::SET_POSITION: m_universe.setPosition(cmd.entity, Vec3(cmd.value[0], cmd.value[1], cmd.value[2])); break;
+					case DeferredCommand::SET_ROTATION: m_universe.setRotation(cmd.entity, Quat(cmd.value[0], cmd.value[1], cmd.value[2], cmd.value[3])); break;
+					case DeferredCommand::SET_SCALE: m_universe.setScale(cmd.entity, cmd.value[0]); break;
 				}
-				lua_pop(update_item.state, 1);
 			}
 		}
 
 
+		void setUpdateLODOrigin(const Vec3& origin) override
+		{
+			m_update_lod_origin = origin;
+			m_is_update_lod_origin_set = true;
+		}
+
+
 		ComponentHandle getComponent(Entity entity, ComponentType type) override
 		{
 			if (m_scripts.find(entity) == m_scripts.end()) return INVALID_COMPONENT;
@@ -1716,13 +2118,18 @@ namespace egal
 		AssociativeArray<u32, string> m_property_names;
 		Array<CallbackData> m_input_handlers;
 		Universe& m_universe;
-		Array<CallbackData> m_updates;
+		Array<UpdateData> m_updates;
 		Array<TimerData> m_timers;
 		FunctionCall m_function_call;
 		ScriptInstance* m_current_script_instance;
 		bool m_scripts_init_called = false;
 		bool m_is_api_registered = false;
 		bool m_is_game_running = false;
+		bool m_is_updates_sorted = true;
+		Array<IsolatedState*> m_isolated_states;
+		Array<DeferredCommand> m_deferred_commands;
+		Vec3 m_update_lod_origin;
+		bool m_is_update_lod_origin_set = false;
 	};
 
 
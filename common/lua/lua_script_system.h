@@ -71,6 +71,12 @@ namespace egal
 		virtual ResourceType getPropertyResourceType(ComponentHandle cmp, int scr_index, int prop_index) = 0;
 		virtual void getScriptData(ComponentHandle cmp, OutputBlob& blob) = 0;
 		virtual void setScriptData(ComponentHandle cmp, InputBlob& blob) = 0;
+		/**
+		 * scripts opt into reduced ticking with globals in their environment: update_interval (seconds between
+		 * update calls), update_lod_distance and update_lod_interval (interval used while the entity is farther
+		 * than update_lod_distance from this origin). The origin follows the main camera until the game sets one here.
+		 */
+		virtual void setUpdateLODOrigin(const Vec3& origin) = 0;
 	};
 }
 #endif
@@ -6,12 +6,17 @@
 #include "engine/engine.h"
 #include "engine/fs/os_file.h"
 #include "engine/iallocator.h"
+#include "engine/job_system.h"
 #include "engine/log.h"
 #include "engine/lua_wrapper.h"
 #include "engine/lumix.h"
+#include "engine/mt/atomic.h"
+#include "engine/mt/thread.h"
 #include "engine/profiler.h"
 #include "engine/reflection.h"
 #include "engine/serializer.h"
+#include "engine/string.h"
+#include "engine/timer.h"
 #include "engine/universe/universe.h"
 #include "engine/vec.h"
 #include "lua_script/lua_script_system.h"
@@ -19,6 +24,7 @@
 #include "renderer/model.h"
 #include "renderer/render_scene.h"
 #include <DetourAlloc.h>
+#include <DetourCommon.h>
 #include <DetourCrowd.h>
 #include <DetourNavMesh.h>
 #include <DetourNavMeshBuilder.h>
@@ -44,6 +50,13 @@ static const ComponentType NAVMESH_AGENT_TYPE = Reflection::getComponentType("na
 static const ComponentType ANIM_CONTROLLER_TYPE = Reflection::getComponentType("anim_controller");
 static const int CELLS_PER_TILE_SIDE = 256;
 static const float CELL_SIZE = 0.3f;
+static const int MAX_CROWD_AGENTS = 4096;
+static const int MAX_PATH_POLYS = 256;
+static const int PATH_ITERATIONS_PER_SLICE = 32;
+// seconds of each crowd job spent searching paths, unfinished searches continue in the next frame
+static const float PATH_QUERY_TIME_BUDGET = 0.001f;
+// idle agents are served this many frames ahead of agents still following a path
+static const int IDLE_AGENT_PATH_PRIORITY = 16;
 
 
 struct Agent
@@ -64,6 +77,79 @@ struct Agent
 	float speed = 0;
 	float yaw_diff = 0;
 	float stop_distance = 0;
+	u32 path_request = 0;
+	bool is_path_pending = false;
+	bool is_path_applied = false;
+};
+
+
+// path searched by the crowd job, applied to the agent on the main thread once it is found
+struct PathRequest
+{
+	enum class Status : u8
+	{
+		PENDING,
+		IN_PROGRESS,
+		DONE,
+		FAILED
+	};
+
+	Entity entity;
+	u32 id;
+	dtPolyRef start_ref;
+	dtPolyRef end_ref;
+	Vec3 start_pos;
+	Vec3 end_pos;
+	float speed;
+	float stop_distance;
+	int priority;
+	int path_offset;
+	int path_count;
+	Status status;
+};
+
+
+static int comparePathRequests(const void* a, const void* b)
+{
+	const PathRequest* request_a = (const PathRequest*)a;
+	const PathRequest* request_b = (const PathRequest*)b;
+
+	// a sliced query can not be interleaved with another one, the running search stays first
+	bool is_a_running = request_a->status == PathRequest::Status::IN_PROGRESS;
+	bool is_b_running = request_b->status == PathRequest::Status::IN_PROGRESS;
+	if (is_a_running != is_b_running) return is_a_running ? -1 : 1;
+	if (request_a->priority != request_b->priority) return request_a->priority > request_b->priority ? -1 : 1;
+	return request_a->id < request_b->id ? -1 : (request_a->id > request_b->id ? 1 : 0);
+}
+
+
+// model instance rasterized into the navmesh, cached so tile jobs do not touch the universe
+struct NavmeshInputInstance
+{
+	Entity entity;
+	Model* model;
+	Matrix mtx;
+	AABB aabb;
+};
+
+
+// intermediate Recast data of a single tile, whatever is still owned when it goes out of scope is freed
+struct TileBuildData
+{
+	~TileBuildData()
+	{
+		rcFreeHeightField(solid);
+		rcFreeCompactHeightfield(chf);
+		rcFreeContourSet(cset);
+		rcFreePolyMesh(polymesh);
+		rcFreePolyMeshDetail(detail_mesh);
+	}
+
+	rcHeightfield* solid = nullptr;
+	rcCompactHeightfield* chf = nullptr;
+	rcContourSet* cset = nullptr;
+	rcPolyMesh* polymesh = nullptr;
+	rcPolyMeshDetail* detail_mesh = nullptr;
 };
 
 
@@ -87,7 +173,25 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 		, m_crowd(nullptr)
 		, m_script_scene(nullptr)
 		, m_on_update(m_allocator)
+		, m_input_instances(m_allocator)
+		, m_input_map(m_allocator)
+		, m_tile_input_offsets(m_allocator)
+		, m_tile_inputs(m_allocator)
+		, m_dirty_tiles(m_allocator)
+		, m_is_input_collected(false)
+		, m_no_navigation_flag(0)
+		, m_nonwalkable_flag(0)
+		, m_path_query(nullptr)
+		, m_path_requests(m_allocator)
+		, m_new_path_requests(m_allocator)
+		, m_path_polys(m_allocator)
+		, m_last_path_request(0)
+		, m_crowd_time_delta(0)
+		, m_crowd_job_counter(0)
 	{
+		m_path_timer = Timer::create(m_allocator);
+		m_crowd_job.task = [](void* data) { ((NavigationSceneImpl*)data)->crowdJob(); };
+		m_crowd_job.data = this;
 		setGeneratorParams(0.3f, 0.1f, 0.3f, 2.0f, 60.0f, 0.3f);
 		m_universe.entityTransformed().bind<NavigationSceneImpl, &NavigationSceneImpl::onEntityMoved>(this);
 		universe.registerComponentType(NAVMESH_AGENT_TYPE, this, &NavigationSceneImpl::serializeAgent, &NavigationSceneImpl::deserializeAgent);
@@ -98,6 +202,7 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 	{
 		m_universe.entityTransformed().unbind<NavigationSceneImpl, &NavigationSceneImpl::onEntityMoved>(this);
 		clearNavmesh();
+		Timer::destroy(m_path_timer);
 	}
 
 
@@ -112,6 +217,7 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 		auto iter = m_agents.find(entity);
 		if (!iter.isValid()) return;
 		if (iter.value().agent < 0) return;
+		finishCrowdUpdate();
 		const Agent& agent = iter.value();
 		Vec3 pos = m_universe.getPosition(iter.key());
 		const dtCrowdAgent* dt_agent = m_crowd->getAgent(agent.agent);
@@ -129,30 +235,47 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 	}
 
 
-	void clearNavmesh()
+	void clearDebugData()
 	{
 		rcFreePolyMeshDetail(m_detail_mesh);
 		rcFreePolyMesh(m_polymesh);
-		dtFreeNavMeshQuery(m_navquery);
-		dtFreeNavMesh(m_navmesh);
-		dtFreeCrowd(m_crowd);
 		rcFreeCompactHeightfield(m_debug_compact_heightfield);
 		rcFreeHeightField(m_debug_heightfield);
 		rcFreeContourSet(m_debug_contours);
 		m_detail_mesh = nullptr;
 		m_polymesh = nullptr;
-		m_navquery = nullptr;
-		m_navmesh = nullptr;
-		m_crowd = nullptr;
 		m_debug_compact_heightfield = nullptr;
 		m_debug_heightfield = nullptr;
 		m_debug_contours = nullptr;
 	}
 
 
-	void rasterizeGeometry(const AABB& aabb, rcContext& ctx, rcConfig& cfg, rcHeightfield& solid)
+	void clearNavmesh()
 	{
-		rasterizeMeshes(aabb, ctx, cfg, solid);
+		finishCrowdUpdate();
+		clearDebugData();
+		dtFreeNavMeshQuery(m_navquery);
+		dtFreeNavMesh(m_navmesh);
+		dtFreeCrowd(m_crowd);
+		dtFreeNavMeshQuery(m_path_query);
+		m_navquery = nullptr;
+		m_navmesh = nullptr;
+		m_crowd = nullptr;
+		m_path_query = nullptr;
+		clearPathRequests();
+
+		m_input_instances.clear();
+		m_input_map.clear();
+		m_tile_input_offsets.clear();
+		m_tile_inputs.clear();
+		m_dirty_tiles.clear();
+		m_is_input_collected = false;
+	}
+
+
+	void rasterizeGeometry(int tile_idx, const AABB& aabb, rcContext& ctx, rcConfig& cfg, rcHeightfield& solid)
+	{
+		rasterizeMeshes(tile_idx, aabb, ctx, cfg, solid);
 		rasterizeTerrains(aabb, ctx, cfg, solid);
 	}
 
@@ -228,29 +351,21 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 	}
 
 
-	void rasterizeMeshes(const AABB& aabb, rcContext& ctx, rcConfig& cfg, rcHeightfield& solid)
+	// visits only the instances bucketed into the tile by buildInputGrid
+	void rasterizeMeshes(int tile_idx, const AABB& aabb, rcContext& ctx, rcConfig& cfg, rcHeightfield& solid)
 	{
 		PROFILE_FUNCTION();
 		const float walkable_threshold = cosf(Math::degreesToRadians(45));
 
-		auto render_scene = static_cast<RenderScene*>(m_universe.getScene(crc32("renderer")));
-		if (!render_scene) return;
-
-		u32 no_navigation_flag = Material::getCustomFlag("no_navigation");
-		u32 nonwalkable_flag = Material::getCustomFlag("nonwalkable");
-		for (auto model_instance = render_scene->getFirstModelInstance(); model_instance != INVALID_COMPONENT;
-			 model_instance = render_scene->getNextModelInstance(model_instance))
+		u32 no_navigation_flag = m_no_navigation_flag;
+		u32 nonwalkable_flag = m_nonwalkable_flag;
+		for (int input_idx = m_tile_input_offsets[tile_idx], c = m_tile_input_offsets[tile_idx + 1]; input_idx < c; ++input_idx)
 		{
-			auto* model = render_scene->getModelInstanceModel(model_instance);
-			if (!model) return;
-			ASSERT(model->isReady());
-
-			Entity entity = render_scene->getModelInstanceEntity(model_instance);
-			Matrix mtx = m_universe.getMatrix(entity);
-			AABB model_aabb = model->getAABB();
-			model_aabb.transform(mtx);
-			if (!model_aabb.overlaps(aabb)) continue;
+			const NavmeshInputInstance& instance = m_input_instances[m_tile_inputs[input_idx]];
+			if (!instance.aabb.overlaps(aabb)) continue;
 
+			Model* model = instance.model;
+			const Matrix& mtx = instance.mtx;
 			auto lod = model->getLODMeshIndices(0);
 			for (int mesh_idx = lod.from; mesh_idx <= lod.to; ++mesh_idx)
 			{
@@ -334,12 +449,16 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 	}
 
 
+	// the crowd was updated by the job started in the previous lateUpdate, its results are used here
 	void update(float time_delta, bool paused) override
 	{
 		PROFILE_FUNCTION();
 		if (!m_crowd) return;
 		if (paused) return;
-		m_crowd->update(time_delta, nullptr);
+		finishCrowdUpdate();
+		// the crowd has run once since the paths of the previous frame were applied, their corners are valid now
+		for (Agent& agent : m_agents) agent.is_path_applied = false;
+		applyPathRequests();
 
 		for (auto& agent : m_agents)
 		{
@@ -429,6 +548,8 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 				m_universe.setRotation(agent.entity, m_universe.getRotation(agent.entity) * root_motion.rot);
 			}
 
+			if (agent.is_path_pending || agent.is_path_applied) continue;
+
 			if (dt_agent->ncorners == 0 && dt_agent->targetState != DT_CROWDAGENT_TARGET_REQUESTING)
 			{
 				if (!agent.is_finished)
@@ -453,6 +574,197 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 				agent.is_finished = false;
 			}
 		}
+
+		startCrowdUpdate(time_delta);
+	}
+
+
+	// the crowd job overlaps the rest of the frame, everything touching m_crowd must wait for it first
+	void finishCrowdUpdate()
+	{
+		JobSystem::wait(&m_crowd_job_counter);
+	}
+
+
+	void startCrowdUpdate(float time_delta)
+	{
+		PROFILE_FUNCTION();
+		for (PathRequest& request : m_path_requests)
+		{
+			++request.priority;
+		}
+
+		for (PathRequest& request : m_new_path_requests)
+		{
+			auto iter = m_agents.find(request.entity);
+			if (!iter.isValid()) continue;
+			const Agent& agent = iter.value();
+			if (agent.agent < 0 || agent.path_request != request.id) continue;
+
+			const dtCrowdAgent* dt_agent = m_crowd->getAgent(agent.agent);
+			request.start_ref = dt_agent->corridor.getFirstPoly();
+			request.start_pos = *(Vec3*)dt_agent->npos;
+			bool is_idle = agent.is_finished || dt_agent->targetState == DT_CROWDAGENT_TARGET_NONE;
+			request.priority = is_idle ? IDLE_AGENT_PATH_PRIORITY : 0;
+			m_path_requests.push(request);
+		}
+		m_new_path_requests.clear();
+
+		// requests replaced by a newer one or of removed agents
+		for (int i = m_path_requests.size() - 1; i >= 0; --i)
+		{
+			auto iter = m_agents.find(m_path_requests[i].entity);
+			if (iter.isValid() && iter.value().path_request == m_path_requests[i].id) continue;
+			m_path_requests.eraseFast(i);
+		}
+		if (!m_path_requests.empty())
+		{
+			qsort(&m_path_requests[0], m_path_requests.size(), sizeof(m_path_requests[0]), comparePathRequests);
+		}
+
+		m_crowd_time_delta = time_delta;
+		JobSystem::runJobs(&m_crowd_job, 1, &m_crowd_job_counter);
+	}
+
+
+	void crowdJob()
+	{
+		PROFILE_FUNCTION();
+		processPathRequests();
+		m_crowd->update(m_crowd_time_delta, nullptr);
+	}
+
+
+	// runs sliced path searches in priority order until the time budget is used up
+	void processPathRequests()
+	{
+		PROFILE_FUNCTION();
+		if (m_path_requests.empty()) return;
+
+		float end_time = m_path_timer->getTimeSinceStart() + PATH_QUERY_TIME_BUDGET;
+		dtPolyRef path[MAX_PATH_POLYS];
+		for (PathRequest& request : m_path_requests)
+		{
+			if (request.status == PathRequest::Status::DONE || request.status == PathRequest::Status::FAILED) continue;
+			if (m_path_timer->getTimeSinceStart() > end_time) break;
+
+			if (request.status == PathRequest::Status::PENDING)
+			{
+				dtStatus status = m_path_query->initSlicedFindPath(
+					request.start_ref, request.end_ref, &request.start_pos.x, &request.end_pos.x, &m_path_filter);
+				if (dtStatusFailed(status))
+				{
+					request.status = PathRequest::Status::FAILED;
+					continue;
+				}
+				request.status = PathRequest::Status::IN_PROGRESS;
+			}
+
+			dtStatus status = DT_IN_PROGRESS;
+			while (dtStatusInProgress(status) && m_path_timer->getTimeSinceStart() <= end_time)
+			{
+				status = m_path_query->updateSlicedFindPath(PATH_ITERATIONS_PER_SLICE, nullptr);
+			}
+			if (dtStatusInProgress(status)) break;
+
+			if (dtStatusSucceed(status))
+			{
+				status = m_path_query->finalizeSlicedFindPath(path, &request.path_count, MAX_PATH_POLYS);
+			}
+			if (dtStatusFailed(status) || request.path_count == 0)
+			{
+				request.status = PathRequest::Status::FAILED;
+				continue;
+			}
+
+			request.path_offset = m_path_polys.size();
+			for (int i = 0; i < request.path_count; ++i)
+			{
+				m_path_polys.push(path[i]);
+			}
+			request.status = PathRequest::Status::DONE;
+		}
+	}
+
+
+	void applyPathRequests()
+	{
+		PROFILE_FUNCTION();
+		for (int i = m_path_requests.size() - 1; i >= 0; --i)
+		{
+			const PathRequest& request = m_path_requests[i];
+			if (request.status == PathRequest::Status::PENDING || request.status == PathRequest::Status::IN_PROGRESS) continue;
+
+			auto iter = m_agents.find(request.entity);
+			if (iter.isValid() && iter.value().path_request == request.id && iter.value().agent >= 0)
+			{
+				applyPath(iter.value(), request);
+			}
+			m_path_requests.eraseFast(i);
+		}
+		m_path_polys.clear();
+	}
+
+
+	void applyPath(Agent& agent, const PathRequest& request)
+	{
+		agent.is_path_pending = false;
+		agent.is_path_applied = true;
+		agent.is_finished = false;
+		agent.stop_distance = request.stop_distance;
+		dtCrowdAgentParams params = m_crowd->getAgent(agent.agent)->params;
+		params.maxSpeed = request.speed;
+		m_crowd->updateAgentParameters(agent.agent, &params);
+
+		dtCrowdAgent* dt_agent = m_crowd->getEditableAgent(agent.agent);
+		if (request.status == PathRequest::Status::DONE)
+		{
+			// the agent kept moving during the search, the path is cut to start at its current polygon
+			const dtPolyRef* path = &m_path_polys[request.path_offset];
+			int count = request.path_count;
+			dtPolyRef current_poly = dt_agent->corridor.getFirstPoly();
+			int start = 0;
+			while (start < count && path[start] != current_poly) ++start;
+
+			if (start < count)
+			{
+				bool is_partial = path[count - 1] != request.end_ref;
+				Vec3 target = request.end_pos;
+				if (is_partial) m_navquery->closestPointOnPolyBoundary(path[count - 1], &request.end_pos.x, &target.x);
+
+				dt_agent->corridor.setCorridor(&target.x, path + start, count - start);
+				dt_agent->boundary.reset();
+				dt_agent->partial = is_partial;
+				dt_agent->targetRef = request.end_ref;
+				dtVcopy(dt_agent->targetPos, &target.x);
+				dt_agent->targetState = DT_CROWDAGENT_TARGET_VALID;
+				dt_agent->targetPathqRef = DT_PATHQ_INVALID;
+				dt_agent->targetReplan = false;
+				dt_agent->targetReplanTime = 0;
+				return;
+			}
+		}
+
+		// the crowd searches the path on its own if ours is not usable
+		if (!m_crowd->requestMoveTarget(agent.agent, request.end_ref, &request.end_pos.x))
+		{
+			g_log_warning.log("Navigation") << "requestMoveTarget failed";
+			agent.is_finished = true;
+		}
+	}
+
+
+	void clearPathRequests()
+	{
+		m_path_requests.clear();
+		m_new_path_requests.clear();
+		m_path_polys.clear();
+		for (Agent& agent : m_agents)
+		{
+			agent.is_path_pending = false;
+			agent.is_path_applied = false;
+			agent.path_request = 0;
+		}
 	}
 
 
@@ -517,6 +829,7 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 	const dtCrowdAgent* getDetourAgent(ComponentHandle cmp) override
 	{
 		if (!m_crowd) return nullptr;
+		finishCrowdUpdate();
 
 		auto iter = m_agents.find({cmp.index});
 		if (iter == m_agents.end()) return nullptr;
@@ -532,6 +845,7 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 		auto render_scene = static_cast<RenderScene*>(m_universe.getScene(crc32("renderer")));
 		if (!render_scene) return;
 		if (!m_crowd) return;
+		finishCrowdUpdate();
 
 		auto iter = m_agents.find({cmp.index});
 		if (iter == m_agents.end()) return;
@@ -635,6 +949,7 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 			{
 				int data_size;
 				file.read(&data_size, sizeof(data_size));
+				if (data_size == 0) continue;
 				u8* data = (u8*)dtAlloc(data_size, DT_ALLOC_PERM);
 				file.read(data, data_size);
 				if (dtStatusFailed(m_navmesh->addTile(data, data_size, DT_TILE_FREE_DATA, 0, 0)))
@@ -679,8 +994,9 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 			for (int i = 0; i < m_num_tiles_x; ++i)
 			{
 				const auto* tile = m_navmesh->getTileAt(i, j, 0);
-				file.write(&tile->dataSize, sizeof(tile->dataSize));
-				file.write(tile->data, tile->dataSize);
+				int data_size = tile ? tile->dataSize : 0;
+				file.write(&data_size, sizeof(data_size));
+				if (tile) file.write(tile->data, tile->dataSize);
 			}
 		}
 
@@ -913,6 +1229,10 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 
 	void stopGame() override
 	{
+		finishCrowdUpdate();
+		clearPathRequests();
+		dtFreeNavMeshQuery(m_path_query);
+		m_path_query = nullptr;
 		if (m_crowd)
 		{
 			for (Agent& agent : m_agents)
@@ -940,12 +1260,22 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 		ASSERT(!m_crowd);
 
 		m_crowd = dtAllocCrowd();
-		if (!m_crowd->init(1000, 4.0f, m_navmesh))
+		if (!m_crowd->init(MAX_CROWD_AGENTS, 4.0f, m_navmesh))
 		{
 			dtFreeCrowd(m_crowd);
 			m_crowd = nullptr;
 			return false;
 		}
+		m_path_query = dtAllocNavMeshQuery();
+		if (!m_path_query || dtStatusFailed(m_path_query->init(m_navmesh, 2048)))
+		{
+			g_log_error.log("Navigation") << "Could not init Detour path query";
+			dtFreeNavMeshQuery(m_path_query);
+			dtFreeCrowd(m_crowd);
+			m_path_query = nullptr;
+			m_crowd = nullptr;
+			return false;
+		}
 		for (auto iter = m_agents.begin(), end = m_agents.end(); iter != end; ++iter)
 		{
 			Agent& agent = iter.value();
@@ -965,6 +1295,10 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 		Agent& agent = iter.value();
 		if (agent.agent < 0) return;
 
+		finishCrowdUpdate();
+		agent.path_request = 0;
+		agent.is_path_pending = false;
+		agent.is_path_applied = false;
 		m_crowd->resetMoveTarget(agent.agent);
 	}
 
@@ -980,6 +1314,7 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 		Agent& agent = iter.value();
 		if (agent.agent < 0) return;
 
+		finishCrowdUpdate();
 		dtCrowdAgent* dt_agent = m_crowd->getEditableAgent(agent.agent);
 		if (dt_agent) dt_agent->paused = !active;
 	}
@@ -999,27 +1334,47 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 		dtQueryFilter filter;
 		static const float ext[] = { 1.0f, 20.0f, 1.0f };
 		m_navquery->findNearestPoly(&dest.x, ext, &filter, &end_poly_ref, 0);
-		dtCrowdAgentParams params = m_crowd->getAgent(agent.agent)->params;
-		params.maxSpeed = speed;
-		m_crowd->updateAgentParameters(agent.agent, &params);
-		if (m_crowd->requestMoveTarget(agent.agent, end_poly_ref, &dest.x))
-		{
-			agent.stop_distance = stop_distance;
-			agent.is_finished = false;
-		}
-		else
+		if (!end_poly_ref)
 		{
 			g_log_warning.log("Navigation") << "requestMoveTarget failed";
 			agent.is_finished = true;
+			return false;
 		}
-		return !agent.is_finished;
+
+		// queued for the crowd job, the crowd is not touched here so scripts do not wait for it
+		PathRequest& request = m_new_path_requests.emplace();
+		request.entity = entity;
+		request.id = ++m_last_path_request;
+		request.start_ref = 0;
+		request.end_ref = end_poly_ref;
+		request.start_pos.set(0, 0, 0);
+		request.end_pos = dest;
+		request.speed = speed;
+		request.stop_distance = stop_distance;
+		request.priority = 0;
+		request.path_offset = 0;
+		request.path_count = 0;
+		request.status = PathRequest::Status::PENDING;
+
+		agent.path_request = request.id;
+		agent.is_path_pending = true;
+		agent.is_finished = false;
+		return true;
 	}
 
 
 	int getPolygonCount() override
 	{
-		if (!m_polymesh) return 0;
-		return m_polymesh->npolys;
+		if (!m_navmesh) return 0;
+
+		const dtNavMesh* navmesh = m_navmesh;
+		int count = 0;
+		for (int i = 0; i < navmesh->getMaxTiles(); ++i)
+		{
+			const dtMeshTile* tile = navmesh->getTile(i);
+			if (tile->header) count += tile->header->polyCount;
+		}
+		return count;
 	}
 
 
@@ -1061,157 +1416,200 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 	}
 
 
-	bool generateTile(int x, int z, bool keep_data) override
+	AABB getTileAABB(int x, int z) const
 	{
-		PROFILE_FUNCTION();
-		if (!m_navmesh) return false;
-		m_navmesh->removeTile(m_navmesh->getTileRefAt(x, z, 0), 0, 0);
-
-		rcContext ctx;
-
 		Vec3 bmin(m_aabb.min.x + x * CELLS_PER_TILE_SIDE * CELL_SIZE - (1 + m_config.borderSize) * m_config.cs,
 			m_aabb.min.y,
 			m_aabb.min.z + z * CELLS_PER_TILE_SIDE * CELL_SIZE - (1 + m_config.borderSize) * m_config.cs);
 		Vec3 bmax(bmin.x + CELLS_PER_TILE_SIDE * CELL_SIZE + (1 + m_config.borderSize) * m_config.cs,
 			m_aabb.max.y,
 			bmin.z + CELLS_PER_TILE_SIDE * CELL_SIZE + (1 + m_config.borderSize) * m_config.cs);
-		if (keep_data) m_debug_tile_origin = bmin;
-		rcVcopy(m_config.bmin, &bmin.x);
-		rcVcopy(m_config.bmax, &bmax.x);
-		rcHeightfield* solid = rcAllocHeightfield();
-		m_debug_heightfield = keep_data ? solid : nullptr;
-		if (!solid)
+		return AABB(bmin, bmax);
+	}
+
+
+	// conservative range of tiles whose AABB overlaps aabb, false if aabb is outside of the tile grid
+	bool getTileRange(const AABB& aabb, int* from_x, int* from_z, int* to_x, int* to_z) const
+	{
+		float tile_size = CELLS_PER_TILE_SIDE * CELL_SIZE;
+		float border = (1 + m_config.borderSize) * m_config.cs;
+		*from_x = Math::maximum(0, (int)floorf((aabb.min.x - m_aabb.min.x) / tile_size) - 1);
+		*from_z = Math::maximum(0, (int)floorf((aabb.min.z - m_aabb.min.z) / tile_size) - 1);
+		*to_x = Math::minimum(m_num_tiles_x - 1, (int)floorf((aabb.max.x - m_aabb.min.x + border) / tile_size));
+		*to_z = Math::minimum(m_num_tiles_z - 1, (int)floorf((aabb.max.z - m_aabb.min.z + border) / tile_size));
+		return *from_x <= *to_x && *from_z <= *to_z;
+	}
+
+
+	// does not touch the navmesh, without keep_data tiles can be built from several threads at once
+	bool buildTile(int x, int z, rcContext& ctx, bool keep_data, u8** nav_data, int* nav_data_size)
+	{
+		PROFILE_FUNCTION();
+		*nav_data = nullptr;
+		*nav_data_size = 0;
+
+		rcConfig cfg = m_config;
+		AABB aabb = getTileAABB(x, z);
+		rcVcopy(cfg.bmin, &aabb.min.x);
+		rcVcopy(cfg.bmax, &aabb.max.x);
+
+		TileBuildData data;
+		data.solid = rcAllocHeightfield();
+		if (!data.solid)
 		{
 			g_log_error.log("Navigation") << "Could not generate navmesh: Out of memory 'solid'.";
 			return false;
 		}
-		if (!rcCreateHeightfield(
-				&ctx, *solid, m_config.width, m_config.height, m_config.bmin, m_config.bmax, m_config.cs, m_config.ch))
+		if (!rcCreateHeightfield(&ctx, *data.solid, cfg.width, cfg.height, cfg.bmin, cfg.bmax, cfg.cs, cfg.ch))
 		{
 			g_log_error.log("Navigation") << "Could not generate navmesh: Could not create solid heightfield.";
 			return false;
 		}
-		rasterizeGeometry(AABB(bmin, bmax), ctx, m_config, *solid);
+		rasterizeGeometry(x + z * m_num_tiles_x, aabb, ctx, cfg, *data.solid);
 
-		rcFilterLowHangingWalkableObstacles(&ctx, m_config.walkableClimb, *solid);
-		rcFilterLedgeSpans(&ctx, m_config.walkableHeight, m_config.walkableClimb, *solid);
-		rcFilterWalkableLowHeightSpans(&ctx, m_config.walkableHeight, *solid);
+		rcFilterLowHangingWalkableObstacles(&ctx, cfg.walkableClimb, *data.solid);
+		rcFilterLedgeSpans(&ctx, cfg.walkableHeight, cfg.walkableClimb, *data.solid);
+		rcFilterWalkableLowHeightSpans(&ctx, cfg.walkableHeight, *data.solid);
 
-		rcCompactHeightfield* chf = rcAllocCompactHeightfield();
-		m_debug_compact_heightfield = keep_data ? chf : nullptr;
-		if (!chf)
+		data.chf = rcAllocCompactHeightfield();
+		if (!data.chf)
 		{
 			g_log_error.log("Navigation") << "Could not generate navmesh: Out of memory 'chf'.";
 			return false;
 		}
 
-		if (!rcBuildCompactHeightfield(&ctx, m_config.walkableHeight, m_config.walkableClimb, *solid, *chf))
+		if (!rcBuildCompactHeightfield(&ctx, cfg.walkableHeight, cfg.walkableClimb, *data.solid, *data.chf))
 		{
 			g_log_error.log("Navigation") << "Could not generate navmesh: Could not build compact data.";
 			return false;
 		}
 
-		if (!m_debug_heightfield) rcFreeHeightField(solid);
-
-		if (!rcErodeWalkableArea(&ctx, m_config.walkableRadius, *chf))
+		if (!rcErodeWalkableArea(&ctx, cfg.walkableRadius, *data.chf))
 		{
 			g_log_error.log("Navigation") << "Could not generate navmesh: Could not erode.";
 			return false;
 		}
 
-		if (!rcBuildDistanceField(&ctx, *chf))
+		if (!rcBuildDistanceField(&ctx, *data.chf))
 		{
 			g_log_error.log("Navigation") << "Could not generate navmesh: Could not build distance field.";
 			return false;
 		}
 
-		if (!rcBuildRegions(&ctx, *chf, m_config.borderSize, m_config.minRegionArea, m_config.mergeRegionArea))
+		if (!rcBuildRegions(&ctx, *data.chf, cfg.borderSize, cfg.minRegionArea, cfg.mergeRegionArea))
 		{
 			g_log_error.log("Navigation") << "Could not generate navmesh: Could not build regions.";
 			return false;
 		}
 
-		rcContourSet* cset = rcAllocContourSet();
-		m_debug_contours = keep_data ? cset : nullptr;
-		if (!cset)
+		data.cset = rcAllocContourSet();
+		if (!data.cset)
 		{
 			ctx.log(RC_LOG_ERROR, "Could not generate navmesh: Out of memory 'cset'.");
 			return false;
 		}
-		if (!rcBuildContours(&ctx, *chf, m_config.maxSimplificationError, m_config.maxEdgeLen, *cset))
+		if (!rcBuildContours(&ctx, *data.chf, cfg.maxSimplificationError, cfg.maxEdgeLen, *data.cset))
 		{
 			g_log_error.log("Navigation") << "Could not generate navmesh: Could not create contours.";
 			return false;
 		}
 
-		m_polymesh = rcAllocPolyMesh();
-		if (!m_polymesh)
+		data.polymesh = rcAllocPolyMesh();
+		if (!data.polymesh)
 		{
-			g_log_error.log("Navigation") << "Could not generate navmesh: Out of memory 'm_polymesh'.";
+			g_log_error.log("Navigation") << "Could not generate navmesh: Out of memory 'polymesh'.";
 			return false;
 		}
-		if (!rcBuildPolyMesh(&ctx, *cset, m_config.maxVertsPerPoly, *m_polymesh))
+		if (!rcBuildPolyMesh(&ctx, *data.cset, cfg.maxVertsPerPoly, *data.polymesh))
 		{
 			g_log_error.log("Navigation") << "Could not generate navmesh: Could not triangulate contours.";
 			return false;
 		}
 
-		m_detail_mesh = rcAllocPolyMeshDetail();
-		if (!m_detail_mesh)
+		data.detail_mesh = rcAllocPolyMeshDetail();
+		if (!data.detail_mesh)
 		{
 			g_log_error.log("Navigation") << "Could not generate navmesh: Out of memory 'pmdtl'.";
 			return false;
 		}
 
 		if (!rcBuildPolyMeshDetail(
-				&ctx, *m_polymesh, *chf, m_config.detailSampleDist, m_config.detailSampleMaxError, *m_detail_mesh))
+				&ctx, *data.polymesh, *data.chf, cfg.detailSampleDist, cfg.detailSampleMaxError, *data.detail_mesh))
 		{
 			g_log_error.log("Navigation") << "Could not generate navmesh: Could not build detail mesh.";
 			return false;
 		}
 
-		if (!m_debug_compact_heightfield) rcFreeCompactHeightfield(chf);
-		if (!m_debug_contours) rcFreeContourSet(cset);
+		rcPolyMesh* polymesh = data.polymesh;
+		rcPolyMeshDetail* detail_mesh = data.detail_mesh;
+		if (keep_data)
+		{
+			// the debug data outlives data, the pointers above stay valid
+			clearDebugData();
+			m_debug_tile_origin = aabb.min;
+			m_debug_heightfield = data.solid;
+			m_debug_compact_heightfield = data.chf;
+			m_debug_contours = data.cset;
+			m_polymesh = data.polymesh;
+			m_detail_mesh = data.detail_mesh;
+			data.solid = nullptr;
+			data.chf = nullptr;
+			data.cset = nullptr;
+			data.polymesh = nullptr;
+			data.detail_mesh = nullptr;
+		}
 
-		unsigned char* nav_data = 0;
-		int nav_data_size = 0;
+		// nothing walkable in the tile, it is left empty
+		if (polymesh->npolys == 0) return true;
 
-		for (int i = 0; i < m_polymesh->npolys; ++i)
+		for (int i = 0; i < polymesh->npolys; ++i)
 		{
-			m_polymesh->flags[i] = m_polymesh->areas[i] == RC_WALKABLE_AREA ? 1 : 0;
+			polymesh->flags[i] = polymesh->areas[i] == RC_WALKABLE_AREA ? 1 : 0;
 		}
 
 		dtNavMeshCreateParams params = {};
-		params.verts = m_polymesh->verts;
-		params.vertCount = m_polymesh->nverts;
-		params.polys = m_polymesh->polys;
-		params.polyAreas = m_polymesh->areas;
-		params.polyFlags = m_polymesh->flags;
-		params.polyCount = m_polymesh->npolys;
-		params.nvp = m_polymesh->nvp;
-		params.detailMeshes = m_detail_mesh->meshes;
-		params.detailVerts = m_detail_mesh->verts;
-		params.detailVertsCount = m_detail_mesh->nverts;
-		params.detailTris = m_detail_mesh->tris;
-		params.detailTriCount = m_detail_mesh->ntris;
-		params.walkableHeight = m_config.walkableHeight * m_config.ch;
-		params.walkableRadius = m_config.walkableRadius * m_config.cs;
-		params.walkableClimb = m_config.walkableClimb * m_config.ch;
+		params.verts = polymesh->verts;
+		params.vertCount = polymesh->nverts;
+		params.polys = polymesh->polys;
+		params.polyAreas = polymesh->areas;
+		params.polyFlags = polymesh->flags;
+		params.polyCount = polymesh->npolys;
+		params.nvp = polymesh->nvp;
+		params.detailMeshes = detail_mesh->meshes;
+		params.detailVerts = detail_mesh->verts;
+		params.detailVertsCount = detail_mesh->nverts;
+		params.detailTris = detail_mesh->tris;
+		params.detailTriCount = detail_mesh->ntris;
+		params.walkableHeight = cfg.walkableHeight * cfg.ch;
+		params.walkableRadius = cfg.walkableRadius * cfg.cs;
+		params.walkableClimb = cfg.walkableClimb * cfg.ch;
 		params.tileX = x;
 		params.tileY = z;
-		rcVcopy(params.bmin, m_polymesh->bmin);
-		rcVcopy(params.bmax, m_polymesh->bmax);
-		params.cs = m_config.cs;
-		params.ch = m_config.ch;
+		rcVcopy(params.bmin, polymesh->bmin);
+		rcVcopy(params.bmax, polymesh->bmax);
+		params.cs = cfg.cs;
+		params.ch = cfg.ch;
 		params.buildBvTree = false;
 
-		if (!dtCreateNavMeshData(&params, &nav_data, &nav_data_size))
+		if (!dtCreateNavMeshData(&params, nav_data, nav_data_size))
 		{
 			g_log_error.log("Navigation") << "Could not build Detour navmesh.";
 			return false;
 		}
+		return true;
+	}
+
+
+	// replaces the tile at x, z, nav_data is owned by the navmesh afterwards, null nav_data leaves the tile empty
+	bool addTile(int x, int z, u8* nav_data, int nav_data_size)
+	{
+		finishCrowdUpdate();
+		m_navmesh->removeTile(m_navmesh->getTileRefAt(x, z, 0), 0, 0);
+		if (!nav_data) return true;
+
 		if (dtStatusFailed(m_navmesh->addTile(nav_data, nav_data_size, DT_TILE_FREE_DATA, 0, nullptr)))
 		{
+			dtFree(nav_data);
 			g_log_error.log("Navigation") << "Could not add Detour tile.";
 			return false;
 		}
@@ -1219,12 +1617,94 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 	}
 
 
-	void computeAABB()
+	bool generateTile(int x, int z, bool keep_data) override
 	{
-		m_aabb.set(Vec3(0, 0, 0), Vec3(0, 0, 0));
+		PROFILE_FUNCTION();
+		if (!m_navmesh) return false;
+		if (x < 0 || z < 0 || x >= m_num_tiles_x || z >= m_num_tiles_z) return false;
+		updateInput();
+
+		rcContext ctx;
+		u8* nav_data;
+		int nav_data_size;
+		bool success = buildTile(x, z, ctx, keep_data, &nav_data, &nav_data_size);
+		m_dirty_tiles[x + z * m_num_tiles_x] = false;
+		return addTile(x, z, nav_data, nav_data_size) && success;
+	}
+
+
+	// builds the tiles on all cores, every job has its own Recast context and pulls tiles until none is left
+	bool buildTiles(const Array<int>& tiles)
+	{
+		PROFILE_FUNCTION();
+		if (tiles.empty()) return true;
+
+		struct TileResult
+		{
+			u8* nav_data;
+			int nav_data_size;
+			bool success;
+		};
+
+		Array<TileResult> results(m_allocator);
+		results.resize(tiles.size());
+		int job_count = Math::minimum((int)MT::getCPUsCount(), tiles.size());
+		Array<JobSystem::JobDecl> jobs(m_allocator);
+		Array<JobSystem::LambdaJob> job_storage(m_allocator);
+		jobs.resize(job_count);
+		job_storage.resize(job_count);
+
+		volatile i32 next_tile = 0;
+		for (int i = 0; i < job_count; ++i)
+		{
+			JobSystem::fromLambda(
+				[this, &tiles, &results, &next_tile]()
+				{
+					rcContext ctx;
+					for (;;)
+					{
+						int idx = MT::atomicIncrement(&next_tile) - 1;
+						if (idx >= tiles.size()) break;
+
+						int tile = tiles[idx];
+						TileResult& result = results[idx];
+						result.success = buildTile(
+							tile % m_num_tiles_x, tile / m_num_tiles_x, ctx, false, &result.nav_data, &result.nav_data_size);
+					}
+				},
+				&job_storage[i],
+				&jobs[i],
+				&m_allocator);
+		}
+
+		volatile i32 counter = 0;
+		JobSystem::runJobs(&jobs[0], jobs.size(), &counter);
+		JobSystem::wait(&counter);
+
+		// Detour is not thread safe, tiles are added in the same order as a serial build would add them
+		bool success = true;
+		for (int i = 0; i < tiles.size(); ++i)
+		{
+			int tile = tiles[i];
+			m_dirty_tiles[tile] = false;
+			const TileResult& result = results[i];
+			if (!addTile(tile % m_num_tiles_x, tile / m_num_tiles_x, result.nav_data, result.nav_data_size) || !result.success)
+			{
+				success = false;
+			}
+		}
+		return success;
+	}
+
+
+	void collectInput(Array<NavmeshInputInstance>& instances)
+	{
+		instances.clear();
 		auto* render_scene = static_cast<RenderScene*>(m_universe.getScene(crc32("renderer")));
 		if (!render_scene) return;
 
+		m_no_navigation_flag = Material::getCustomFlag("no_navigation");
+		m_nonwalkable_flag = Material::getCustomFlag("nonwalkable");
 		for (auto model_instance = render_scene->getFirstModelInstance(); model_instance != INVALID_COMPONENT;
 			model_instance = render_scene->getNextModelInstance(model_instance))
 		{
@@ -1232,10 +1712,120 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 			if (!model) continue;
 			ASSERT(model->isReady());
 
-			AABB model_bb = model->getAABB();
-			Matrix mtx = m_universe.getMatrix(render_scene->getModelInstanceEntity(model_instance));
-			model_bb.transform(mtx);
-			m_aabb.merge(model_bb);
+			NavmeshInputInstance& instance = instances.emplace();
+			instance.entity = render_scene->getModelInstanceEntity(model_instance);
+			instance.model = model;
+			instance.mtx = m_universe.getMatrix(instance.entity);
+			instance.aabb = model->getAABB();
+			instance.aabb.transform(instance.mtx);
+		}
+	}
+
+
+	// buckets the input instances into the tile grid, instances keep their order inside a tile
+	void buildInputGrid()
+	{
+		PROFILE_FUNCTION();
+		int tile_count = m_num_tiles_x * m_num_tiles_z;
+		m_tile_input_offsets.resize(tile_count + 1);
+		for (int& offset : m_tile_input_offsets) offset = 0;
+
+		for (const NavmeshInputInstance& instance : m_input_instances)
+		{
+			int from_x, from_z, to_x, to_z;
+			if (!getTileRange(instance.aabb, &from_x, &from_z, &to_x, &to_z)) continue;
+			for (int j = from_z; j <= to_z; ++j)
+			{
+				for (int i = from_x; i <= to_x; ++i) ++m_tile_input_offsets[i + j * m_num_tiles_x + 1];
+			}
+		}
+		for (int i = 0; i < tile_count; ++i) m_tile_input_offsets[i + 1] += m_tile_input_offsets[i];
+
+		Array<int> fill(m_allocator);
+		fill.resize(tile_count);
+		for (int i = 0; i < tile_count; ++i) fill[i] = m_tile_input_offsets[i];
+		m_tile_inputs.resize(m_tile_input_offsets[tile_count]);
+		for (int idx = 0; idx < m_input_instances.size(); ++idx)
+		{
+			int from_x, from_z, to_x, to_z;
+			if (!getTileRange(m_input_instances[idx].aabb, &from_x, &from_z, &to_x, &to_z)) continue;
+			for (int j = from_z; j <= to_z; ++j)
+			{
+				for (int i = from_x; i <= to_x; ++i) m_tile_inputs[fill[i + j * m_num_tiles_x]++] = idx;
+			}
+		}
+	}
+
+
+	void markTilesDirty(const AABB& aabb)
+	{
+		int from_x, from_z, to_x, to_z;
+		if (!getTileRange(aabb, &from_x, &from_z, &to_x, &to_z)) return;
+		for (int j = from_z; j <= to_z; ++j)
+		{
+			for (int i = from_x; i <= to_x; ++i) m_dirty_tiles[i + j * m_num_tiles_x] = true;
+		}
+	}
+
+
+	// collects the input again and marks tiles touched by added, removed or moved instances as dirty
+	void updateInput()
+	{
+		PROFILE_FUNCTION();
+		Array<NavmeshInputInstance> instances(m_allocator);
+		collectInput(instances);
+
+		int tile_count = m_num_tiles_x * m_num_tiles_z;
+		if (m_dirty_tiles.size() != tile_count)
+		{
+			m_dirty_tiles.resize(tile_count);
+			for (bool& dirty : m_dirty_tiles) dirty = false;
+		}
+
+		// the first collection after load trusts the loaded tiles
+		if (m_is_input_collected)
+		{
+			for (const NavmeshInputInstance& instance : instances)
+			{
+				auto iter = m_input_map.find(instance.entity);
+				if (!iter.isValid())
+				{
+					markTilesDirty(instance.aabb);
+					continue;
+				}
+				const NavmeshInputInstance& old = m_input_instances[iter.value()];
+				if (old.model == instance.model && compareMemory(&old.mtx, &instance.mtx, sizeof(old.mtx)) == 0) continue;
+				markTilesDirty(old.aabb);
+				markTilesDirty(instance.aabb);
+			}
+		}
+
+		m_input_map.clear();
+		for (int i = 0; i < instances.size(); ++i) m_input_map.insert(instances[i].entity, i);
+
+		if (m_is_input_collected)
+		{
+			for (const NavmeshInputInstance& old : m_input_instances)
+			{
+				if (!m_input_map.find(old.entity).isValid()) markTilesDirty(old.aabb);
+			}
+		}
+
+		m_input_instances.swap(instances);
+		m_is_input_collected = true;
+		buildInputGrid();
+	}
+
+
+	void computeAABB()
+	{
+		m_aabb.set(Vec3(0, 0, 0), Vec3(0, 0, 0));
+		auto* render_scene = static_cast<RenderScene*>(m_universe.getScene(crc32("renderer")));
+		if (!render_scene) return;
+
+		for (const NavmeshInputInstance& instance : m_input_instances)
+		{
+			m_aabb.merge(instance.aabb);
 		}
 
 		ComponentHandle cmp = render_scene->getFirstTerrain();
@@ -1282,6 +1872,7 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 
 		if (!initNavmesh()) return false;
 
+		collectInput(m_input_instances);
 		computeAABB();
 		dtNavMeshParams params;
 		rcVcopy(params.orig, &m_aabb.min.x);
@@ -1301,17 +1892,34 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 			return false;
 		}
 
-		for (int j = 0; j < m_num_tiles_z; ++j)
+		for (int i = 0; i < m_input_instances.size(); ++i) m_input_map.insert(m_input_instances[i].entity, i);
+		m_is_input_collected = true;
+		buildInputGrid();
+
+		Array<int> tiles(m_allocator);
+		tiles.resize(params.maxTiles);
+		m_dirty_tiles.resize(params.maxTiles);
+		for (int i = 0; i < params.maxTiles; ++i)
 		{
-			for (int i = 0; i < m_num_tiles_x; ++i)
-			{
-				if (!generateTile(i, j, false))
-				{
-					return false;
-				}
-			}
+			tiles[i] = i;
+			m_dirty_tiles[i] = true;
 		}
-		return true;
+		return buildTiles(tiles);
+	}
+
+
+	bool rebuildDirtyTiles() override
+	{
+		PROFILE_FUNCTION();
+		if (!m_navmesh) return false;
+
+		updateInput();
+		Array<int> tiles(m_allocator);
+		for (int i = 0; i < m_dirty_tiles.size(); ++i)
+		{
+			if (m_dirty_tiles[i]) tiles.push(i);
+		}
+		return buildTiles(tiles);
 	}
 
 
@@ -1347,7 +1955,11 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 			agent.agent = -1;
 			agent.flags = Agent::USE_ROOT_MOTION;
 			agent.is_finished = true;
-			if (m_crowd) addCrowdAgent(agent);
+			if (m_crowd)
+			{
+				finishCrowdUpdate();
+				addCrowdAgent(agent);
+			}
 			m_agents.insert(entity, agent);
 			ComponentHandle cmp = {entity.index};
 			m_universe.addComponent(entity, type, this, cmp);
@@ -1364,7 +1976,11 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 			Entity entity = { component.index };
 			auto iter = m_agents.find(entity);
 			const Agent& agent = iter.value();
-			if (m_crowd && agent.agent >= 0) m_crowd->removeAgent(agent.agent);
+			if (m_crowd && agent.agent >= 0)
+			{
+				finishCrowdUpdate();
+				m_crowd->removeAgent(agent.agent);
+			}
 			m_agents.erase(iter);
 			m_universe.destroyComponent(entity, type, this, component);
 		}
@@ -1410,7 +2026,11 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 		}
 		agent.is_finished = true;
 		agent.agent = -1;
-		if (m_crowd) addCrowdAgent(agent);
+		if (m_crowd)
+		{
+			finishCrowdUpdate();
+			addCrowdAgent(agent);
+		}
 		m_agents.insert(agent.entity, agent);
 		ComponentHandle cmp = {agent.entity.index};
 		m_universe.addComponent(agent.entity, NAVMESH_AGENT_TYPE, this, cmp);
@@ -1542,6 +2162,24 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 	LuaScriptScene* m_script_scene;
 	dtCrowd* m_crowd;
 	DelegateList<void(float)> m_on_update;
+	Array<NavmeshInputInstance> m_input_instances;
+	HashMap<Entity, int> m_input_map;
+	Array<int> m_tile_input_offsets;
+	Array<int> m_tile_inputs;
+	Array<bool> m_dirty_tiles;
+	bool m_is_input_collected;
+	u32 m_no_navigation_flag;
+	u32 m_nonwalkable_flag;
+	dtNavMeshQuery* m_path_query;
+	dtQueryFilter m_path_filter;
+	Timer* m_path_timer;
+	Array<PathRequest> m_path_requests;
+	Array<PathRequest> m_new_path_requests;
+	Array<dtPolyRef> m_path_polys;
+	u32 m_last_path_request;
+	float m_crowd_time_delta;
+	JobSystem::JobDecl m_crowd_job;
+	volatile i32 m_crowd_job_counter;
 };
 
 
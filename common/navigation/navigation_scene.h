@@ -38,6 +38,7 @@ public:
 	virtual bool generateNavmesh() = 0;
 	virtual bool generateTile(int x, int z, bool keep_data) = 0;
 	virtual bool generateTileAt(const Vec3& pos, bool keep_data) = 0;
+	virtual bool rebuildDirtyTiles() = 0;
 	virtual bool load(const char* path) = 0;
 	virtual bool save(const char* path) = 0;
 	virtual int getPolygonCount() = 0;
@@ -172,6 +172,7 @@ static void registerLuaAPI(lua_State* L)
 	REGISTER_FUNCTION(getPolygonCount);
 	REGISTER_FUNCTION(debugDrawContours);
 	REGISTER_FUNCTION(generateTile);
+	REGISTER_FUNCTION(rebuildDirtyTiles);
 	REGISTER_FUNCTION(save);
 	REGISTER_FUNCTION(load);
 	REGISTER_FUNCTION(setGeneratorParams);
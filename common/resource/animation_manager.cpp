@@ -1,4 +1,7 @@
-#include "runtime/Resource/animation_manager.h"
+#include "common/resource/animation_manager.h"
+#include "common/resource/entity_manager.h"
+#include "common/animation/io/archive.h"
+#include "common/animation/io/stream.h"
 
 namespace egal
 {
@@ -12,6 +15,12 @@ namespace egal
 	};
 
 
+	Resource* AnimationManager::createResource()
+	{
+		return _aligned_new(m_allocator, Animation)(ArchivePath(""), *this, m_allocator);
+	}
+
+
 	Resource* AnimationManager::createResource(const ArchivePath& path)
 	{
 		return _aligned_new(m_allocator, Animation)(path, *this, m_allocator);
@@ -31,11 +40,87 @@ namespace egal
 		, m_mem(allocator)
 		, m_bones(allocator)
 		, m_root_motion_bone_idx(-1)
+		, m_is_runtime(false)
+	{
+	}
+
+
+	e_int32 Animation::findKey(const e_uint16* times, e_int32 count, e_int32 frame, e_int32& cursor)
+	{
+		if (count < 2) return 0;
+
+		e_int32 idx = cursor;
+		if (idx < 1 || idx >= count || times[idx - 1] > frame)
+		{
+			e_int32 lo = 1;
+			e_int32 hi = count - 1;
+			while (lo < hi)
+			{
+				e_int32 mid = (lo + hi) >> 1;
+				if (times[mid] > frame) hi = mid;
+				else lo = mid + 1;
+			}
+			idx = lo;
+		}
+		else
+		{
+			while (idx < count - 1 && times[idx] <= frame) ++idx;
+		}
+		cursor = idx;
+		return idx;
+	}
+
+
+	static e_void sampleBonePosition(const e_uint16* times, const float3* keys, e_int32 idx, e_float time, e_float rcp_fps, float3* out)
+	{
+		if (idx == 0)
+		{
+			*out = keys[0];
+			return;
+		}
+		e_float t = e_float(time - times[idx - 1] * rcp_fps) / ((times[idx] - times[idx - 1]) * rcp_fps);
+		lerp(keys[idx - 1], keys[idx], out, t);
+	}
+
+
+	static e_void sampleBoneRotation(const e_uint16* times, const Quaternion* keys, e_int32 idx, e_float time, e_float rcp_fps, Quaternion* out)
+	{
+		if (idx == 0)
+		{
+			*out = keys[0];
+			return;
+		}
+		e_float t = e_float(time - times[idx - 1] * rcp_fps) / ((times[idx] - times[idx - 1]) * rcp_fps);
+		nlerp(keys[idx - 1], keys[idx], out, t);
+	}
+
+
+	e_void Animation::prepareCache(Entity& model, BoneMask* mask, AnimationSamplingCache& cache) const
 	{
+		if (cache.animation == this && cache.model == &model && cache.mask == mask && cache.remap.size() == m_bones.size())
+		{
+			return;
+		}
+
+		cache.animation = this;
+		cache.model = &model;
+		cache.mask = mask;
+		cache.remap.resize(m_bones.size());
+		cache.pos_keys.resize(m_bones.size());
+		cache.rot_keys.resize(m_bones.size());
+		for (e_int32 i = 0, c = m_bones.size(); i < c; ++i)
+		{
+			const Bone& bone = m_bones[i];
+			Entity::BoneMap::iterator iter = model.getBoneIndex(bone.name);
+			e_bool masked_out = mask && !mask->bones.find(bone.name).isValid();
+			cache.remap[i] = iter.isValid() && !masked_out ? iter.value() : -1;
+			cache.pos_keys[i] = 0;
+			cache.rot_keys[i] = 0;
+		}
 	}
 
 
-	e_void Animation::getRelativePose(e_float time, Pose& pose, Model& model, e_float weight, BoneMask* mask) const
+	e_void Animation::getRelativePose(e_float time, Pose& pose, Entity& model, e_float weight, BoneMask* mask) const
 	{
 		//PROFILE_FUNCTION();
 		ASSERT(!pose.is_absolute);
@@ -45,52 +130,36 @@ namespace egal
 		e_int32 frame = (e_int32)(time * m_fps);
 		e_float rcp_fps = 1.0f / m_fps;
 		frame = Math::clamp(frame, 0, m_frame_count);
-		Vec3* pos = pose.positions;
-		Quat* rot = pose.rotations;
+		float3* pos = pose.positions;
+		Quaternion* rot = pose.rotations;
 
 		if (frame < m_frame_count)
 		{
-			for (Bone& bone : m_bones)
+			for (const Bone& bone : m_bones)
 			{
-				Model::BoneMap::iterator iter = model.getBoneIndex(bone.name);
+				Entity::BoneMap::iterator iter = model.getBoneIndex(bone.name);
 				if (!iter.isValid()) continue;
-				if (mask && mask->bones.find(bone.name) == mask->bones.end()) continue;
-
-				e_int32 idx = 1;
-				for (e_int32 c = bone.pos_count; idx < c; ++idx)
-				{
-					if (bone.pos_times[idx] > frame) break;
-				}
-
-				e_float t = e_float(time - bone.pos_times[idx - 1] * rcp_fps) /
-					((bone.pos_times[idx] - bone.pos_times[idx - 1]) * rcp_fps);
+				if (mask && !mask->bones.find(bone.name).isValid()) continue;
 
 				e_int32 model_bone_index = iter.value();
-				Vec3 anim_pos;
-				lerp(bone.pos[idx - 1], bone.pos[idx], &anim_pos, t);
+				e_int32 cursor = 0;
+				float3 anim_pos;
+				sampleBonePosition(bone.pos_times, bone.pos, findKey(bone.pos_times, bone.pos_count, frame, cursor), time, rcp_fps, &anim_pos);
 				lerp(pos[model_bone_index], anim_pos, &pos[model_bone_index], weight);
 
-				idx = 1;
-				for (e_int32 c = bone.rot_count; idx < c; ++idx)
-				{
-					if (bone.rot_times[idx] > frame) break;
-				}
-
-				t = e_float(time - bone.rot_times[idx - 1] * rcp_fps) /
-					((bone.rot_times[idx] - bone.rot_times[idx - 1]) * rcp_fps);
-
-				Quat anim_rot;
-				nlerp(bone.rot[idx - 1], bone.rot[idx], &anim_rot, t);
+				cursor = 0;
+				Quaternion anim_rot;
+				sampleBoneRotation(bone.rot_times, bone.rot, findKey(bone.rot_times, bone.rot_count, frame, cursor), time, rcp_fps, &anim_rot);
 				nlerp(rot[model_bone_index], anim_rot, &rot[model_bone_index], weight);
 			}
 		}
 		else
 		{
-			for (Bone& bone : m_bones)
+			for (const Bone& bone : m_bones)
 			{
-				Model::BoneMap::iterator iter = model.getBoneIndex(bone.name);
+				Entity::BoneMap::iterator iter = model.getBoneIndex(bone.name);
 				if (!iter.isValid()) continue;
-				if (mask && mask->bones.find(bone.name) == mask->bones.end()) continue;
+				if (mask && !mask->bones.find(bone.name).isValid()) continue;
 
 				e_int32 model_bone_index = iter.value();
 				lerp(pos[model_bone_index], bone.pos[bone.pos_count - 1], &pos[model_bone_index], weight);
@@ -100,35 +169,67 @@ namespace egal
 	}
 
 
-	RigidTransform Animation::getBoneTransform(e_float time, e_int32 bone_idx) const
+	e_void Animation::getRelativePose(e_float time, Pose& pose, Entity& model, e_float weight, BoneMask* mask, AnimationSamplingCache& cache) const
 	{
-		RigidTransform ret;
+		//PROFILE_FUNCTION();
+		ASSERT(!pose.is_absolute);
+
+		if (!model.isReady()) return;
+		prepareCache(model, mask, cache);
+
 		e_int32 frame = (e_int32)(time * m_fps);
 		e_float rcp_fps = 1.0f / m_fps;
 		frame = Math::clamp(frame, 0, m_frame_count);
+		float3* pos = pose.positions;
+		Quaternion* rot = pose.rotations;
+		const e_int32* remap = cache.remap.empty() ? nullptr : &cache.remap[0];
 
-		const Bone& bone = m_bones[bone_idx];
 		if (frame < m_frame_count)
 		{
-			e_int32 idx = 1;
-			for (e_int32 c = bone.pos_count; idx < c; ++idx)
+			for (e_int32 i = 0, c = m_bones.size(); i < c; ++i)
 			{
-				if (bone.pos_times[idx] > frame) break;
-			}
+				e_int32 model_bone_index = remap[i];
+				if (model_bone_index < 0) continue;
 
-			e_float t = e_float(time - bone.pos_times[idx - 1] * rcp_fps) /
-				((bone.pos_times[idx] - bone.pos_times[idx - 1]) * rcp_fps);
-			lerp(bone.pos[idx - 1], bone.pos[idx], &ret.pos, t);
+				const Bone& bone = m_bones[i];
+				float3 anim_pos;
+				sampleBonePosition(bone.pos_times, bone.pos, findKey(bone.pos_times, bone.pos_count, frame, cache.pos_keys[i]), time, rcp_fps, &anim_pos);
+				lerp(pos[model_bone_index], anim_pos, &pos[model_bone_index], weight);
 
-			idx = 1;
-			for (e_int32 c = bone.rot_count; idx < c; ++idx)
+				Quaternion anim_rot;
+				sampleBoneRotation(bone.rot_times, bone.rot, findKey(bone.rot_times, bone.rot_count, frame, cache.rot_keys[i]), time, rcp_fps, &anim_rot);
+				nlerp(rot[model_bone_index], anim_rot, &rot[model_bone_index], weight);
+			}
+		}
+		else
+		{
+			for (e_int32 i = 0, c = m_bones.size(); i < c; ++i)
 			{
-				if (bone.rot_times[idx] > frame) break;
+				e_int32 model_bone_index = remap[i];
+				if (model_bone_index < 0) continue;
+
+				const Bone& bone = m_bones[i];
+				lerp(pos[model_bone_index], bone.pos[bone.pos_count - 1], &pos[model_bone_index], weight);
+				nlerp(rot[model_bone_index], bone.rot[bone.rot_count - 1], &rot[model_bone_index], weight);
 			}
+		}
+	}
+
 
-			t = e_float(time - bone.rot_times[idx - 1] * rcp_fps) /
-				((bone.rot_times[idx] - bone.rot_times[idx - 1]) * rcp_fps);
-			nlerp(bone.rot[idx - 1], bone.rot[idx], &ret.rot, t);
+	RigidTransform Animation::getBoneTransform(e_float time, e_int32 bone_idx) const
+	{
+		RigidTransform ret;
+		e_int32 frame = (e_int32)(time * m_fps);
+		e_float rcp_fps = 1.0f / m_fps;
+		frame = Math::clamp(frame, 0, m_frame_count);
+
+		const Bone& bone = m_bones[bone_idx];
+		if (frame < m_frame_count)
+		{
+			e_int32 cursor = 0;
+			sampleBonePosition(bone.pos_times, bone.pos, findKey(bone.pos_times, bone.pos_count, frame, cursor), time, rcp_fps, &ret.pos);
+			cursor = 0;
+			sampleBoneRotation(bone.rot_times, bone.rot, findKey(bone.rot_times, bone.rot_count, frame, cursor), time, rcp_fps, &ret.rot);
 		}
 		else
 		{
@@ -149,7 +250,7 @@ namespace egal
 	}
 
 
-	e_void Animation::getRelativePose(e_float time, Pose& pose, Model& model, BoneMask* mask) const
+	e_void Animation::getRelativePose(e_float time, Pose& pose, Entity& model, BoneMask* mask) const
 	{
 		//PROFILE_FUNCTION();
 		ASSERT(!pose.is_absolute);
@@ -159,48 +260,75 @@ namespace egal
 		e_int32 frame = (e_int32)(time * m_fps);
 		e_float rcp_fps = 1.0f / m_fps;
 		frame = Math::clamp(frame, 0, m_frame_count);
-		Vec3* pos = pose.positions;
-		Quat* rot = pose.rotations;
+		float3* pos = pose.positions;
+		Quaternion* rot = pose.rotations;
 
 		if (frame < m_frame_count)
 		{
-			for (Bone& bone : m_bones)
+			for (const Bone& bone : m_bones)
 			{
-				Model::BoneMap::iterator iter = model.getBoneIndex(bone.name);
+				Entity::BoneMap::iterator iter = model.getBoneIndex(bone.name);
 				if (!iter.isValid()) continue;
-				if (mask && mask->bones.find(bone.name) == mask->bones.end()) continue;
+				if (mask && !mask->bones.find(bone.name).isValid()) continue;
 
-				e_int32 idx = 1;
-				for (e_int32 c = bone.pos_count; idx < c; ++idx)
-				{
-					if (bone.pos_times[idx] > frame) break;
-				}
+				e_int32 model_bone_index = iter.value();
+				e_int32 cursor = 0;
+				sampleBonePosition(bone.pos_times, bone.pos, findKey(bone.pos_times, bone.pos_count, frame, cursor), time, rcp_fps, &pos[model_bone_index]);
+				cursor = 0;
+				sampleBoneRotation(bone.rot_times, bone.rot, findKey(bone.rot_times, bone.rot_count, frame, cursor), time, rcp_fps, &rot[model_bone_index]);
+			}
+		}
+		else
+		{
+			for (const Bone& bone : m_bones)
+			{
+				Entity::BoneMap::iterator iter = model.getBoneIndex(bone.name);
+				if (!iter.isValid()) continue;
+				if (mask && !mask->bones.find(bone.name).isValid()) continue;
 
-				e_float t = e_float(time - bone.pos_times[idx - 1] * rcp_fps) /
-					((bone.pos_times[idx] - bone.pos_times[idx - 1]) * rcp_fps);
 				e_int32 model_bone_index = iter.value();
-				lerp(bone.pos[idx - 1], bone.pos[idx], &pos[model_bone_index], t);
+				pos[model_bone_index] = bone.pos[bone.pos_count - 1];
+				rot[model_bone_index] = bone.rot[bone.rot_count - 1];
+			}
+		}
+	}
+
+
+	e_void Animation::getRelativePose(e_float time, Pose& pose, Entity& model, BoneMask* mask, AnimationSamplingCache& cache) const
+	{
+		//PROFILE_FUNCTION();
+		ASSERT(!pose.is_absolute);
 
-				idx = 1;
-				for (e_int32 c = bone.rot_count; idx < c; ++idx)
-				{
-					if (bone.rot_times[idx] > frame) break;
-				}
+		if (!model.isReady()) return;
+		prepareCache(model, mask, cache);
+
+		e_int32 frame = (e_int32)(time * m_fps);
+		e_float rcp_fps = 1.0f / m_fps;
+		frame = Math::clamp(frame, 0, m_frame_count);
+		float3* pos = pose.positions;
+		Quaternion* rot = pose.rotations;
+		const e_int32* remap = cache.remap.empty() ? nullptr : &cache.remap[0];
+
+		if (frame < m_frame_count)
+		{
+			for (e_int32 i = 0, c = m_bones.size(); i < c; ++i)
+			{
+				e_int32 model_bone_index = remap[i];
+				if (model_bone_index < 0) continue;
 
-				t = e_float(time - bone.rot_times[idx - 1] * rcp_fps) /
-					((bone.rot_times[idx] - bone.rot_times[idx - 1]) * rcp_fps);
-				nlerp(bone.rot[idx - 1], bone.rot[idx], &rot[model_bone_index], t);
+				const Bone& bone = m_bones[i];
+				sampleBonePosition(bone.pos_times, bone.pos, findKey(bone.pos_times, bone.pos_count, frame, cache.pos_keys[i]), time, rcp_fps, &pos[model_bone_index]);
+				sampleBoneRotation(bone.rot_times, bone.rot, findKey(bone.rot_times, bone.rot_count, frame, cache.rot_keys[i]), time, rcp_fps, &rot[model_bone_index]);
 			}
 		}
 		else
 		{
-			for (Bone& bone : m_bones)
+			for (e_int32 i = 0, c = m_bones.size(); i < c; ++i)
 			{
-				Model::BoneMap::iterator iter = model.getBoneIndex(bone.name);
-				if (!iter.isValid()) continue;
-				if (mask && mask->bones.find(bone.name) == mask->bones.end()) continue;
+				e_int32 model_bone_index = remap[i];
+				if (model_bone_index < 0) continue;
 
-				e_int32 model_bone_index = iter.value();
+				const Bone& bone = m_bones[i];
 				pos[model_bone_index] = bone.pos[bone.pos_count - 1];
 				rot[model_bone_index] = bone.rot[bone.rot_count - 1];
 			}
@@ -208,21 +336,50 @@ namespace egal
 	}
 
 
+	e_bool Animation::loadRuntime(FS::IFile& file)
+	{
+		io::MemoryStream stream;
+		stream.Write(file.getBuffer(), file.size());
+		stream.Seek(0, io::Stream::kSet);
+
+		io::IArchive archive(&stream);
+		if (!archive.TestTag<animation::Animation>()) return false;
+
+		archive >> m_runtime_animation;
+		if (stream.Tell() + (e_int32)sizeof(float) > (e_int32)stream.Size())
+		{
+			log_error("Animation %s has no sampling rate, reimport it.", getPath().c_str());
+			return false;
+		}
+		float fps;
+		archive >> fps;
+		m_is_runtime = true;
+		m_fps = Math::maximum(1, (e_int32)(fps + 0.5f));
+		m_frame_count = (e_int32)(m_runtime_animation.duration() * m_fps);
+		m_root_motion_bone_idx = -1;
+		m_size = file.size();
+		return true;
+	}
+
+
 	e_bool Animation::load(FS::IFile& file)
 	{
 		m_bones.clear();
 		m_mem.clear();
+		m_is_runtime = false;
+		if (loadRuntime(file)) return true;
+
+		file.seek(FS::SeekMode::BEGIN, 0);
 		Header header;
 		file.read(&header, sizeof(header));
 		if (header.magic != HEADER_MAGIC)
 		{
-			g_log_error.log("Animation") << getPath() << " is not an animation file";
+			log_error("Animation %s is not an animation file", getPath().c_str());
 			return false;
 		}
 		if (header.version <= (e_int32)Version::COMPRESSION)
 		{
-			g_log_error.log("Animation") << "Unsupported animation version " << (e_int32)header.version << " ("
-				<< getPath() << ")";
+			log_error("Animation unsupported animation version %d (%s)", (e_int32)header.version, getPath().c_str());
 			return false;
 		}
 		if (header.version > (e_int32)Version::ROOT_MOTION)
@@ -243,18 +400,18 @@ namespace egal
 		e_int32 size = e_int32(file.size() - file.pos());
 		m_mem.resize(size);
 		file.read(&m_mem[0], size);
-		InputBlob blob(&m_mem[0], size);
+		ReadBinary blob(&m_mem[0], size);
 		for (e_int32 i = 0; i < m_bones.size(); ++i)
 		{
 			m_bones[i].name = blob.read<e_uint32>();
 
 			m_bones[i].pos_count = blob.read<e_int32>();
 			m_bones[i].pos_times = (const e_uint16*)blob.skip(m_bones[i].pos_count * sizeof(e_uint16));
-			m_bones[i].pos = (const Vec3*)blob.skip(m_bones[i].pos_count * sizeof(Vec3));
+			m_bones[i].pos = (const float3*)blob.skip(m_bones[i].pos_count * sizeof(float3));
 
 			m_bones[i].rot_count = blob.read<e_int32>();
 			m_bones[i].rot_times = (const e_uint16*)blob.skip(m_bones[i].rot_count * sizeof(e_uint16));
-			m_bones[i].rot = (const Quat*)blob.skip(m_bones[i].rot_count * sizeof(Quat));
+			m_bones[i].rot = (const Quaternion*)blob.skip(m_bones[i].rot_count * sizeof(Quaternion));
 		}
 
 		m_size = file.size();
@@ -273,5 +430,57 @@ namespace egal
 		m_bones.clear();
 		m_mem.clear();
 		m_frame_count = 0;
+		m_is_runtime = false;
+		m_runtime_animation.~Animation();
+		_new(&m_runtime_animation) animation::Animation();
+	}
+
+
+	Resource* SkeletonManager::createResource()
+	{
+		return _aligned_new(m_allocator, SkeletonResource)(ArchivePath(""), *this, m_allocator);
+	}
+
+
+	Resource* SkeletonManager::createResource(const ArchivePath& path)
+	{
+		return _aligned_new(m_allocator, SkeletonResource)(path, *this, m_allocator);
+	}
+
+
+	e_void SkeletonManager::destroyResource(Resource& resource)
+	{
+		_delete(m_allocator, static_cast<SkeletonResource*>(&resource));
+	}
+
+
+	SkeletonResource::SkeletonResource(const ArchivePath& path, ResourceManagerBase& resource_manager, IAllocator& allocator)
+		: Resource(path, resource_manager, allocator)
+	{
+	}
+
+
+	e_bool SkeletonResource::load(FS::IFile& file)
+	{
+		io::MemoryStream stream;
+		stream.Write(file.getBuffer(), file.size());
+		stream.Seek(0, io::Stream::kSet);
+
+		io::IArchive archive(&stream);
+		if (!archive.TestTag<animation::Skeleton>())
+		{
+			log_error("Animation %s is not a skeleton file", getPath().c_str());
+			return false;
+		}
+		archive >> m_skeleton;
+		m_size = file.size();
+		return true;
+	}
+
+
+	e_void SkeletonResource::unload()
+	{
+		m_skeleton.~Skeleton();
+		_new(&m_skeleton) animation::Skeleton();
 	}
 }
@@ -2,9 +2,12 @@
 #define _animation_manager_h_
 #pragma once
 
-#include "runtime/Resource/resource_define.h"
-#include "runtime/Resource/resource_public.h"
-#include "runtime/Resource/resource_manager.h"
+#include "common/resource/resource_define.h"
+#include "common/resource/resource_public.h"
+#include "common/resource/resource_manager.h"
+
+#include "common/animation/animation.h"
+#include "common/animation/skeleton.h"
 
 namespace egal
 {
@@ -14,10 +17,8 @@ namespace egal
 		struct IFile;
 	}
 
-	class Model;
+	class Entity;
 	struct Pose;
-	struct Quat;
-	struct Vec3;
 
 	class AnimationManager : public ResourceManagerBase
 	{
@@ -28,8 +29,10 @@ namespace egal
 		{}
 		~AnimationManager() {}
 		IAllocator& getAllocator() { return m_allocator; }
+		Debug::MemoryTag getMemoryTag() const override { return Debug::MemoryTag::ANIMATION; }
 
 	protected:
+		Resource* createResource() override;
 		Resource* createResource(const ArchivePath& path) override;
 		e_void destroyResource(Resource& resource) override;
 
@@ -38,11 +41,78 @@ namespace egal
 	};
 
 
+	class SkeletonManager : public ResourceManagerBase
+	{
+	public:
+		explicit SkeletonManager(IAllocator& allocator)
+			: ResourceManagerBase(allocator)
+			, m_allocator(allocator)
+		{}
+		~SkeletonManager() {}
+		Debug::MemoryTag getMemoryTag() const override { return Debug::MemoryTag::ANIMATION; }
+
+	protected:
+		Resource* createResource() override;
+		Resource* createResource(const ArchivePath& path) override;
+		e_void destroyResource(Resource& resource) override;
+
+	private:
+		IAllocator& m_allocator;
+	};
+
+
+	/** runtime SoA skeleton (.ske), produced offline by SkeletonBuilder */
+	class SkeletonResource : public Resource
+	{
+	public:
+		SkeletonResource(const ArchivePath& path, ResourceManagerBase& resource_manager, IAllocator& allocator);
+
+		const animation::Skeleton& getSkeleton() const { return m_skeleton; }
+
+	private:
+		e_void unload() override;
+		e_bool load(FS::IFile& file) override;
+
+	private:
+		animation::Skeleton m_skeleton;
+	};
+
+
 	struct BoneMask
 	{
 		BoneMask(IAllocator& allocator) : bones(allocator) {}
 		e_uint32 name;
-		HashMap<e_uint32, e_uint8> bones;
+		THashMap<e_uint32, e_uint8> bones;
+	};
+
+
+	class Animation;
+
+
+	/**
+	 * Per instance sampling state. Caches the animation->model bone remap table (including the mask)
+	 * and the last used key of every bone, so sampling with monotonically advancing time does not search.
+	 */
+	struct AnimationSamplingCache
+	{
+		explicit AnimationSamplingCache(IAllocator& allocator)
+			: remap(allocator)
+			, pos_keys(allocator)
+			, rot_keys(allocator)
+			, animation(nullptr)
+			, model(nullptr)
+			, mask(nullptr)
+		{}
+
+		e_void invalidate() { animation = nullptr; }
+
+		/** model bone index for every animation bone, -1 when missing in model or masked out */
+		TArrary<e_int32> remap;
+		TArrary<e_int32> pos_keys;
+		TArrary<e_int32> rot_keys;
+		const Animation* animation;
+		const Entity* model;
+		const BoneMask* mask;
 	};
 
 
@@ -64,19 +134,27 @@ namespace egal
 
 		e_int32 getRootMotionBoneIdx() const { return m_root_motion_bone_idx; }
 		RigidTransform getBoneTransform(e_float time, e_int32 bone_idx) const;
-		e_void getRelativePose(e_float time, Pose& pose, Model& model, BoneMask* mask) const;
-		e_void getRelativePose(e_float time, Pose& pose, Model& model, e_float weight, BoneMask* mask) const;
+		e_void getRelativePose(e_float time, Pose& pose, Entity& model, BoneMask* mask) const;
+		e_void getRelativePose(e_float time, Pose& pose, Entity& model, e_float weight, BoneMask* mask) const;
+		e_void getRelativePose(e_float time, Pose& pose, Entity& model, BoneMask* mask, AnimationSamplingCache& cache) const;
+		e_void getRelativePose(e_float time, Pose& pose, Entity& model, e_float weight, BoneMask* mask, AnimationSamplingCache& cache) const;
 		e_int32 getFrameCount() const { return m_frame_count; }
 		e_float getLength() const { return m_frame_count / (e_float)m_fps; }
 		e_int32 getFPS() const { return m_fps; }
 		e_int32 getBoneCount() const { return m_bones.size(); }
 		e_int32 getBoneIndex(e_uint32 name) const;
 
+		/** SoA keyframes when the file was built by AnimationBuilder, null for legacy '_LAF' clips */
+		const animation::Animation* getRuntimeAnimation() const { return m_is_runtime ? &m_runtime_animation : nullptr; }
+
 	private:
 		IAllocator& getAllocator() const;
+		e_void prepareCache(Entity& model, BoneMask* mask, AnimationSamplingCache& cache) const;
+		static e_int32 findKey(const e_uint16* times, e_int32 count, e_int32 frame, e_int32& cursor);
 
 		e_void unload() override;
 		e_bool load(FS::IFile& file) override;
+		e_bool loadRuntime(FS::IFile& file);
 
 	private:
 		e_int32	m_frame_count;
@@ -85,15 +163,17 @@ namespace egal
 			e_uint32 name;
 			e_int32 pos_count;
 			const e_uint16* pos_times;
-			const Vec3* pos;
+			const float3* pos;
 			e_int32 rot_count;
 			const e_uint16* rot_times;
-			const Quat* rot;
+			const Quaternion* rot;
 		};
-		Array<Bone> m_bones;
-		Array<e_uint8> m_mem;
+		TArrary<Bone> m_bones;
+		TArrary<e_uint8> m_mem;
 		e_int32 m_fps;
 		e_int32 m_root_motion_bone_idx;
+		e_bool m_is_runtime;
+		animation::Animation m_runtime_animation;
 	};
 }
 
@@ -0,0 +1,170 @@
+#include "common/resource/animation_sampler.h"
+#include "common/resource/entity_manager.h"
+#include "common/animation/animation.h"
+#include "common/animation/skeleton.h"
+#include "common/animation/sampling_job.h"
+#include "common/animation/blending_job.h"
+#include "common/animation/local_to_model_job.h"
+#include "common/utils/crc32.h"
+
+namespace egal
+{
+	AnimationSampler::AnimationSampler(IAllocator& allocator)
+		: m_allocator(allocator)
+		, m_skeleton(nullptr)
+		, m_layer_count(0)
+		, m_locals(nullptr)
+		, m_blended(nullptr)
+		, m_models(nullptr)
+		, m_joint_to_bone(allocator)
+	{
+		for (e_int32 i = 0; i < MAX_LAYERS; ++i) m_caches[i] = nullptr;
+	}
+
+
+	AnimationSampler::~AnimationSampler()
+	{
+		release();
+	}
+
+
+	e_void AnimationSampler::release()
+	{
+		for (e_int32 i = 0; i < MAX_LAYERS; ++i)
+		{
+			if (m_caches[i]) _delete(m_allocator, m_caches[i]);
+			m_caches[i] = nullptr;
+		}
+		if (m_locals) m_allocator.deallocate_aligned(m_locals);
+		if (m_models) m_allocator.deallocate_aligned(m_models);
+		m_locals = nullptr;
+		m_blended = nullptr;
+		m_models = nullptr;
+		m_joint_to_bone.clear();
+		m_layer_count = 0;
+	}
+
+
+	e_void AnimationSampler::setSkeleton(const animation::Skeleton* skeleton)
+	{
+		if (m_skeleton == skeleton) return;
+		release();
+		m_skeleton = skeleton;
+		if (!skeleton || skeleton->num_joints() == 0) return;
+
+		/** one slice per layer plus the blended result */
+		e_int32 num_soa_joints = skeleton->num_soa_joints();
+		m_locals = (math::SoaTransform*)m_allocator.allocate_aligned(
+			sizeof(math::SoaTransform) * num_soa_joints * (MAX_LAYERS + 1), ALIGN_OF(math::SoaTransform));
+		m_blended = m_locals + num_soa_joints * MAX_LAYERS;
+		m_models = (math::Float4x4*)m_allocator.allocate_aligned(
+			sizeof(math::Float4x4) * skeleton->num_joints(), ALIGN_OF(math::Float4x4));
+		for (e_int32 i = 0; i < MAX_LAYERS; ++i)
+		{
+			m_caches[i] = _aligned_new(m_allocator, animation::SamplingCache)(skeleton->num_joints());
+		}
+		m_joint_to_bone.resize(skeleton->num_joints());
+		for (e_int32& bone : m_joint_to_bone) bone = -1;
+	}
+
+
+	e_void AnimationSampler::bindEntity(Entity& entity)
+	{
+		if (!m_skeleton) return;
+
+		Range<const char* const> names = m_skeleton->joint_names();
+		for (e_int32 i = 0; i < m_joint_to_bone.size(); ++i)
+		{
+			Entity::BoneMap::iterator iter = entity.getBoneIndex(crc32(names.begin[i]));
+			m_joint_to_bone[i] = iter.isValid() ? iter.value() : -1;
+		}
+	}
+
+
+	e_bool AnimationSampler::addLayer(const animation::Animation& animation, e_float time, e_float weight)
+	{
+		if (m_layer_count == MAX_LAYERS || !m_skeleton) return false;
+		if (animation.num_tracks() != m_skeleton->num_joints()) return false;
+
+		Layer& layer = m_layers[m_layer_count];
+		layer.animation = &animation;
+		layer.time = time;
+		layer.weight = weight;
+		++m_layer_count;
+		return true;
+	}
+
+
+	e_bool AnimationSampler::evaluate()
+	{
+		if (!m_skeleton || !m_locals || m_layer_count == 0) return false;
+
+		e_int32 num_soa_joints = m_skeleton->num_soa_joints();
+
+		/** a single layer needs no blending, sample straight into the result */
+		e_bool single = m_layer_count == 1 && m_layers[0].weight >= 1.0f;
+		animation::BlendingJob::Layer blend_layers[MAX_LAYERS];
+		for (e_int32 i = 0; i < m_layer_count; ++i)
+		{
+			math::SoaTransform* output = single ? m_blended : m_locals + i * num_soa_joints;
+
+			animation::SamplingJob sampling;
+			sampling.animation = m_layers[i].animation;
+			sampling.cache = m_caches[i];
+			sampling.time = m_layers[i].time;
+			sampling.output = Range<math::SoaTransform>(output, num_soa_joints);
+			if (!sampling.Run()) return false;
+
+			blend_layers[i].weight = m_layers[i].weight;
+			blend_layers[i].transform = Range<const math::SoaTransform>(output, num_soa_joints);
+		}
+
+		if (!single)
+		{
+			animation::BlendingJob blending;
+			blending.layers = Range<const animation::BlendingJob::Layer>(blend_layers, m_layer_count);
+			blending.bind_pose = m_skeleton->bind_pose();
+			blending.output = Range<math::SoaTransform>(m_blended, num_soa_joints);
+			if (!blending.Run()) return false;
+		}
+
+		animation::LocalToModelJob ltm;
+		ltm.skeleton = m_skeleton;
+		ltm.input = Range<const math::SoaTransform>(m_blended, num_soa_joints);
+		ltm.output = Range<math::Float4x4>(m_models, m_skeleton->num_joints());
+		return ltm.Run();
+	}
+
+
+	e_void AnimationSampler::getPose(Pose& pose) const
+	{
+		if (!m_blended) return;
+
+		pose.is_absolute = false;
+		e_int32 num_joints = m_joint_to_bone.size();
+		for (e_int32 soa_idx = 0; soa_idx * 4 < num_joints; ++soa_idx)
+		{
+			const math::SoaTransform& transform = m_blended[soa_idx];
+			e_float tx[4], ty[4], tz[4];
+			e_float rx[4], ry[4], rz[4], rw[4];
+			math::StorePtrU(transform.translation.x, tx);
+			math::StorePtrU(transform.translation.y, ty);
+			math::StorePtrU(transform.translation.z, tz);
+			math::StorePtrU(transform.rotation.x, rx);
+			math::StorePtrU(transform.rotation.y, ry);
+			math::StorePtrU(transform.rotation.z, rz);
+			math::StorePtrU(transform.rotation.w, rw);
+
+			for (e_int32 lane = 0; lane < 4; ++lane)
+			{
+				e_int32 joint = soa_idx * 4 + lane;
+				if (joint >= num_joints) break;
+				e_int32 bone = m_joint_to_bone[joint];
+				if (bone < 0 || bone >= pose.count) continue;
+
+				pose.positions[bone].set(tx[lane], ty[lane], tz[lane]);
+				pose.rotations[bone] = Quaternion(rx[lane], ry[lane], rz[lane], rw[lane]);
+			}
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#ifndef _animation_sampler_h_
+#define _animation_sampler_h_
+#pragma once
+
+#include "common/egal-d.h"
+#include "common/animation/maths/soa_transform.h"
+#include "common/animation/maths/simd_math.h"
+
+namespace egal
+{
+	class Entity;
+	struct Pose;
+
+	namespace animation
+	{
+		class Animation;
+		class Skeleton;
+		class SamplingCache;
+	}
+
+	/**
+	 * Per character SoA animation evaluation: Sampling -> Blending -> LocalToModel.
+	 * Everything is allocated in setSkeleton, evaluate does no allocation, so samplers of different
+	 * characters can be evaluated on different job system workers at once.
+	 */
+	class AnimationSampler
+	{
+	public:
+		enum { MAX_LAYERS = 4 };
+
+		struct Layer
+		{
+			const animation::Animation* animation;
+			e_float time;
+			e_float weight;
+		};
+
+	public:
+		explicit AnimationSampler(IAllocator& allocator);
+		~AnimationSampler();
+
+		e_void setSkeleton(const animation::Skeleton* skeleton);
+		const animation::Skeleton* getSkeleton() const { return m_skeleton; }
+
+		/** maps skeleton joints to entity bones by name, must be called again if the entity is reloaded */
+		e_void bindEntity(Entity& entity);
+
+		e_void clearLayers() { m_layer_count = 0; }
+		e_bool addLayer(const animation::Animation& animation, e_float time, e_float weight);
+		e_int32 getLayerCount() const { return m_layer_count; }
+
+		e_bool evaluate();
+
+		/** writes blended local transforms to bones bound by bindEntity */
+		e_void getPose(Pose& pose) const;
+		const math::Float4x4* getModelMatrices() const { return m_models; }
+	private:
+		e_void release();
+
+	private:
+		IAllocator&					m_allocator;
+		const animation::Skeleton*	m_skeleton;
+		Layer						m_layers[MAX_LAYERS];
+		animation::SamplingCache*	m_caches[MAX_LAYERS];
+		e_int32						m_layer_count;
+		math::SoaTransform*			m_locals;
+		math::SoaTransform*			m_blended;
+		math::Float4x4*				m_models;
+		TArrary<e_int32>			m_joint_to_bone;
+	};
+}
+#endif
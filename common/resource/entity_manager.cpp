@@ -24,6 +24,7 @@ namespace egal
 		, vertices(allocator)
 		, uvs(allocator)
 		, skin(allocator)
+		, bvh(allocator)
 	{
 	}
 
@@ -42,6 +43,7 @@ namespace egal
 		vertex_buffer_handle = rhs.vertex_buffer_handle;
 		index_buffer_handle = rhs.index_buffer_handle;
 		name = rhs.name;
+		bvh.clear();
 		// all except material
 	}
 
@@ -186,21 +188,93 @@ namespace egal
 	}
 
 
-	static e_void computeSkinMatrices(const Pose& pose, const Entity& Entity, float4x4* matrices)
+	e_void Entity::computeSkinMatrices(const Pose& pose, float4x4* matrices) const
 	{
 		for (e_int32 i = 0; i < pose.count; ++i)
 		{
-			auto& bone = Entity.getBone(i);
+			auto& bone = getBone(i);
 			RigidTransform tmp = { pose.positions[i], pose.rotations[i] };
 			matrices[i] = (tmp * bone.inv_bind_transform).toMatrix();
 		}
 	}
 
 
-	RayCastEntityHit Entity::castRay(const float3& origin, const float3& dir, const Matrix& model_transform, const Pose* pose)
+	static INLINE e_void getTriangleIndices(const Mesh& mesh, e_int32 triangle, e_uint32* out)
+	{
+		if (mesh.areIndices16())
+		{
+			const e_uint16* indices = (const e_uint16*)&mesh.indices[0] + triangle * 3;
+			out[0] = indices[0];
+			out[1] = indices[1];
+			out[2] = indices[2];
+		}
+		else
+		{
+			const e_uint32* indices = (const e_uint32*)&mesh.indices[0] + triangle * 3;
+			out[0] = indices[0];
+			out[1] = indices[1];
+			out[2] = indices[2];
+		}
+	}
+
+
+	static e_int32 getTriangleCount(const Mesh& mesh)
+	{
+		return mesh.indices.size() / (mesh.areIndices16() ? 2 : 4) / 3;
+	}
+
+
+	/** skin is null for rigid meshes */
+	static e_bool castRayTriangle(const Mesh& mesh, e_int32 triangle, const float3& origin, const float3& dir, const float4x4* skin, e_float* t)
+	{
+		e_uint32 idx[3];
+		getTriangleIndices(mesh, triangle, idx);
+		float3 p0 = mesh.vertices[idx[0]];
+		float3 p1 = mesh.vertices[idx[1]];
+		float3 p2 = mesh.vertices[idx[2]];
+		if (skin)
+		{
+			p0 = evaluateSkin(p0, mesh.skin[idx[0]], skin);
+			p1 = evaluateSkin(p1, mesh.skin[idx[1]], skin);
+			p2 = evaluateSkin(p2, mesh.skin[idx[2]], skin);
+		}
+		return Math::getRayTriangleIntersection(origin, dir, p0, p1, p2, t);
+	}
+
+
+	e_void Entity::buildMeshBVHs()
+	{
+		TArrary<AABB> boxes(m_allocator);
+		for (e_int32 mesh_index = m_lods[0].from_mesh; mesh_index <= m_lods[0].to_mesh; ++mesh_index)
+		{
+			Mesh& mesh = m_meshes[mesh_index];
+			mesh.bvh.clear();
+			/** skinned meshes deform every frame, those are tested against the current palette */
+			if (!mesh.skin.empty() || mesh.vertices.empty()) continue;
+
+			e_int32 triangle_count = getTriangleCount(mesh);
+			if (triangle_count == 0) continue;
+
+			boxes.resize(triangle_count);
+			for (e_int32 i = 0; i < triangle_count; ++i)
+			{
+				e_uint32 idx[3];
+				getTriangleIndices(mesh, i, idx);
+				boxes[i].set(mesh.vertices[idx[0]], mesh.vertices[idx[0]]);
+				boxes[i].addPoint(mesh.vertices[idx[1]]);
+				boxes[i].addPoint(mesh.vertices[idx[2]]);
+			}
+			mesh.bvh.build(&boxes[0], triangle_count);
+		}
+	}
+
+
+	RayCastEntityHit Entity::castRay(const float3& origin, const float3& dir, const Matrix& model_transform, const Pose* pose, const float4x4* skin_matrices)
 	{
 		RayCastEntityHit hit;
 		hit.m_is_hit = false;
+		hit.m_origin = origin;
+		hit.m_dir = dir;
 		if (!isReady()) return hit;
 
 		Matrix inv = model_transform;
@@ -208,88 +282,59 @@ namespace egal
 		float3 local_origin = inv.transformPoint(origin);
 		float3 local_dir = static_cast<float3>(inv * float4(dir.x, dir.y, dir.z, 0));
 
-		Matrix matrices[256];
-		ASSERT(!pose || pose->count <= TlengthOf(matrices));
-		e_bool is_skinned = false;
-		for (e_int32 mesh_index = m_lods[0].from_mesh; mesh_index <= m_lods[0].to_mesh; ++mesh_index)
-		{
-			Mesh& mesh = m_meshes[mesh_index];
-			is_skinned = pose && !mesh.skin.empty() && pose->count <= TlengthOf(matrices);
-		}
-		if (is_skinned)
-		{
-			computeSkinMatrices(*pose, *this, matrices);
-		}
+		/** reuse the palette computed for rendering when the caller has an up to date one */
+		TArrary<float4x4> palette(m_allocator);
+		const float4x4* skin = skin_matrices;
 
+		e_float t_max = FLT_MAX;
 		for (e_int32 mesh_index = m_lods[0].from_mesh; mesh_index <= m_lods[0].to_mesh; ++mesh_index)
 		{
 			Mesh& mesh = m_meshes[mesh_index];
-			e_bool is_mesh_skinned = !mesh.skin.empty();
-			e_uint16* indices16 = (e_uint16*)&mesh.indices[0];
-			e_uint32* indices32 = (e_uint32*)&mesh.indices[0];
-			e_bool is16 = mesh.flags & (e_uint32)Mesh::Flags::INDICES_16_BIT;
-			e_int32 index_size = is16 ? 2 : 4;
-			for (e_int32 i = 0, c = mesh.indices.size() / index_size; i < c; i += 3)
+			e_int32 hit_triangle = -1;
+			if (!mesh.bvh.empty())
+			{
+				auto callback = [&](e_int32 triangle, e_float& max_t) {
+					e_float t;
+					if (castRayTriangle(mesh, triangle, local_origin, local_dir, nullptr, &t) && t < max_t)
+					{
+						max_t = t;
+						t_max = t;
+						hit_triangle = triangle;
+					}
+				};
+				mesh.bvh.castRay(local_origin, local_dir, t_max, callback);
+			}
+			else
 			{
-				float3 p0, p1, p2;
-				if (is16)
+				const float4x4* mesh_skin = nullptr;
+				if (pose && !mesh.skin.empty())
 				{
-					p0 = mesh.vertices[indices16[i]];
-					p1 = mesh.vertices[indices16[i + 1]];
-					p2 = mesh.vertices[indices16[i + 2]];
-					if (is_mesh_skinned)
+					if (!skin)
 					{
-						p0 = evaluateSkin(p0, mesh.skin[indices16[i]], matrices);
-						p1 = evaluateSkin(p1, mesh.skin[indices16[i + 1]], matrices);
-						p2 = evaluateSkin(p2, mesh.skin[indices16[i + 2]], matrices);
+						palette.resize(pose->count);
+						computeSkinMatrices(*pose, &palette[0]);
+						skin = &palette[0];
 					}
+					mesh_skin = skin;
 				}
-				else
+				for (e_int32 i = 0, c = getTriangleCount(mesh); i < c; ++i)
 				{
-					p0 = mesh.vertices[indices32[i]];
-					p1 = mesh.vertices[indices32[i + 1]];
-					p2 = mesh.vertices[indices32[i + 2]];
-					if (is_mesh_skinned)
+					e_float t;
+					if (castRayTriangle(mesh, i, local_origin, local_dir, mesh_skin, &t) && t < t_max)
 					{
-						p0 = evaluateSkin(p0, mesh.skin[indices32[i]], matrices);
-						p1 = evaluateSkin(p1, mesh.skin[indices32[i + 1]], matrices);
-						p2 = evaluateSkin(p2, mesh.skin[indices32[i + 2]], matrices);
+						t_max = t;
+						hit_triangle = i;
 					}
 				}
+			}
 
-
-				float3 normal = crossProduct(p1 - p0, p2 - p0);
-				e_float q = dotProduct(normal, local_dir);
-				if (q == 0)	continue;
-
-				e_float d = -dotProduct(normal, p0);
-				e_float t = -(dotProduct(normal, local_origin) + d) / q;
-				if (t < 0) continue;
-
-				float3 hit_point = local_origin + local_dir * t;
-
-				float3 edge0 = p1 - p0;
-				float3 VP0 = hit_point - p0;
-				if (dotProduct(normal, crossProduct(edge0, VP0)) < 0) continue;
-
-				float3 edge1 = p2 - p1;
-				float3 VP1 = hit_point - p1;
-				if (dotProduct(normal, crossProduct(edge1, VP1)) < 0) continue;
-
-				float3 edge2 = p0 - p2;
-				float3 VP2 = hit_point - p2;
-				if (dotProduct(normal, crossProduct(edge2, VP2)) < 0) continue;
-
-				if (!hit.m_is_hit || hit.m_t > t)
-				{
-					hit.m_is_hit = true;
-					hit.m_t = t;
-					hit.m_mesh = &m_meshes[mesh_index];
-				}
+			if (hit_triangle >= 0)
+			{
+				hit.m_is_hit = true;
+				hit.m_t = t_max;
+				hit.m_mesh = &mesh;
 			}
 		}
-		hit.m_origin = origin;
-		hit.m_dir = dir;
 		return hit;
 	}
 
@@ -9,6 +9,7 @@
 #include "common/resource/resource_manager.h"
 #include "common/resource/resource_define.h"
 #include "common/utils/geometry.h"
+#include "common/utils/bvh.h"
 #include "common/egal_string.h"
 
 #include "common/filesystem/binary.h"
@@ -88,6 +89,8 @@ namespace egal
 		IndexBufferHandle	index_buffer_handle = BGFX_INVALID_HANDLE;
 		String				name;
 		Material*			material;
+		/** triangle hierarchy of rigid lod 0 meshes, built at load for ray casts */
+		BVH					bvh;
 	};
 
 	struct LODMeshIndices
@@ -226,7 +229,9 @@ namespace egal
 		RayCastEntityHit castRay(const float3& origin
 							   , const float3& dir
 							   , const Matrix& model_transform
-							   , const Pose* pose);
+							   , const Pose* pose
+							   , const float4x4* skin_matrices = nullptr);
+		e_void computeSkinMatrices(const Pose& pose, float4x4* matrices) const;
 		e_void getPose(Pose& pose);
 		e_void getRelativePose(Pose& pose);
 		e_void setKeepSkin();
@@ -242,6 +247,7 @@ namespace egal
 		e_void operator=(const Entity&);
 
 		e_int32 getBoneIdx(const e_char* name);
+		e_void buildMeshBVHs();
 
 		e_void unload() override;
 		e_bool load(FS::IFile& file) override;
@@ -286,6 +292,7 @@ namespace egal
 		{}
 
 		~EntityManager() {}
+		Debug::MemoryTag getMemoryTag() const override { return Debug::MemoryTag::MESH; }
 
 	protected:
 		virtual Resource* createResource() override;
@@ -750,6 +750,7 @@ namespace egal
 			&& parseBones(file)
 			&& parseLODs(file))
 		{
+			buildMeshBVHs();
 			m_size = file.size();
 			return true;
 		}
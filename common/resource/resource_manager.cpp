@@ -34,6 +34,7 @@ namespace egal
 			if (m_empty_dep_count == 0 && m_current_state != State::READY &&
 				m_desired_state != State::EMPTY)
 			{
+				Debug::MemoryTagScope memory_tag(m_resource_manager.getMemoryTag());
 				onBeforeReady();
 				m_current_state = State::READY;
 				m_cb.invoke(old_state, m_current_state, *this);
@@ -54,6 +55,8 @@ namespace egal
 		m_async_op = FS::FileSystem::INVALID_ASYNC;
 		if (m_desired_state != State::READY) return;
 
+		Debug::MemoryTagScope memory_tag(m_resource_manager.getMemoryTag());
+
 		ASSERT(m_current_state != State::READY);
 		ASSERT(m_empty_dep_count == 1);
 
@@ -2,6 +2,7 @@
 #define _resource_manager_h_
 
 #include "common/type.h"
+#include "common/debug/debug.h"
 #include "common/filesystem/ifile_device.h"
 
 #include "common/resource/resource_public.h"
@@ -132,6 +133,10 @@ namespace egal
 		virtual ~ResourceManagerBase();
 		ResourceManager& getOwner() const { return *m_owner; }
 
+		/** budget heap allocations made while loading resources of this manager are charged to */
+		virtual Debug::MemoryTag getMemoryTag() const { return Debug::MemoryTag::GENERAL; }
+		e_bool isOverMemoryBudget() const { return Debug::isOverMemoryBudget(getMemoryTag()); }
+
 	protected:
 		virtual Resource* createResource() = 0;
 		virtual Resource* createResource(const ArchivePath& path) = 0;
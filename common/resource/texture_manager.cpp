@@ -601,11 +601,15 @@ namespace egal
 		}
 
 		m_size = file.size();
+		/** the pixels live on the gpu, the file size is a close estimate of what they take there */
+		Debug::trackMemory(Debug::MemoryTag::TEXTURE, (e_int64)m_size);
 		return true;
 	}
 
 	e_void Texture::unload()
 	{
+		Debug::trackMemory(Debug::MemoryTag::TEXTURE, -(e_int64)m_size);
+		m_size = 0;
 		if (bgfx::isValid(handle))
 		{
 			bgfx::destroy(handle);
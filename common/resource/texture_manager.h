@@ -91,6 +91,7 @@ namespace egal
 		~TextureManager();
 
 		e_uint8* getBuffer(e_int32 size);
+		Debug::MemoryTag getMemoryTag() const override { return Debug::MemoryTag::TEXTURE; }
 
 	protected:
 		virtual Resource* createResource() override;
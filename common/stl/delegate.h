@@ -214,6 +214,9 @@ namespace egal
 			for (auto& i : m_delegates) i.invoke(args...);
 		}
 
+		int size() const { return m_delegates.size(); }
+		const TDelegate<R(Args...)>& operator[](int index) const { return m_delegates[index]; }
+
 	private:
 		TArrary<TDelegate<R(Args...)>> m_delegates;
 	};
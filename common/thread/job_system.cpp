@@ -25,6 +25,7 @@ namespace egal
 			Job					current_job;
 			struct WorkerTask*	worker_task;
 			e_void*				switch_state;
+			Profiler::FiberSwitchData profiler_data;
 		};
 
 		struct SleepingFiber
@@ -159,11 +160,10 @@ namespace egal
 					{
 						ready_sleeping_fiber.fiber->worker_task = that;
 						ready_sleeping_fiber.fiber->switch_state = nullptr;
-						//PROFILE_BLOCK("work");
 						that->m_current_fiber = ready_sleeping_fiber.fiber;
 						Fiber::switchTo(&that->m_primary_fiber, ready_sleeping_fiber.fiber->fiber);
 						that->m_current_fiber = nullptr;
-						ASSERT(Profiler::getCurrentBlock() == Profiler::getRootBlock(MT::getCurrentThreadID()));
+						ASSERT(Profiler::getBlockDepth() == 0);
 						handleSwitch(*ready_sleeping_fiber.fiber);
 						continue;
 					}
@@ -175,16 +175,15 @@ namespace egal
 						fiber_decl.worker_task = that;
 						fiber_decl.current_job = job;
 						fiber_decl.switch_state = nullptr;
-						//PROFILE_BLOCK("work");
 						that->m_current_fiber = &fiber_decl;
 						Fiber::switchTo(&that->m_primary_fiber, fiber_decl.fiber);
 						that->m_current_fiber = nullptr;
-						ASSERT(Profiler::getCurrentBlock() == Profiler::getRootBlock(MT::getCurrentThreadID()));
+						ASSERT(Profiler::getBlockDepth() == 0);
 						handleSwitch(fiber_decl);
 					}
 					else
 					{
-						//PROFILE_BLOCK("wait");
+						PROFILE_BLOCK("wait");
 						g_system->m_work_signal.waitTimeout(1);
 					}
 				}
@@ -206,7 +205,10 @@ namespace egal
 			for (;;)
 			{
 				Job job = fiber_decl->current_job;
-				job.decl.task(job.decl.data);
+				{
+					PROFILE_BLOCK("job");
+					job.decl.task(job.decl.data);
+				}
 				if (job.counter) 
 					MT::atomicDecrement(job.counter);
 
@@ -306,14 +308,16 @@ namespace egal
 			if (*counter <= 0) return;
 			if (g_worker)
 			{
-				//ASSERT(Profiler::getCurrentBlock() == Profiler::getRootBlock(MT::getCurrentThreadID()));
+				/** the fiber may resume on another worker, its open blocks move along with it */
 				FiberDecl* fiber_decl = ((WorkerTask*)g_worker)->m_current_fiber;
 				fiber_decl->switch_state = (e_void*)counter;
+				Profiler::beforeFiberSwitch(&fiber_decl->profiler_data);
 				Fiber::switchTo(&fiber_decl->fiber, fiber_decl->worker_task->m_primary_fiber);
+				Profiler::afterFiberSwitch(fiber_decl->profiler_data);
 			}
 			else
 			{
-				//PROFILE_BLOCK("not a job waiting");
+				PROFILE_BLOCK("not a job waiting");
 
 				//ASSERT(g_system->m_event_outside_job.poll());
 				g_system->m_event_outside_job.reset();
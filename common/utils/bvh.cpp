@@ -0,0 +1,113 @@
+#include "common/utils/bvh.h"
+
+#include <algorithm>
+
+namespace egal
+{
+	BVH::BVH(IAllocator& allocator)
+		: m_allocator(allocator)
+		, m_nodes(allocator)
+		, m_items(allocator)
+	{
+	}
+
+
+	e_void BVH::clear()
+	{
+		m_nodes.clear();
+		m_items.clear();
+	}
+
+
+	e_void BVH::build(const AABB* boxes, e_int32 count)
+	{
+		clear();
+		if (count <= 0) return;
+
+		TArrary<float3> centers(m_allocator);
+		centers.resize(count);
+		m_items.resize(count);
+		for (e_int32 i = 0; i < count; ++i)
+		{
+			centers[i] = (boxes[i]._min + boxes[i]._max) * 0.5f;
+			m_items[i] = i;
+		}
+
+		m_nodes.reserve(2 * ((count + MAX_LEAF_SIZE - 1) / MAX_LEAF_SIZE));
+		buildNode(boxes, &centers[0], 0, count);
+	}
+
+
+	e_int32 BVH::buildNode(const AABB* boxes, const float3* centers, e_int32 from, e_int32 to)
+	{
+		e_int32 node_idx = m_nodes.size();
+		{
+			Node& node = m_nodes.emplace();
+			node.min = boxes[m_items[from]]._min;
+			node.max = boxes[m_items[from]]._max;
+		}
+
+		float3 center_min = centers[m_items[from]];
+		float3 center_max = center_min;
+		float3 min = m_nodes[node_idx].min;
+		float3 max = m_nodes[node_idx].max;
+		for (e_int32 i = from + 1; i < to; ++i)
+		{
+			const AABB& box = boxes[m_items[i]];
+			min = AABB::minCoords(min, box._min);
+			max = AABB::maxCoords(max, box._max);
+			center_min = AABB::minCoords(center_min, centers[m_items[i]]);
+			center_max = AABB::maxCoords(center_max, centers[m_items[i]]);
+		}
+		m_nodes[node_idx].min = min;
+		m_nodes[node_idx].max = max;
+
+		if (to - from <= MAX_LEAF_SIZE)
+		{
+			m_nodes[node_idx].first = from;
+			m_nodes[node_idx].count = to - from;
+			return node_idx;
+		}
+
+		/** object median along the longest axis of the centers, keeps the depth logarithmic */
+		float3 extent = center_max - center_min;
+		e_int32 axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		e_int32 mid = (from + to) / 2;
+		e_int32* items = &m_items[0];
+		std::nth_element(items + from, items + mid, items + to, [centers, axis](e_int32 a, e_int32 b) {
+			return (&centers[a].x)[axis] < (&centers[b].x)[axis];
+		});
+
+		m_nodes[node_idx].count = 0;
+		buildNode(boxes, centers, from, mid);
+		e_int32 right = buildNode(boxes, centers, mid, to);
+		m_nodes[node_idx].first = right;
+		return node_idx;
+	}
+
+
+	e_void BVH::refit(const AABB* boxes)
+	{
+		for (e_int32 i = m_nodes.size() - 1; i >= 0; --i)
+		{
+			Node& node = m_nodes[i];
+			if (node.count > 0)
+			{
+				node.min = boxes[m_items[node.first]]._min;
+				node.max = boxes[m_items[node.first]]._max;
+				for (e_int32 j = node.first + 1, c = node.first + node.count; j < c; ++j)
+				{
+					node.min = AABB::minCoords(node.min, boxes[m_items[j]]._min);
+					node.max = AABB::maxCoords(node.max, boxes[m_items[j]]._max);
+				}
+			}
+			else
+			{
+				const Node& left = m_nodes[i + 1];
+				const Node& right = m_nodes[node.first];
+				node.min = AABB::minCoords(left.min, right.min);
+				node.max = AABB::maxCoords(left.max, right.max);
+			}
+		}
+	}
+}
@@ -0,0 +1,218 @@
+#ifndef _bvh_h_
+#define _bvh_h_
+#pragma once
+
+#include "common/type.h"
+#include "common/allocator/egal_allocator.h"
+#include "common/stl/tarrary.h"
+#include "common/utils/geometry.h"
+
+namespace egal
+{
+	/**
+	 * Bounding volume hierarchy over boxes, stored flat in depth first order so a parent always precedes its
+	 * children. The left child directly follows its parent, the right child index is stored in the node.
+	 * Items are referenced by the index of their box in the array passed to build().
+	 */
+	class BVH
+	{
+	public:
+		enum { MAX_LEAF_SIZE = 4, MAX_DEPTH = 64 };
+
+		struct Node
+		{
+			float3	min;
+			e_int32	first;	/** right child for inner nodes, first entry in m_items for leaves */
+			float3	max;
+			e_int32	count;	/** 0 for inner nodes */
+		};
+
+	public:
+		explicit BVH(IAllocator& allocator);
+
+		e_void build(const AABB* boxes, e_int32 count);
+		/** recomputes node bounds after boxes moved, the tree topology is kept */
+		e_void refit(const AABB* boxes);
+		e_void clear();
+
+		e_bool empty() const { return m_nodes.empty(); }
+		const TArrary<Node>& getNodes() const { return m_nodes; }
+		const TArrary<e_int32>& getItems() const { return m_items; }
+
+		/**
+		 * Visits items whose box is hit by origin + dir * t, 0 <= t <= t_max, roughly front to back.
+		 * callback(e_int32 item, e_float& t_max) may shrink t_max to cut off the rest of the traversal.
+		 */
+		template <typename Callback>
+		e_void castRay(const float3& origin, const float3& dir, e_float t_max, Callback& callback) const;
+
+		/**
+		 * Traverses up to four rays at once, node boxes are tested against the whole packet with simd.
+		 * callback(e_int32 item, e_int32 ray_mask, e_float* t_max) is called with the rays that reached the leaf,
+		 * t_max holds four floats and may be shrunk per ray. Unused lanes must have t_max < 0.
+		 */
+		template <typename Callback>
+		e_void castRayPacket(const float3* origins, const float3* dirs, e_float* t_max, Callback& callback) const;
+
+	private:
+		e_int32 buildNode(const AABB* boxes, const float3* centers, e_int32 from, e_int32 to);
+
+		static float3 getInvDir(const float3& dir);
+		static e_bool intersect(const Node& node, const float3& origin, const float3& inv_dir, e_float t_max, e_float* t_near);
+
+	private:
+		IAllocator&			m_allocator;
+		TArrary<Node>		m_nodes;
+		TArrary<e_int32>	m_items;
+	};
+
+
+	INLINE float3 BVH::getInvDir(const float3& dir)
+	{
+		/** keeps the slab test free of 0 * inf */
+		static const e_float EPS = 1e-20f;
+		return float3(1 / (Math::abs(dir.x) > EPS ? dir.x : EPS),
+			1 / (Math::abs(dir.y) > EPS ? dir.y : EPS),
+			1 / (Math::abs(dir.z) > EPS ? dir.z : EPS));
+	}
+
+
+	INLINE e_bool BVH::intersect(const Node& node, const float3& origin, const float3& inv_dir, e_float t_max, e_float* t_near)
+	{
+		e_float tx0 = (node.min.x - origin.x) * inv_dir.x;
+		e_float tx1 = (node.max.x - origin.x) * inv_dir.x;
+		e_float ty0 = (node.min.y - origin.y) * inv_dir.y;
+		e_float ty1 = (node.max.y - origin.y) * inv_dir.y;
+		e_float tz0 = (node.min.z - origin.z) * inv_dir.z;
+		e_float tz1 = (node.max.z - origin.z) * inv_dir.z;
+
+		e_float t_min = Math::maximum(Math::minimum(tx0, tx1), Math::minimum(ty0, ty1), Math::minimum(tz0, tz1), 0.0f);
+		e_float t_exit = Math::minimum(Math::maximum(tx0, tx1), Math::maximum(ty0, ty1), Math::maximum(tz0, tz1), t_max);
+		*t_near = t_min;
+		return t_min <= t_exit;
+	}
+
+
+	template <typename Callback>
+	e_void BVH::castRay(const float3& origin, const float3& dir, e_float t_max, Callback& callback) const
+	{
+		if (m_nodes.empty()) return;
+
+		float3 inv_dir = getInvDir(dir);
+		e_float t_near;
+		if (!intersect(m_nodes[0], origin, inv_dir, t_max, &t_near)) return;
+
+		struct Entry
+		{
+			e_int32 node;
+			e_float t;
+		};
+		Entry stack[MAX_DEPTH * 2];
+		e_int32 stack_size = 0;
+		stack[stack_size++] = { 0, t_near };
+
+		while (stack_size > 0)
+		{
+			const Entry entry = stack[--stack_size];
+			if (entry.t > t_max) continue;
+
+			const Node& node = m_nodes[entry.node];
+			if (node.count > 0)
+			{
+				for (e_int32 i = node.first, c = node.first + node.count; i < c; ++i)
+				{
+					callback(m_items[i], t_max);
+				}
+				continue;
+			}
+
+			e_int32 left = entry.node + 1;
+			e_int32 right = node.first;
+			e_float t_left, t_right;
+			e_bool hit_left = intersect(m_nodes[left], origin, inv_dir, t_max, &t_left);
+			e_bool hit_right = intersect(m_nodes[right], origin, inv_dir, t_max, &t_right);
+
+			/** the nearer child is pushed last so it is visited first */
+			if (hit_left && hit_right)
+			{
+				if (t_left < t_right)
+				{
+					stack[stack_size++] = { right, t_right };
+					stack[stack_size++] = { left, t_left };
+				}
+				else
+				{
+					stack[stack_size++] = { left, t_left };
+					stack[stack_size++] = { right, t_right };
+				}
+			}
+			else if (hit_left)
+			{
+				stack[stack_size++] = { left, t_left };
+			}
+			else if (hit_right)
+			{
+				stack[stack_size++] = { right, t_right };
+			}
+		}
+	}
+
+
+	template <typename Callback>
+	e_void BVH::castRayPacket(const float3* origins, const float3* dirs, e_float* t_max, Callback& callback) const
+	{
+		if (m_nodes.empty()) return;
+
+		e_float ox[4], oy[4], oz[4], ix[4], iy[4], iz[4];
+		for (e_int32 i = 0; i < 4; ++i)
+		{
+			float3 inv_dir = getInvDir(dirs[i]);
+			ox[i] = origins[i].x; oy[i] = origins[i].y; oz[i] = origins[i].z;
+			ix[i] = inv_dir.x; iy[i] = inv_dir.y; iz[i] = inv_dir.z;
+		}
+		simd4 pox = f4LoadUnaligned(ox);
+		simd4 poy = f4LoadUnaligned(oy);
+		simd4 poz = f4LoadUnaligned(oz);
+		simd4 pix = f4LoadUnaligned(ix);
+		simd4 piy = f4LoadUnaligned(iy);
+		simd4 piz = f4LoadUnaligned(iz);
+		simd4 zero = f4Splat(0);
+
+		e_int32 stack[MAX_DEPTH * 2];
+		e_int32 stack_size = 0;
+		stack[stack_size++] = 0;
+
+		while (stack_size > 0)
+		{
+			const Node& node = m_nodes[stack[--stack_size]];
+
+			simd4 tx0 = f4Mul(f4Sub(f4Splat(node.min.x), pox), pix);
+			simd4 tx1 = f4Mul(f4Sub(f4Splat(node.max.x), pox), pix);
+			simd4 ty0 = f4Mul(f4Sub(f4Splat(node.min.y), poy), piy);
+			simd4 ty1 = f4Mul(f4Sub(f4Splat(node.max.y), poy), piy);
+			simd4 tz0 = f4Mul(f4Sub(f4Splat(node.min.z), poz), piz);
+			simd4 tz1 = f4Mul(f4Sub(f4Splat(node.max.z), poz), piz);
+
+			simd4 t_enter = f4Max(f4Max(f4Min(tx0, tx1), f4Min(ty0, ty1)), f4Max(f4Min(tz0, tz1), zero));
+			simd4 t_exit = f4Min(f4Min(f4Max(tx0, tx1), f4Max(ty0, ty1)), f4Min(f4Max(tz0, tz1), f4LoadUnaligned(t_max)));
+
+			/** sign bit set where the ray misses the box */
+			e_int32 ray_mask = ~f4MoveMask(f4Sub(t_exit, t_enter)) & 0xf;
+			if (ray_mask == 0) continue;
+
+			if (node.count > 0)
+			{
+				for (e_int32 i = node.first, c = node.first + node.count; i < c; ++i)
+				{
+					callback(m_items[i], ray_mask, t_max);
+				}
+				continue;
+			}
+
+			stack[stack_size++] = node.first;
+			stack[stack_size++] = (e_int32)(&node - &m_nodes[0]) + 1;
+		}
+	}
+}
+
+#endif
@@ -5,26 +5,90 @@
 #include <stdarg.h>
 
 #include "common/filesystem/ifile_device.h"
+#include "common/thread/task.h"
+#include "common/thread/atomic.h"
+#include "common/thread/lock_free_fixed_queue.h"
+#include "common/utils/perf_timer.h"
 
 #include "common/egal_string.h"
 
 namespace egal
 {
+	struct LogMessage
+	{
+		e_int32 level;
+		e_char text[MAX_LOG_LENGTH];
+	};
+
+	/**
+	 * Messages are handed to a writer thread through a lock free queue, the thread batches them into one write
+	 * and flushes either on error severity or every LOG_FLUSH_INTERVAL seconds, so no logging thread waits on disk.
+	 */
 	class Logger
 	{
+	public:
+		enum
+		{
+			QUEUE_SIZE = 512,
+			BATCH_SIZE = 64 * 1024
+		};
+
+		class WriterTask : public MT::Task
+		{
+		public:
+			explicit WriterTask(Logger& logger)
+				: MT::Task(*g_allocator)
+				, m_logger(logger)
+				, m_finished(false)
+			{
+			}
+
+			e_int32 task() override
+			{
+				while (!m_finished)
+				{
+					m_logger.m_signal.waitTimeout(e_uint32(LOG_FLUSH_INTERVAL * 1000));
+					m_logger.drain();
+				}
+				m_logger.drain();
+				return 0;
+			}
+
+			Logger& m_logger;
+			volatile e_bool m_finished;
+		};
+
 	public:
 		Logger()
 			: m_callbacks(*g_allocator)
+			, m_signal(false)
+			, m_writer(*this)
+			, m_writer_running(false)
+			, m_batch_size(0)
+			, m_dirty(false)
+			, m_dropped(0)
+			, m_mutex(false)
 		{
 			mLogFile = nullptr;
+			m_flush_timer = Timer::create(*g_allocator);
+			m_writer_running = m_writer.create("Logger");
 		}
 
 		~Logger()
 		{
+			if (m_writer_running)
+			{
+				m_writer.m_finished = true;
+				m_signal.trigger();
+				m_writer.destroy();
+			}
+			drain();
+
 			if (mLogFile)
 			{
 				mLogFile->close();
 			}
+			Timer::destroy(m_flush_timer);
 		}
 
 	public:
@@ -39,29 +103,131 @@ namespace egal
 			m_callbacks.invoke(n, pcszLog);
 		}
 
-		e_void write(const e_char * pcszLog)
+		e_void write(e_int32 n, const e_char * pcszLog)
 		{
+			/** only errors may wait for a free slot, lower levels are dropped while the writer catches up */
+			LogMessage* msg = m_queue.alloc(n >= 3);
+			if (!msg)
+			{
+				MT::atomicIncrement(&m_dropped);
+				return;
+			}
+
+			msg->level = n;
+			StringUnitl::copyString(msg->text, pcszLog);
+			m_queue.push_back(msg, true);
+			if (n >= 3 || !m_writer_running) m_signal.trigger();
+			if (!m_writer_running) drain();
+		}
+
+		Callback& getCallback() { return m_callbacks; }
+
+	private:
+		e_void drain()
+		{
+			MT::SpinLock lock(m_mutex);
 			init();
 
-#if PLATFORM_WINDOWS
-			if (mLogFile)
-			{
-				mLogFile->write(pcszLog, StringUnitl::stringLength(pcszLog));
-				mLogFile->flush();
+			e_bool flush = false;
+			e_int32 dropped = m_dropped;
+			if (dropped > 0)
+			{
+				MT::atomicSubtract(&m_dropped, dropped);
+				e_char tmp[64];
+				snprintf(tmp, sizeof(tmp), "[waring]: %d log messages dropped\r\n", dropped);
+				append(tmp);
 			}
-#elif PLATFORM_ANDROID
 
-#elif PLATFORM_APPLE
+			while (LogMessage* msg = m_queue.pop(false))
+			{
+				append(msg->text);
+				flush |= msg->level >= 3;
+				m_queue.dealoc(msg);
+			}
+			writeBatch();
 
-#endif
+			if (m_dirty && (flush || m_flush_timer->getTimeSinceTick() >= LOG_FLUSH_INTERVAL))
+			{
+				if (mLogFile) mLogFile->flush();
+				m_flush_timer->tick();
+				m_dirty = false;
+			}
 		}
 
-		Callback& getCallback() { return m_callbacks; }
+		e_void append(const e_char* text)
+		{
+			e_int32 len = StringUnitl::stringLength(text);
+			if (m_batch_size + len > BATCH_SIZE) writeBatch();
+			StringUnitl::copyMemory(m_batch + m_batch_size, text, len);
+			m_batch_size += len;
+		}
+
+		e_void writeBatch()
+		{
+			if (m_batch_size == 0) return;
+			if (mLogFile)
+			{
+				mLogFile->write(m_batch, m_batch_size);
+				m_dirty = true;
+			}
+			m_batch_size = 0;
+		}
 
 	private:
 		FS::IFile*  mLogFile;
 		Callback m_callbacks;
+		MT::LockFreeFixedQueue<LogMessage, QUEUE_SIZE> m_queue;
+		MT::Event m_signal;
+		WriterTask m_writer;
+		e_bool m_writer_running;
+		Timer* m_flush_timer;
+		e_char m_batch[BATCH_SIZE];
+		e_int32 m_batch_size;
+		e_bool m_dirty;
+		volatile e_int32 m_dropped;
+		MT::SpinMutex m_mutex;
 	};
+
+	/** per call site counters for LOG_RATE_LIMIT, races between threads only let a few extra messages through */
+	struct LogRateSlot
+	{
+		const e_char* filename;
+		e_int32 fileline;
+		time_t window;
+		volatile e_int32 count;
+		volatile e_int32 suppressed;
+	};
+
+	static LogRateSlot g_rate_slots[256];
+
+	static e_bool checkRateLimit(const e_char* filename, e_int32 fileline, time_t now, e_int32* suppressed)
+	{
+		*suppressed = 0;
+		e_uint32 hash = e_uint32(((uintptr_t)filename >> 4) * 31 + fileline);
+		LogRateSlot& slot = g_rate_slots[hash & (TlengthOf(g_rate_slots) - 1)];
+		if (slot.filename != filename || slot.fileline != fileline)
+		{
+			slot.filename = filename;
+			slot.fileline = fileline;
+			slot.window = now;
+			slot.count = 0;
+			slot.suppressed = 0;
+		}
+		else if (slot.window != now)
+		{
+			*suppressed = slot.suppressed;
+			slot.window = now;
+			slot.count = 0;
+			slot.suppressed = 0;
+		}
+
+		if (MT::atomicIncrement(&slot.count) > LOG_RATE_LIMIT)
+		{
+			MT::atomicIncrement(&slot.suppressed);
+			return false;
+		}
+		return true;
+	}
 
 	Logger* logger = nullptr;
 	
@@ -95,6 +261,11 @@ namespace egal
 
 	egal::e_void _log(e_int32 n, const e_char* filename, const e_char * functionName, const e_int32 fileline, const e_char *fmt, ...)
 	{
+		time_t time_seconds = time(0);
+		e_int32 suppressed;
+		if (!checkRateLimit(filename, fileline, time_seconds, &suppressed))
+			return;
+
 		char szParam[MAX_LOG_LENGTH];
 		va_list pArgList;
 		va_start(pArgList, fmt);
@@ -108,12 +279,20 @@ namespace egal
 			int tv_usec;
 		};
 
-		time_t time_seconds = time(0);
 		struct tm now_time;
 #if PLATFORM_WINDOWS
 		localtime_s(&now_time, &time_seconds);
+#else
+		localtime_r(&time_seconds, &now_time);
 #endif
 
+		if (suppressed > 0)
+		{
+			char szTmp[MAX_LOG_LENGTH];
+			snprintf(szTmp, MAX_LOG_LENGTH, "(%d repeated messages suppressed) %s", suppressed, szParam);
+			StringUnitl::copyString(szParam, szTmp);
+		}
+
 		switch (n)
 		{
 		case 1:
@@ -140,7 +319,7 @@ namespace egal
 		if (logger)
 		{
 			logger->inovke(n - 1, szBuf);
-			logger->write(szBuf);
+			logger->write(n, szBuf);
 		}
 
 		//printf("%s\n", szLog);
@@ -28,9 +28,9 @@ namespace egal
 						 const e_char* functionName,
 						 const e_char* op);
 
-	#define _log_info(fl, ln, fun, ...)   do{ _log(1, fl, ln, fun, __VA_ARGS__); } while(0)
-	#define _log_waring(fl, ln, fun, ...) do{ _log(2, fl, ln, fun, __VA_ARGS__); } while(0)
-	#define _log_error(fl, ln, fun, ...)  do{ _log(3, fl, ln, fun, __VA_ARGS__); } while(0)
+	#define _log_info(fl, ln, fun, ...)   do{ if (1 >= LOG_MIN_LEVEL) _log(1, fl, ln, fun, __VA_ARGS__); } while(0)
+	#define _log_waring(fl, ln, fun, ...) do{ if (2 >= LOG_MIN_LEVEL) _log(2, fl, ln, fun, __VA_ARGS__); } while(0)
+	#define _log_error(fl, ln, fun, ...)  do{ if (3 >= LOG_MIN_LEVEL) _log(3, fl, ln, fun, __VA_ARGS__); } while(0)
 
 	#define log_info(...)   _log_info(__FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
 	#define log_waring(...) _log_waring(__FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
@@ -355,6 +355,17 @@ namespace egal
 				ImGui::DragFloat(StaticString<10>("LOD ", i), &m_fbx_importer_option.lods_distances[i], 1.0f, 1.0f, FLT_MAX);
 			}
 		}
+
+		ImGui::SliderInt("Generated LODs", &m_fbx_importer_option.auto_lod_count, 0, TlengthOf(m_fbx_importer_option.auto_lod_ratios));
+		for (int i = 0; i < m_fbx_importer_option.auto_lod_count; ++i)
+		{
+			ImGui::DragFloat(StaticString<30>("Triangle ratio ", i + 1), &m_fbx_importer_option.auto_lod_ratios[i], 0.01f, 0.01f, 1.0f);
+			ImGui::DragFloat(StaticString<30>("Screen size ", i + 1), &m_fbx_importer_option.auto_lod_screen_sizes[i], 0.01f, 0.01f, 1.0f);
+		}
+		if (m_fbx_importer_option.auto_lod_count > 0)
+		{
+			ImGui::DragFloat("Max simplification error", &m_fbx_importer_option.auto_lod_max_error, 0.001f, 0.0f, 1.0f);
+		}
 	}
 
 	void ImportAssetDialog::onAnimationsGUI()
@@ -2,10 +2,13 @@
 #include "common/egal-d.h"
 #include "common/filesystem/binary.h"
 
+#include "common/thread/job_system.h"
 #include "common/thread/task.h"
+#include "common/utils/crc32.h"
 
 #include "editor/tools/base/platform_interface.h"
 #include "editor/tools/import_assert/import_asset_dialog.h"
+#include "editor/tools/import_assert/ofbx/mesh_simplifier.h"
 #include "ofbx.h"
 
 namespace egal
@@ -236,10 +239,6 @@ namespace egal
 		, bones(*g_allocator)
 	{
 		open = false;
-		lods_distances[0] = -10;
-		lods_distances[1] = -100;
-		lods_distances[2] = -1000;
-		lods_distances[3] = -10000;
 		mesh_scale = 1.0f;
 		time_scale = 1.0f;
 		position_error = 0.1f;
@@ -310,18 +309,37 @@ namespace egal
 		}
 	}
 
-	int ResourceSerializer::findSubblobIndex(const WriteBinary& haystack, const WriteBinary& needle, const TArrary<int>& subblobs, int first_subblob)
+	ResourceSerializer::VertexHashTable::VertexHashTable(IAllocator& allocator, int vertex_count, int vertex_size)
+		: m_slots(allocator)
+		, m_vertex_size(vertex_size)
+	{
+		m_slots.resize((int)Math::nextPow2((e_uint32)Math::maximum(vertex_count * 2, 16)));
+		for (Slot& slot : m_slots)
+		{
+			slot.hash = 0;
+			slot.index = -1;
+		}
+	}
+
+	int ResourceSerializer::VertexHashTable::findOrInsert(const WriteBinary& haystack, const void* needle, int new_index)
 	{
 		const e_uint8* data = (const e_uint8*)haystack.getData();
-		const e_uint8* needle_data = (const e_uint8*)needle.getData();
-		int step_size = needle.getPos();
-		int idx = first_subblob;
-		while (idx != -1)
+		e_uint32 hash = crc32(needle, m_vertex_size);
+		e_uint32 mask = (e_uint32)m_slots.size() - 1;
+		for (e_uint32 i = hash & mask;; i = (i + 1) & mask)
 		{
-			if (StringUnitl::compareMemory(data + idx * step_size, needle_data, step_size) == 0) return idx;
-			idx = subblobs[idx];
+			Slot& slot = m_slots[i];
+			if (slot.index == -1)
+			{
+				slot.hash = hash;
+				slot.index = new_index;
+				return -1;
+			}
+			if (slot.hash == hash && StringUnitl::compareMemory(data + slot.index * m_vertex_size, needle, m_vertex_size) == 0)
+			{
+				return slot.index;
+			}
 		}
-		return -1;
 	}
 
 	void ResourceSerializer::writeUV(const ofbx::Vec2& uv, WriteBinary* blob)
@@ -712,101 +730,231 @@ namespace egal
 		blob->write(packed);
 	}
 
-	void ResourceSerializer::postprocessMeshes()
+	void ResourceSerializer::postprocessMesh(ImportMesh& import_mesh) const
 	{
-		for (int mesh_idx = 0; mesh_idx < meshes.size(); ++mesh_idx)
-		{
-			ImportMesh& import_mesh = meshes[mesh_idx];
-			dialog.setImportMessage("Processing meshes...", (mesh_idx / (float)meshes.size()) * 0.4f);
-			import_mesh.vertex_data.clear();
-			import_mesh.indices.clear();
+		import_mesh.vertex_data.clear();
+		import_mesh.indices.clear();
+
+		const ofbx::Mesh& mesh = *import_mesh.fbx;
+		const ofbx::Geometry* geom = import_mesh.fbx->getGeometry();
+		int vertex_count = geom->getVertexCount();
+		const ofbx::Vec3* vertices = geom->getVertices();
+		const ofbx::Vec3* normals = geom->getNormals();
+		const ofbx::Vec3* tangents = geom->getTangents();
+		const ofbx::Vec4* colors = import_vertex_colors ? geom->getColors() : nullptr;
+		const ofbx::Vec2* uvs = geom->getUVs();
+
+		Matrix transform_matrix = Matrix::IDENTITY;
+		Matrix geometry_matrix = toLumix(mesh.getGeometricMatrix());
+		transform_matrix = toLumix(mesh.getGlobalTransform()) * geometry_matrix;
+		if (center_mesh) transform_matrix.setTranslation({ 0, 0, 0 });
 
-			const ofbx::Mesh& mesh = *import_mesh.fbx;
-			const ofbx::Geometry* geom = import_mesh.fbx->getGeometry();
-			int vertex_count = geom->getVertexCount();
-			const ofbx::Vec3* vertices = geom->getVertices();
-			const ofbx::Vec3* normals = geom->getNormals();
-			const ofbx::Vec3* tangents = geom->getTangents();
-			const ofbx::Vec4* colors = import_vertex_colors ? geom->getColors() : nullptr;
-			const ofbx::Vec2* uvs = geom->getUVs();
-
-			Matrix transform_matrix = Matrix::IDENTITY;
-			Matrix geometry_matrix = toLumix(mesh.getGeometricMatrix());
-			transform_matrix = toLumix(mesh.getGlobalTransform()) * geometry_matrix;
-			if (center_mesh) transform_matrix.setTranslation({ 0, 0, 0 });
+		IAllocator& allocator = *g_allocator;
+		WriteBinary blob(allocator);
+		int vertex_size = getVertexSize(mesh);
+		import_mesh.vertex_data.reserve(vertex_count * vertex_size);
 
-			IAllocator& allocator = *g_allocator;
-			WriteBinary blob(allocator);
-			int vertex_size = getVertexSize(mesh);
-			import_mesh.vertex_data.reserve(vertex_count * vertex_size);
+		TArrary<Skin> skinning(allocator);
+		bool is_skinned = isSkinned(mesh);
+		if (is_skinned) fillSkinInfo(skinning, &mesh);
 
-			TArrary<Skin> skinning(allocator);
-			bool is_skinned = isSkinned(mesh);
-			if (is_skinned) fillSkinInfo(skinning, &mesh);
+		AABB aabb = { {0, 0, 0}, {0, 0, 0} };
+		float radius_squared = 0;
 
-			AABB aabb = { {0, 0, 0}, {0, 0, 0} };
-			float radius_squared = 0;
+		int material_idx = getMaterialIndex(mesh, *import_mesh.fbx_mat);
+		assert(material_idx >= 0);
 
-			int material_idx = getMaterialIndex(mesh, *import_mesh.fbx_mat);
-			assert(material_idx >= 0);
+		VertexHashTable vertex_table(allocator, vertex_count, vertex_size);
 
-			int first_subblob[256];
-			for (int& subblob : first_subblob) subblob = -1;
-			TArrary<int> subblobs(allocator);
-			subblobs.reserve(vertex_count);
+		const int* materials = geom->getMaterials();
+		for (int i = 0; i < vertex_count; ++i)
+		{
+			if (materials && materials[i / 3] != material_idx) continue;
 
-			const int* materials = geom->getMaterials();
-			for (int i = 0; i < vertex_count; ++i)
-			{
-				if (materials && materials[i / 3] != material_idx) continue;
+			blob.clear();
+			ofbx::Vec3 cp = vertices[i];
 
-				blob.clear();
-				ofbx::Vec3 cp = vertices[i];
+			// premultiply control points here, so we can have constantly-scaled meshes without scale in bones
+			float3 pos = transform_matrix.transformPoint(toLumixfloat3(cp)) * mesh_scale;
+			pos = fixOrientation(pos);
+			blob.write(pos);
 
-				// premultiply control points here, so we can have constantly-scaled meshes without scale in bones
-				float3 pos = transform_matrix.transformPoint(toLumixfloat3(cp)) * mesh_scale;
-				pos = fixOrientation(pos);
-				blob.write(pos);
+			float sq_len = pos.squaredLength();
+			radius_squared = Math::maximum(radius_squared, sq_len);
 
-				float sq_len = pos.squaredLength();
-				radius_squared = Math::maximum(radius_squared, sq_len);
+			aabb._min.x = Math::minimum(aabb._min.x, pos.x);
+			aabb._min.y = Math::minimum(aabb._min.y, pos.y);
+			aabb._min.z = Math::minimum(aabb._min.z, pos.z);
+			aabb._max.x = Math::maximum(aabb._max.x, pos.x);
+			aabb._max.y = Math::maximum(aabb._max.y, pos.y);
+			aabb._max.z = Math::maximum(aabb._max.z, pos.z);
 
-				aabb._min.x = Math::minimum(aabb._min.x, pos.x);
-				aabb._min.y = Math::minimum(aabb._min.y, pos.y);
-				aabb._min.z = Math::minimum(aabb._min.z, pos.z);
-				aabb._max.x = Math::maximum(aabb._max.x, pos.x);
-				aabb._max.y = Math::maximum(aabb._max.y, pos.y);
-				aabb._max.z = Math::maximum(aabb._max.z, pos.z);
+			if (normals) writePackedfloat3(normals[i], transform_matrix, &blob);
+			if (uvs) writeUV(uvs[i], &blob);
+			if (colors) writeColor(colors[i], &blob);
+			if (tangents) writePackedfloat3(tangents[i], transform_matrix, &blob);
+			if (is_skinned) writeSkin(skinning[i], &blob);
 
-				if (normals) writePackedfloat3(normals[i], transform_matrix, &blob);
-				if (uvs) writeUV(uvs[i], &blob);
-				if (colors) writeColor(colors[i], &blob);
-				if (tangents) writePackedfloat3(tangents[i], transform_matrix, &blob);
-				if (is_skinned) writeSkin(skinning[i], &blob);
+			int new_idx = import_mesh.vertex_data.getPos() / vertex_size;
+			int idx = vertex_table.findOrInsert(import_mesh.vertex_data, blob.getData(), new_idx);
+			if (idx == -1)
+			{
+				import_mesh.indices.push_back(new_idx);
+				import_mesh.vertex_data.write(blob.getData(), vertex_size);
+			}
+			else
+			{
+				import_mesh.indices.push_back(idx);
+			}
+		}
 
-				e_uint8 first_byte = ((const e_uint8*)blob.getData())[0];
+		import_mesh.aabb = aabb;
+		import_mesh.radius_squared = radius_squared;
+	}
 
-				int idx = findSubblobIndex(import_mesh.vertex_data, blob, subblobs, first_subblob[first_byte]);
-				if (idx == -1)
-				{
-					subblobs.push_back(first_subblob[first_byte]);
-					first_subblob[first_byte] = subblobs.size() - 1;
-					import_mesh.indices.push_back(import_mesh.vertex_data.getPos() / vertex_size);
-					import_mesh.vertex_data.write(blob.getData(), vertex_size);
-				}
-				else
+	void ResourceSerializer::postprocessMeshes()
+	{
+		dialog.setImportMessage("Processing meshes...", 0);
+
+		IAllocator& allocator = *g_allocator;
+		TArrary<JobSystem::JobDecl> jobs(allocator);
+		TArrary<JobSystem::LambdaJob> job_storage(allocator);
+		jobs.resize(meshes.size());
+		job_storage.resize(meshes.size());
+
+		/** meshes are independent, dedupe each of them on its own worker */
+		volatile e_int32 counter = 0;
+		for (int mesh_idx = 0; mesh_idx < meshes.size(); ++mesh_idx)
+		{
+			ImportMesh* import_mesh = &meshes[mesh_idx];
+			JobSystem::fromLambda(
+				[this, import_mesh]()
 				{
-					import_mesh.indices.push_back(idx);
-				}
+					postprocessMesh(*import_mesh);
+				},
+				&job_storage[mesh_idx],
+				&jobs[mesh_idx],
+				nullptr);
+		}
+		if (!jobs.empty())
+		{
+			JobSystem::runJobs(&jobs[0], jobs.size(), &counter);
+			JobSystem::wait(&counter);
+		}
+		dialog.setImportMessage("Processing meshes...", 0.4f);
+
+		for (int mesh_idx = meshes.size() - 1; mesh_idx >= 0; --mesh_idx)
+		{
+			if (meshes[mesh_idx].indices.empty()) meshes.eraseFast(mesh_idx);
+		}
+	}
+
+	void ResourceSerializer::generateLODs()
+	{
+		const ImportOption& option = dialog.m_fbx_importer_option;
+		if (option.auto_lod_count <= 0) return;
+
+		for (const ImportMesh& mesh : meshes)
+		{
+			if (mesh.import && mesh.lod > 0)
+			{
+				log_info("FBX Model has authored LODs, skipping LOD generation.");
+				return;
 			}
+		}
 
-			import_mesh.aabb = aabb;
-			import_mesh.radius_squared = radius_squared;
+		dialog.setImportMessage("Generating LODs...", 0.4f);
+
+		IAllocator& allocator = *g_allocator;
+		int lod_count = Math::minimum(option.auto_lod_count, (int)TlengthOf(option.auto_lod_ratios));
+		int base_count = meshes.size();
+		float radius_squared = 0;
+		for (int i = 0; i < base_count; ++i)
+		{
+			if (!meshes[i].import) continue;
+			radius_squared = Math::maximum(radius_squared, meshes[i].radius_squared);
+			for (int lod = 1; lod <= lod_count; ++lod)
+			{
+				ImportMesh& lod_mesh = meshes.emplace(allocator);
+				const ImportMesh& src = meshes[i];
+				lod_mesh.fbx = src.fbx;
+				lod_mesh.fbx_mat = src.fbx_mat;
+				lod_mesh.lod = lod;
+				lod_mesh.aabb = src.aabb;
+				lod_mesh.radius_squared = src.radius_squared;
+			}
 		}
-		for (int mesh_idx = meshes.size() - 1; mesh_idx >= 0; --mesh_idx)
+
+		/** every level is simplified from LOD0, so all levels can be built at once */
+		TArrary<JobSystem::JobDecl> jobs(allocator);
+		TArrary<JobSystem::LambdaJob> job_storage(allocator);
+		jobs.resize(meshes.size() - base_count);
+		job_storage.resize(meshes.size() - base_count);
+
+		int job_idx = 0;
+		for (int i = 0; i < base_count; ++i)
+		{
+			if (!meshes[i].import) continue;
+			for (int lod = 1; lod <= lod_count; ++lod)
+			{
+				const ImportMesh* src = &meshes[i];
+				ImportMesh* lod_mesh = &meshes[base_count + job_idx];
+				float ratio = option.auto_lod_ratios[lod - 1];
+				float max_error = option.auto_lod_max_error;
+				int vertex_size = getVertexSize(*src->fbx);
+				JobSystem::fromLambda(
+					[src, lod_mesh, ratio, max_error, vertex_size]()
+					{
+						lod_mesh->indices = src->indices;
+						lod_mesh->vertex_data.write(src->vertex_data.getData(), src->vertex_data.getPos());
+
+						int vertex_count = src->vertex_data.getPos() / vertex_size;
+						int target_index_count = Math::maximum((int)(src->indices.size() / 3 * ratio), 1) * 3;
+						int index_count = MeshSimplifier::simplify(&lod_mesh->indices[0],
+							lod_mesh->indices.size(),
+							lod_mesh->vertex_data.getData(),
+							vertex_count,
+							vertex_size,
+							target_index_count,
+							max_error);
+						lod_mesh->indices.resize(index_count);
+						if (index_count == 0) return;
+
+						vertex_count = MeshSimplifier::compactVertices(&lod_mesh->indices[0],
+							index_count,
+							lod_mesh->vertex_data.getMutableData(),
+							vertex_count,
+							vertex_size);
+						lod_mesh->vertex_data.resize(vertex_count * vertex_size);
+					},
+					&job_storage[job_idx],
+					&jobs[job_idx],
+					nullptr);
+				++job_idx;
+			}
+		}
+
+		volatile e_int32 counter = 0;
+		if (!jobs.empty())
+		{
+			JobSystem::runJobs(&jobs[0], jobs.size(), &counter);
+			JobSystem::wait(&counter);
+		}
+
+		for (int mesh_idx = meshes.size() - 1; mesh_idx >= base_count; --mesh_idx)
 		{
 			if (meshes[mesh_idx].indices.empty()) meshes.eraseFast(mesh_idx);
 		}
+
+		/** switch to the next level once the bounding sphere covers less than screen_size of a 60 degree fov screen,
+		  * distances the user already enabled are kept */
+		static const float TAN_HALF_FOV = 0.57735f;
+		float radius = sqrtf(radius_squared) * bounding_shape_scale;
+		for (int i = 0; i < lod_count && i < TlengthOf(lods_distances); ++i)
+		{
+			if (lods_distances[i] >= 0) continue;
+			lods_distances[i] = radius / (option.auto_lod_screen_sizes[i] * TAN_HALF_FOV);
+		}
 	}
 
 	void ResourceSerializer::gatherMeshes(ofbx::IScene* scene)
@@ -1640,7 +1788,15 @@ namespace egal
 
 	void ResourceSerializer::writeModel(const char* output_dir, const char* output_mesh_filename)
 	{
+		/** per-import copy, generated distances must not leak into the dialog or the next import */
+		const ImportOption& option = dialog.m_fbx_importer_option;
+		for (int i = 0; i < TlengthOf(lods_distances); ++i)
+		{
+			lods_distances[i] = option.lods_distances[i];
+		}
+
 		postprocessMeshes();
+		generateLODs();
 
 		auto cmpMeshes = [](const void* a, const void* b) -> int {
 			auto a_mesh = static_cast<const ImportMesh*>(a);
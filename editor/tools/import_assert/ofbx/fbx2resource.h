@@ -105,6 +105,26 @@ namespace egal
 			float radius_squared;
 		};
 
+		/** open addressing table keyed by the hash of the whole vertex blob */
+		class VertexHashTable
+		{
+		public:
+			VertexHashTable(IAllocator& allocator, int vertex_count, int vertex_size);
+
+			/** returns index of the equal vertex in haystack or -1 if needle was inserted as new_index */
+			int findOrInsert(const WriteBinary& haystack, const void* needle, int new_index);
+
+		private:
+			struct Slot
+			{
+				e_uint32 hash;
+				int index;
+			};
+
+			TArrary<Slot> m_slots;
+			int m_vertex_size;
+		};
+
 
 	public:
 		ResourceSerializer(ImportAssetDialog& _dialog);
@@ -115,7 +135,6 @@ namespace egal
 		static void insertHierarchy(TArrary<const ofbx::Object*>& bones, const ofbx::Object* node);
 		static ofbx::Matrix getBindPoseMatrix(const ofbx::Mesh* mesh, const ofbx::Object* node);
 		static void makeValidFilename(char* filename);
-		static int findSubblobIndex(const WriteBinary& haystack, const WriteBinary& needle, const TArrary<int>& subblobs, int first_subblob);
 		static void writeUV(const ofbx::Vec2& uv, WriteBinary* blob);
 		static void writeColor(const ofbx::Vec4& color, WriteBinary* blob);
 		static void writeSkin(const Skin& skin, WriteBinary* blob);
@@ -141,7 +160,9 @@ namespace egal
 		void gatherBones(const ofbx::IScene& scene);
 		void gatherAnimations(const ofbx::IScene& scene);
 		void writePackedfloat3(const ofbx::Vec3& vec, const Matrix& mtx, WriteBinary* blob) const;
+		void postprocessMesh(ImportMesh& import_mesh) const;
 		void postprocessMeshes();
+		void generateLODs();
 		void gatherMeshes(ofbx::IScene* scene);
 		bool addSource(const char* filename);
 		
@@ -0,0 +1,342 @@
+#include "editor/tools/import_assert/ofbx/mesh_simplifier.h"
+#include "common/utils/crc32.h"
+
+namespace egal
+{
+	namespace MeshSimplifier
+	{
+		struct Quadric
+		{
+			double a00, a01, a02, a03;
+			double a11, a12, a13;
+			double a22, a23;
+			double a33;
+
+			void clear()
+			{
+				a00 = a01 = a02 = a03 = 0;
+				a11 = a12 = a13 = 0;
+				a22 = a23 = 0;
+				a33 = 0;
+			}
+
+			void addPlane(double a, double b, double c, double d)
+			{
+				a00 += a * a; a01 += a * b; a02 += a * c; a03 += a * d;
+				a11 += b * b; a12 += b * c; a13 += b * d;
+				a22 += c * c; a23 += c * d;
+				a33 += d * d;
+			}
+
+			void add(const Quadric& q)
+			{
+				a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+				a11 += q.a11; a12 += q.a12; a13 += q.a13;
+				a22 += q.a22; a23 += q.a23;
+				a33 += q.a33;
+			}
+
+			double eval(const float3& p) const
+			{
+				double x = p.x, y = p.y, z = p.z;
+				double r = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+					+ a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+					+ a22 * z * z + 2 * a23 * z
+					+ a33;
+				return r < 0 ? 0 : r;
+			}
+		};
+
+		struct Collapse
+		{
+			int from;
+			int to;
+			float cost;
+		};
+
+		static int compareCollapses(const void* a, const void* b)
+		{
+			float ca = ((const Collapse*)a)->cost;
+			float cb = ((const Collapse*)b)->cost;
+			return ca < cb ? -1 : (ca > cb ? 1 : 0);
+		}
+
+		static int compareEdges(const void* a, const void* b)
+		{
+			e_uint64 ea = *(const e_uint64*)a;
+			e_uint64 eb = *(const e_uint64*)b;
+			return ea < eb ? -1 : (ea > eb ? 1 : 0);
+		}
+
+		static const float3& getPosition(const e_uint8* vertices, int stride, int index)
+		{
+			return *(const float3*)(vertices + index * stride);
+		}
+
+		static bool hasEdge(const TArrary<e_uint64>& sorted_edges, e_uint64 edge)
+		{
+			int lo = 0;
+			int hi = sorted_edges.size() - 1;
+			while (lo <= hi)
+			{
+				int mid = (lo + hi) >> 1;
+				if (sorted_edges[mid] == edge) return true;
+				if (sorted_edges[mid] < edge) lo = mid + 1;
+				else hi = mid - 1;
+			}
+			return false;
+		}
+
+		/** maps every vertex to the first vertex with bitwise equal position */
+		static void weldPositions(TArrary<int>& welded, const e_uint8* vertices, int vertex_count, int stride, IAllocator& allocator)
+		{
+			TArrary<int> table(allocator);
+			table.resize((int)Math::nextPow2((e_uint32)Math::maximum(vertex_count * 2, 16)));
+			for (int& i : table) i = -1;
+			e_uint32 mask = (e_uint32)table.size() - 1;
+
+			welded.resize(vertex_count);
+			for (int i = 0; i < vertex_count; ++i)
+			{
+				const float3& pos = getPosition(vertices, stride, i);
+				for (e_uint32 slot = crc32(&pos, sizeof(pos)) & mask;; slot = (slot + 1) & mask)
+				{
+					if (table[slot] == -1)
+					{
+						table[slot] = i;
+						welded[i] = i;
+						break;
+					}
+					if (StringUnitl::compareMemory(&getPosition(vertices, stride, table[slot]), &pos, sizeof(pos)) == 0)
+					{
+						welded[i] = table[slot];
+						break;
+					}
+				}
+			}
+		}
+
+		static bool flipsTriangle(const e_uint8* vertices, int stride, int i0, int i1, int i2, int from, const float3& to_pos)
+		{
+			const float3& p0 = getPosition(vertices, stride, i0);
+			const float3& p1 = getPosition(vertices, stride, i1);
+			const float3& p2 = getPosition(vertices, stride, i2);
+			float3 old_normal = crossProduct(p1 - p0, p2 - p0);
+
+			float3 n0 = i0 == from ? to_pos : p0;
+			float3 n1 = i1 == from ? to_pos : p1;
+			float3 n2 = i2 == from ? to_pos : p2;
+			float3 new_normal = crossProduct(n1 - n0, n2 - n0);
+
+			return dotProduct(old_normal, new_normal) <= 0;
+		}
+
+		int simplify(int* indices,
+			int index_count,
+			const void* vertices_data,
+			int vertex_count,
+			int vertex_stride,
+			int target_index_count,
+			float target_error)
+		{
+			if (index_count <= target_index_count || vertex_count == 0) return index_count;
+
+			IAllocator& allocator = *g_allocator;
+			const e_uint8* vertices = (const e_uint8*)vertices_data;
+
+			TArrary<int> welded(allocator);
+			weldPositions(welded, vertices, vertex_count, vertex_stride, allocator);
+
+			AABB aabb;
+			aabb._min = aabb._max = getPosition(vertices, vertex_stride, 0);
+			TArrary<int> group_size(allocator);
+			group_size.resize(vertex_count);
+			for (int& i : group_size) i = 0;
+			for (int i = 0; i < vertex_count; ++i)
+			{
+				++group_size[welded[i]];
+				const float3& p = getPosition(vertices, vertex_stride, i);
+				aabb._min.set(Math::minimum(aabb._min.x, p.x), Math::minimum(aabb._min.y, p.y), Math::minimum(aabb._min.z, p.z));
+				aabb._max.set(Math::maximum(aabb._max.x, p.x), Math::maximum(aabb._max.y, p.y), Math::maximum(aabb._max.z, p.z));
+			}
+			float extent = (aabb._max - aabb._min).length();
+			double max_error = (double)target_error * extent;
+			max_error *= max_error;
+
+			/** border and seam vertices are locked, only interior vertices of one attribute wedge may collapse */
+			TArrary<e_uint64> edges(allocator);
+			edges.reserve(index_count);
+			for (int i = 0; i < index_count; i += 3)
+			{
+				for (int e = 0; e < 3; ++e)
+				{
+					e_uint64 a = (e_uint64)welded[indices[i + e]];
+					e_uint64 b = (e_uint64)welded[indices[i + (e + 1) % 3]];
+					edges.push_back((a << 32) | b);
+				}
+			}
+			qsort(&edges[0], edges.size(), sizeof(edges[0]), compareEdges);
+
+			TArrary<bool> locked(allocator);
+			locked.resize(vertex_count);
+			for (int i = 0; i < vertex_count; ++i) locked[i] = group_size[welded[i]] > 1;
+			for (int i = 0; i < index_count; i += 3)
+			{
+				for (int e = 0; e < 3; ++e)
+				{
+					int a = indices[i + e];
+					int b = indices[i + (e + 1) % 3];
+					e_uint64 reverse = ((e_uint64)welded[b] << 32) | (e_uint64)welded[a];
+					if (!hasEdge(edges, reverse))
+					{
+						locked[a] = true;
+						locked[b] = true;
+					}
+				}
+			}
+
+			TArrary<Quadric> quadrics(allocator);
+			quadrics.resize(vertex_count);
+			for (Quadric& q : quadrics) q.clear();
+			for (int i = 0; i < index_count; i += 3)
+			{
+				const float3& p0 = getPosition(vertices, vertex_stride, indices[i]);
+				const float3& p1 = getPosition(vertices, vertex_stride, indices[i + 1]);
+				const float3& p2 = getPosition(vertices, vertex_stride, indices[i + 2]);
+				float3 n = crossProduct(p1 - p0, p2 - p0);
+				float len = n.length();
+				if (len <= 0) continue;
+				n *= 1 / len;
+				double d = -dotProduct(n, p0);
+				for (int e = 0; e < 3; ++e) quadrics[indices[i + e]].addPlane(n.x, n.y, n.z, d);
+			}
+
+			TArrary<Collapse> collapses(allocator);
+			TArrary<int> remap(allocator);
+			TArrary<bool> touched(allocator);
+			TArrary<int> adjacency_offsets(allocator);
+			TArrary<int> adjacency(allocator);
+			remap.resize(vertex_count);
+			touched.resize(vertex_count);
+			adjacency_offsets.resize(vertex_count + 1);
+
+			while (index_count > target_index_count)
+			{
+				/** vertex -> triangle adjacency for flip tests */
+				for (int& i : adjacency_offsets) i = 0;
+				for (int i = 0; i < index_count; ++i) ++adjacency_offsets[indices[i] + 1];
+				for (int i = 0; i < vertex_count; ++i) adjacency_offsets[i + 1] += adjacency_offsets[i];
+				adjacency.resize(index_count);
+				for (int i = 0; i < vertex_count; ++i) remap[i] = adjacency_offsets[i];
+				for (int i = 0; i < index_count; ++i) adjacency[remap[indices[i]]++] = i / 3;
+
+				collapses.clear();
+				for (int i = 0; i < index_count; i += 3)
+				{
+					for (int e = 0; e < 3; ++e)
+					{
+						int a = indices[i + e];
+						int b = indices[i + (e + 1) % 3];
+						for (int dir = 0; dir < 2; ++dir)
+						{
+							int from = dir == 0 ? a : b;
+							int to = dir == 0 ? b : a;
+							if (locked[from]) continue;
+
+							Quadric q = quadrics[from];
+							q.add(quadrics[to]);
+							double cost = q.eval(getPosition(vertices, vertex_stride, to));
+							if (cost > max_error) continue;
+
+							Collapse& c = collapses.emplace();
+							c.from = from;
+							c.to = to;
+							c.cost = (float)cost;
+						}
+					}
+				}
+				if (collapses.empty()) break;
+				qsort(&collapses[0], collapses.size(), sizeof(collapses[0]), compareCollapses);
+
+				for (int i = 0; i < vertex_count; ++i)
+				{
+					remap[i] = i;
+					touched[i] = false;
+				}
+
+				/** every collapse removes about two triangles, each vertex is touched at most once per pass */
+				int collapse_goal = (index_count - target_index_count) / 6 + 1;
+				int collapsed = 0;
+				for (const Collapse& c : collapses)
+				{
+					if (collapsed >= collapse_goal) break;
+					if (touched[c.from] || touched[c.to]) continue;
+
+					const float3& to_pos = getPosition(vertices, vertex_stride, c.to);
+					bool flips = false;
+					for (int t = adjacency_offsets[c.from]; t < adjacency_offsets[c.from + 1] && !flips; ++t)
+					{
+						const int* tri = &indices[adjacency[t] * 3];
+						if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) continue;
+						flips = flipsTriangle(vertices, vertex_stride, tri[0], tri[1], tri[2], c.from, to_pos);
+					}
+					if (flips) continue;
+
+					remap[c.from] = c.to;
+					quadrics[c.to].add(quadrics[c.from]);
+					for (int t = adjacency_offsets[c.from]; t < adjacency_offsets[c.from + 1]; ++t)
+					{
+						const int* tri = &indices[adjacency[t] * 3];
+						touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+					}
+					++collapsed;
+				}
+				if (collapsed == 0) break;
+
+				int write_idx = 0;
+				for (int i = 0; i < index_count; i += 3)
+				{
+					int i0 = remap[indices[i]];
+					int i1 = remap[indices[i + 1]];
+					int i2 = remap[indices[i + 2]];
+					if (i0 == i1 || i1 == i2 || i0 == i2) continue;
+					indices[write_idx++] = i0;
+					indices[write_idx++] = i1;
+					indices[write_idx++] = i2;
+				}
+				index_count = write_idx;
+			}
+
+			return index_count;
+		}
+
+		int compactVertices(int* indices, int index_count, void* vertices_data, int vertex_count, int vertex_stride)
+		{
+			IAllocator& allocator = *g_allocator;
+			e_uint8* vertices = (e_uint8*)vertices_data;
+
+			TArrary<int> remap(allocator);
+			remap.resize(vertex_count);
+			for (int& i : remap) i = -1;
+
+			int new_count = 0;
+			for (int i = 0; i < index_count; ++i)
+			{
+				int& r = remap[indices[i]];
+				if (r == -1) r = new_count++;
+				indices[i] = r;
+			}
+
+			TArrary<e_uint8> tmp(allocator);
+			tmp.resize(new_count * vertex_stride);
+			for (int i = 0; i < vertex_count; ++i)
+			{
+				if (remap[i] == -1) continue;
+				StringUnitl::copyMemory(&tmp[remap[i] * vertex_stride], vertices + i * vertex_stride, vertex_stride);
+			}
+			if (new_count > 0) StringUnitl::copyMemory(vertices, &tmp[0], new_count * vertex_stride);
+
+			return new_count;
+		}
+	}
+}
@@ -0,0 +1,30 @@
+#ifndef _mesh_simplifier_h_
+#define _mesh_simplifier_h_
+#pragma once
+#include "common/egal-d.h"
+
+namespace egal
+{
+	/** quadric error edge collapse simplifier used to generate LOD chains at import time */
+	namespace MeshSimplifier
+	{
+		/**
+		 * Collapses edges of the indexed triangle list in place until index count drops to target_index_count
+		 * or the next collapse would exceed target_error (relative to the mesh extent).
+		 * Vertices are only ever collapsed onto an existing neighbour, vertices on attribute seams and open
+		 * borders are locked, so uvs, normals and skin weights of the remaining vertices stay untouched.
+		 * Returns the new index count.
+		 */
+		int simplify(int* indices,
+			int index_count,
+			const void* vertices,
+			int vertex_count,
+			int vertex_stride,
+			int target_index_count,
+			float target_error);
+
+		/** drops vertices not referenced by indices and remaps indices, returns the new vertex count */
+		int compactVertices(int* indices, int index_count, void* vertices, int vertex_count, int vertex_stride);
+	}
+}
+#endif
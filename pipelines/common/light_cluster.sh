@@ -0,0 +1,87 @@
+#ifndef LIGHT_CLUSTER_SH_HEADER_GUARD
+#define LIGHT_CLUSTER_SH_HEADER_GUARD
+
+// Froxel light grid built by LightCluster (runtime/EngineFramework/light_cluster.h), the sizes must match it.
+// Pipeline::bindLightClusters binds the textures as the first global textures of the view.
+// Included by material shaders compiled with CLUSTERED_LIGHTS.
+
+#define CLUSTER_INDEX_TEXTURE_HEIGHT 64.0
+#define CLUSTER_MAX_LIGHTS 1024.0
+#define CLUSTER_LIGHT_TEXELS 4.0
+#define CLUSTER_MAX_LIGHTS_PER_PIXEL 64
+
+SAMPLER2D(u_texClusterGrid, 15);
+SAMPLER2D(u_texClusterIndices, 14);
+SAMPLER2D(u_texClusterLights, 13);
+uniform vec4 u_clusterParams;	// grid x, y, z, light count
+uniform vec4 u_clusterDepth;	// near plane, GRID_Z / log(far / near), index texture width
+
+vec4 clusterTexel(float x, float y, float width, float height)
+{
+	return vec4(x + 0.5, y + 0.5, 0.0, 0.0) / vec4(width, height, 1.0, 1.0);
+}
+
+// offset and count of the lights in the cluster containing wpos
+vec2 getClusterRange(vec3 wpos)
+{
+	vec4 clip = mul(u_viewProj, vec4(wpos, 1.0));
+	vec2 ndc = clip.xy / clip.w;
+	float depth = -mul(u_view, vec4(wpos, 1.0)).z;
+
+	float slice = log(max(depth, u_clusterDepth.x) / u_clusterDepth.x) * u_clusterDepth.y;
+	vec3 cell = floor(vec3((ndc * 0.5 + 0.5) * u_clusterParams.xy, slice));
+	cell = clamp(cell, vec3_splat(0.0), u_clusterParams.xyz - 1.0);
+
+	vec4 uv = clusterTexel(cell.y * u_clusterParams.x + cell.x, cell.z, u_clusterParams.x * u_clusterParams.y, u_clusterParams.z);
+	return texture2DLod(u_texClusterGrid, uv.xy, 0.0).xy;
+}
+
+float getClusterLightIndex(float i)
+{
+	float width = u_clusterDepth.z;
+	float y = floor(i / width);
+	vec4 uv = clusterTexel(i - y * width, y, width, CLUSTER_INDEX_TEXTURE_HEIGHT);
+	return texture2DLod(u_texClusterIndices, uv.xy, 0.0).x;
+}
+
+vec4 getClusterLightTexel(float light, float texel)
+{
+	vec4 uv = clusterTexel(texel, light, CLUSTER_LIGHT_TEXELS, CLUSTER_MAX_LIGHTS);
+	return texture2DLod(u_texClusterLights, uv.xy, 0.0);
+}
+
+// sum of all point and spot lights of the cluster, same attenuation and cone as the per light pass
+vec3 clusteredPointLights(vec3 wpos, vec3 normal, vec3 view, vec3 albedo, float shininess)
+{
+	vec2 range = getClusterRange(wpos);
+	vec3 result = vec3_splat(0.0);
+	for (int i = 0; i < CLUSTER_MAX_LIGHTS_PER_PIXEL; ++i)
+	{
+		if (float(i) >= range.y) break;
+
+		float light = getClusterLightIndex(range.x + float(i));
+		vec4 pos_radius = getClusterLightTexel(light, 0.0);
+		vec4 color_attenuation = getClusterLightTexel(light, 1.0);
+		vec4 dir_fov = getClusterLightTexel(light, 2.0);
+		vec4 specular = getClusterLightTexel(light, 3.0);
+
+		vec3 to_light = pos_radius.xyz - wpos;
+		float dist = length(to_light);
+		vec3 l = to_light / max(dist, 0.0001);
+		float attn = pow(max(0.0, 1.0 - dist / pos_radius.w), color_attenuation.w);
+		if (dir_fov.w < 3.14159)
+		{
+			float cosine = dot(-l, dir_fov.xyz);
+			float cos_half_fov = cos(dir_fov.w * 0.5);
+			attn *= clamp((cosine - cos_half_fov) / max(1.0 - cos_half_fov, 0.0001), 0.0, 1.0);
+		}
+
+		float ndotl = max(0.0, dot(normal, l));
+		vec3 h = normalize(l + view);
+		float spec = pow(max(0.0, dot(normal, h)), shininess) * step(0.0001, ndotl);
+		result += attn * (color_attenuation.rgb * albedo * ndotl + specular.rgb * spec);
+	}
+	return result;
+}
+
+#endif
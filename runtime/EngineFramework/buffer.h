@@ -121,6 +121,8 @@ namespace egal
 			RenderBuffer	m_renderbuffers[16];
 			e_int32			m_renderbuffers_count = 0;
 			e_char			m_name[64];
+			/** contents do not survive between frames, textures come from the pipeline pool and may be aliased */
+			e_bool			m_is_transient = false;
 		};
 
 	public:
@@ -134,6 +136,8 @@ namespace egal
 		float2 getSizeRatio() const {				return m_declaration.m_size_ratio; }
 		const e_char* getName() const {				return m_declaration.m_name; }
 		e_int32 getRenderbuffersCounts() const {	return m_declaration.m_renderbuffers_count; }
+		e_bool isTransient() const {				return m_declaration.m_is_transient; }
+		const Declaration& getDeclaration() const {	return m_declaration; }
 
 		RenderBuffer& getRenderbuffer(e_int32 idx)
 		{
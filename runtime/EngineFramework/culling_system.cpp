@@ -12,10 +12,10 @@ namespace egal
 		e_uint64 layer_mask,
 		CullingSystem::Subresults& results)
 	{
-		//PROFILE_FUNCTION();
+		PROFILE_FUNCTION();
 		e_int32 i = start_index;
 		assert(results.empty());
-		//PROFILE_INT("objects", e_int32(end - start));
+		PROFILE_INT("objects", e_int32(end - start));
 		simd4 px = f4Load(frustum->xs);
 		simd4 py = f4Load(frustum->ys);
 		simd4 pz = f4Load(frustum->zs);
@@ -70,9 +70,9 @@ namespace egal
 			, *cull_data->results);
 	}
 
-	CullingSystem* CullingSystem::create(IAllocator& allocator)
+	CullingSystem* CullingSystem::create(IAllocator& allocator, IAllocator& frame_allocator)
 	{
-		return _aligned_new(allocator, CullingSystem)(allocator);
+		return _aligned_new(allocator, CullingSystem)(allocator, frame_allocator);
 	}
 
 	e_void CullingSystem::destroy(CullingSystem& culling_system, IAllocator& allocator)
@@ -84,23 +84,28 @@ namespace egal
 	/********************************************************************************************************/
 	/********************************************************************************************************/
 
-	CullingSystem::CullingSystem(IAllocator& allocator)
+	CullingSystem::CullingSystem(IAllocator& allocator, IAllocator& frame_allocator)
 		: m_allocator(allocator)
+		, m_frame_allocator(frame_allocator)
 		, m_job_allocator(allocator)
 		, m_spheres(allocator)
 		, m_result(allocator)
 		, m_layer_masks(allocator)
 		, m_sphere_to_model_instance_map(allocator)
 		, m_entity_instance_to_sphere_map(allocator)
+		, m_bvh_boxes(allocator)
+		, m_bvh(allocator)
+		, m_is_bvh_dirty(true)
+		, m_is_bvh_moved(false)
 	{
-		m_result.emplace(m_allocator);
+		m_result.emplace(m_frame_allocator);
 		m_entity_instance_to_sphere_map.reserve(RESERVED_ENTITIES_COUNT);
 		m_sphere_to_model_instance_map.reserve(RESERVED_ENTITIES_COUNT);
 		m_spheres.reserve(RESERVED_ENTITIES_COUNT);
 		e_int32 cpu_count = (e_int32)MT::getCPUsCount();
 		while (m_result.size() < cpu_count)
 		{
-			m_result.emplace(m_allocator);
+			m_result.emplace(m_frame_allocator);
 		}
 	}
 
@@ -114,18 +119,24 @@ namespace egal
 		m_layer_masks.clear();
 		m_entity_instance_to_sphere_map.clear();
 		m_sphere_to_model_instance_map.clear();
+		m_is_bvh_dirty = true;
 	}
 
 	CullingSystem::Results& CullingSystem::cull(const Frustum& frustum, e_uint64 layer_mask)
 	{
 		e_int32 count = m_spheres.size();
-		for (auto& i : m_result) i.clear();
+		/** buffers of the previous call may belong to an already rewound frame arena, start from fresh ones */
+		for (auto& i : m_result)
+		{
+			Subresults fresh(m_frame_allocator);
+			fresh.reserve(i.size());
+			i.swap(fresh);
+		}
 
 		e_int32 step = count / m_result.size();
 		assert(TlengthOf(jobs) >= m_result.size());
 		for (e_int32 i = 0; i < m_result.size(); i++)
 		{
-			m_result[i].clear();
 			job_data[i] = {
 				&m_spheres,
 				&m_result[i],
@@ -177,6 +188,7 @@ namespace egal
 		}
 		m_entity_instance_to_sphere_map[model_instance.index] = m_spheres.size() - 1;
 		m_layer_masks.push_back(layer_mask);
+		m_is_bvh_dirty = true;
 	}
 
 	e_void CullingSystem::removeStatic(ComponentHandle model_instance)
@@ -197,31 +209,75 @@ namespace egal
 		m_sphere_to_model_instance_map.pop_back();
 		m_layer_masks.pop_back();
 		m_entity_instance_to_sphere_map[model_instance.index] = -1;
+		m_is_bvh_dirty = true;
 	}
 
 	e_void CullingSystem::updateBoundingSphere(const Sphere& sphere, ComponentHandle model_instance)
 	{
 		e_int32 idx = m_entity_instance_to_sphere_map[model_instance.index];
-		if (idx >= 0) m_spheres[idx] = sphere;
+		if (idx >= 0)
+		{
+			m_spheres[idx] = sphere;
+			m_is_bvh_moved = true;
+		}
 	}
 
-	e_void CullingSystem::insert(const InputSpheres& spheres, const Subresults& model_instances)
+	e_void CullingSystem::insert(const InputSpheres& spheres, const Subresults& model_instances, const LayerMasks& layer_masks)
 	{
+		ASSERT(spheres.size() == model_instances.size() && spheres.size() == layer_masks.size());
+		if (spheres.empty())
+			return;
+
+		e_int32 max_index = 0;
+		for (e_int32 i = 0; i < model_instances.size(); i++)
+		{
+			max_index = Math::maximum(max_index, model_instances[i].index);
+		}
+		while (m_entity_instance_to_sphere_map.size() <= max_index)
+		{
+			m_entity_instance_to_sphere_map.push_back(-1);
+		}
+
+		e_int32 first = m_spheres.size();
+		m_spheres.resize(first + spheres.size());
+		m_sphere_to_model_instance_map.resize(first + spheres.size());
+		m_layer_masks.resize(first + spheres.size());
 		for (e_int32 i = 0; i < spheres.size(); i++)
 		{
-			m_spheres.push_back(spheres[i]);
-			while (m_entity_instance_to_sphere_map.size() <= model_instances[i].index)
-			{
-				m_entity_instance_to_sphere_map.push_back(-1);
-			}
-			m_entity_instance_to_sphere_map[model_instances[i].index] = m_spheres.size() - 1;
-			m_sphere_to_model_instance_map.push_back(model_instances[i]);
-			m_layer_masks.push_back(1);
+			ASSERT(m_entity_instance_to_sphere_map[model_instances[i].index] == -1);
+			m_spheres[first + i] = spheres[i];
+			m_sphere_to_model_instance_map[first + i] = model_instances[i];
+			m_layer_masks[first + i] = layer_masks[i];
+			m_entity_instance_to_sphere_map[model_instances[i].index] = first + i;
 		}
+		m_is_bvh_dirty = true;
 	}
 
 	const Sphere& CullingSystem::getSphere(ComponentHandle model_instance)
 	{
 		return m_spheres[m_entity_instance_to_sphere_map[model_instance.index]];
 	}
+
+	e_void CullingSystem::updateBVH()
+	{
+		if (!m_is_bvh_dirty && !m_is_bvh_moved)
+			return;
+
+		PROFILE_FUNCTION();
+		m_bvh_boxes.resize(m_spheres.size());
+		for (e_int32 i = 0; i < m_spheres.size(); ++i)
+		{
+			const Sphere& sphere = m_spheres[i];
+			float3 extent(sphere.radius, sphere.radius, sphere.radius);
+			m_bvh_boxes[i].set(sphere.position - extent, sphere.position + extent);
+		}
+
+		if (m_is_bvh_dirty)
+			m_bvh.build(m_bvh_boxes.empty() ? nullptr : &m_bvh_boxes[0], m_bvh_boxes.size());
+		else if (!m_bvh_boxes.empty())
+			m_bvh.refit(&m_bvh_boxes[0]);
+
+		m_is_bvh_dirty = false;
+		m_is_bvh_moved = false;
+	}
 }
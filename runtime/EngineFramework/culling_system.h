@@ -4,6 +4,7 @@
 
 #include "common/egal-d.h"
 #include "common/allocator/pool_allocator.h"
+#include "common/utils/bvh.h"
 
 namespace egal
 {
@@ -11,7 +12,8 @@ namespace egal
 	class CullingSystem
 	{
 	public:
-		static CullingSystem* create(IAllocator& allocator);
+		/** per thread results are allocated from frame_allocator and stay valid until the end of the next frame */
+		static CullingSystem* create(IAllocator& allocator, IAllocator& frame_allocator);
 		static e_void destroy(CullingSystem& culling_system, IAllocator& allocator);
 
 	public:
@@ -35,7 +37,7 @@ namespace egal
 		};
 
 	public:
-		CullingSystem(IAllocator& allocator);
+		CullingSystem(IAllocator& allocator, IAllocator& frame_allocator);
 		~CullingSystem();
 
 		e_void clear();
@@ -54,8 +56,16 @@ namespace egal
 
 		e_void updateBoundingSphere(const Sphere& sphere, ComponentHandle model_instance);
 
-		e_void insert(const InputSpheres& spheres, const Subresults& model_instances);
+		/** adds many instances at once, used when a whole scene or all instances of an entity become ready */
+		e_void insert(const InputSpheres& spheres, const Subresults& model_instances, const LayerMasks& layer_masks);
 		const Sphere& getSphere(ComponentHandle model_instance);
+
+		/** rebuilds the sphere hierarchy used by ray queries when spheres were added or removed, refits it when they only moved */
+		e_void updateBVH();
+		/** items of the hierarchy are sphere indices, call updateBVH first */
+		const BVH& getBVH() const { return m_bvh; }
+		const Sphere& getSphereByIndex(e_int32 sphere_idx) const { return m_spheres[sphere_idx]; }
+		ComponentHandle getSphereOwner(e_int32 sphere_idx) const { return m_sphere_to_model_instance_map[sphere_idx]; }
 	private:
 		PoolAllocator<CullingJobData, 16>	m_job_allocator;
 		InputSpheres						m_spheres;
@@ -63,9 +73,14 @@ namespace egal
 		LayerMasks							m_layer_masks;
 		EntityInstancetoSphereMap			m_entity_instance_to_sphere_map;
 		SphereToModelInstanceMap			m_sphere_to_model_instance_map;
+		TArrary<AABB>						m_bvh_boxes;
+		BVH									m_bvh;
+		e_bool								m_is_bvh_dirty;
+		e_bool								m_is_bvh_moved;
 		CullingJobData						job_data[16];
 		JobSystem::JobDecl					jobs[16];
 		IAllocator&							m_allocator;
+		IAllocator&							m_frame_allocator;
 	};
 }
 #endif
@@ -0,0 +1,178 @@
+#include "runtime/EngineFramework/debug_draw_buffer.h"
+#include "common/thread/atomic.h"
+
+#include <cmath>
+
+namespace egal
+{
+	const e_float DebugDrawBuffer::BUCKET_TIME = 0.25f;
+
+
+	DebugDrawBuffer::DebugDrawBuffer(IAllocator& allocator)
+		: m_allocator(allocator)
+		, m_write_ring(0)
+		, m_bucket_vertices(allocator)
+		, m_bucket_mutex(false)
+		, m_time(0)
+	{
+		for (e_int32 ring = 0; ring < 2; ++ring)
+		{
+			for (e_int32 type = 0; type < PRIMITIVE_COUNT; ++type)
+			{
+				m_rings[ring][type] = nullptr;
+				m_ring_sizes[ring][type] = 0;
+				m_ring_capacities[ring][type] = 0;
+			}
+		}
+
+		m_bucket_vertices.reserve(BUCKET_COUNT * PRIMITIVE_COUNT);
+		for (e_int32 i = 0; i < BUCKET_COUNT * PRIMITIVE_COUNT; ++i)
+		{
+			m_bucket_vertices.emplace(m_allocator);
+		}
+		for (e_int32& stamp : m_bucket_stamps)
+		{
+			stamp = -1;
+		}
+	}
+
+
+	DebugDrawBuffer::~DebugDrawBuffer()
+	{
+		for (e_int32 ring = 0; ring < 2; ++ring)
+		{
+			for (e_int32 type = 0; type < PRIMITIVE_COUNT; ++type)
+			{
+				if (m_rings[ring][type]) m_allocator.deallocate(m_rings[ring][type]);
+			}
+		}
+	}
+
+
+	e_void DebugDrawBuffer::reserveRing(e_int32 ring, e_int32 type, e_int32 vertex_count)
+	{
+		vertex_count = Math::minimum(vertex_count, (e_int32)RING_MAX_VERTEX_COUNT);
+		if (vertex_count <= m_ring_capacities[ring][type]) return;
+
+		e_int32 capacity = Math::maximum(m_ring_capacities[ring][type], (e_int32)RING_MIN_VERTEX_COUNT);
+		while (capacity < vertex_count) capacity <<= 1;
+
+		/** only called from frame(), the ring is empty, so nothing is copied */
+		if (m_rings[ring][type]) m_allocator.deallocate(m_rings[ring][type]);
+		m_rings[ring][type] = (DebugVertex*)m_allocator.allocate(capacity * sizeof(DebugVertex));
+		m_ring_capacities[ring][type] = capacity;
+	}
+
+
+	e_void DebugDrawBuffer::add(Primitive type, const DebugVertex* vertices, e_int32 vertex_count, e_float life)
+	{
+		if (life <= 0)
+		{
+			e_int32 ring = m_write_ring;
+			e_int32 start = MT::atomicAdd(&m_ring_sizes[ring][type], vertex_count);
+			/** a full ring drops the primitive, the size is clamped when read */
+			if (start + vertex_count > m_ring_capacities[ring][type]) return;
+
+			StringUnitl::copyMemory(m_rings[ring][type] + start, vertices, vertex_count * sizeof(DebugVertex));
+			return;
+		}
+
+		/**
+		 * Buckets are indexed by their stamp, a primitive living longer than the whole bucket range shares
+		 * the bucket with one expiring earlier and keeps it alive until the later of the two stamps.
+		 */
+		e_int32 stamp = (e_int32)ceilf((m_time + life) / BUCKET_TIME);
+		e_int32 bucket = stamp % BUCKET_COUNT;
+		MT::SpinLock lock(m_bucket_mutex);
+		m_bucket_stamps[bucket] = Math::maximum(m_bucket_stamps[bucket], stamp);
+		TArrary<DebugVertex>& dst = getBucket(bucket, type);
+		e_int32 size = dst.size();
+		dst.resize(size + vertex_count);
+		StringUnitl::copyMemory(&dst[size], vertices, vertex_count * sizeof(DebugVertex));
+	}
+
+
+	e_void DebugDrawBuffer::clearBucket(e_int32 bucket)
+	{
+		/** clear keeps the capacity, so buckets stop allocating once debug drawing settles */
+		for (e_int32 type = 0; type < PRIMITIVE_COUNT; ++type)
+		{
+			getBucket(bucket, type).clear();
+		}
+		m_bucket_stamps[bucket] = -1;
+	}
+
+
+	e_void DebugDrawBuffer::frame(e_float time)
+	{
+		m_time = time;
+		m_write_ring = 1 - m_write_ring;
+		for (e_int32 type = 0; type < PRIMITIVE_COUNT; ++type)
+		{
+			/** the ring is sized for what was requested last frame, including what did not fit */
+			reserveRing(m_write_ring, type, m_ring_sizes[1 - m_write_ring][type]);
+			m_ring_sizes[m_write_ring][type] = 0;
+		}
+
+		MT::SpinLock lock(m_bucket_mutex);
+		e_int32 stamp = (e_int32)floorf(time / BUCKET_TIME);
+		for (e_int32 i = 0; i < BUCKET_COUNT; ++i)
+		{
+			if (m_bucket_stamps[i] >= 0 && m_bucket_stamps[i] <= stamp) clearBucket(i);
+		}
+	}
+
+
+	e_void DebugDrawBuffer::clear()
+	{
+		for (e_int32 ring = 0; ring < 2; ++ring)
+		{
+			for (e_int32 type = 0; type < PRIMITIVE_COUNT; ++type)
+			{
+				m_ring_sizes[ring][type] = 0;
+			}
+		}
+
+		MT::SpinLock lock(m_bucket_mutex);
+		for (e_int32 i = 0; i < BUCKET_COUNT; ++i)
+		{
+			clearBucket(i);
+		}
+	}
+
+
+	e_int32 DebugDrawBuffer::getRingSize(e_int32 ring, Primitive type) const
+	{
+		return Math::minimum((e_int32)m_ring_sizes[ring][type], m_ring_capacities[ring][type]);
+	}
+
+
+	e_int32 DebugDrawBuffer::getVertexCount(Primitive type) const
+	{
+		e_int32 count = getRingSize(1 - m_write_ring, type);
+		for (e_int32 i = 0; i < BUCKET_COUNT; ++i)
+		{
+			count += m_bucket_vertices[i * PRIMITIVE_COUNT + type].size();
+		}
+		return count;
+	}
+
+
+	e_int32 DebugDrawBuffer::copyVertices(Primitive type, DebugVertex* out, e_int32 max_count) const
+	{
+		e_int32 ring = 1 - m_write_ring;
+		e_int32 count = Math::minimum(getRingSize(ring, type), max_count);
+		StringUnitl::copyMemory(out, m_rings[ring][type], count * sizeof(DebugVertex));
+
+		for (e_int32 i = 0; i < BUCKET_COUNT && count < max_count; ++i)
+		{
+			const TArrary<DebugVertex>& vertices = m_bucket_vertices[i * PRIMITIVE_COUNT + type];
+			e_int32 n = Math::minimum(vertices.size(), max_count - count);
+			if (n == 0) continue;
+
+			StringUnitl::copyMemory(out + count, &vertices[0], n * sizeof(DebugVertex));
+			count += n;
+		}
+		return count;
+	}
+}
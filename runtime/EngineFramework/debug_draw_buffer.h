@@ -0,0 +1,82 @@
+#ifndef _debug_draw_buffer_h_
+#define _debug_draw_buffer_h_
+#pragma once
+
+#include "common/egal-d.h"
+#include "common/thread/sync.h"
+
+namespace egal
+{
+	/** same layout as the pipeline's base vertex, so the vertices are copied to bgfx as they are */
+	struct DebugVertex
+	{
+		e_float		x, y, z;
+		e_uint32	rgba;
+		e_float		u;
+		e_float		v;
+	};
+
+	/**
+	 * Debug primitives stored as ready to draw vertices. Primitives living a single frame go to a ring,
+	 * space is reserved with one atomic add, so any job can emit them without locking. The ring is double
+	 * buffered, frame() swaps it, so the pipeline draws what was emitted during the previous frame.
+	 * Rings are allocated on first use and grown in frame() to what the previous frame asked for, primitives
+	 * that do not fit are dropped until then.
+	 * Primitives with a life go to buckets stamped with their quantized expiry time, frame() drops whole
+	 * buckets once they expire instead of ticking every primitive.
+	 */
+	class DebugDrawBuffer
+	{
+	public:
+		enum Primitive
+		{
+			POINTS,
+			LINES,
+			TRIANGLES,
+
+			PRIMITIVE_COUNT
+		};
+
+		enum
+		{
+			RING_MIN_VERTEX_COUNT = 1 << 12,
+			RING_MAX_VERTEX_COUNT = 1 << 18,
+			BUCKET_COUNT = 64
+		};
+
+		/** expiry times are rounded up to this, so primitives added close to each other share a bucket */
+		static const e_float BUCKET_TIME;
+
+	public:
+		explicit DebugDrawBuffer(IAllocator& allocator);
+		~DebugDrawBuffer();
+
+		/** copies vertex_count vertices of whole primitives, life <= 0 means a single frame, safe from any thread */
+		e_void add(Primitive type, const DebugVertex* vertices, e_int32 vertex_count, e_float life);
+		/** swaps the rings and drops expired buckets, call once per frame when no job is emitting */
+		e_void frame(e_float time);
+		e_void clear();
+
+		e_int32 getVertexCount(Primitive type) const;
+		/** copies up to max_count vertices of the primitive type to out, returns the number copied */
+		e_int32 copyVertices(Primitive type, DebugVertex* out, e_int32 max_count) const;
+
+	private:
+		e_int32 getRingSize(e_int32 ring, Primitive type) const;
+		e_void reserveRing(e_int32 ring, e_int32 type, e_int32 vertex_count);
+		TArrary<DebugVertex>& getBucket(e_int32 bucket, e_int32 type) { return m_bucket_vertices[bucket * PRIMITIVE_COUNT + type]; }
+		e_void clearBucket(e_int32 bucket);
+
+	private:
+		IAllocator&						m_allocator;
+		DebugVertex*					m_rings[2][PRIMITIVE_COUNT];
+		volatile e_int32				m_ring_sizes[2][PRIMITIVE_COUNT];	/** requested vertices, can exceed the capacity */
+		e_int32							m_ring_capacities[2][PRIMITIVE_COUNT];
+		e_int32							m_write_ring;
+		TArrary<TArrary<DebugVertex>>	m_bucket_vertices;	/** BUCKET_COUNT * PRIMITIVE_COUNT, bucket major */
+		e_int32							m_bucket_stamps[BUCKET_COUNT];	/** -1 for empty buckets */
+		MT::SpinMutex					m_bucket_mutex;
+		e_float							m_time;
+	};
+}
+#endif
@@ -46,12 +46,14 @@ namespace egal
 		, m_paused(false)
 		, m_next_frame(false)
 		, m_lifo_allocator(allocator, 10 * 1024 * 1024)
+		, m_frame_allocator(allocator, 32 * 1024 * 1024)
 		, m_p_render(nullptr)
 		, m_p_pipeline(nullptr)
 	{
 		log_info("Core Creating engine...");
 		
 		Profiler::setThreadName("Main");
+		Profiler::init();
 
 		/** init dump */
 		enableCrashReporting(false);
@@ -96,6 +98,7 @@ namespace egal
 		m_resource_manager.destroy();
 
 		JobSystem::shutdown();
+		Profiler::shutdown();
 
 		for (Resource* res : m_lua_resources)
 		{
@@ -238,7 +241,13 @@ namespace egal
 
 	void EngineRoot::frame()
 	{
-		//PROFILE_FUNCTION();
+		PROFILE_FUNCTION();
+		/** nothing runs on the job system between frames, so the arenas can be switched here */
+		m_frame_allocator.frame();
+		const FrameAllocator::Stats& frame_allocator_stats = m_frame_allocator.getLastFrameStats();
+		PROFILE_INT("frame allocator kb", frame_allocator_stats.used_bytes >> 10);
+		PROFILE_INT("frame allocator slabs", frame_allocator_stats.slab_count);
+		PROFILE_INT("frame allocator heap fallbacks", frame_allocator_stats.fallback_count);
 		++m_fps_frame;
 		if (m_fps_timer->getTimeSinceTick() > 0.5f)
 		{
@@ -254,14 +263,14 @@ namespace egal
 		m_time += dt;
 		m_last_time_delta = dt;
 		{
-			//PROFILE_BLOCK("update scenes");
+			PROFILE_BLOCK("update scenes");
 			for (auto* scene : m_p_component_manager->getScenes())
 			{
 				scene->frame(dt, m_paused);
 			}
 		}
 		{
-			//PROFILE_BLOCK("late update scenes");
+			PROFILE_BLOCK("late update scenes");
 			for (auto* scene : m_p_component_manager->getScenes())
 			{
 				scene->lateUpdate(dt, m_paused);
@@ -281,6 +290,8 @@ namespace egal
 			m_paused = true;
 			m_next_frame = false;
 		}
+
+		Profiler::frame();
 	}
 
 	egal::e_void EngineRoot::on_mouse_moved(e_float x, e_float y)
@@ -388,6 +399,7 @@ namespace egal
 		if (!hasSerializedPlugins(serializer)) return false;
 		if (!hasSupportedSceneVersions(serializer)) return false;
 
+		Debug::MemoryTagScope memory_tag(Debug::MemoryTag::SCENE);
 		m_p_component_manager->deserialize(serializer);
 		m_plugin_manager->deserialize(serializer);
 		e_int32 scene_count;
@@ -408,6 +420,8 @@ namespace egal
 		SceneManager* scene = m_p_component_manager->getScene(type);
 		if (!scene) return ComponentUID::INVALID;
 
+		Debug::MemoryTagScope memory_tag(Debug::MemoryTag::SCENE);
+
 		return ComponentUID(game_object, type, scene, scene->createComponent(type, game_object));
 	}
 
@@ -441,6 +455,11 @@ namespace egal
 		return m_lifo_allocator;
 	}
 
+	IAllocator& EngineRoot::getFrameAllocator()
+	{
+		return m_frame_allocator;
+	}
+
 	void EngineRoot::runScript(const char* src, int src_length, const char* path)
 	{
 		if (m_p_lua_manager)
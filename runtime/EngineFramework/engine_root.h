@@ -4,6 +4,7 @@
 
 #include "common/egal-d.h"
 #include "common/allocator/lifo_allocator.h"
+#include "common/allocator/frame_allocator.h"
 #include "common/resource/resource_manager.h"
 #include "common/utils/singleton.h"
 
@@ -84,6 +85,8 @@ namespace egal
 		ComponentUID createComponent(GameObject game_object, ComponentType type);
 		
 		IAllocator& getLIFOAllocator();
+		/** memory valid until the end of the next frame, any thread may allocate from it */
+		IAllocator& getFrameAllocator();
 
 		e_void on_mouse_moved(e_float x, e_float y);
 
@@ -94,6 +97,7 @@ namespace egal
 	private:
 		IAllocator&		m_allocator;
 		LIFOAllocator	m_lifo_allocator;
+		FrameAllocator	m_frame_allocator;
 
 		ComponentManager*	m_p_component_manager;
 		SceneManager*		m_p_scene_manager;
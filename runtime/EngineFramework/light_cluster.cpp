@@ -0,0 +1,222 @@
+#include "runtime/EngineFramework/light_cluster.h"
+
+#include <cmath>
+
+namespace egal
+{
+	static const e_uint32 CLUSTER_TEXTURE_FLAGS = BGFX_TEXTURE_MIN_POINT | BGFX_TEXTURE_MAG_POINT | BGFX_TEXTURE_MIP_POINT
+		| BGFX_TEXTURE_U_CLAMP | BGFX_TEXTURE_V_CLAMP;
+
+
+	LightCluster::LightCluster(IAllocator& allocator)
+		: m_allocator(allocator)
+		, m_lights(allocator)
+		, m_grid(allocator)
+		, m_indices(allocator)
+		, m_cluster_counts(allocator)
+		, m_depth_scale(0)
+		, m_counter(0)
+		, m_is_building(false)
+	{
+		m_grid_texture = BGFX_INVALID_HANDLE;
+		m_index_texture = BGFX_INVALID_HANDLE;
+		m_light_texture = BGFX_INVALID_HANDLE;
+		m_grid.resize(CLUSTER_COUNT * 2);
+		m_cluster_counts.resize(CLUSTER_COUNT);
+		m_indices.reserve(MAX_LIGHT_INDICES);
+	}
+
+
+	LightCluster::~LightCluster()
+	{
+		finish();
+		destroy();
+	}
+
+
+	e_void LightCluster::create()
+	{
+		m_grid_texture = bgfx::createTexture2D(GRID_X * GRID_Y, GRID_Z, false, 1, bgfx::TextureFormat::RG32F, CLUSTER_TEXTURE_FLAGS);
+		m_index_texture = bgfx::createTexture2D(INDEX_TEXTURE_WIDTH, INDEX_TEXTURE_HEIGHT, false, 1, bgfx::TextureFormat::R32F, CLUSTER_TEXTURE_FLAGS);
+		m_light_texture = bgfx::createTexture2D(LIGHT_TEXELS, MAX_LIGHTS, false, 1, bgfx::TextureFormat::RGBA32F, CLUSTER_TEXTURE_FLAGS);
+	}
+
+
+	e_void LightCluster::destroy()
+	{
+		if (bgfx::isValid(m_grid_texture)) bgfx::destroy(m_grid_texture);
+		if (bgfx::isValid(m_index_texture)) bgfx::destroy(m_index_texture);
+		if (bgfx::isValid(m_light_texture)) bgfx::destroy(m_light_texture);
+		m_grid_texture = BGFX_INVALID_HANDLE;
+		m_index_texture = BGFX_INVALID_HANDLE;
+		m_light_texture = BGFX_INVALID_HANDLE;
+	}
+
+
+	e_void LightCluster::build(const Camera& camera, const Light* lights, e_int32 light_count)
+	{
+		finish();
+
+		m_camera = camera;
+		m_camera.near_plane = Math::maximum(camera.near_plane, 0.001f);
+		m_camera.far_plane = Math::maximum(camera.far_plane, m_camera.near_plane * 1.001f);
+		m_depth_scale = GRID_Z / logf(m_camera.far_plane / m_camera.near_plane);
+
+		light_count = Math::minimum(light_count, (e_int32)MAX_LIGHTS);
+		m_lights.resize(light_count);
+		if (light_count > 0) StringUnitl::copyMemory(&m_lights[0], lights, sizeof(Light) * light_count);
+
+		m_counter = 0;
+		m_is_building = true;
+		JobSystem::JobDecl job;
+		job.task = &buildTask;
+		job.data = this;
+		JobSystem::runJobs(&job, 1, &m_counter);
+	}
+
+
+	e_void LightCluster::buildTask(e_void* data)
+	{
+		((LightCluster*)data)->assign();
+	}
+
+
+	e_void LightCluster::finish()
+	{
+		if (!m_is_building) return;
+		JobSystem::wait(&m_counter);
+		m_is_building = false;
+
+		if (!bgfx::isValid(m_grid_texture)) return;
+
+		bgfx::updateTexture2D(m_grid_texture, 0, 0, 0, 0, GRID_X * GRID_Y, GRID_Z,
+			bgfx::copy(&m_grid[0], m_grid.size() * sizeof(m_grid[0])));
+
+		if (!m_indices.empty())
+		{
+			e_int32 rows = (m_indices.size() + INDEX_TEXTURE_WIDTH - 1) / INDEX_TEXTURE_WIDTH;
+			m_indices.resize(rows * INDEX_TEXTURE_WIDTH);
+			bgfx::updateTexture2D(m_index_texture, 0, 0, 0, 0, INDEX_TEXTURE_WIDTH, (e_uint16)rows,
+				bgfx::copy(&m_indices[0], m_indices.size() * sizeof(m_indices[0])));
+		}
+
+		if (!m_lights.empty())
+		{
+			bgfx::updateTexture2D(m_light_texture, 0, 0, 0, 0, LIGHT_TEXELS, (e_uint16)m_lights.size(),
+				bgfx::copy(&m_lights[0], m_lights.size() * sizeof(m_lights[0])));
+		}
+	}
+
+
+	float4 LightCluster::getGridParams() const
+	{
+		return float4((e_float)GRID_X, (e_float)GRID_Y, (e_float)GRID_Z, (e_float)m_lights.size());
+	}
+
+
+	float4 LightCluster::getDepthParams() const
+	{
+		return float4(m_camera.near_plane, m_depth_scale, (e_float)INDEX_TEXTURE_WIDTH, 0);
+	}
+
+
+	e_bool LightCluster::getClusterRange(const Light& light, e_int32* min, e_int32* max) const
+	{
+		float3 center = m_camera.view.transformPoint(float3(light.pos_radius.x, light.pos_radius.y, light.pos_radius.z));
+		e_float radius = light.pos_radius.w;
+
+		/** camera looks down -z */
+		e_float depth = -center.z;
+		e_float min_depth = depth - radius;
+		e_float max_depth = depth + radius;
+		if (max_depth < m_camera.near_plane || min_depth > m_camera.far_plane) return false;
+		min_depth = Math::maximum(min_depth, m_camera.near_plane);
+		max_depth = Math::minimum(max_depth, m_camera.far_plane);
+
+		min[2] = Math::clamp((e_int32)(logf(min_depth / m_camera.near_plane) * m_depth_scale), 0, GRID_Z - 1);
+		max[2] = Math::clamp((e_int32)(logf(max_depth / m_camera.near_plane) * m_depth_scale), 0, GRID_Z - 1);
+
+		/** projected extent of the sphere's view space box, the nearest or farthest depth is the conservative one */
+		e_float half_h = m_camera.is_ortho ? m_camera.ortho_size : tanf(m_camera.fov * 0.5f);
+		e_float half_w = half_h * m_camera.ratio;
+		const e_float lo[2] = { center.x - radius, center.y - radius };
+		const e_float hi[2] = { center.x + radius, center.y + radius };
+		const e_float half[2] = { half_w, half_h };
+		const e_int32 grid[2] = { GRID_X, GRID_Y };
+		for (e_int32 axis = 0; axis < 2; ++axis)
+		{
+			e_float ndc_min, ndc_max;
+			if (m_camera.is_ortho)
+			{
+				ndc_min = lo[axis] / half[axis];
+				ndc_max = hi[axis] / half[axis];
+			}
+			else
+			{
+				ndc_min = lo[axis] / ((lo[axis] < 0 ? min_depth : max_depth) * half[axis]);
+				ndc_max = hi[axis] / ((hi[axis] > 0 ? min_depth : max_depth) * half[axis]);
+			}
+			if (ndc_max < -1 || ndc_min > 1) return false;
+			min[axis] = Math::clamp((e_int32)((ndc_min * 0.5f + 0.5f) * grid[axis]), 0, grid[axis] - 1);
+			max[axis] = Math::clamp((e_int32)((ndc_max * 0.5f + 0.5f) * grid[axis]), 0, grid[axis] - 1);
+		}
+		return true;
+	}
+
+
+	e_void LightCluster::assign()
+	{
+		/** ranges are computed once and stored in the count pass, then used again to scatter indices */
+		struct Range
+		{
+			e_int32 min[3];
+			e_int32 max[3];
+		};
+		TArrary<Range> ranges(m_allocator);
+		ranges.resize(m_lights.size());
+
+		for (e_int32& count : m_cluster_counts) count = 0;
+		for (e_int32 i = 0; i < m_lights.size(); ++i)
+		{
+			Range& range = ranges[i];
+			if (!getClusterRange(m_lights[i], range.min, range.max))
+			{
+				for (e_int32 axis = 0; axis < 3; ++axis)
+				{
+					range.min[axis] = 1;
+					range.max[axis] = 0;
+				}
+				continue;
+			}
+			for (e_int32 z = range.min[2]; z <= range.max[2]; ++z)
+				for (e_int32 y = range.min[1]; y <= range.max[1]; ++y)
+					for (e_int32 x = range.min[0]; x <= range.max[0]; ++x)
+						++m_cluster_counts[(z * GRID_Y + y) * GRID_X + x];
+		}
+
+		e_int32 offset = 0;
+		for (e_int32 i = 0; i < CLUSTER_COUNT; ++i)
+		{
+			e_int32 count = Math::minimum(m_cluster_counts[i], MAX_LIGHT_INDICES - offset);
+			m_grid[i * 2] = (e_float)offset;
+			m_grid[i * 2 + 1] = (e_float)count;
+			m_cluster_counts[i] = offset;
+			offset += count;
+		}
+
+		m_indices.resize(offset);
+		for (e_int32 i = 0; i < m_lights.size(); ++i)
+		{
+			const Range& range = ranges[i];
+			for (e_int32 z = range.min[2]; z <= range.max[2]; ++z)
+				for (e_int32 y = range.min[1]; y <= range.max[1]; ++y)
+					for (e_int32 x = range.min[0]; x <= range.max[0]; ++x)
+					{
+						e_int32 cluster = (z * GRID_Y + y) * GRID_X + x;
+						e_int32& cursor = m_cluster_counts[cluster];
+						if (cursor >= (e_int32)m_grid[cluster * 2] + (e_int32)m_grid[cluster * 2 + 1]) continue;
+						m_indices[cursor++] = (e_float)i;
+					}
+		}
+	}
+}
@@ -0,0 +1,93 @@
+#ifndef _light_cluster_h_
+#define _light_cluster_h_
+#pragma once
+
+#include "common/egal-d.h"
+#include <bgfx/bgfx.h>
+
+namespace egal
+{
+	/**
+	 * Froxel light grid. The camera frustum is split in GRID_X * GRID_Y tiles and GRID_Z exponential depth
+	 * slices, every cluster stores an offset and a count into one light index list.
+	 * Built from scratch every frame on a worker and uploaded as three point sampled textures:
+	 * grid (RG32F offset/count), indices (R32F) and lights (RGBA32F, LIGHT_TEXELS texels per light).
+	 * Shaders compiled with CLUSTERED_LIGHTS read them through pipelines/common/light_cluster.sh.
+	 */
+	class LightCluster
+	{
+	public:
+		enum
+		{
+			GRID_X = 16,
+			GRID_Y = 8,
+			GRID_Z = 24,
+			CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z,
+			MAX_LIGHTS = 1024,
+			LIGHT_TEXELS = 4,
+			INDEX_TEXTURE_WIDTH = 1024,
+			INDEX_TEXTURE_HEIGHT = 64,
+			MAX_LIGHT_INDICES = INDEX_TEXTURE_WIDTH * INDEX_TEXTURE_HEIGHT
+		};
+
+		struct Light
+		{
+			float4 pos_radius;
+			float4 color_attenuation;
+			float4 dir_fov;
+			float4 specular;
+		};
+
+		struct Camera
+		{
+			float4x4	view;
+			e_float		fov;
+			e_float		ratio;
+			e_float		near_plane;
+			e_float		far_plane;
+			e_float		ortho_size;
+			e_bool		is_ortho;
+		};
+
+	public:
+		explicit LightCluster(IAllocator& allocator);
+		~LightCluster();
+
+		e_void create();
+		e_void destroy();
+
+		/** lights are copied, the grid is built on a job system worker until finish() is called */
+		e_void build(const Camera& camera, const Light* lights, e_int32 light_count);
+		e_void finish();
+
+		/** x, y, z grid size, w = light count */
+		float4 getGridParams() const;
+		/** x = near plane, y = GRID_Z / log(far / near), used to get the slice from view depth */
+		float4 getDepthParams() const;
+
+		bgfx::TextureHandle getGridTexture() const { return m_grid_texture; }
+		bgfx::TextureHandle getIndexTexture() const { return m_index_texture; }
+		bgfx::TextureHandle getLightTexture() const { return m_light_texture; }
+
+	private:
+		static e_void buildTask(e_void* data);
+		e_void assign();
+		e_bool getClusterRange(const Light& light, e_int32* min, e_int32* max) const;
+
+	private:
+		IAllocator&			m_allocator;
+		Camera				m_camera;
+		TArrary<Light>		m_lights;
+		TArrary<e_float>	m_grid;
+		TArrary<e_float>	m_indices;
+		TArrary<e_int32>	m_cluster_counts;
+		e_float				m_depth_scale;
+		volatile e_int32	m_counter;
+		e_bool				m_is_building;
+
+		bgfx::TextureHandle	m_grid_texture;
+		bgfx::TextureHandle	m_index_texture;
+		bgfx::TextureHandle	m_light_texture;
+	};
+}
+#endif
@@ -0,0 +1,288 @@
+#include "runtime/EngineFramework/occlusion_buffer.h"
+#include "common/resource/entity_manager.h"
+
+#include <cfloat>
+#include <cmath>
+
+namespace egal
+{
+	/** added to the triangle depth in lanes outside the triangle, so f4Min leaves them untouched */
+	static const e_float s_outside_lanes[16][4] =
+	{
+		{ 0, 0, 0, 0 },				{ FLT_MAX, 0, 0, 0 },				{ 0, FLT_MAX, 0, 0 },				{ FLT_MAX, FLT_MAX, 0, 0 },
+		{ 0, 0, FLT_MAX, 0 },		{ FLT_MAX, 0, FLT_MAX, 0 },			{ 0, FLT_MAX, FLT_MAX, 0 },			{ FLT_MAX, FLT_MAX, FLT_MAX, 0 },
+		{ 0, 0, 0, FLT_MAX },		{ FLT_MAX, 0, 0, FLT_MAX },			{ 0, FLT_MAX, 0, FLT_MAX },			{ FLT_MAX, FLT_MAX, 0, FLT_MAX },
+		{ 0, 0, FLT_MAX, FLT_MAX },	{ FLT_MAX, 0, FLT_MAX, FLT_MAX },	{ 0, FLT_MAX, FLT_MAX, FLT_MAX },	{ FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX }
+	};
+
+
+	OcclusionBuffer::OcclusionBuffer(IAllocator& allocator)
+		: m_allocator(allocator)
+		, m_x_scale(1)
+		, m_y_scale(1)
+		, m_triangles(allocator)
+		, m_projected(allocator)
+		, m_is_ready(false)
+	{
+		e_int32 total = 0;
+		for (e_int32 i = 0; i < LEVEL_COUNT; ++i)
+		{
+			total += (getLevelWidth(i) * getLevelHeight(i) + 3) & ~3;
+		}
+		m_depth = (e_float*)m_allocator.allocate_aligned(total * sizeof(e_float), 16);
+
+		e_float* level = m_depth;
+		for (e_int32 i = 0; i < LEVEL_COUNT; ++i)
+		{
+			m_levels[i] = level;
+			level += (getLevelWidth(i) * getLevelHeight(i) + 3) & ~3;
+		}
+		m_triangles.reserve(1024);
+	}
+
+
+	OcclusionBuffer::~OcclusionBuffer()
+	{
+		m_allocator.deallocate_aligned(m_depth);
+	}
+
+
+	e_void OcclusionBuffer::begin(const Camera& camera)
+	{
+		m_camera = camera;
+		m_camera.near_plane = Math::maximum(camera.near_plane, 0.001f);
+		if (camera.is_ortho)
+		{
+			m_y_scale = 1 / Math::maximum(camera.ortho_size, 0.0001f);
+			m_x_scale = m_y_scale / camera.ratio;
+		}
+		else
+		{
+			m_y_scale = 1 / tanf(camera.fov * 0.5f);
+			m_x_scale = m_y_scale / camera.ratio;
+		}
+		m_triangles.clear();
+		m_is_ready = false;
+	}
+
+
+	e_void OcclusionBuffer::addOccluder(const Mesh& mesh, const float4x4& matrix)
+	{
+		if (mesh.vertices.empty() || mesh.indices.empty() || !mesh.skin.empty()) return;
+
+		float4x4 model_view = m_camera.view * matrix;
+		e_int32 vertex_count = mesh.vertices.size();
+		m_projected.resize(vertex_count);
+		for (e_int32 i = 0; i < vertex_count; ++i)
+		{
+			float3 p = model_view.transform(mesh.vertices[i]);
+			e_float depth = -p.z;
+			e_float inv_w = m_camera.is_ortho || depth <= 0 ? 1 : 1 / depth;
+			m_projected[i].x = (p.x * m_x_scale * inv_w * 0.5f + 0.5f) * WIDTH;
+			m_projected[i].y = (0.5f - p.y * m_y_scale * inv_w * 0.5f) * HEIGHT;
+			m_projected[i].z = depth;
+		}
+
+		e_bool is_16bit = mesh.areIndices16();
+		e_int32 index_count = mesh.indices.size() / (is_16bit ? 2 : 4);
+		const e_uint16* indices16 = (const e_uint16*)&mesh.indices[0];
+		const e_uint32* indices32 = (const e_uint32*)&mesh.indices[0];
+		for (e_int32 i = 0; i + 2 < index_count; i += 3)
+		{
+			if (m_triangles.size() >= MAX_TRIANGLES) return;
+
+			const float3& p0 = m_projected[is_16bit ? indices16[i] : indices32[i]];
+			const float3& p1 = m_projected[is_16bit ? indices16[i + 1] : indices32[i + 1]];
+			const float3& p2 = m_projected[is_16bit ? indices16[i + 2] : indices32[i + 2]];
+
+			/** clipping could only shrink the occluder, dropping the triangle is conservative */
+			e_float near_plane = m_camera.near_plane;
+			if (p0.z < near_plane || p1.z < near_plane || p2.z < near_plane) continue;
+
+			e_float area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+			if (Math::abs(area) < 0.01f) continue;
+
+			e_float min_x = Math::minimum(p0.x, p1.x, p2.x);
+			e_float max_x = Math::maximum(p0.x, p1.x, p2.x);
+			e_float min_y = Math::minimum(p0.y, p1.y, p2.y);
+			e_float max_y = Math::maximum(p0.y, p1.y, p2.y);
+			if (max_x < 0 || min_x > WIDTH || max_y < 0 || min_y > HEIGHT) continue;
+
+			Triangle& tri = m_triangles.emplace();
+			tri.x[0] = p0.x; tri.x[1] = p1.x; tri.x[2] = p2.x;
+			tri.y[0] = p0.y; tri.y[1] = p1.y; tri.y[2] = p2.y;
+			tri.depth = Math::maximum(p0.z, p1.z, p2.z);
+			tri.min_y = (e_int32)Math::clamp(min_y, 0.0f, (e_float)(HEIGHT - 1));
+			tri.max_y = (e_int32)Math::clamp(max_y, 0.0f, (e_float)(HEIGHT - 1));
+		}
+	}
+
+
+	e_void OcclusionBuffer::rasterize()
+	{
+		PROFILE_FUNCTION();
+		PROFILE_INT("occluder triangles", m_triangles.size());
+
+		JobSystem::JobDecl jobs[BAND_COUNT];
+		JobSystem::LambdaJob job_storage[BAND_COUNT];
+		for (e_int32 band = 0; band < BAND_COUNT; ++band)
+		{
+			JobSystem::fromLambda([this, band]() { rasterizeBand(band); }, &job_storage[band], &jobs[band], nullptr);
+		}
+		volatile e_int32 counter = 0;
+		JobSystem::runJobs(jobs, BAND_COUNT, &counter);
+		JobSystem::wait(&counter);
+
+		for (e_int32 level = 1; level < LEVEL_COUNT; ++level)
+		{
+			buildLevel(level);
+		}
+		m_is_ready = true;
+	}
+
+
+	e_void OcclusionBuffer::rasterizeBand(e_int32 band)
+	{
+		PROFILE_BLOCK("Occlusion band");
+		e_int32 band_min_y = band * BAND_HEIGHT;
+		e_int32 band_max_y = band_min_y + BAND_HEIGHT - 1;
+
+		simd4 far_depth = f4Splat(FLT_MAX);
+		for (e_int32 y = band_min_y; y <= band_max_y; ++y)
+		{
+			e_float* row = m_depth + y * WIDTH;
+			for (e_int32 x = 0; x < WIDTH; x += 4) f4Store(row + x, far_depth);
+		}
+
+		const e_float lane_offsets[4] = { 0.5f, 1.5f, 2.5f, 3.5f };
+		simd4 lanes = f4LoadUnaligned(lane_offsets);
+		for (const Triangle& tri : m_triangles)
+		{
+			if (tri.max_y < band_min_y || tri.min_y > band_max_y) continue;
+
+			/** edge functions a * x + b * y + c, positive inside for both windings */
+			e_float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.y[1] - tri.y[0]) * (tri.x[2] - tri.x[0]);
+			e_float sign = area > 0 ? 1.0f : -1.0f;
+			e_float a[3], b[3], c[3];
+			for (e_int32 e = 0; e < 3; ++e)
+			{
+				e_int32 n = (e + 1) % 3;
+				a[e] = -(tri.y[n] - tri.y[e]) * sign;
+				b[e] = (tri.x[n] - tri.x[e]) * sign;
+				c[e] = -(a[e] * tri.x[e] + b[e] * tri.y[e]);
+			}
+
+			e_int32 min_x = (e_int32)Math::clamp(Math::minimum(tri.x[0], tri.x[1], tri.x[2]), 0.0f, (e_float)(WIDTH - 1)) & ~3;
+			e_int32 max_x = (e_int32)Math::clamp(Math::maximum(tri.x[0], tri.x[1], tri.x[2]), 0.0f, (e_float)(WIDTH - 1));
+			e_int32 min_y = Math::maximum(tri.min_y, band_min_y);
+			e_int32 max_y = Math::minimum(tri.max_y, band_max_y);
+
+			simd4 depth = f4Splat(tri.depth);
+			simd4 x_start = f4Add(f4Splat((e_float)min_x), lanes);
+			simd4 step0 = f4Splat(a[0] * 4);
+			simd4 step1 = f4Splat(a[1] * 4);
+			simd4 step2 = f4Splat(a[2] * 4);
+			for (e_int32 y = min_y; y <= max_y; ++y)
+			{
+				e_float py = y + 0.5f;
+				simd4 e0 = f4Add(f4Mul(f4Splat(a[0]), x_start), f4Splat(b[0] * py + c[0]));
+				simd4 e1 = f4Add(f4Mul(f4Splat(a[1]), x_start), f4Splat(b[1] * py + c[1]));
+				simd4 e2 = f4Add(f4Mul(f4Splat(a[2]), x_start), f4Splat(b[2] * py + c[2]));
+				e_float* row = m_depth + y * WIDTH;
+				for (e_int32 x = min_x; x <= max_x; x += 4)
+				{
+					/** sign bit set in lanes outside any edge */
+					e_int32 outside = f4MoveMask(f4Min(f4Min(e0, e1), e2));
+					if (outside != 0xf)
+					{
+						simd4 value = f4Max(depth, f4LoadUnaligned(s_outside_lanes[outside]));
+						f4Store(row + x, f4Min(f4Load(row + x), value));
+					}
+					e0 = f4Add(e0, step0);
+					e1 = f4Add(e1, step1);
+					e2 = f4Add(e2, step2);
+				}
+			}
+		}
+	}
+
+
+	e_void OcclusionBuffer::buildLevel(e_int32 level)
+	{
+		const e_float* src = getLevel(level - 1);
+		e_float* dst = getLevel(level);
+		e_int32 src_w = getLevelWidth(level - 1);
+		e_int32 src_h = getLevelHeight(level - 1);
+		e_int32 w = getLevelWidth(level);
+		e_int32 h = getLevelHeight(level);
+		for (e_int32 y = 0; y < h; ++y)
+		{
+			e_int32 y0 = Math::minimum(y * 2, src_h - 1);
+			e_int32 y1 = Math::minimum(y * 2 + 1, src_h - 1);
+			for (e_int32 x = 0; x < w; ++x)
+			{
+				e_int32 x0 = Math::minimum(x * 2, src_w - 1);
+				e_int32 x1 = Math::minimum(x * 2 + 1, src_w - 1);
+				dst[y * w + x] = Math::maximum(Math::maximum(src[y0 * src_w + x0], src[y0 * src_w + x1]),
+					Math::maximum(src[y1 * src_w + x0], src[y1 * src_w + x1]));
+			}
+		}
+	}
+
+
+	e_bool OcclusionBuffer::isOccluded(const Sphere& sphere) const
+	{
+		if (!m_is_ready) return false;
+
+		float3 center = m_camera.view.transform(sphere.position);
+		e_float r = sphere.radius;
+		e_float depth = -center.z;
+		e_float nearest = depth - r;
+		if (nearest <= m_camera.near_plane) return false;
+
+		e_float min_x, max_x, min_y, max_y;
+		if (m_camera.is_ortho)
+		{
+			min_x = (center.x - r) * m_x_scale;
+			max_x = (center.x + r) * m_x_scale;
+			min_y = (center.y - r) * m_y_scale;
+			max_y = (center.y + r) * m_y_scale;
+		}
+		else
+		{
+			/** divide by the depth that pushes each side outwards, a cheap bound of the projected sphere */
+			e_float farthest = depth + r;
+			min_x = (center.x - r) * m_x_scale / (center.x - r < 0 ? nearest : farthest);
+			max_x = (center.x + r) * m_x_scale / (center.x + r > 0 ? nearest : farthest);
+			min_y = (center.y - r) * m_y_scale / (center.y - r < 0 ? nearest : farthest);
+			max_y = (center.y + r) * m_y_scale / (center.y + r > 0 ? nearest : farthest);
+		}
+
+		e_float left = (min_x * 0.5f + 0.5f) * WIDTH;
+		e_float right = (max_x * 0.5f + 0.5f) * WIDTH;
+		e_float top = (0.5f - max_y * 0.5f) * HEIGHT;
+		e_float bottom = (0.5f - min_y * 0.5f) * HEIGHT;
+		if (right < 0 || left >= WIDTH || bottom < 0 || top >= HEIGHT) return false;
+
+		e_int32 x0 = left <= 0 ? 0 : (e_int32)left;
+		e_int32 x1 = right >= WIDTH ? WIDTH - 1 : (e_int32)right;
+		e_int32 y0 = top <= 0 ? 0 : (e_int32)top;
+		e_int32 y1 = bottom >= HEIGHT ? HEIGHT - 1 : (e_int32)bottom;
+
+		/** coarsest level where the rect spans at most 2x2 texels */
+		e_int32 level = 0;
+		while (level < LEVEL_COUNT - 1 && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1)) ++level;
+
+		const e_float* hiz = getLevel(level);
+		e_int32 w = getLevelWidth(level);
+		e_int32 h = getLevelHeight(level);
+		for (e_int32 y = y0 >> level, ye = Math::minimum(y1 >> level, h - 1); y <= ye; ++y)
+		{
+			for (e_int32 x = x0 >> level, xe = Math::minimum(x1 >> level, w - 1); x <= xe; ++x)
+			{
+				if (hiz[y * w + x] >= nearest) return false;
+			}
+		}
+		return true;
+	}
+}
@@ -0,0 +1,85 @@
+#ifndef _occlusion_buffer_h_
+#define _occlusion_buffer_h_
+#pragma once
+
+#include "common/egal-d.h"
+
+namespace egal
+{
+	struct Mesh;
+
+	/**
+	 * Low resolution depth buffer of designated occluders rasterized on the cpu, used to drop instances hidden
+	 * behind them before lod selection. Every triangle is written with the depth of its farthest vertex and
+	 * triangles crossing the near plane are dropped, so the buffer never claims more than the real occluders hide.
+	 * Depth is linear view space distance, level 0 keeps the nearest occluder per pixel, every further level
+	 * of the hierarchical z keeps the farthest of the 2x2 texels below it.
+	 */
+	class OcclusionBuffer
+	{
+	public:
+		enum
+		{
+			WIDTH = 256,
+			HEIGHT = 128,
+			LEVEL_COUNT = 9,
+			BAND_HEIGHT = 16,
+			BAND_COUNT = HEIGHT / BAND_HEIGHT,
+			MAX_TRIANGLES = 1 << 16
+		};
+
+		struct Camera
+		{
+			float4x4	view;
+			e_float		fov;
+			e_float		ratio;
+			e_float		near_plane;
+			e_float		ortho_size;
+			e_bool		is_ortho;
+		};
+
+	public:
+		explicit OcclusionBuffer(IAllocator& allocator);
+		~OcclusionBuffer();
+
+		/** clears the buffer, occluders added until rasterize() are projected with this camera */
+		e_void begin(const Camera& camera);
+		/** queues the triangles of a rigid mesh placed with matrix */
+		e_void addOccluder(const Mesh& mesh, const float4x4& matrix);
+		/** rasterizes queued triangles in horizontal bands on the job system and builds the hierarchical z */
+		e_void rasterize();
+
+		/** true if every texel the sphere may cover has an occluder nearer than the sphere, safe to call from many threads */
+		e_bool isOccluded(const Sphere& sphere) const;
+		e_bool isReady() const { return m_is_ready; }
+		e_int32 getTriangleCount() const { return m_triangles.size(); }
+
+	private:
+		struct Triangle
+		{
+			e_float x[3];
+			e_float y[3];
+			e_float depth;
+			e_int32 min_y;
+			e_int32 max_y;
+		};
+
+		e_void rasterizeBand(e_int32 band);
+		e_void buildLevel(e_int32 level);
+		e_float* getLevel(e_int32 level) const { return m_levels[level]; }
+		static e_int32 getLevelWidth(e_int32 level) { return Math::maximum(WIDTH >> level, 1); }
+		static e_int32 getLevelHeight(e_int32 level) { return Math::maximum(HEIGHT >> level, 1); }
+
+	private:
+		IAllocator&			m_allocator;
+		Camera				m_camera;
+		e_float				m_x_scale;
+		e_float				m_y_scale;
+		TArrary<Triangle>	m_triangles;
+		TArrary<float3>		m_projected;
+		e_float*			m_depth;
+		e_float*			m_levels[LEVEL_COUNT];
+		e_bool				m_is_ready;
+	};
+}
+#endif
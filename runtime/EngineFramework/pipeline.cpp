@@ -4,6 +4,7 @@
 #include "runtime/EngineFramework/component_manager.h"
 #include "runtime/EngineFramework/engine_root.h"
 #include "runtime/EngineFramework/scene_manager.h"
+#include "runtime/EngineFramework/debug_draw_buffer.h"
 #include "runtime/EngineFramework/renderer.h"
 
 #include "common/resource/entity_manager.h"
@@ -22,6 +23,7 @@
 #include "common/filesystem/ifile_device.h"
 
 #include <cmath>
+#include <climits>
 
 #include "bx/bx.h"
 #include "bx/math.h"
@@ -33,6 +35,11 @@ namespace egal
 		: m_allocator(allocator)
 		, m_path(path)
 		, m_framebuffers(allocator)
+		, m_framebuffer_map(allocator)
+		, m_framebuffer_uses(allocator)
+		, m_transient_textures(allocator)
+		, m_current_framebuffer_handle(-1)
+		, m_has_transient_uses(false)
 		, m_custom_commands_handlers(allocator)
 		, m_uniforms(allocator)
 		, m_renderer(renderer)
@@ -42,18 +49,18 @@ namespace egal
 		, m_default_cubemap(nullptr)
 		, m_debug_flags(BGFX_DEBUG_TEXT)
 		, m_point_light_shadowmaps(allocator)
+		, m_local_shadow_tiles(allocator)
 		, m_is_rendering_in_shadowmap(false)
+		, m_is_clustered_light_pass(false)
 		, m_is_ready(false)
-		, m_debug_index_buffer(BGFX_INVALID_HANDLE)
 		, m_scene(nullptr)
 		, m_width(-1)
 		, m_height(-1)
 		, m_define(define, allocator)
+		, m_light_cluster(allocator)
+		, m_shadow_frame(0)
 	{
-		for (auto& handle : m_debug_vertex_buffers)
-		{
-			handle = BGFX_INVALID_HANDLE;
-		}
+		invalidateShadowCache();
 		m_deferred_point_light_vertex_decl.begin()
 			.add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
 			.end();
@@ -66,8 +73,10 @@ namespace egal
 
 		m_has_shadowmap_define_idx = m_renderer.getShaderDefineIdx("HAS_SHADOWMAP");
 		m_instanced_define_idx = m_renderer.getShaderDefineIdx("INSTANCED");
+		m_clustered_lights_define_idx = m_renderer.getShaderDefineIdx("CLUSTERED_LIGHTS");
 
 		createUniforms();
+		m_light_cluster.create();
 
 		MaterialManager& material_manager = renderer.getMaterialManager();
 
@@ -118,6 +127,10 @@ namespace egal
 		}
 		_delete(m_allocator, m_default_framebuffer);
 		m_framebuffers.clear();
+		m_framebuffer_map.clear();
+		m_framebuffer_uses.clear();
+		destroyTransientTextures();
+		m_has_transient_uses = false;
 		bgfx::frame();
 		bgfx::frame();
 	}
@@ -191,6 +204,11 @@ namespace egal
 			m_terrain_matrix_uniform					= bgfx::createUniform("u_terrainMatrix",				bgfx::UniformType::Mat4);
 			m_decal_matrix_uniform						= bgfx::createUniform("u_decalMatrix",					bgfx::UniformType::Mat4);
 			m_emitter_matrix_uniform					= bgfx::createUniform("u_emitterMatrix",				bgfx::UniformType::Mat4);
+			m_cluster_grid_uniform						= bgfx::createUniform("u_texClusterGrid",				bgfx::UniformType::Int1);
+			m_cluster_indices_uniform					= bgfx::createUniform("u_texClusterIndices",			bgfx::UniformType::Int1);
+			m_cluster_lights_uniform					= bgfx::createUniform("u_texClusterLights",				bgfx::UniformType::Int1);
+			m_cluster_params_uniform					= bgfx::createUniform("u_clusterParams",				bgfx::UniformType::Vec4);
+			m_cluster_depth_uniform						= bgfx::createUniform("u_clusterDepth",					bgfx::UniformType::Vec4);
 		}
 
 		e_void Pipeline::destroyUniforms()
@@ -220,6 +238,11 @@ namespace egal
 			bgfx::destroy(m_texture_size_uniform);
 			bgfx::destroy(m_decal_matrix_uniform);
 			bgfx::destroy(m_emitter_matrix_uniform);
+			bgfx::destroy(m_cluster_grid_uniform);
+			bgfx::destroy(m_cluster_indices_uniform);
+			bgfx::destroy(m_cluster_lights_uniform);
+			bgfx::destroy(m_cluster_params_uniform);
+			bgfx::destroy(m_cluster_depth_uniform);
 		}
 
 		Pipeline::~Pipeline()
@@ -230,6 +253,8 @@ namespace egal
 			m_sky_material->getResourceManager().unload(*m_sky_material);
 
 			destroyUniforms();
+			m_light_cluster.finish();
+			m_light_cluster.destroy();
 
 			for (e_int32 i = 0; i < m_uniforms.size(); ++i)
 			{
@@ -242,17 +267,12 @@ namespace egal
 				if (m_framebuffers[i] == m_default_framebuffer) m_default_framebuffer = nullptr;
 			}
 			_delete(m_allocator, m_default_framebuffer);
+			destroyTransientTextures();
 
 			bgfx::destroy(m_cube_vb);
 			bgfx::destroy(m_cube_ib);
 			bgfx::destroy(m_particle_index_buffer);
 			bgfx::destroy(m_particle_vertex_buffer);
-			if (bgfx::isValid(m_debug_index_buffer)) 
-				bgfx::destroy(m_debug_index_buffer);
-			for (auto& handle : m_debug_vertex_buffers)
-			{
-				if (bgfx::isValid(handle)) bgfx::destroy(handle);
-			}
 		}
 
 		e_void Pipeline::bindTexture(e_int32 uniform_idx, e_int32 texture_idx)
@@ -299,6 +319,79 @@ namespace egal
 			m_current_view->command_buffer.end();
 		}
 
+		e_void Pipeline::getPointLightData(ComponentHandle light_cmp, LightCluster::Light& data)
+		{
+			ComponentManager& com_man = m_scene->getComponentManager();
+			GameObject entity = m_scene->getPointLightGameObject(light_cmp);
+			e_float intensity = m_scene->getPointLightIntensity(light_cmp);
+			e_float specular_intensity = m_scene->getPointLightSpecularIntensity(light_cmp);
+			intensity *= intensity;
+
+			data.pos_radius.set(com_man.getPosition(entity), m_scene->getLightRange(light_cmp));
+			data.color_attenuation.set(m_scene->getPointLightColor(light_cmp) * intensity, m_scene->getLightAttenuation(light_cmp));
+			data.dir_fov.set(com_man.getRotation(entity).rotate(float3(0, 0, -1)), m_scene->getLightFOV(light_cmp));
+			data.specular.set(m_scene->getPointLightSpecularColor(light_cmp) * specular_intensity * specular_intensity, 1);
+		}
+
+		e_void Pipeline::buildLightClusters()
+		{
+			if (m_applied_camera == INVALID_COMPONENT)
+				return;
+
+			IAllocator& frame_allocator = m_renderer.getEngine().getLIFOAllocator();
+			TArrary<ComponentHandle> local_lights(frame_allocator);
+			m_scene->getPointLights(m_camera_frustum, local_lights);
+
+			/** shadow casters need their shadowmap, they keep the per light pass of renderPointLightInfluencedGeometry */
+			TArrary<LightCluster::Light> lights(frame_allocator);
+			lights.reserve(local_lights.size());
+			for (ComponentHandle light : local_lights)
+			{
+				if (m_scene->getLightCastShadows(light)) continue;
+				getPointLightData(light, lights.emplace());
+			}
+
+			LightCluster::Camera camera;
+			camera.view = m_scene->getComponentManager().getMatrix(m_scene->getCameraGameObject(m_applied_camera));
+			camera.view.fastInverse();
+			camera.fov = m_scene->getCameraFOV(m_applied_camera);
+			camera.ratio = m_height > 0 ? m_width / (e_float)m_height : 1;
+			camera.near_plane = m_scene->getCameraNearPlane(m_applied_camera);
+			camera.far_plane = m_scene->getCameraFarPlane(m_applied_camera);
+			camera.ortho_size = m_scene->getCameraOrthoSize(m_applied_camera);
+			camera.is_ortho = m_scene->isCameraOrtho(m_applied_camera);
+			m_light_cluster.build(camera, lights.empty() ? nullptr : &lights[0], lights.size());
+		}
+
+		e_void Pipeline::bindLightClusters()
+		{
+			if (!m_current_view)
+				return;
+
+			m_current_view->command_buffer.beginAppend();
+			m_current_view->command_buffer.setUniform(m_cluster_params_uniform, m_light_cluster.getGridParams());
+			m_current_view->command_buffer.setUniform(m_cluster_depth_uniform, m_light_cluster.getDepthParams());
+			m_current_view->command_buffer.setTexture(15 - m_global_textures_count, m_cluster_grid_uniform, m_light_cluster.getGridTexture());
+			++m_global_textures_count;
+			m_current_view->command_buffer.setTexture(15 - m_global_textures_count, m_cluster_indices_uniform, m_light_cluster.getIndexTexture());
+			++m_global_textures_count;
+			m_current_view->command_buffer.setTexture(15 - m_global_textures_count, m_cluster_lights_uniform, m_light_cluster.getLightTexture());
+			++m_global_textures_count;
+			m_current_view->command_buffer.end();
+		}
+
+
+		e_void Pipeline::renderClusteredLitGeometry(const Frustum& frustum, ComponentHandle camera, e_uint64 layer_mask)
+		{
+			PROFILE_FUNCTION();
+			if (!camera.isValid())
+				return;
+
+			m_is_clustered_light_pass = true;
+			renderMeshes(getMeshes(frustum, camera, layer_mask, true));
+			m_is_clustered_light_pass = false;
+		}
+
 		e_void Pipeline::bindRenderbuffer(bgfx::TextureHandle* rb, e_int32 width, e_int32 height, e_int32 uniform_idx)
 		{
 			if (!rb) return;
@@ -337,6 +430,7 @@ namespace egal
 			Material* material = mesh.material;
 
 			material->setDefine(m_instanced_define_idx, true);
+			material->setDefine(m_clustered_lights_define_idx, m_is_clustered_light_pass);
 
 			e_int32 view_idx = m_layer_to_view_map[material->getRenderLayer()];
 			ASSERT(view_idx >= 0);
@@ -416,21 +510,43 @@ namespace egal
 		bgfx::TextureHandle& Pipeline::getRenderbuffer(const e_char* framebuffer_name, e_int32 renderbuffer_idx)
 		{
 			static bgfx::TextureHandle invalid = BGFX_INVALID_HANDLE;
-			FrameBuffer* fb = getFramebuffer(framebuffer_name);
+			e_int32 handle = getFramebufferHandle(framebuffer_name);
+			FrameBuffer* fb = getFramebuffer(handle);
 			if (!fb) return invalid;
+			touchFramebuffer(handle);
 			return fb->getRenderbufferHandle(renderbuffer_idx);
 		}
 
+		e_int32 Pipeline::getFramebufferHandle(const e_char* framebuffer_name)
+		{
+			auto iter = m_framebuffer_map.find(crc32(framebuffer_name));
+			if (!iter.isValid()) return -1;
+			FrameBuffer* fb = m_framebuffers[iter.value()];
+			if (!fb || !StringUnitl::equalStrings(fb->getName(), framebuffer_name)) return -1;
+			return iter.value();
+		}
+
 		FrameBuffer* Pipeline::getFramebuffer(const e_char* framebuffer_name)
 		{
-			for (auto* framebuffer : m_framebuffers)
-			{
-				if (StringUnitl::equalStrings(framebuffer->getName(), framebuffer_name))
-				{
-					return framebuffer;
-				}
-			}
-			return nullptr;
+			return getFramebuffer(getFramebufferHandle(framebuffer_name));
+		}
+
+		FrameBuffer* Pipeline::getFramebuffer(e_int32 framebuffer)
+		{
+			if (framebuffer < 0 || framebuffer >= m_framebuffers.size()) return nullptr;
+			return m_framebuffers[framebuffer];
+		}
+
+		e_void Pipeline::touchFramebuffer(e_int32 framebuffer)
+		{
+			FrameBuffer* fb = getFramebuffer(framebuffer);
+			if (!fb) return;
+
+			FramebufferUse& use = m_framebuffer_uses[framebuffer];
+			e_int32 view = Math::maximum(m_view_idx, 0);
+			if (use.first_view < 0) use.first_view = view;
+			use.last_view = Math::maximum(use.last_view, view);
+			if (fb->isTransient()) m_has_transient_uses = true;
 		}
 
 		e_void Pipeline::setFramebuffer(const e_char* framebuffer_name)
@@ -438,6 +554,7 @@ namespace egal
 			if (!m_current_view) return;
 			if (StringUnitl::equalStrings(framebuffer_name, "default"))
 			{
+				m_current_framebuffer_handle = -1;
 				m_current_framebuffer = m_default_framebuffer;
 				if (m_current_framebuffer)
 				{
@@ -452,18 +569,32 @@ namespace egal
 				}
 				return;
 			}
-			m_current_framebuffer = getFramebuffer(framebuffer_name);
-			if (m_current_framebuffer)
+			e_int32 handle = getFramebufferHandle(framebuffer_name);
+			if (handle < 0)
 			{
-				bgfx::setViewFrameBuffer(m_current_view->bgfx_id, m_current_framebuffer->getHandle());
-				e_uint16 w = m_current_framebuffer->getWidth();
-				e_uint16 h = m_current_framebuffer->getHeight();
-				bgfx::setViewRect(m_current_view->bgfx_id, 0, 0, w, h);
+				m_current_framebuffer = nullptr;
+				log_error("Renderer Framebuffer %s not found.", framebuffer_name);
+				return;
 			}
-			else
+			setFramebuffer(handle);
+		}
+
+		e_void Pipeline::setFramebuffer(e_int32 framebuffer)
+		{
+			if (!m_current_view) return;
+			m_current_framebuffer = getFramebuffer(framebuffer);
+			if (!m_current_framebuffer)
 			{
-				log_error("Renderer Framebuffer %s not found.", framebuffer_name);
+				log_error("Renderer Framebuffer %d not found.", framebuffer);
+				return;
 			}
+
+			m_current_framebuffer_handle = framebuffer;
+			touchFramebuffer(framebuffer);
+			bgfx::setViewFrameBuffer(m_current_view->bgfx_id, m_current_framebuffer->getHandle());
+			e_uint16 w = m_current_framebuffer->getWidth();
+			e_uint16 h = m_current_framebuffer->getHeight();
+			bgfx::setViewRect(m_current_view->bgfx_id, 0, 0, w, h);
 		}
 
 		e_int32 Pipeline::getWidth() { return m_width; }
@@ -512,6 +643,8 @@ namespace egal
 			}
 			if (m_current_framebuffer)
 			{
+				/** the new view keeps rendering into the current framebuffer, which extends its lifetime */
+				touchFramebuffer(m_current_framebuffer_handle);
 				bgfx::setViewFrameBuffer(m_current_view->bgfx_id, m_current_framebuffer->getHandle());
 			}
 			else
@@ -525,12 +658,14 @@ namespace egal
 
 		e_void Pipeline::saveRenderbuffer(const e_char* framebuffer, e_int32 render_buffer_index, const e_char* out_path)
 		{
-			FrameBuffer* fb = getFramebuffer(framebuffer);
+			e_int32 handle = getFramebufferHandle(framebuffer);
+			FrameBuffer* fb = getFramebuffer(handle);
 			if (!fb)
 			{
 				log_error("Renderer saveRenderbuffer: Framebuffer %s not found", framebuffer);
 				return;
 			}
+			touchFramebuffer(handle);
 
 			bgfx::TextureHandle texture = bgfx::createTexture2D(
 				fb->getWidth(), fb->getHeight(), false, 1, bgfx::TextureFormat::RGBA8, BGFX_TEXTURE_READ_BACK);
@@ -561,10 +696,14 @@ namespace egal
 
 		e_void Pipeline::copyRenderbuffer(const e_char* src_fb_name, e_int32 src_rb_idx, const e_char* dest_fb_name, e_int32 dest_rb_idx)
 		{
-			FrameBuffer* src_fb = getFramebuffer(src_fb_name);
+			e_int32 src_handle = getFramebufferHandle(src_fb_name);
+			e_int32 dest_handle = getFramebufferHandle(dest_fb_name);
+			FrameBuffer* src_fb = getFramebuffer(src_handle);
 			if (!src_fb) return;
-			FrameBuffer* dest_fb = getFramebuffer(dest_fb_name);
+			FrameBuffer* dest_fb = getFramebuffer(dest_handle);
 			if (!dest_fb) return;
+			touchFramebuffer(src_handle);
+			touchFramebuffer(dest_handle);
 
 			if (bgfx::getCaps()->supported & BGFX_CAPS_TEXTURE_BLIT)
 			{
@@ -638,15 +777,19 @@ namespace egal
 
 		e_void Pipeline::removeFramebuffer(const e_char* framebuffer_name)
 		{
-			for (e_int32 i = 0; i < m_framebuffers.size(); ++i)
-			{
-				if (StringUnitl::equalStrings(m_framebuffers[i]->getName(), framebuffer_name))
-				{
-					_delete(m_allocator, m_framebuffers[i]);
-					m_framebuffers.erase(i);
-					break;
-				}
-			}
+			e_int32 handle = getFramebufferHandle(framebuffer_name);
+			if (handle < 0) return;
+
+			/** the slot stays so handles of other framebuffers remain valid */
+			FrameBuffer* fb = m_framebuffers[handle];
+			e_bool is_transient = fb->isTransient();
+			if (m_current_framebuffer == fb) m_current_framebuffer = nullptr;
+			if (m_current_framebuffer_handle == handle) m_current_framebuffer_handle = -1;
+			_delete(m_allocator, fb);
+			m_framebuffers[handle] = nullptr;
+			m_framebuffer_map.erase(crc32(framebuffer_name));
+			invalidateShadowCache();
+			if (is_transient) updateTransientFramebuffers();
 		}
 
 		e_void Pipeline::setMaterialDefine(e_int32 material_idx, const e_char* define, e_bool enabled)
@@ -659,7 +802,7 @@ namespace egal
 
 		e_void Pipeline::renderLightVolumes(e_int32 material_index)
 		{
-			//PROFILE_FUNCTION();
+			PROFILE_FUNCTION();
 			if (m_applied_camera == INVALID_COMPONENT) 
 				return;
 			Resource* res = m_scene->getEngine().getLuaResource(material_index);
@@ -671,7 +814,7 @@ namespace egal
 			TArrary<ComponentHandle> local_lights(frame_allocator);
 			m_scene->getPointLights(m_camera_frustum, local_lights);
 
-			//PROFILE_INT("light count", local_lights.size());
+			PROFILE_INT("light count", local_lights.size());
 			struct Data
 			{
 				float4x4 mtx;
@@ -758,7 +901,7 @@ namespace egal
 
 		e_void Pipeline::renderDecalsVolumes()
 		{
-			//PROFILE_FUNCTION();
+			PROFILE_FUNCTION();
 			if (m_applied_camera == INVALID_COMPONENT) return;
 			if (!m_current_view) return;
 
@@ -766,7 +909,7 @@ namespace egal
 			TArrary<DecalInfo> decals(frame_allocator);
 			m_scene->getDecals(m_camera_frustum, decals);
 
-			//PROFILE_INT("decal count", decals.size());
+			PROFILE_INT("decal count", decals.size());
 
 			const View& view = *m_current_view;
 			for (const DecalInfo& decal : decals)
@@ -789,51 +932,173 @@ namespace egal
 			}
 		}
 
-		e_void Pipeline::renderSpotLightShadowmap(ComponentHandle light)
+		/** the local light shadow atlas is split into SHADOW_ATLAS_GRID^2 cells, tiles are 8, 4, 2 or 1 cells wide */
+		enum { SHADOW_ATLAS_GRID = 8, SHADOW_ATLAS_LEVEL_COUNT = 4 };
+
+		static e_uint64 getShadowTileMask(e_int32 x, e_int32 y, e_int32 level)
 		{
-			newView("point_light", ~0ULL);
+			e_int32 size = SHADOW_ATLAS_GRID >> level;
+			e_uint64 row = ((1ULL << size) - 1) << x;
+			e_uint64 mask = 0;
+			for (e_int32 i = 0; i < size; ++i)
+			{
+				mask |= row << ((y + i) * SHADOW_ATLAS_GRID);
+			}
+			return mask;
+		}
 
-			GameObject light_entity = m_scene->getPointLightGameObject(light);
+		static e_bool allocateShadowTile(e_uint64& used_cells, e_int32 level, e_int32* x, e_int32* y)
+		{
+			e_int32 size = SHADOW_ATLAS_GRID >> level;
+			for (e_int32 j = 0; j < SHADOW_ATLAS_GRID; j += size)
+			{
+				for (e_int32 i = 0; i < SHADOW_ATLAS_GRID; i += size)
+				{
+					e_uint64 mask = getShadowTileMask(i, j, level);
+					if (used_cells & mask) continue;
+
+					used_cells |= mask;
+					*x = i;
+					*y = j;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/** level 0 for lights around the camera, every halving of the light's screen coverage halves its tile */
+		static e_int32 getShadowTileLevel(const float3& camera_pos, e_float camera_fov, const float3& light_pos, e_float range)
+		{
+			e_float dist = (light_pos - camera_pos).length();
+			if (dist <= range) return 0;
+
+			e_float coverage = range / (dist * tanf(camera_fov * 0.5f));
+			e_int32 level = 0;
+			while (level < SHADOW_ATLAS_LEVEL_COUNT - 1 && coverage < 1)
+			{
+				coverage *= 2;
+				++level;
+			}
+			return level;
+		}
+
+		e_void Pipeline::addPointLightShadowmap(const LocalShadowTile& tile)
+		{
+			e_float size = (e_float)(SHADOW_ATLAS_GRID >> tile.level) / SHADOW_ATLAS_GRID;
+			e_float u = (e_float)tile.x / SHADOW_ATLAS_GRID;
+			e_float v = (e_float)tile.y / SHADOW_ATLAS_GRID;
+			if (bgfx::getCaps()->originBottomLeft) v = 1 - v - size;
+
+			/** the matrices map into the light's tile of the atlas, omni faces into their quarter of it */
+			static const e_float face_offsets[] = { 0, 0, 0.5f, 0, 0, 0.5f, 0.5f, 0.5f };
+			e_bool is_omni = m_scene->getLightFOV(tile.light) > Math::C_Pi;
+			e_float face_size = is_omni ? size * 0.5f : size;
+			PointLightShadowmap& s = m_point_light_shadowmaps.emplace();
+			s.framebuffer = tile.framebuffer;
+			s.light = tile.light;
+			for (e_int32 i = 0; i < (is_omni ? 4 : 1); ++i)
+			{
+				e_float face_u = u + (is_omni ? face_offsets[i * 2] * size : 0);
+				e_float face_v = v + (is_omni ? face_offsets[i * 2 + 1] * size : 0);
+				/** view rects are placed from the top, with a bottom left origin the upper face has the larger v */
+				if (is_omni && bgfx::getCaps()->originBottomLeft) face_v = v + (0.5f - face_offsets[i * 2 + 1]) * size;
+				const float4x4 tile_matrix(
+					face_size, 0.0f, 0.0f, 0.0f,
+					0.0f, face_size, 0.0f, 0.0f,
+					0.0f, 0.0f, 1.0f, 0.0f,
+					face_u, face_v, 0.0f, 1.0f);
+				s.matrices[i] = tile_matrix * tile.matrices[i];
+			}
+		}
+
+		e_void Pipeline::renderShadowTile(LocalShadowTile& tile,
+			const float4x4* view_matrices,
+			const float4x4* projection_matrices,
+			const TArrary<EntityInstanceMesh>* faces,
+			e_int32 face_count)
+		{
+			/** moving casters are not reported as changes, a tile they touch is redrawn every frame they are in it */
+			e_bool has_dynamic = false;
+			for (e_int32 i = 0; i < face_count && !has_dynamic; ++i)
+			{
+				for (const EntityInstanceMesh& mesh : faces[i])
+				{
+					if (!m_scene->isStaticShadowCaster(mesh.entity_instance))
+					{
+						has_dynamic = true;
+						break;
+					}
+				}
+			}
+
+			e_bool redraw = tile.dirty || has_dynamic || tile.had_dynamic;
+			tile.had_dynamic = has_dynamic;
+			if (!redraw) return;
+			tile.dirty = false;
+
+			static const e_float viewports[] = { 0, 0, 0.5f, 0, 0, 0.5f, 0.5f, 0.5f };
+			e_int32 cell_width = tile.framebuffer->getWidth() / SHADOW_ATLAS_GRID;
+			e_int32 cell_height = tile.framebuffer->getHeight() / SHADOW_ATLAS_GRID;
+			e_int32 tile_width = cell_width * (SHADOW_ATLAS_GRID >> tile.level);
+			e_int32 tile_height = cell_height * (SHADOW_ATLAS_GRID >> tile.level);
+			e_int32 face_width = face_count > 1 ? tile_width >> 1 : tile_width;
+			e_int32 face_height = face_count > 1 ? tile_height >> 1 : tile_height;
+
+			m_is_current_light_global = false;
+			for (e_int32 i = 0; i < face_count; ++i)
+			{
+				newView(face_count > 1 ? "omnilight" : "point_light", ~0ULL);
+
+				/** the clear is limited to the view rect, so other tiles of the atlas keep their cached content */
+				bgfx::setViewClear(m_current_view->bgfx_id, BGFX_CLEAR_DEPTH, 0, 1.0f, 0);
+				bgfx::touch(m_current_view->bgfx_id);
+				const e_float* viewport = face_count > 1 ? &viewports[i * 2] : nullptr;
+				bgfx::setViewRect(m_current_view->bgfx_id,
+					(e_uint16)(tile.x * cell_width + (viewport ? tile_width * viewport[0] : 0)),
+					(e_uint16)(tile.y * cell_height + (viewport ? tile_height * viewport[1] : 0)),
+					(e_uint16)face_width,
+					(e_uint16)face_height);
+				bgfx::setViewTransform(m_current_view->bgfx_id, &view_matrices[i].m11, &projection_matrices[i].m11);
+
+				renderMeshes(faces[i]);
+			}
+		}
+
+		e_void Pipeline::renderSpotLightShadowmap(LocalShadowTile& tile)
+		{
+			GameObject light_entity = m_scene->getPointLightGameObject(tile.light);
 			float4x4 mtx = m_scene->getComponentManager().getMatrix(light_entity);
-			e_float fov = m_scene->getLightFOV(light);
-			e_float range = m_scene->getLightRange(light);
-			e_uint16 shadowmap_height = (e_uint16)m_current_framebuffer->getHeight();
-			e_uint16 shadowmap_width = (e_uint16)m_current_framebuffer->getWidth();
+			e_float fov = m_scene->getLightFOV(tile.light);
+			e_float range = m_scene->getLightRange(tile.light);
 			float3 pos = mtx.getTranslation();
 
-			bgfx::setViewClear(m_current_view->bgfx_id, BGFX_CLEAR_DEPTH, 0, 1.0f, 0);
-			bgfx::touch(m_current_view->bgfx_id);
-			bgfx::setViewRect(m_current_view->bgfx_id, 0, 0, shadowmap_width, shadowmap_height);
-
 			float4x4 projection_matrix;
 			projection_matrix.setPerspective(fov, 1, 0.01f, range, bgfx::getCaps()->homogeneousDepth);
 			float4x4 view_matrix;
 			view_matrix.lookAt(pos, pos - mtx.getZVector(), mtx.getYVector());
-			bgfx::setViewTransform(m_current_view->bgfx_id, &view_matrix.m11, &projection_matrix.m11);
 
-			PointLightShadowmap& s = m_point_light_shadowmaps.emplace();
-			s.framebuffer = m_current_framebuffer;
-			s.light = light;
 			e_float ymul = bgfx::getCaps()->originBottomLeft ? 0.5f : -0.5f;
 			static const float4x4 biasMatrix(
 				0.5,  0.0, 0.0, 0.0,
 				0.0, ymul, 0.0, 0.0,
 				0.0,  0.0, 0.5, 0.0,
 				0.5,  0.5, 0.5, 1.0);
-			s.matrices[0] = biasMatrix * (projection_matrix * view_matrix);
+			tile.matrices[0] = biasMatrix * (projection_matrix * view_matrix);
+			addPointLightShadowmap(tile);
+
+			Frustum frustum;
+			frustum.computePerspective(pos, -mtx.getZVector(), mtx.getYVector(), fov, 1, 0.01f, range);
+			TArrary<EntityInstanceMesh> meshes(m_renderer.getEngine().getLIFOAllocator());
+			m_scene->getPointLightInfluencedGeometry(tile.light, &frustum, 1, &meshes);
 
-			renderPointLightInfluencedGeometry(light);
+			renderShadowTile(tile, &view_matrix, &projection_matrix, &meshes, 1);
 		}
 
-		e_void Pipeline::renderOmniLightShadowmap(ComponentHandle light)
+		e_void Pipeline::renderOmniLightShadowmap(LocalShadowTile& tile)
 		{
-			GameObject light_entity = m_scene->getPointLightGameObject(light);
+			GameObject light_entity = m_scene->getPointLightGameObject(tile.light);
 			float3 light_pos = m_scene->getComponentManager().getPosition(light_entity);
-			e_float range = m_scene->getLightRange(light);
-			e_uint16 shadowmap_height = (e_uint16)m_current_framebuffer->getHeight();
-			e_uint16 shadowmap_width = (e_uint16)m_current_framebuffer->getWidth();
-
-			e_float viewports[] = {0, 0, 0.5, 0, 0, 0.5, 0.5, 0.5};
+			e_float range = m_scene->getLightRange(tile.light);
 
 			static const e_float YPR_gl[4][3] = {
 				{Math::degreesToRadians(-90.0f), Math::degreesToRadians(-27.36780516f), Math::degreesToRadians(0.0f)},
@@ -849,31 +1114,18 @@ namespace egal
 				{Math::degreesToRadians(90.0f), Math::degreesToRadians(-27.36780516f), Math::degreesToRadians(0.0f)},
 			};
 
-			PointLightShadowmap& shadowmap_info = m_point_light_shadowmaps.emplace();
-			shadowmap_info.framebuffer = m_current_framebuffer;
-			shadowmap_info.light = light;
-			//setPointLightUniforms(light);
+			e_float fovx = Math::degreesToRadians(143.98570868f + 3.51f);
+			e_float fovy = Math::degreesToRadians(125.26438968f + 9.85f);
+			e_float aspect = tanf(fovx * 0.5f) / tanf(fovy * 0.5f);
 
-			IAllocator& frame_allocator = m_renderer.getEngine().getLIFOAllocator();
+			float4x4 view_matrices[4];
+			float4x4 projection_matrices[4];
+			Frustum frustums[4];
 			for (e_int32 i = 0; i < 4; ++i)
 			{
-				newView("omnilight", 0xff);
+				projection_matrices[i].setPerspective(fovx, aspect, 0.01f, range, bgfx::getCaps()->homogeneousDepth);
 
-				bgfx::setViewClear(m_current_view->bgfx_id, BGFX_CLEAR_DEPTH, 0, 1.0f, 0);
-				bgfx::touch(m_current_view->bgfx_id);
-				e_uint16 view_x = e_uint16(shadowmap_width * viewports[i * 2]);
-				e_uint16 view_y = e_uint16(shadowmap_height * viewports[i * 2 + 1]);
-				bgfx::setViewRect(
-					m_current_view->bgfx_id, view_x, view_y, shadowmap_width >> 1, shadowmap_height >> 1);
-
-				e_float fovx = Math::degreesToRadians(143.98570868f + 3.51f);
-				e_float fovy = Math::degreesToRadians(125.26438968f + 9.85f);
-				e_float aspect = tanf(fovx * 0.5f) / tanf(fovy * 0.5f);
-
-				float4x4 projection_matrix;
-				projection_matrix.setPerspective(fovx, aspect, 0.01f, range, bgfx::getCaps()->homogeneousDepth);
-
-				float4x4 view_matrix;
+				float4x4& view_matrix = view_matrices[i];
 				if (bgfx::getCaps()->originBottomLeft)
 				{
 					view_matrix.fromEuler(YPR_gl[i][0], YPR_gl[i][1], YPR_gl[i][2]);
@@ -883,8 +1135,7 @@ namespace egal
 					view_matrix.fromEuler(YPR[i][0], YPR[i][1], YPR[i][2]);
 				}
 				view_matrix.setTranslation(light_pos);
-				Frustum frustum;
-				frustum.computePerspective(light_pos,
+				frustums[i].computePerspective(light_pos,
 					-view_matrix.getZVector(),
 					view_matrix.getYVector(),
 					fovx,
@@ -894,53 +1145,177 @@ namespace egal
 
 				view_matrix.fastInverse();
 
-				bgfx::setViewTransform(m_current_view->bgfx_id, &view_matrix.m11, &projection_matrix.m11);
-
 				e_float ymul = bgfx::getCaps()->originBottomLeft ? 0.5f : -0.5f;
 				static const float4x4 biasMatrix(
 					0.5, 0.0, 0.0, 0.0, 0.0, ymul, 0.0, 0.0, 0.0, 0.0, 0.5, 0.0, 0.5, 0.5, 0.5, 1.0);
-				shadowmap_info.matrices[i] = biasMatrix * (projection_matrix * view_matrix);
-
-				TArrary<EntityInstanceMesh> tmp_meshes(frame_allocator);
-				m_is_current_light_global = false;
-				m_scene->getPointLightInfluencedGeometry(light, frustum, tmp_meshes);
-
-				renderMeshes(tmp_meshes);
+				tile.matrices[i] = biasMatrix * (projection_matrices[i] * view_matrix);
 			}
+			addPointLightShadowmap(tile);
+
+			/**
+			 * One culling pass for the whole light, casters are bucketed into the faces they overlap.
+			 * The buckets grow interleaved, so they live in the frame allocator instead of the LIFO one.
+			 */
+			IAllocator& bucket_allocator = m_renderer.getEngine().getFrameAllocator();
+			TArrary<TArrary<EntityInstanceMesh>> faces(bucket_allocator);
+			faces.reserve(4);
+			for (e_int32 i = 0; i < 4; ++i)
+			{
+				faces.emplace(bucket_allocator);
+			}
+			m_scene->getPointLightInfluencedGeometry(tile.light, frustums, 4, &faces[0]);
+
+			renderShadowTile(tile, view_matrices, projection_matrices, &faces[0], 4);
 		}
 
 		e_void Pipeline::renderLocalLightShadowmaps(ComponentHandle camera, FrameBuffer** fbs, e_int32 framebuffers_count)
 		{
 			if (!camera.isValid()) return;
+			PROFILE_FUNCTION();
 
 			ComponentManager& com_man = m_scene->getComponentManager();
 			GameObject camera_entity = m_scene->getCameraGameObject(camera);
 			float3 camera_pos = com_man.getPosition(camera_entity);
+			e_float camera_fov = m_scene->getCameraFOV(camera);
 
 			ComponentHandle lights[16];
 			e_int32 light_count = m_scene->getClosestPointLights(camera_pos, lights, TlengthOf(lights));
+			framebuffers_count = Math::minimum(framebuffers_count, 16);
+
+			/** tiles are kept between frames, a transient page shares pooled textures and would lose them */
+			FrameBuffer* pages[16];
+			for (e_int32 i = 0; i < framebuffers_count; ++i)
+			{
+				pages[i] = fbs[i] && !fbs[i]->isTransient() ? fbs[i] : nullptr;
+				if (fbs[i] && !pages[i]) log_error("Renderer Transient framebuffer can not be a shadow atlas page.");
+			}
 
-			e_int32 fb_index = 0;
+			for (LocalShadowTile& tile : m_local_shadow_tiles)
+			{
+				tile.used = false;
+			}
+
+			/** lights keep their tile while its size still matches their coverage, so cached tiles are not moved */
+			e_uint64 used_cells[16] = {};
+			ComponentHandle pending[16];
+			e_int32 pending_levels[16];
+			e_int32 pending_count = 0;
 			for (e_int32 i = 0; i < light_count; ++i)
 			{
 				if (!m_scene->getLightCastShadows(lights[i])) continue;
-				if (fb_index == framebuffers_count) break;
 
-				e_float fov = m_scene->getLightFOV(lights[i]);
+				float3 light_pos = com_man.getPosition(m_scene->getPointLightGameObject(lights[i]));
+				e_int32 level = getShadowTileLevel(camera_pos, camera_fov, light_pos, m_scene->getLightRange(lights[i]));
+
+				LocalShadowTile* tile = nullptr;
+				for (LocalShadowTile& t : m_local_shadow_tiles)
+				{
+					if (t.light == lights[i]) tile = &t;
+				}
+				if (tile && tile->level == level)
+				{
+					e_uint64 mask = getShadowTileMask(tile->x, tile->y, tile->level);
+					for (e_int32 page = 0; page < framebuffers_count; ++page)
+					{
+						if (pages[page] != tile->framebuffer || (used_cells[page] & mask)) continue;
+
+						used_cells[page] |= mask;
+						tile->used = true;
+						break;
+					}
+					if (tile->used) continue;
+				}
+
+				e_int32 j = pending_count++;
+				for (; j > 0 && pending_levels[j - 1] > level; --j)
+				{
+					pending[j] = pending[j - 1];
+					pending_levels[j] = pending_levels[j - 1];
+				}
+				pending[j] = lights[i];
+				pending_levels[j] = level;
+			}
+
+			/** largest tiles first, a light that does not fit falls back to smaller tiles and then to no shadow */
+			for (e_int32 i = 0; i < pending_count; ++i)
+			{
+				e_int32 x = 0, y = 0, page = -1;
+				for (e_int32 level = pending_levels[i]; level < SHADOW_ATLAS_LEVEL_COUNT && page < 0; ++level)
+				{
+					for (e_int32 j = 0; j < framebuffers_count; ++j)
+					{
+						if (!pages[j] || !allocateShadowTile(used_cells[j], level, &x, &y)) continue;
+
+						page = j;
+						pending_levels[i] = level;
+						break;
+					}
+				}
+				if (page < 0) continue;
+
+				LocalShadowTile* tile = nullptr;
+				for (LocalShadowTile& t : m_local_shadow_tiles)
+				{
+					if (t.light == pending[i]) tile = &t;
+				}
+				if (!tile) tile = &m_local_shadow_tiles.emplace();
+				tile->light = pending[i];
+				tile->framebuffer = pages[page];
+				tile->x = x;
+				tile->y = y;
+				tile->level = pending_levels[i];
+				tile->dirty = true;
+				tile->had_dynamic = false;
+				tile->used = true;
+			}
+
+			for (e_int32 i = m_local_shadow_tiles.size() - 1; i >= 0; --i)
+			{
+				if (!m_local_shadow_tiles[i].used) m_local_shadow_tiles.eraseFast(i);
+			}
+
+			const TArrary<Sphere>& caster_changes = m_scene->getShadowCasterChanges();
+			for (LocalShadowTile& tile : m_local_shadow_tiles)
+			{
+				float4x4 light_matrix = com_man.getMatrix(m_scene->getPointLightGameObject(tile.light));
+				e_float range = m_scene->getLightRange(tile.light);
+				e_float fov = m_scene->getLightFOV(tile.light);
+				if (StringUnitl::compareMemory(&light_matrix, &tile.light_matrix, sizeof(light_matrix)) != 0
+					|| range != tile.range
+					|| fov != tile.fov)
+				{
+					tile.light_matrix = light_matrix;
+					tile.range = range;
+					tile.fov = fov;
+					tile.dirty = true;
+				}
+
+				float3 light_pos = light_matrix.getTranslation();
+				for (e_int32 i = 0; i < caster_changes.size() && !tile.dirty; ++i)
+				{
+					const Sphere& sphere = caster_changes[i];
+					e_float max_dist = sphere.radius + range;
+					if ((sphere.position - light_pos).squaredLength() <= max_dist * max_dist) tile.dirty = true;
+				}
 
-				m_current_framebuffer = fbs[i];
+				/** the page is tracked like any other render target, views rendering into it extend its lifetime */
+				m_current_framebuffer = tile.framebuffer;
+				m_current_framebuffer_handle = m_framebuffers.indexOf(tile.framebuffer);
 				if (fov < Math::C_Pi)
 				{
-					renderSpotLightShadowmap(lights[i]);
+					renderSpotLightShadowmap(tile);
 				}
 				else
 				{
-					renderOmniLightShadowmap(lights[i]);
+					renderOmniLightShadowmap(tile);
 				}
-				++fb_index;
 			}
 		}
 
+		/** cascades are rendered this much larger than the split, so the camera can move before they are redrawn */
+		static const e_float SHADOW_CACHE_MARGIN = 0.15f;
+		static const e_float SHADOW_CACHE_MIN_LIGHT_DOT = 0.99999f;
+
 		static float3 shadowmapTexelAlign(const float3& shadow_cam_pos,
 			e_float shadowmap_width,
 			e_float frustum_radius,
@@ -1008,15 +1383,13 @@ namespace egal
 			e_float camera_ratio = m_scene->getCameraScreenWidth(m_applied_camera) / camera_height;
 			float4 cascades = m_scene->getShadowmapCascades(light_cmp);
 			e_float split_distances[] = {0.1f, cascades.x, cascades.y, cascades.z, cascades.w};
-			m_is_rendering_in_shadowmap = true;
-			bgfx::setViewClear(m_current_view->bgfx_id, BGFX_CLEAR_DEPTH | BGFX_CLEAR_COLOR, 0xffffffff, 1.0f, 0);
-			bgfx::touch(m_current_view->bgfx_id);
 			e_float* viewport = (bgfx::getCaps()->originBottomLeft ? viewports_gl : viewports) + split_index * 2;
 			bgfx::setViewRect(m_current_view->bgfx_id,
 				(e_uint16)(1 + shadowmap_width * viewport[0]),
 				(e_uint16)(1 + shadowmap_height * viewport[1]),
 				(e_uint16)(0.5f * shadowmap_width - 2),
 				(e_uint16)(0.5f * shadowmap_height - 2));
+			if (split_index == 0) ++m_shadow_frame;
 
 			Frustum camera_frustum;
 			float4x4 camera_matrix = com_man.getMatrix(m_scene->getCameraGameObject(m_applied_camera));
@@ -1029,202 +1402,129 @@ namespace egal
 				split_distances[split_index + 1]);
 
 			Sphere frustum_bounding_sphere = camera_frustum.computeBoundingSphere();
-			float3 shadow_cam_pos = frustum_bounding_sphere.position;
 			e_float bb_size = frustum_bounding_sphere.radius;
-			shadow_cam_pos = shadowmapTexelAlign(shadow_cam_pos, 0.5f * shadowmap_width - 2, bb_size, light_mtx);
-
-			float4x4 projection_matrix;
-			projection_matrix.setOrtho(-bb_size, bb_size, -bb_size, bb_size, SHADOW_CAM_NEAR, SHADOW_CAM_FAR, bgfx::getCaps()->homogeneousDepth);
 			float3 light_forward = light_mtx.getZVector();
-			shadow_cam_pos -= light_forward * SHADOW_CAM_FAR * 0.5f;
-			float4x4 view_matrix;
-			view_matrix.lookAt(shadow_cam_pos, shadow_cam_pos + light_forward, light_mtx.getYVector());
-			bgfx::setViewTransform(m_current_view->bgfx_id, &view_matrix.m11, &projection_matrix.m11);
-			e_float ymul = bgfx::getCaps()->originBottomLeft ? 0.5f : -0.5f;
-			static const float4x4 biasMatrix(0.5, 0.0, 0.0, 0.0, 0.0, ymul, 0.0, 0.0, 0.0, 0.0, 0.5, 0.0, 0.5, 0.5, 0.5, 1.0);
-			m_shadow_viewprojection[split_index] = biasMatrix * (projection_matrix * view_matrix);
 
-			Frustum shadow_camera_frustum;
-			shadow_camera_frustum.computeOrtho(
-				shadow_cam_pos, -light_forward, light_mtx.getYVector(), bb_size, bb_size, SHADOW_CAM_NEAR, SHADOW_CAM_FAR);
+			/** the projection is kept while it still covers the split, so an unchanged cascade can be reused as is */
+			ShadowCascadeCache& cache = m_shadow_cascades[split_index];
+			/** a transient target shares pooled textures with other views, its content does not survive the frame */
+			e_bool covers = cache.valid
+				&& cache.framebuffer == m_current_framebuffer
+				&& m_current_framebuffer && !m_current_framebuffer->isTransient()
+				&& dotProduct(cache.light_forward, light_forward) > SHADOW_CACHE_MIN_LIGHT_DOT
+				&& (frustum_bounding_sphere.position - cache.center).length() + bb_size <= cache.radius
+				&& bb_size * (1 + 2 * SHADOW_CACHE_MARGIN) >= cache.radius;
+			if (!covers)
+			{
+				cache.framebuffer = m_current_framebuffer;
+				cache.light_forward = light_forward;
+				cache.center = frustum_bounding_sphere.position;
+				cache.radius = bb_size * (1 + SHADOW_CACHE_MARGIN);
+
+				float3 shadow_cam_pos = shadowmapTexelAlign(cache.center, 0.5f * shadowmap_width - 2, cache.radius, light_mtx);
+				cache.projection_matrix.setOrtho(-cache.radius, cache.radius, -cache.radius, cache.radius, SHADOW_CAM_NEAR, SHADOW_CAM_FAR, bgfx::getCaps()->homogeneousDepth);
+				shadow_cam_pos -= light_forward * SHADOW_CAM_FAR * 0.5f;
+				cache.view_matrix.lookAt(shadow_cam_pos, shadow_cam_pos + light_forward, light_mtx.getYVector());
+				/** no extra planes from the camera frustum, the cascade has to stay valid while the camera moves */
+				cache.frustum.computeOrtho(
+					shadow_cam_pos, -light_forward, light_mtx.getYVector(), cache.radius, cache.radius, SHADOW_CAM_NEAR, SHADOW_CAM_FAR);
+				cache.valid = true;
+				cache.dirty = true;
+			}
+
+			for (const Sphere& sphere : m_scene->getShadowCasterChanges())
+			{
+				if (cache.frustum.isSphereInside(sphere.position, sphere.radius))
+				{
+					cache.dirty = true;
+					break;
+				}
+			}
 
-			findExtraShadowcasterPlanes(light_forward, camera_frustum, camera_matrix.getTranslation(), &shadow_camera_frustum);
+			bgfx::setViewTransform(m_current_view->bgfx_id, &cache.view_matrix.m11, &cache.projection_matrix.m11);
+			e_float ymul = bgfx::getCaps()->originBottomLeft ? 0.5f : -0.5f;
+			static const float4x4 biasMatrix(0.5, 0.0, 0.0, 0.0, 0.0, ymul, 0.0, 0.0, 0.0, 0.0, 0.5, 0.0, 0.5, 0.5, 0.5, 1.0);
+			m_shadow_viewprojection[split_index] = biasMatrix * (cache.projection_matrix * cache.view_matrix);
 
-			renderAll(shadow_camera_frustum, false, m_applied_camera, m_current_view->layer_mask);
+			TArrary<TArrary<EntityInstanceMesh>>& meshes = getMeshes(cache.frustum, m_applied_camera, m_current_view->layer_mask, false);
+			e_bool has_dynamic = false;
+			for (const TArrary<EntityInstanceMesh>& subresult : meshes)
+			{
+				for (const EntityInstanceMesh& mesh : subresult)
+				{
+					if (!m_scene->isStaticShadowCaster(mesh.entity_instance))
+					{
+						has_dynamic = true;
+						break;
+					}
+				}
+				if (has_dynamic) break;
+			}
 
+			/**
+			 * Dynamic casters can not be composited over a cached static layer, bgfx copies depth surfaces only whole
+			 * on some backends and the cascades share one atlas, so a cascade with dynamic casters is redrawn in full.
+			 * Far cascades pick up static changes every other frame.
+			 */
+			e_bool staggered = covers && split_index >= 2 && ((m_shadow_frame + split_index) & 1) != 0;
+			e_bool redraw = has_dynamic || cache.had_dynamic || (cache.dirty && !staggered);
+			cache.had_dynamic = has_dynamic;
+			if (!redraw) return;
+
+			cache.dirty = false;
+			m_is_rendering_in_shadowmap = true;
+			bgfx::setViewClear(m_current_view->bgfx_id, BGFX_CLEAR_DEPTH | BGFX_CLEAR_COLOR, 0xffffffff, 1.0f, 0);
+			bgfx::touch(m_current_view->bgfx_id);
+			renderMeshes(meshes);
 			m_is_rendering_in_shadowmap = false;
 		}
 
 		e_void Pipeline::renderDebugShapes()
 		{
-			if (!bgfx::isValid(m_debug_index_buffer))
-			{
-				auto* mem = bgfx::alloc(0xffFF * 2);
-				e_uint16* data = (e_uint16*)mem->data;
-				for (e_uint16 i = 0; i < 0xffff; ++i) data[i] = i;
-				m_debug_index_buffer = bgfx::createDynamicIndexBuffer(mem);
-			}
-
-			m_debug_buffer_idx = 0;
 			renderDebugTriangles();
 			renderDebugLines();
 			renderDebugPoints();
 		}
 
-		e_void Pipeline::renderDebugPoints()
+		e_void Pipeline::renderDebugPrimitives(e_int32 type, e_int32 vertices_per_primitive, e_uint64 primitive_state)
 		{
-			if (!m_current_view) return;
+			if (!m_current_view || !m_debug_line_material->isReady()) return;
 
-			const TArrary<DebugPoint>& points = m_scene->getDebugPoints();
-			if (points.empty() || !m_debug_line_material->isReady()) return;
+			const DebugDrawBuffer& buffer = m_scene->getDebugDrawBuffer();
+			DebugDrawBuffer::Primitive primitive = (DebugDrawBuffer::Primitive)type;
+			e_int32 vertex_count = buffer.getVertexCount(primitive);
+			if (vertex_count == 0) return;
 
-			static const e_int32 BATCH_SIZE = 0xffff;
-			View& view = *m_current_view;
+			/** whatever does not fit into this frame's transient buffer is dropped, debug drawing must not stall */
+			vertex_count = bgfx::getAvailTransientVertexBuffer(vertex_count, m_base_vertex_decl);
+			vertex_count -= vertex_count % vertices_per_primitive;
+			if (vertex_count == 0) return;
 
-			for (e_int32 j = 0; j < points.size() && m_debug_buffer_idx < TlengthOf(m_debug_vertex_buffers);
-				j += BATCH_SIZE, ++m_debug_buffer_idx)
-			{
-				if (!bgfx::isValid(m_debug_vertex_buffers[m_debug_buffer_idx]))
-				{
-					m_debug_vertex_buffers[m_debug_buffer_idx] = bgfx::createDynamicVertexBuffer(0xffFF, m_base_vertex_decl);
-				}
-
-				e_int32 point_count = Math::minimum(BATCH_SIZE, points.size() - j);
-				auto* mem = bgfx::alloc(sizeof(BaseVertex) * point_count);
-
-				BaseVertex* vertex = (BaseVertex*)mem->data;
-				for (e_int32 i = 0; i < points.size(); ++i)
-				{
-					const DebugPoint& point = points[i];
-					vertex[0].rgba = point.color;
-					vertex[0].x = point.pos.x;
-					vertex[0].y = point.pos.y;
-					vertex[0].z = point.pos.z;
-					vertex[0].u = vertex[0].v = 0;
-
-					++vertex;
-				}
+			bgfx::TransientVertexBuffer vb;
+			bgfx::allocTransientVertexBuffer(&vb, vertex_count, m_base_vertex_decl);
+			vertex_count = buffer.copyVertices(primitive, (DebugVertex*)vb.data, vertex_count);
 
-				bgfx::updateDynamicVertexBuffer(m_debug_vertex_buffers[m_debug_buffer_idx], 0, mem);
+			View& view = *m_current_view;
+			bgfx::setVertexBuffer(0, &vb, 0, vertex_count);
+			bgfx::setStencil(view.stencil, BGFX_STENCIL_NONE);
+			bgfx::setState(view.render_state | m_debug_line_material->getRenderStates() | primitive_state);
+			++m_stats.draw_call_count;
+			bgfx::submit(m_current_view->bgfx_id, m_debug_line_material->getShaderInstance().getProgramHandle(m_pass_idx));
+		}
 
-				bgfx::setVertexBuffer(0, m_debug_vertex_buffers[m_debug_buffer_idx]);
-				bgfx::setIndexBuffer(m_debug_index_buffer, 0, point_count);
-				bgfx::setStencil(view.stencil, BGFX_STENCIL_NONE);
-				bgfx::setState(view.render_state | m_debug_line_material->getRenderStates() | BGFX_STATE_PT_POINTS);
-				bgfx::submit(
-					m_current_view->bgfx_id, m_debug_line_material->getShaderInstance().getProgramHandle(m_pass_idx));
-			}
+		e_void Pipeline::renderDebugPoints()
+		{
+			renderDebugPrimitives(DebugDrawBuffer::POINTS, 1, BGFX_STATE_PT_POINTS);
 		}
 
 		e_void Pipeline::renderDebugLines()
 		{
-			if (!m_current_view) 
-				return;
-
-			const TArrary<DebugLine>& lines = m_scene->getDebugLines();
-			if (lines.empty() || !m_debug_line_material->isReady()) 
-				return;
-
-			static const e_int32 BATCH_SIZE = 0xffff / 2;
-			View& view = *m_current_view;
-
-			for (e_int32 j = 0; j < lines.size() && m_debug_buffer_idx < TlengthOf(m_debug_vertex_buffers);
-				 j += BATCH_SIZE, ++m_debug_buffer_idx)
-			{
-				if (!bgfx::isValid(m_debug_vertex_buffers[m_debug_buffer_idx]))
-				{
-					m_debug_vertex_buffers[m_debug_buffer_idx] = bgfx::createDynamicVertexBuffer(0xffFF, m_base_vertex_decl);
-				}
-
-				e_int32 line_count = Math::minimum(BATCH_SIZE, lines.size() - j);
-				auto* mem = bgfx::alloc(sizeof(BaseVertex) * 2 * line_count);
-			
-				BaseVertex* vertex = (BaseVertex*)mem->data;
-				for (e_int32 i = 0; i < line_count; ++i)
-				{
-					const DebugLine& line = lines[j + i];
-					vertex[0].rgba = line.color;
-					vertex[0].x = line.from.x;
-					vertex[0].y = line.from.y;
-					vertex[0].z = line.from.z;
-					vertex[0].u = vertex[0].v = 0;
-
-					vertex[1].rgba = line.color;
-					vertex[1].x = line.to.x;
-					vertex[1].y = line.to.y;
-					vertex[1].z = line.to.z;
-					vertex[1].u = vertex[0].v = 0;
-
-					vertex += 2;
-				}
-
-				bgfx::updateDynamicVertexBuffer(m_debug_vertex_buffers[m_debug_buffer_idx], 0, mem);
-
-				bgfx::setVertexBuffer(0, m_debug_vertex_buffers[m_debug_buffer_idx]);
-				bgfx::setIndexBuffer(m_debug_index_buffer, 0, line_count * 2);
-				bgfx::setStencil(view.stencil, BGFX_STENCIL_NONE);
-				bgfx::setState(view.render_state | m_debug_line_material->getRenderStates() | BGFX_STATE_PT_LINES);
-				bgfx::submit(
-					m_current_view->bgfx_id, m_debug_line_material->getShaderInstance().getProgramHandle(m_pass_idx));
-			}
+			renderDebugPrimitives(DebugDrawBuffer::LINES, 2, BGFX_STATE_PT_LINES);
 		}
 
-
 		e_void Pipeline::renderDebugTriangles()
 		{
-			if (!m_current_view) return;
-
-			const auto& tris = m_scene->getDebugTriangles();
-			if(tris.empty() || !m_debug_line_material->isReady()) return;
-
-			static const e_int32 BATCH_SIZE = 0xffFF / 3;
-			View& view = *m_current_view;
-
-			for (e_int32 j = 0; j < tris.size() && m_debug_buffer_idx < TlengthOf(m_debug_vertex_buffers);
-				 j += BATCH_SIZE, ++m_debug_buffer_idx)
-			{
-				if (!bgfx::isValid(m_debug_vertex_buffers[m_debug_buffer_idx]))
-				{
-					m_debug_vertex_buffers[m_debug_buffer_idx] = bgfx::createDynamicVertexBuffer(0xffFF, m_base_vertex_decl);
-				}
-
-				e_int32 tri_count = Math::minimum(BATCH_SIZE, tris.size() - j);
-				auto* mem = bgfx::alloc(sizeof(BaseVertex) * 3 * tri_count);
-
-				BaseVertex* vertex = (BaseVertex*)mem->data;
-				for (e_int32 i = 0; i < tri_count; ++i)
-				{
-					const DebugTriangle& tri = tris[j + i];
-					vertex[0].rgba = tri.color;
-					vertex[0].x = tri.p0.x;
-					vertex[0].y = tri.p0.y;
-					vertex[0].z = tri.p0.z;
-					vertex[0].u = vertex[0].v = 0;
-
-					vertex[1].rgba = tri.color;
-					vertex[1].x = tri.p1.x;
-					vertex[1].y = tri.p1.y;
-					vertex[1].z = tri.p1.z;
-					vertex[1].u = vertex[0].v = 0;
-
-					vertex[2].rgba = tri.color;
-					vertex[2].x = tri.p2.x;
-					vertex[2].y = tri.p2.y;
-					vertex[2].z = tri.p2.z;
-					vertex[2].u = vertex[0].v = 0;
-
-					vertex += 3;
-				}
-
-				bgfx::updateDynamicVertexBuffer(m_debug_vertex_buffers[m_debug_buffer_idx], 0, mem);
-
-				bgfx::setVertexBuffer(0, m_debug_vertex_buffers[m_debug_buffer_idx]);
-				bgfx::setIndexBuffer(m_debug_index_buffer, 0, tri_count * 3);
-				bgfx::setStencil(view.stencil, BGFX_STENCIL_NONE);
-				bgfx::setState(view.render_state | m_debug_line_material->getRenderStates());
-				bgfx::submit(
-					m_current_view->bgfx_id, m_debug_line_material->getShaderInstance().getProgramHandle(m_pass_idx));
-			}
+			renderDebugPrimitives(DebugDrawBuffer::TRIANGLES, 3, 0);
 		}
 
 		e_void Pipeline::setPointLightUniforms(ComponentHandle light_cmp)
@@ -1377,7 +1677,7 @@ namespace egal
 
 		e_void Pipeline::renderPointLightInfluencedGeometry(ComponentHandle light)
 		{
-			//PROFILE_FUNCTION();
+			PROFILE_FUNCTION();
 
 			TArrary<EntityInstanceMesh> tmp_meshes(m_renderer.getEngine().getLIFOAllocator());
 			m_scene->getPointLightInfluencedGeometry(light, tmp_meshes);
@@ -1387,15 +1687,17 @@ namespace egal
 
 		e_void Pipeline::renderPointLightInfluencedGeometry(const Frustum& frustum)
 		{
-			//PROFILE_FUNCTION();
+			PROFILE_FUNCTION();
 
-			TArrary<ComponentHandle> lights(m_allocator);
+			TArrary<ComponentHandle> lights(m_renderer.getEngine().getFrameAllocator());
 			m_scene->getPointLights(frustum, lights);
 			IAllocator& frame_allocator = m_renderer.getEngine().getLIFOAllocator();
 			m_is_current_light_global	= false;
 			for (e_int32 i = 0; i < lights.size(); ++i)
 			{
+				/** lights without shadows are in the light clusters */
 				ComponentHandle light = lights[i];
+				if (!m_scene->getLightCastShadows(light)) continue;
 				setPointLightUniforms(light);
 
 				{
@@ -1568,28 +1870,14 @@ namespace egal
 
 		e_void Pipeline::renderAll(const Frustum& frustum, e_bool render_grass, ComponentHandle camera, e_uint64 layer_mask)
 		{
-			//PROFILE_FUNCTION();
+			PROFILE_FUNCTION();
 
 			if (!m_applied_camera.isValid()) 
 				return;
 
-			GameObject camera_entity = m_scene->getCameraGameObject(camera);
-			float3 lod_ref_point = m_scene->getComponentManager().getPosition(camera_entity);
-			m_is_current_light_global = true;
-
 			//m_grasses_buffer.clear();
 			//m_terrains_buffer.clear();
 
-			JobSystem::JobDecl jobs[1];
-			JobSystem::LambdaJob job_storage[1];
-
-			JobSystem::fromLambda(
-				[this, &frustum, &lod_ref_point, layer_mask, camera]()
-				{
-					m_mesh_buffer = &m_scene->getEntityInstanceInfos(frustum, lod_ref_point, camera, layer_mask);
-				},
-				&job_storage[0], &jobs[0], nullptr);
-
 			//JobSystem::fromLambda([this, &frustum, &lod_ref_point]() {
 			//	m_scene->getTerrainInfos(frustum, lod_ref_point, m_terrains_buffer);
 			//}, &job_storage[1], &jobs[1], nullptr);
@@ -1601,11 +1889,7 @@ namespace egal
 				//}, &job_storage[2], &jobs[2], nullptr);
 			}
 
-			volatile e_int32 counter = 0;
-			JobSystem::runJobs(jobs, render_grass ? 2 : 1, &counter);
-			JobSystem::wait(&counter);
-		
-			renderMeshes(*m_mesh_buffer);
+			renderMeshes(getMeshes(frustum, camera, layer_mask, true));
 
 			//if(render_grass) 
 			//	renderGrasses(m_grasses_buffer);
@@ -1613,6 +1897,42 @@ namespace egal
 		}
 
 
+		TArrary<TArrary<EntityInstanceMesh>>& Pipeline::getMeshes(const Frustum& frustum, ComponentHandle camera, e_uint64 layer_mask, e_bool occlusion_culling)
+		{
+			GameObject camera_entity = m_scene->getCameraGameObject(camera);
+			float3 lod_ref_point = m_scene->getComponentManager().getPosition(camera_entity);
+			m_is_current_light_global = true;
+
+			JobSystem::JobDecl jobs[1];
+			JobSystem::LambdaJob job_storage[1];
+
+			JobSystem::fromLambda(
+				[this, &frustum, &lod_ref_point, layer_mask, camera, occlusion_culling]()
+				{
+					m_mesh_buffer = &m_scene->getEntityInstanceInfos(frustum, lod_ref_point, camera, layer_mask, occlusion_culling);
+				},
+				&job_storage[0], &jobs[0], &m_renderer.getEngine().getFrameAllocator());
+
+			volatile e_int32 counter = 0;
+			JobSystem::runJobs(jobs, 1, &counter);
+			JobSystem::wait(&counter);
+			return *m_mesh_buffer;
+		}
+
+
+		e_void Pipeline::invalidateShadowCache()
+		{
+			for (ShadowCascadeCache& cache : m_shadow_cascades)
+			{
+				cache.valid = false;
+				cache.dirty = true;
+				cache.had_dynamic = false;
+				cache.framebuffer = nullptr;
+			}
+			m_local_shadow_tiles.clear();
+		}
+
+
 		e_void Pipeline::toggleStats()
 		{
 			m_debug_flags ^= BGFX_DEBUG_STATS;
@@ -1631,6 +1951,14 @@ namespace egal
 			GameObject camera_entity = m_scene->getCameraGameObject(m_applied_camera);
 			float3 camera_pos = m_scene->getComponentManager().getPosition(camera_entity);
 
+			/** the pose is not owned by the scene, so there is no cached palette for it */
+			float4x4 bone_mtx[Entity::Bone::MAX_COUNT];
+			if (pose)
+			{
+				ASSERT(pose->count <= TlengthOf(bone_mtx));
+				model.computeSkinMatrices(*pose, bone_mtx);
+			}
+
 			for (e_int32 i = 0; i < model.getMeshCount(); ++i)
 			{
 				Mesh& mesh = model.getMesh(i);
@@ -1649,35 +1977,23 @@ namespace egal
 						renderMultilayerRigidMesh(model, mtx, mesh);
 						break;
 					case Mesh::MULTILAYER_SKINNED:
-						renderMultilayerSkinnedMesh(*pose, model, mtx, mesh);
+						if(pose) renderMultilayerSkinnedMesh(bone_mtx, pose->count, mtx, mesh);
 						break;
 					case Mesh::SKINNED:
-						if(pose) renderSkinnedMesh(*pose, model, mtx, mesh);
+						if(pose) renderSkinnedMesh(bone_mtx, pose->count, mtx, mesh);
 						break;
 				}
 			}
 		}
 
 
-		e_void Pipeline::renderSkinnedMesh(const Pose& pose, const Entity& model, const float4x4& matrix, const Mesh& mesh)
+		e_void Pipeline::renderSkinnedMesh(const float4x4* bone_mtx, e_int32 bone_count, const float4x4& matrix, const Mesh& mesh)
 		{
 			Material* material = mesh.material;
 			auto& shader_instance = mesh.material->getShaderInstance();
 
 			material->setDefine(m_instanced_define_idx, false);
-
-			float4x4 bone_mtx[196];
-
-			float3* poss = pose.positions;
-			Quaternion* rots = pose.rotations;
-
-			ASSERT(pose.count <= TlengthOf(bone_mtx));
-			for (e_int32 bone_index = 0, bone_count = pose.count; bone_index < bone_count; ++bone_index)
-			{
-				auto& bone = model.getBone(bone_index);
-				RigidTransform tmp = {poss[bone_index], rots[bone_index]};
-				bone_mtx[bone_index] = (tmp * bone.inv_bind_transform).toMatrix();
-			}
+			material->setDefine(m_clustered_lights_define_idx, m_is_clustered_light_pass);
 
 			e_int32 view_idx = m_layer_to_view_map[material->getRenderLayer()];
 			ASSERT(view_idx >= 0);
@@ -1685,7 +2001,7 @@ namespace egal
 
 			if (!bgfx::isValid(shader_instance.getProgramHandle(view.pass_idx))) return;
 
-			bgfx::setUniform(m_bone_matrices_uniform, bone_mtx, pose.count);
+			bgfx::setUniform(m_bone_matrices_uniform, bone_mtx, bone_count);
 			executeCommandBuffer(material->getCommandBuffer(), material);
 			executeCommandBuffer(view.command_buffer.buffer, material);
 
@@ -1706,6 +2022,7 @@ namespace egal
 			Material* material = mesh.material;
 
 			material->setDefine(m_instanced_define_idx, true);
+			material->setDefine(m_clustered_lights_define_idx, m_is_clustered_light_pass);
 
 			e_int32 layers_count = material->getLayersCount();
 			auto& shader_instance = mesh.material->getShaderInstance();
@@ -1753,6 +2070,7 @@ namespace egal
 			Material* material = mesh.material;
 
 			material->setDefine(m_instanced_define_idx, false);
+			material->setDefine(m_clustered_lights_define_idx, m_is_clustered_light_pass);
 
 			e_int32 view_idx = m_layer_to_view_map[material->getRenderLayer()];
 			ASSERT(view_idx >= 0);
@@ -1785,29 +2103,18 @@ namespace egal
 		}
 
 
-		e_void Pipeline::renderMultilayerSkinnedMesh(const Pose& pose, const Entity& model, const float4x4& matrix, const Mesh& mesh)
+		e_void Pipeline::renderMultilayerSkinnedMesh(const float4x4* bone_mtx, e_int32 bone_count, const float4x4& matrix, const Mesh& mesh)
 		{
 			Material* material = mesh.material;
 
 			material->setDefine(m_instanced_define_idx, false);
-
-			float4x4 bone_mtx[196];
-			float3* poss = pose.positions;
-			Quaternion* rots = pose.rotations;
-
-			ASSERT(pose.count <= TlengthOf(bone_mtx));
-			for (e_int32 bone_index = 0, bone_count = pose.count; bone_index < bone_count; ++bone_index)
-			{
-				auto& bone = model.getBone(bone_index);
-				RigidTransform tmp = { poss[bone_index], rots[bone_index] };
-				bone_mtx[bone_index] = (tmp * bone.inv_bind_transform).toMatrix();
-			}
+			material->setDefine(m_clustered_lights_define_idx, m_is_clustered_light_pass);
 
 			e_int32 layers_count = material->getLayersCount();
 			auto& shader_instance = mesh.material->getShaderInstance();
 
 			auto renderLayer = [&](View& view) {
-				bgfx::setUniform(m_bone_matrices_uniform, bone_mtx, pose.count);
+				bgfx::setUniform(m_bone_matrices_uniform, bone_mtx, bone_count);
 				executeCommandBuffer(material->getCommandBuffer(), material);
 				executeCommandBuffer(view.command_buffer.buffer, material);
 
@@ -2066,10 +2373,10 @@ namespace egal
 					renderRigidMesh(model_instance.matrix, *mesh.mesh, mesh.depth);
 					break;
 				case Mesh::SKINNED:
-					renderSkinnedMesh(*model_instance.pose, *model_instance.entity, model_instance.matrix, *mesh.mesh);
+					renderSkinnedMesh(m_scene->getSkinMatrices(mesh.entity_instance), model_instance.pose->count, model_instance.matrix, *mesh.mesh);
 					break;
 				case Mesh::MULTILAYER_SKINNED:
-					renderMultilayerSkinnedMesh(*model_instance.pose, *model_instance.entity, model_instance.matrix, *mesh.mesh);
+					renderMultilayerSkinnedMesh(m_scene->getSkinMatrices(mesh.entity_instance), model_instance.pose->count, model_instance.matrix, *mesh.mesh);
 					break;
 				case Mesh::MULTILAYER_RIGID:
 					renderMultilayerRigidMesh(*model_instance.entity, model_instance.matrix, *mesh.mesh);
@@ -2082,7 +2389,7 @@ namespace egal
 
 		e_void Pipeline::renderMeshes(const TArrary<TArrary<EntityInstanceMesh>>& meshes)
 		{
-			//PROFILE_FUNCTION();
+			PROFILE_FUNCTION();
 			e_int32 mesh_count = 0;
 			for (auto& submeshes : meshes)
 			{
@@ -2103,10 +2410,10 @@ namespace egal
 							renderRigidMesh(model_instance.matrix, *mesh.mesh, mesh.depth);
 							break;
 						case Mesh::SKINNED:
-							renderSkinnedMesh(*model_instance.pose, *model_instance.entity, model_instance.matrix, *mesh.mesh);
+							renderSkinnedMesh(m_scene->getSkinMatrices(mesh.entity_instance), model_instance.pose->count, model_instance.matrix, *mesh.mesh);
 							break;
 						case Mesh::MULTILAYER_SKINNED:
-							renderMultilayerSkinnedMesh(*model_instance.pose, *model_instance.entity, model_instance.matrix, *mesh.mesh);
+							renderMultilayerSkinnedMesh(m_scene->getSkinMatrices(mesh.entity_instance), model_instance.pose->count, model_instance.matrix, *mesh.mesh);
 							break;
 						case Mesh::MULTILAYER_RIGID:
 							renderMultilayerRigidMesh(*model_instance.entity, model_instance.matrix, *mesh.mesh);
@@ -2115,7 +2422,7 @@ namespace egal
 				}
 			}
 			finishInstances();
-			//PROFILE_INT("mesh count", mesh_count);
+			PROFILE_INT("mesh count", mesh_count);
 		}
 
 
@@ -2129,6 +2436,7 @@ namespace egal
 			}
 			for (auto& i : m_framebuffers)
 			{
+				if (!i || i->isTransient()) continue;
 				auto size_ratio = i->getSizeRatio();
 				if (size_ratio.x > 0 || size_ratio.y > 0)
 				{
@@ -2137,17 +2445,26 @@ namespace egal
 			}
 			m_width = w;
 			m_height = h;
+			updateTransientFramebuffers();
+			invalidateShadowCache();
 		}
 
 		e_int32 Pipeline::bindFramebufferTexture(const char* framebuffer_name, e_int32 renderbuffer_idx, e_int32 uniform_idx,e_uint32 flags)
+		{
+			return bindFramebufferTexture(getFramebufferHandle(framebuffer_name), renderbuffer_idx, uniform_idx, flags);
+		}
+
+		e_int32 Pipeline::bindFramebufferTexture(e_int32 framebuffer, e_int32 renderbuffer_idx, e_int32 uniform_idx, e_uint32 flags)
 		{
 			if (!m_current_view) 
 				return 0;
 
-			FrameBuffer* fb = getFramebuffer(framebuffer_name);
+			FrameBuffer* fb = getFramebuffer(framebuffer);
 			if (!fb) 
 				return 0;
 
+			touchFramebuffer(framebuffer);
+
 			float4 size;
 			size.x = (float)fb->getWidth();
 			size.y = (float)fb->getHeight();
@@ -2169,13 +2486,6 @@ namespace egal
 
 		e_int32 Pipeline::addFramebuffer(const e_char* name, e_int32 width, e_int32 height, bool is_screen_size, float2 size_ratio, TArrary<FrameBuffer::RenderBuffer>& buffers)
 		{
-			FrameBuffer* framebuffer = getFramebuffer(name);
-			if (framebuffer)
-			{
-				log_waring("Renderer Trying to create already existing framebuffer %s.", name);
-				return 0;
-			}
-
 			FrameBuffer::Declaration decl;
 			StringUnitl::copyString(decl.m_name, name);
 
@@ -2195,19 +2505,199 @@ namespace egal
 				buf.m_shared = buffers[i].m_shared;
 			}
 
+			return createFramebuffer(decl);
+		}
+
+		e_int32 Pipeline::createFramebuffer(const FrameBuffer::Declaration& declaration)
+		{
+			if (getFramebufferHandle(declaration.m_name) >= 0)
+			{
+				log_waring("Renderer Trying to create already existing framebuffer %s.", declaration.m_name);
+				return -1;
+			}
+
+			FrameBuffer::Declaration decl = declaration;
 			if ((decl.m_size_ratio.x > 0 || decl.m_size_ratio.y > 0) && m_height > 0)
 			{
 				decl.m_width  = e_int32(m_width * decl.m_size_ratio.x);
 				decl.m_height = e_int32(m_height * decl.m_size_ratio.y);
 			}
 
+			e_bool is_default = StringUnitl::equalStrings(decl.m_name, "default");
+			if (decl.m_is_transient)
+			{
+				/** the default framebuffer is presented and shared renderbuffers point into their owner, both must persist */
+				e_bool has_shared = false;
+				for (e_int32 i = 0; i < decl.m_renderbuffers_count; ++i)
+				{
+					has_shared = has_shared || decl.m_renderbuffers[i].m_shared;
+				}
+				if (is_default || has_shared)
+				{
+					log_waring("Renderer Framebuffer %s can not be transient.", decl.m_name);
+					decl.m_is_transient = false;
+				}
+			}
+
+			e_int32 handle = m_framebuffers.size();
+			if (decl.m_is_transient)
+			{
+				/** lifetimes are not known before the first frame, so nothing is aliased yet */
+				for (e_int32 i = 0; i < decl.m_renderbuffers_count; ++i)
+				{
+					FrameBuffer::RenderBuffer& rb = decl.m_renderbuffers[i];
+					TransientTexture* texture = createTransientTexture(rb.m_format, decl.m_width, decl.m_height);
+					texture->last_user = handle;
+					rb.m_shared = &texture->renderbuffer;
+				}
+			}
+
 			auto* fb = _aligned_new(m_allocator, FrameBuffer)(decl);
 			m_framebuffers.push_back(fb);
+			FramebufferUse& use = m_framebuffer_uses.emplace();
+			use.first_view = use.last_view = -1;
+			m_framebuffer_map.insert(crc32(decl.m_name), handle);
 
-			if (StringUnitl::equalStrings(decl.m_name, "default"))
+			if (is_default)
 				m_default_framebuffer = fb;
 
-			return 0;
+			return handle;
+		}
+
+		TransientTexture* Pipeline::createTransientTexture(bgfx::TextureFormat::Enum format, e_int32 width, e_int32 height)
+		{
+			TransientTexture* texture = _aligned_new(m_allocator, TransientTexture);
+			texture->renderbuffer.m_format = format;
+			texture->renderbuffer.m_handle = bgfx::createTexture2D((uint16_t)width,
+				(uint16_t)height,
+				false,
+				1,
+				format,
+				FrameBuffer::RenderBuffer::DEFAULT_FLAGS);
+			texture->width = width;
+			texture->height = height;
+			texture->busy_until = -1;
+			texture->last_user = -1;
+			m_transient_textures.push_back(texture);
+			return texture;
+		}
+
+		TransientTexture* Pipeline::findTransientTexture(const FrameBuffer::RenderBuffer& rb,
+			e_int32 width,
+			e_int32 height,
+			e_int32 user,
+			const FramebufferUse& use)
+		{
+			TransientTexture* found = nullptr;
+			for (TransientTexture* texture : m_transient_textures)
+			{
+				if (texture->renderbuffer.m_format != rb.m_format) continue;
+				if (texture->width != width || texture->height != height) continue;
+				if (texture->last_user == user) continue;
+				/** targets unused last frame get textures of their own, they may be needed again at any point of the frame */
+				e_bool is_free = use.first_view >= 0 ? texture->busy_until < use.first_view : texture->last_user < 0;
+				if (!is_free) continue;
+
+				/** keeping the current texture avoids recreating the framebuffer */
+				if (&texture->renderbuffer == rb.m_shared) return texture;
+				if (!found) found = texture;
+			}
+			return found;
+		}
+
+		struct TransientUse
+		{
+			FramebufferUse	use;
+			e_int32			handle;
+		};
+
+		/** sorted by first use so greedy assignment packs the intervals, unused targets go last */
+		static int compareTransientUses(const void* a, const void* b)
+		{
+			e_int32 first_a = ((const TransientUse*)a)->use.first_view;
+			e_int32 first_b = ((const TransientUse*)b)->use.first_view;
+			if (first_a < 0) first_a = INT_MAX;
+			if (first_b < 0) first_b = INT_MAX;
+			return first_a < first_b ? -1 : (first_a > first_b ? 1 : 0);
+		}
+
+		e_void Pipeline::updateTransientFramebuffers()
+		{
+			for (TransientTexture* texture : m_transient_textures)
+			{
+				texture->busy_until = -1;
+				texture->last_user = -1;
+			}
+
+			TArrary<TransientUse> uses(m_allocator);
+			for (e_int32 i = 0; i < m_framebuffers.size(); ++i)
+			{
+				if (!m_framebuffers[i] || !m_framebuffers[i]->isTransient()) continue;
+				TransientUse& use = uses.emplace();
+				use.handle = i;
+				use.use.first_view = use.use.last_view = -1;
+				if (m_has_transient_uses) use.use = m_framebuffer_uses[i];
+			}
+			if (!uses.empty()) qsort(&uses[0], uses.size(), sizeof(uses[0]), compareTransientUses);
+
+			e_bool changed = false;
+			for (const TransientUse& use : uses)
+			{
+				FrameBuffer* fb = m_framebuffers[use.handle];
+				FrameBuffer::Declaration decl = fb->getDeclaration();
+				e_int32 width = decl.m_width;
+				e_int32 height = decl.m_height;
+				if ((decl.m_size_ratio.x > 0 || decl.m_size_ratio.y > 0) && m_height > 0)
+				{
+					width = e_int32(m_width * decl.m_size_ratio.x);
+					height = e_int32(m_height * decl.m_size_ratio.y);
+				}
+
+				e_bool rebuild = width != decl.m_width || height != decl.m_height;
+				for (e_int32 i = 0; i < decl.m_renderbuffers_count; ++i)
+				{
+					FrameBuffer::RenderBuffer& rb = decl.m_renderbuffers[i];
+					TransientTexture* texture = findTransientTexture(rb, width, height, use.handle, use.use);
+					if (!texture) texture = createTransientTexture(rb.m_format, width, height);
+					texture->last_user = use.handle;
+					texture->busy_until = Math::maximum(texture->busy_until, use.use.last_view);
+					if (rb.m_shared != &texture->renderbuffer)
+					{
+						rb.m_shared = &texture->renderbuffer;
+						rebuild = true;
+					}
+				}
+
+				if (!rebuild) continue;
+
+				decl.m_width = width;
+				decl.m_height = height;
+				_delete(m_allocator, fb);
+				m_framebuffers[use.handle] = _aligned_new(m_allocator, FrameBuffer)(decl);
+				changed = true;
+			}
+
+			/** textures nobody was assigned are released only after the framebuffers using them are gone */
+			for (e_int32 i = m_transient_textures.size() - 1; i >= 0; --i)
+			{
+				TransientTexture* texture = m_transient_textures[i];
+				if (texture->last_user >= 0) continue;
+				bgfx::destroy(texture->renderbuffer.m_handle);
+				_delete(m_allocator, texture);
+				m_transient_textures.eraseFast(i);
+			}
+
+			if (changed) invalidateShadowCache();
+		}
+
+		e_void Pipeline::destroyTransientTextures()
+		{
+			for (TransientTexture* texture : m_transient_textures)
+			{
+				bgfx::destroy(texture->renderbuffer.m_handle);
+				_delete(m_allocator, texture);
+			}
+			m_transient_textures.clear();
 		}
 
 		e_void Pipeline::clearLayerToViewMap()
@@ -2220,13 +2710,23 @@ namespace egal
 
 		e_bool Pipeline::frame()
 		{
-			//PROFILE_FUNCTION();
+			PROFILE_FUNCTION();
 			if (!isReady()) 
 				return false;
 			if (!m_scene) 
 				return false;
 
+			/** aliasing follows the lifetimes seen during the previous frame */
+			if (m_has_transient_uses) updateTransientFramebuffers();
+			for (FramebufferUse& use : m_framebuffer_uses)
+			{
+				use.first_view = use.last_view = -1;
+			}
+			m_has_transient_uses = false;
+			m_current_framebuffer_handle = -1;
+
 			m_stats = {};
+			m_stats.transient_texture_count = m_transient_textures.size();
 			m_applied_camera = INVALID_COMPONENT;
 			m_global_light_shadowmap = nullptr;
 			m_current_view = nullptr;
@@ -2249,12 +2749,19 @@ namespace egal
 			}
 			bgfx::touch(0);
 
+			/** skin palettes are shared by all views and passes of this frame */
+			m_scene->updateSkinMatrices();
+
 			//sky
 			newView("main", 1);
 			applyCamera("main");
 			setPass("DEFERRED");
 			clear(BGFX_CLEAR_COLOR, 0x303030ff);
 
+			/** light grid is built on a worker while the scene is culled */
+			buildLightClusters();
+			bindLightClusters();
+
 			//disableDepthWrite();
 			//enableBlending("alpha");
 
@@ -2262,7 +2769,8 @@ namespace egal
 			//renderDebugShapes();
 
 			e_uint64 all_render_mask = getLayerMask("default") + getLayerMask("transparent") + getLayerMask("water") + getLayerMask("fur") + getLayerMask("no_shadows");
-			renderAll(m_camera_frustum, false, m_applied_camera, all_render_mask);
+			renderClusteredLitGeometry(m_camera_frustum, m_applied_camera, all_render_mask);
+			m_light_cluster.finish();
 
 			bool success = true;// lua_frame(this);
 
@@ -2322,6 +2830,11 @@ namespace egal
 
 		e_void Pipeline::renderPointLightLitGeometry()
 		{
+			if (!m_current_view)
+				return;
+
+			bindLightClusters();
+			renderClusteredLitGeometry(m_camera_frustum, m_applied_camera, m_current_view->layer_mask);
 			renderPointLightInfluencedGeometry(m_camera_frustum);
 		}
 
@@ -2335,6 +2848,7 @@ namespace egal
 		e_void Pipeline::setScene(SceneManager* scene)
 		{
 			m_scene = scene;
+			invalidateShadowCache();
 			if (m_lua_state && m_scene)
 				lua_callInitScene(this);
 		}
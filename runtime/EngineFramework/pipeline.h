@@ -6,6 +6,7 @@
 #include "common/resource/resource_define.h"
 #include "runtime/EngineFramework/buffer.h"
 #include "runtime/EngineFramework/scene_manager.h"
+#include "runtime/EngineFramework/light_cluster.h"
 
 struct lua_State;
 namespace egal
@@ -55,7 +56,56 @@ namespace egal
 	{
 		ComponentHandle light;
 		FrameBuffer*	framebuffer;
+		float4x4		matrices[4];	/** world to atlas uv, the tile rect is already applied */
+	};
+
+	/** tile of a local light in the shadow atlas, it is only redrawn when the light or its casters change */
+	struct LocalShadowTile
+	{
+		ComponentHandle light;
+		FrameBuffer*	framebuffer;
+		e_int32			x;		/** in atlas cells */
+		e_int32			y;
+		e_int32			level;	/** 0 is the whole atlas, every level halves the tile */
+		float4x4		light_matrix;
+		e_float			range;
+		e_float			fov;
 		float4x4		matrices[4];
+		e_bool			dirty;
+		e_bool			had_dynamic;
+		e_bool			used;
+	};
+
+	/** global light cascade kept between frames, it is only redrawn once it goes stale */
+	struct ShadowCascadeCache
+	{
+		FrameBuffer*	framebuffer;
+		float3			light_forward;
+		float3			center;
+		e_float			radius;
+		float4x4		view_matrix;
+		float4x4		projection_matrix;
+		Frustum			frustum;
+		e_bool			valid;
+		e_bool			dirty;
+		e_bool			had_dynamic;
+	};
+
+	/** pooled texture of transient framebuffers, targets whose views do not overlap within a frame share it */
+	struct TransientTexture
+	{
+		FrameBuffer::RenderBuffer	renderbuffer;
+		e_int32						width;
+		e_int32						height;
+		e_int32						busy_until;	/** last view of the targets assigned so far */
+		e_int32						last_user;	/** framebuffer handle assigned last, -1 if none */
+	};
+
+	/** first and last view a framebuffer was rendered to or sampled in during the last frame */
+	struct FramebufferUse
+	{
+		e_int32 first_view;
+		e_int32 last_view;
 	};
 
 	struct BaseVertex
@@ -75,6 +125,7 @@ namespace egal
 			e_int32 draw_call_count;
 			e_int32 instance_count;
 			e_int32 triangle_count;
+			e_int32 transient_texture_count;
 		};
 
 		struct CustomCommandHandler
@@ -95,6 +146,10 @@ namespace egal
 
 		e_void bindTexture(e_int32 uniform_idx, e_int32 texture_idx);
 		e_void bindEnvironmentMaps(e_int32 irradiance_uniform_idx, e_int32 radiance_uniform_idx);
+		e_void buildLightClusters();
+		e_void bindLightClusters();
+		/** one pass over the visible meshes, every shadowless point light is read from the clusters by the shader */
+		e_void renderClusteredLitGeometry(const Frustum& frustum, ComponentHandle camera, e_uint64 layer_mask);
 		e_void bindRenderbuffer(bgfx::TextureHandle* rb, e_int32 width, e_int32 height, e_int32 uniform_idx);
 		e_void load();
 		e_void cleanup();
@@ -117,12 +172,25 @@ namespace egal
 		e_void resize(e_int32 width, e_int32 height);
 
 		e_int32 bindFramebufferTexture(const char* framebuffer_name, e_int32 renderbuffer_idx, e_int32 uniform_idx, e_uint32 flags);
+		e_int32 bindFramebufferTexture(e_int32 framebuffer, e_int32 renderbuffer_idx, e_int32 uniform_idx, e_uint32 flags);
 		e_int32 addFramebuffer(const e_char* name, e_int32 width, e_int32 height, bool is_screen_size, float2 size_ratio, TArrary<FrameBuffer::RenderBuffer>& buffers);
+		/** returns the framebuffer handle, -1 if it already exists */
+		e_int32 createFramebuffer(const FrameBuffer::Declaration& decl);
 		e_void clearLayerToViewMap();
 		TextureHandle& getRenderbuffer(const e_char* framebuffer_name, e_int32 renderbuffer_idx);
 
+		/** handles stay valid until the framebuffer is removed, scripts resolve names once when they load */
+		e_int32 getFramebufferHandle(const e_char* framebuffer_name);
 		FrameBuffer* getFramebuffer(const e_char* framebuffer_name);
+		FrameBuffer* getFramebuffer(e_int32 framebuffer);
 		e_void setFramebuffer(const e_char* framebuffer_name);
+		e_void setFramebuffer(e_int32 framebuffer);
+		e_void touchFramebuffer(e_int32 framebuffer);
+		e_void updateTransientFramebuffers();
+		e_void destroyTransientTextures();
+		TransientTexture* createTransientTexture(bgfx::TextureFormat::Enum format, e_int32 width, e_int32 height);
+		TransientTexture* findTransientTexture(const FrameBuffer::RenderBuffer& rb, e_int32 width, e_int32 height, e_int32 user, const FramebufferUse& use);
+		e_int32 getTransientTextureCount() const { return m_transient_textures.size(); }
 		e_void setScene(SceneManager* scene);
 		SceneManager* getScene();
 
@@ -139,13 +207,17 @@ namespace egal
 		e_void removeFramebuffer(const e_char* framebuffer_name);
 		e_void setMaterialDefine(e_int32 material_idx, const e_char* define, e_bool enabled);
 		e_void renderLightVolumes(e_int32 material_index);
+		e_void getPointLightData(ComponentHandle light_cmp, LightCluster::Light& data);
 		e_void renderDecalsVolumes();
-		e_void renderSpotLightShadowmap(ComponentHandle light);
-		e_void renderOmniLightShadowmap(ComponentHandle light);
+		e_void renderSpotLightShadowmap(LocalShadowTile& tile);
+		e_void renderOmniLightShadowmap(LocalShadowTile& tile);
+		e_void renderShadowTile(LocalShadowTile& tile, const float4x4* view_matrices, const float4x4* projection_matrices, const TArrary<EntityInstanceMesh>* faces, e_int32 face_count);
+		e_void addPointLightShadowmap(const LocalShadowTile& tile);
 		e_void renderLocalLightShadowmaps(ComponentHandle camera, FrameBuffer** fbs, e_int32 framebuffers_count);
 		e_void findExtraShadowcasterPlanes(const float3& light_forward, const Frustum& camera_frustum, const float3& camera_position, Frustum* shadow_camera_frustum);
 		e_void renderShadowmap(e_int32 split_index);
 		e_void renderDebugShapes();
+		e_void renderDebugPrimitives(e_int32 type, e_int32 vertices_per_primitive, e_uint64 primitive_state);
 		e_void renderDebugPoints();
 		e_void renderDebugLines();
 		e_void renderDebugTriangles();
@@ -168,6 +240,8 @@ namespace egal
 		e_void drawQuadExMaterial(e_float left, e_float top, e_float w, e_float h, e_float u0, e_float v0, e_float u1, e_float v1, Material* material);
 		e_void drawQuad(e_float left, e_float top, e_float w, e_float h, e_int32 material_index);
 		e_void renderAll(const Frustum& frustum, e_bool render_grass, ComponentHandle camera, e_uint64 layer_mask);
+		TArrary<TArrary<EntityInstanceMesh>>& getMeshes(const Frustum& frustum, ComponentHandle camera, e_uint64 layer_mask, e_bool occlusion_culling);
+		e_void invalidateShadowCache();
 		CustomCommandHandler& addCustomCommandHandler(const e_char* name);
 		e_void setViewProjection(const float4x4& mtx, e_int32 width, e_int32 height);
 		e_void setScissor(e_int32 x, e_int32 y, e_int32 width, e_int32 height);
@@ -198,10 +272,10 @@ namespace egal
 			struct ShaderInstance& shader_instance);
 
 		e_void renderEntity(Entity& entity, Pose* pose, const float4x4& mtx);
-		e_void renderSkinnedMesh(const Pose& pose, const Entity& model, const float4x4& matrix, const Mesh& mesh);
+		e_void renderSkinnedMesh(const float4x4* bone_mtx, e_int32 bone_count, const float4x4& matrix, const Mesh& mesh);
 		e_void renderMultilayerRigidMesh(const Entity& model, const float4x4& float4x4, const Mesh& mesh);
 		e_void renderRigidMesh(const float4x4& float4x4, Mesh& mesh, e_float depth);
-		e_void renderMultilayerSkinnedMesh(const Pose& pose, const Entity& model, const float4x4& matrix, const Mesh& mesh);
+		e_void renderMultilayerSkinnedMesh(const float4x4* bone_mtx, e_int32 bone_count, const float4x4& matrix, const Mesh& mesh);
 		e_void toggleStats();
 		e_void setWindowHandle(e_void* data);
 		e_bool isReady() const;
@@ -241,9 +315,15 @@ namespace egal
 		FrameBuffer*			m_global_light_shadowmap;
 		FrameBuffer*			m_current_framebuffer;
 		FrameBuffer*			m_default_framebuffer;
-		TArrary<FrameBuffer*>	m_framebuffers;
+		TArrary<FrameBuffer*>	m_framebuffers;	/** indexed by handle, removed framebuffers leave nullptr */
+		THashMap<e_uint32, e_int32>	m_framebuffer_map;	/** crc32 of the name -> handle */
+		TArrary<FramebufferUse>		m_framebuffer_uses;
+		TArrary<TransientTexture*>	m_transient_textures;
+		e_int32						m_current_framebuffer_handle;
+		e_bool						m_has_transient_uses;
 		
 		TArrary<PointLightShadowmap> m_point_light_shadowmaps;
+		TArrary<LocalShadowTile>	 m_local_shadow_tiles;
 		
 		InstanceData			m_instances_data[128];
 		e_int32					m_instance_data_idx;
@@ -257,12 +337,17 @@ namespace egal
 
 		e_bool m_is_current_light_global;
 		e_bool m_is_rendering_in_shadowmap;
+		/** meshes rendered while set are shaded by the light clusters, see CLUSTERED_LIGHTS */
+		e_bool m_is_clustered_light_pass;
 		e_bool m_is_ready;
 		Frustum m_camera_frustum;
+		LightCluster m_light_cluster;
 
 		TArrary<TArrary<EntityInstanceMesh>>* m_mesh_buffer;
 
 		float4x4 m_shadow_viewprojection[4];
+		ShadowCascadeCache m_shadow_cascades[4];
+		e_uint32 m_shadow_frame;
 		e_int32 m_width;
 		e_int32 m_height;
 		String	m_define;
@@ -298,6 +383,11 @@ namespace egal
 		bgfx::UniformHandle m_cam_inv_proj_uniform;
 		bgfx::UniformHandle m_cam_inv_viewproj_uniform;
 		bgfx::UniformHandle m_texture_size_uniform;
+		bgfx::UniformHandle m_cluster_grid_uniform;
+		bgfx::UniformHandle m_cluster_indices_uniform;
+		bgfx::UniformHandle m_cluster_lights_uniform;
+		bgfx::UniformHandle m_cluster_params_uniform;
+		bgfx::UniformHandle m_cluster_depth_uniform;
 		bgfx::UniformHandle m_grass_max_dist_uniform;
 
 		e_int32								m_layer_to_view_map[64];
@@ -307,12 +397,9 @@ namespace egal
 		Material*							m_draw2d_material;
 		Texture*							m_default_cubemap;
 
-		bgfx::DynamicVertexBufferHandle		m_debug_vertex_buffers[32];
-		bgfx::DynamicIndexBufferHandle		m_debug_index_buffer;
-
-		e_int32								m_debug_buffer_idx;
 		e_int32								m_has_shadowmap_define_idx;
 		e_int32								m_instanced_define_idx;
+		e_int32								m_clustered_lights_define_idx;
 
 
 
@@ -221,6 +221,7 @@ namespace egal
 				property("Source", PROPERITY(SceneManager, getEntityInstancePath, setEntityInstancePath),
 					ResourceAttribute("Mesh (*.msh)",  RESOURCE_ENTITY_TYPE)),
 				property("Keep skin", PROPERITY(SceneManager, getEntityInstanceKeepSkin, setEntityInstanceKeepSkin)),
+				property("Occluder", PROPERITY(SceneManager, isEntityInstanceOccluder, setEntityInstanceOccluder)),
 				const_array("Materials", &SceneManager::getEntityInstanceMaterialsCount,
 					property("Source", PROPERITY(SceneManager, getEntityInstanceMaterial, setEntityInstanceMaterial),
 						ResourceAttribute("Material (*.mat)", RESOURCE_MATERIAL_TYPE))
@@ -277,6 +278,8 @@ namespace egal
 		, m_material_manager(*this, engine.getAllocator())
 		, m_shader_manager(*this, engine.getAllocator())
 		, m_shader_binary_manager(*this, engine.getAllocator())
+		, m_animation_manager(engine.getAllocator())
+		, m_skeleton_manager(engine.getAllocator())
 		, m_passes(engine.getAllocator())
 		, m_shader_defines(engine.getAllocator())
 		, m_layers(engine.getAllocator())
@@ -322,6 +325,8 @@ namespace egal
 		m_material_manager.create(RESOURCE_MATERIAL_TYPE, manager);
 		m_shader_manager.create( RESOURCE_SHADER_TYPE, manager);
 		m_shader_binary_manager.create( RESOURCE_SHADER_BINARY_TYPE, manager);
+		m_animation_manager.create(RESOURCE_ANIMATION_TYPE, manager);
+		m_skeleton_manager.create(RESOURCE_SKELETON_TYPE, manager);
 
 		m_current_pass_hash = crc32("MAIN");
 		m_view_counter = 0;
@@ -371,6 +376,8 @@ namespace egal
 		m_material_manager.destroy();
 		m_shader_manager.destroy();
 		m_shader_binary_manager.destroy();
+		m_animation_manager.destroy();
+		m_skeleton_manager.destroy();
 
 		bgfx::destroy(m_mat_color_uniform);
 		bgfx::destroy(m_roughness_metallic_uniform);
@@ -407,6 +414,8 @@ namespace egal
 
 
 	EntityManager& Renderer::getEntityManager() { return m_entity_manager; }
+	AnimationManager& Renderer::getAnimationManager() { return m_animation_manager; }
+	SkeletonManager& Renderer::getSkeletonManager() { return m_skeleton_manager; }
 	MaterialManager& Renderer::getMaterialManager() { return m_material_manager; }
 	TextureManager& Renderer::getTextureManager() { return m_texture_manager; }
 	const bgfx::VertexDecl& Renderer::getBasicVertexDecl() const { return m_basic_vertex_decl; }
@@ -9,6 +9,7 @@
 #include "common/resource/entity_manager.h"
 #include "common/resource/material_manager.h"
 #include "common/resource/texture_manager.h"
+#include "common/resource/animation_manager.h"
 
 #include "common/allocator/bgfx_allocator.h"
 #include "runtime/EngineFramework/plugin_manager.h"
@@ -99,6 +100,8 @@ namespace egal
 		MaterialManager& getMaterialManager();
 		EntityManager& getEntityManager();
 		TextureManager& getTextureManager();
+		AnimationManager& getAnimationManager();
+		SkeletonManager& getSkeletonManager();
 		Shader* getDefaultShader();
 
 		const UniformHandle& getMaterialColorUniform() const;
@@ -132,6 +135,8 @@ namespace egal
 		ShaderManager		m_shader_manager;
 		ShaderBinaryManager m_shader_binary_manager;
 		EntityManager		m_entity_manager;
+		AnimationManager	m_animation_manager;
+		SkeletonManager		m_skeleton_manager;
 
 		TArrary<ShaderCombinations::Pass>	m_passes;
 		TArrary<ShaderDefine>				m_shader_defines;
@@ -10,9 +10,13 @@
 #include "runtime/EngineFramework/scene_manager.h"
 #include "runtime/EngineFramework/renderer.h"
 #include "runtime/EngineFramework/culling_system.h"
+#include "runtime/EngineFramework/occlusion_buffer.h"
+#include "runtime/EngineFramework/debug_draw_buffer.h"
 #include "runtime/EngineFramework/pipeline.h"
 
 #include "common/resource/entity_manager.h"
+#include "common/resource/animation_manager.h"
+#include "common/resource/animation_sampler.h"
 #include "common/resource/material_manager.h"
 #include "common/resource/texture_manager.h"
 #include "common/resource/shader_manager.h"
@@ -42,6 +46,44 @@ namespace egal
 		return layer_mask;
 	}
 
+	/** layout of the entity instance block written by serializeEntityInstances */
+	static const e_int32 ENTITY_INSTANCES_VERSION = 1;
+	/** frames an entity instance has to stay in place before shadow caches treat it as static again */
+	static const e_uint32 SHADOW_STATIC_FRAMES = 30;
+
+	static e_void initAnimable(Animable& animable, GameObject game_object, IAllocator& allocator)
+	{
+		animable.game_object = game_object;
+		animable.animation = nullptr;
+		animable.skeleton = nullptr;
+		animable.sampler = _aligned_new(allocator, AnimationSampler)(allocator);
+		animable.bound_entity = nullptr;
+		animable.cache = _aligned_new(allocator, AnimationSamplingCache)(allocator);
+		animable.time = 0;
+		animable.time_scale = 1;
+		animable.start_time = 0;
+	}
+
+	/** runs on a job system worker, touches only the pose, sampler and cache of this animable */
+	static e_void sampleAnimable(Animable& animable, EntityInstance& r)
+	{
+		r.entity->getRelativePose(*r.pose);
+		const animation::Animation* clip = animable.animation->getRuntimeAnimation();
+		if (clip)
+		{
+			animable.sampler->clearLayers();
+			if (animable.sampler->addLayer(*clip, animable.time, 1.0f) && animable.sampler->evaluate())
+			{
+				animable.sampler->getPose(*r.pose);
+			}
+		}
+		else
+		{
+			animable.animation->getRelativePose(animable.time, *r.pose, *r.entity, nullptr, *animable.cache);
+		}
+		r.pose->computeAbsolute(*r.entity);
+	}
+
 	static e_uint32 ARGBToABGR(e_uint32 color)
 	{
 		return ((color & 0xff) << 16) | (color & 0xff00) | ((color & 0xff0000) >> 16) | (color & 0xff000000);
@@ -74,6 +116,7 @@ namespace egal
 		COMPONENT_TYPE(COMPONENT_CAMERA_TYPE,				Camera),
 		COMPONENT_TYPE(COMPONENT_BONE_ATTACHMENT_TYPE,		BoneAttachment),
 		COMPONENT_TYPE(COMPONENT_ENVIRONMENT_PROBE_TYPE,	EnvironmentProbe),
+		COMPONENT_TYPE(COMPONENT_ANIMABLE_TYPE,				Animable),
 	};
 
 #undef COMPONENT_TYPE
@@ -94,19 +137,22 @@ namespace egal
 		, m_entity_instances(allocator)
 		, m_cameras(allocator)
 		, m_point_lights(allocator)
-		, m_light_influenced_geometry(allocator)
 		, m_global_lights(allocator)
 		, m_decals(allocator)
-		, m_debug_triangles(allocator)
-		, m_debug_lines(allocator)
-		, m_debug_points(allocator)
 		, m_temporary_infos(allocator)
+		, m_skin_matrices(allocator)
+		, m_dirty_skins(allocator)
+		, m_moving_casters(allocator)
+		, m_shadow_caster_changes(allocator)
+		, m_pending_shadow_caster_changes(allocator)
+		, m_frame_index(0)
 		, m_active_global_light_cmp(INVALID_COMPONENT)
 		, m_is_grass_enabled(true)
 		, m_is_game_running(false)
 		, m_point_lights_map(allocator)
 		, m_bone_attachments(allocator)
 		, m_environment_probes(allocator)
+		, m_animables(allocator)
 		, m_lod_multiplier(1.0f)
 		, m_time(0)
 		, m_mouse_sensitivity(200, 200)
@@ -117,7 +163,9 @@ namespace egal
 		m_com_man.m_game_object_destroyed.bind<SceneManager, &SceneManager::onEntityDestroyed>(this);
 		m_com_man.m_game_object_moved.bind<SceneManager, &SceneManager::onEntityMoved>(this);
 
-		m_culling_system = CullingSystem::create(m_allocator);
+		m_culling_system = CullingSystem::create(m_allocator, m_engine.getFrameAllocator());
+		m_occlusion_buffer = _aligned_new(m_allocator, OcclusionBuffer)(m_allocator);
+		m_debug_draw_buffer = _aligned_new(m_allocator, DebugDrawBuffer)(m_allocator);
 		m_entity_instances.reserve(5000);
 
 		for (auto& i : COMPONENT_INFOS)
@@ -131,6 +179,8 @@ namespace egal
 			m_com_man.GameObjectDestroyed().unbind<SceneManager, &SceneManager::onEntityDestroyed>(this);
 
 			CullingSystem::destroy(*m_culling_system, m_allocator);
+			_delete(m_allocator, m_occlusion_buffer);
+			_delete(m_allocator, m_debug_draw_buffer);
 		}
 
 
@@ -161,6 +211,7 @@ namespace egal
 					material_manager->unload(*decal.material);
 			}
 			m_decals.clear();
+			m_debug_draw_buffer->clear();
 
 			m_cameras.clear();
 
@@ -188,6 +239,12 @@ namespace egal
 					probe.irradiance->getResourceManager().unload(*probe.irradiance);
 			}
 			m_environment_probes.clear();
+
+			for (Animable& animable : m_animables)
+			{
+				releaseAnimable(animable);
+			}
+			m_animables.clear();
 		}
 
 		ComponentManager& SceneManager::getComponentManager() { return m_com_man; }
@@ -268,6 +325,12 @@ namespace egal
 				}
 				return INVALID_COMPONENT;
 			}
+			if (type == COMPONENT_ANIMABLE_TYPE)
+			{
+				if (m_animables.find(game_object) < 0)
+					return INVALID_COMPONENT;
+				return {game_object.index};
+			}
 			return INVALID_COMPONENT;
 		}
 
@@ -578,6 +641,10 @@ namespace egal
 		e_void SceneManager::startGame()
 		{
 			m_is_game_running = true;
+			for (Animable& animable : m_animables)
+			{
+				animable.time = animable.start_time;
+			}
 		}
 
 
@@ -592,48 +659,11 @@ namespace egal
 			PROFILE_FUNCTION();
 
 			m_time += dt;
-			for (e_int32 i = m_debug_triangles.size() - 1; i >= 0; --i)
-			{
-				e_float life = m_debug_triangles[i].life;
-				if (life < 0)
-				{
-					m_debug_triangles.eraseFast(i);
-				}
-				else
-				{
-					life -= dt;
-					m_debug_triangles[i].life = life;
-				}
-			}
-
-			for(e_int32 i = m_debug_lines.size() - 1; i >= 0; --i)
-			{
-				e_float life = m_debug_lines[i].life;
-				if(life < 0)
-				{
-					m_debug_lines.eraseFast(i);
-				}
-				else
-				{
-					life -= dt;
-					m_debug_lines[i].life = life;
-				}
-			}
-
-
-			for (e_int32 i = m_debug_points.size() - 1; i >= 0; --i)
-			{
-				e_float life = m_debug_points[i].life;
-				if (life < 0)
-				{
-					m_debug_points.eraseFast(i);
-				}
-				else
-				{
-					life -= dt;
-					m_debug_points[i].life = life;
-				}
-			}
+			++m_frame_index;
+			updateMovingShadowCasters();
+			m_shadow_caster_changes.swap(m_pending_shadow_caster_changes);
+			m_pending_shadow_caster_changes.clear();
+			m_debug_draw_buffer->frame(m_time);
 
 			if (m_is_game_running && !paused)
 			{
@@ -651,7 +681,88 @@ namespace egal
 
 		egal::e_void SceneManager::lateUpdate(e_float time_delta, e_bool paused)
 		{
+			/** frame runs more than once per engine frame, lateUpdate only once */
+			if (m_is_game_running && !paused) updateAnimables(time_delta);
+		}
+
 
+		e_void SceneManager::updateAnimables(e_float time_delta)
+		{
+			PROFILE_FUNCTION();
+
+			/** samplers are (re)bound here, so the jobs below only read shared resources */
+			TArrary<e_int32> active(m_engine.getFrameAllocator());
+			active.reserve(m_animables.size());
+			for (e_int32 i = 0, c = m_animables.size(); i < c; ++i)
+			{
+				Animable& animable = m_animables.at(i);
+				if (!animable.animation || !animable.animation->isReady()) continue;
+
+				GameObject game_object = animable.game_object;
+				if (game_object.index >= m_entity_instances.size()) continue;
+				EntityInstance& r = m_entity_instances[game_object.index];
+				if (!r.game_object.isValid() || !r.pose || !r.entity || !r.entity->isReady()) continue;
+
+				if (animable.animation->getRuntimeAnimation())
+				{
+					if (!animable.skeleton || !animable.skeleton->isReady()) continue;
+					const animation::Skeleton* skeleton = &animable.skeleton->getSkeleton();
+					if (animable.sampler->getSkeleton() != skeleton)
+					{
+						animable.sampler->setSkeleton(skeleton);
+						animable.bound_entity = nullptr;
+					}
+					if (animable.bound_entity != r.entity)
+					{
+						animable.sampler->bindEntity(*r.entity);
+						animable.bound_entity = r.entity;
+					}
+				}
+				active.push_back(i);
+			}
+			if (active.empty()) return;
+
+			JobSystem::JobDecl jobs[64];
+			JobSystem::LambdaJob job_storage[64];
+			e_int32 max_jobs = (e_int32)TlengthOf(jobs);
+			e_int32 step = Math::maximum(4, (active.size() + max_jobs - 1) / max_jobs);
+			e_int32 job_count = 0;
+			for (e_int32 from = 0; from < active.size(); from += step)
+			{
+				e_int32 to = Math::minimum(active.size(), from + step);
+				JobSystem::fromLambda(
+					[this, &active, from, to]()
+					{
+						for (e_int32 i = from; i < to; ++i)
+						{
+							Animable& animable = m_animables.at(active[i]);
+							sampleAnimable(animable, m_entity_instances[animable.game_object.index]);
+						}
+					},
+					&job_storage[job_count],
+					&jobs[job_count],
+					&m_engine.getFrameAllocator());
+				++job_count;
+			}
+
+			volatile e_int32 counter = 0;
+			JobSystem::runJobs(jobs, job_count, &counter);
+			JobSystem::wait(&counter);
+
+			for (e_int32 idx : active)
+			{
+				Animable& animable = m_animables.at(idx);
+				GameObject game_object = animable.game_object;
+				e_float length = animable.animation->getLength();
+				e_float time = animable.time + time_delta * animable.time_scale;
+				if (length > 0)
+				{
+					time = fmodf(time, length);
+					if (time < 0) time += length;
+				}
+				animable.time = time;
+				unlockPose({game_object.index}, true);
+			}
 		}
 
 		e_void SceneManager::serializeEntityInstance(ISerializer& serialize, ComponentHandle cmp)
@@ -695,6 +806,7 @@ namespace egal
 				r.entity = nullptr;
 				r.meshes = nullptr;
 				r.mesh_count = 0;
+				r.skin_offset = -1;
 			}
 			auto& r = m_entity_instances[_game_object.index];
 			r.game_object = _game_object;
@@ -703,6 +815,7 @@ namespace egal
 			r.flags = 0;
 			r.meshes = nullptr;
 			r.mesh_count = 0;
+			r.skin_offset = -1;
 
 			r.matrix = m_com_man.getMatrix(r.game_object);
 
@@ -799,7 +912,6 @@ namespace egal
 
 		e_void SceneManager::deserializePointLight(IDeserializer& serializer, GameObject entity, e_int32 scene_version)
 		{
-			m_light_influenced_geometry.emplace(m_allocator);
 			PointLight& light = m_point_lights.emplace();
 			light.m_game_object = entity;
 			serializer.read(&light.m_attenuation_param);
@@ -872,6 +984,34 @@ namespace egal
 		}
 
 
+		e_void SceneManager::serializeAnimable(ISerializer& serializer, ComponentHandle cmp)
+		{
+			Animable& animable = m_animables[{cmp.index}];
+			serializer.write("time_scale",	animable.time_scale);
+			serializer.write("start_time",	animable.start_time);
+			serializer.write("animation",	animable.animation ? animable.animation->getPath().c_str() : "");
+			serializer.write("skeleton",	animable.skeleton ? animable.skeleton->getPath().c_str() : "");
+		}
+
+
+		e_void SceneManager::deserializeAnimable(IDeserializer& serializer, GameObject game_object, e_int32 /*scene_version*/)
+		{
+			Animable& animable = m_animables.insert(game_object);
+			initAnimable(animable, game_object, m_allocator);
+			serializer.read(&animable.time_scale);
+			serializer.read(&animable.start_time);
+			animable.time = animable.start_time;
+			e_char path[MAX_PATH_LENGTH];
+			serializer.read(path, TlengthOf(path));
+			ResourceManagerBase* animation_manager = m_engine.getResourceManager().get(RESOURCE_ANIMATION_TYPE);
+			animable.animation = path[0] == '\0' ? nullptr : static_cast<Animation*>(animation_manager->load(ArchivePath(path)));
+			serializer.read(path, TlengthOf(path));
+			ResourceManagerBase* skeleton_manager = m_engine.getResourceManager().get(RESOURCE_SKELETON_TYPE);
+			animable.skeleton = path[0] == '\0' ? nullptr : static_cast<SkeletonResource*>(skeleton_manager->load(ArchivePath(path)));
+			m_com_man.addComponent(game_object, COMPONENT_ANIMABLE_TYPE, this, {game_object.index});
+		}
+
+
 		e_void SceneManager::serializeBoneAttachment(ISerializer& serializer, ComponentHandle cmp)
 		{
 			BoneAttachment& attachment = m_bone_attachments[{cmp.index}];
@@ -1048,25 +1188,113 @@ namespace egal
 
 		e_void SceneManager::serializeEntityInstances(WriteBinary& serializer)
 		{
-			serializer.write((e_int32)m_entity_instances.size());
-			for (auto& r : m_entity_instances)
+			/** 
+			 * every path is written once in a table at the head, instances follow grouped by entity as raw
+			 * game object and flag arrays, instances with custom materials are listed at the end
+			 */
+			THashMap<e_uint32, e_int32> path_map(m_allocator);
+			TArrary<const ArchivePath*> paths(m_allocator);
+			auto getPathIndex = [&path_map, &paths](const ArchivePath& path) {
+				auto iter = path_map.find(path.getHash());
+				if (iter != path_map.end()) return iter.value();
+				e_int32 idx = paths.size();
+				path_map.insert(path.getHash(), idx);
+				paths.push_back(&path);
+				return idx;
+			};
+
+			/** group 0 holds instances without entity, group i + 1 instances of entity path i */
+			e_int32 instance_count = m_entity_instances.size();
+			TArrary<e_int32> group_of(m_allocator);
+			group_of.resize(instance_count);
+			for (e_int32 i = 0; i < instance_count; ++i)
 			{
-				serializer.write(r.entity);
-				serializer.write(e_uint8(r.flags & EntityInstance::PERSISTENT_FLAGS));
-				if(r.game_object != INVALID_GAME_OBJECT)
+				const EntityInstance& r = m_entity_instances[i];
+				group_of[i] = r.game_object == INVALID_GAME_OBJECT ? -1 : (r.entity ? getPathIndex(r.entity->getPath()) + 1 : 0);
+			}
+			e_int32 group_count = paths.size() + 1;
+
+			TArrary<e_int32> custom_instances(m_allocator);
+			TArrary<e_int32> custom_paths(m_allocator);
+			for (e_int32 i = 0; i < instance_count; ++i)
+			{
+				EntityInstance& r = m_entity_instances[i];
+				if (r.game_object == INVALID_GAME_OBJECT) continue;
+				e_bool has_changed_materials = r.entity && r.entity->isReady() && r.meshes != &r.entity->getMesh(0);
+				if (!has_changed_materials) continue;
+
+				custom_instances.push_back(i);
+				for (e_int32 j = 0; j < r.mesh_count; ++j)
 				{
-					serializer.write(r.entity ? r.entity->getPath().getHash() : 0);
-					e_bool has_changed_materials = r.entity && r.entity->isReady() && r.meshes != &r.entity->getMesh(0);
-					serializer.write(has_changed_materials ? r.mesh_count : 0);
-					if (has_changed_materials)
-					{
-						for (e_int32 i = 0; i < r.mesh_count; ++i)
-						{
-							serializer.writeString(r.meshes[i].material->getPath().c_str());
-						}
-					}
+					custom_paths.push_back(getPathIndex(r.meshes[j].material->getPath()));
 				}
-			
+			}
+
+			TArrary<e_int32> group_start(m_allocator);
+			group_start.resize(group_count + 1);
+			for (e_int32& i : group_start) i = 0;
+			for (e_int32 i = 0; i < instance_count; ++i)
+			{
+				if (group_of[i] >= 0) ++group_start[group_of[i] + 1];
+			}
+			for (e_int32 i = 0; i < group_count; ++i)
+			{
+				group_start[i + 1] += group_start[i];
+			}
+
+			TArrary<e_int32> cursor(m_allocator);
+			cursor.resize(group_count);
+			for (e_int32 i = 0; i < group_count; ++i) cursor[i] = group_start[i];
+			TArrary<GameObject> game_objects(m_allocator);
+			TArrary<e_uint8> flags(m_allocator);
+			game_objects.resize(group_start[group_count]);
+			flags.resize(group_start[group_count]);
+			for (e_int32 i = 0; i < instance_count; ++i)
+			{
+				if (group_of[i] < 0) continue;
+				e_int32 slot = cursor[group_of[i]]++;
+				game_objects[slot] = m_entity_instances[i].game_object;
+				flags[slot] = e_uint8(m_entity_instances[i].flags & EntityInstance::PERSISTENT_FLAGS);
+			}
+
+			serializer.write(ENTITY_INSTANCES_VERSION);
+			serializer.write(instance_count);
+			e_int32 strings_size = 0;
+			for (const ArchivePath* path : paths)
+			{
+				strings_size += path->length() + 1;
+			}
+			serializer.write(paths.size());
+			serializer.write(strings_size);
+			for (const ArchivePath* path : paths)
+			{
+				serializer.write(path->c_str(), path->length() + 1);
+			}
+
+			e_int32 used_groups = 0;
+			for (e_int32 i = 0; i < group_count; ++i)
+			{
+				if (group_start[i + 1] > group_start[i]) ++used_groups;
+			}
+			serializer.write(used_groups);
+			for (e_int32 i = 0; i < group_count; ++i)
+			{
+				e_int32 count = group_start[i + 1] - group_start[i];
+				if (count == 0) continue;
+				serializer.write(i - 1);
+				serializer.write(count);
+				serializer.write(&game_objects[group_start[i]], count * sizeof(GameObject));
+				serializer.write(&flags[group_start[i]], count);
+			}
+
+			serializer.write(custom_instances.size());
+			for (e_int32 i = 0, path_idx = 0; i < custom_instances.size(); ++i)
+			{
+				const EntityInstance& r = m_entity_instances[custom_instances[i]];
+				serializer.write(r.game_object);
+				serializer.write((e_int32)r.mesh_count);
+				serializer.write(&custom_paths[path_idx], r.mesh_count * sizeof(e_int32));
+				path_idx += r.mesh_count;
 			}
 		}
 
@@ -1179,6 +1407,47 @@ namespace egal
 		}
 
 
+		e_void SceneManager::serializeAnimables(WriteBinary& serializer)
+		{
+			serializer.write((e_int32)m_animables.size());
+			for (const Animable& animable : m_animables)
+			{
+				serializer.write(animable.game_object);
+				serializer.write(animable.time_scale);
+				serializer.write(animable.start_time);
+				serializer.writeString(animable.animation ? animable.animation->getPath().c_str() : "");
+				serializer.writeString(animable.skeleton ? animable.skeleton->getPath().c_str() : "");
+			}
+		}
+
+
+		e_void SceneManager::deserializeAnimables(ReadBinary& serializer)
+		{
+			/** older scenes end before this block and read a zero count */
+			e_int32 count = 0;
+			serializer.read(count);
+			m_animables.reserve(count);
+			ResourceManagerBase* animation_manager = m_engine.getResourceManager().get(RESOURCE_ANIMATION_TYPE);
+			ResourceManagerBase* skeleton_manager = m_engine.getResourceManager().get(RESOURCE_SKELETON_TYPE);
+			for (e_int32 i = 0; i < count; ++i)
+			{
+				GameObject game_object;
+				serializer.read(game_object);
+				Animable& animable = m_animables.insert(game_object);
+				initAnimable(animable, game_object, m_allocator);
+				serializer.read(animable.time_scale);
+				serializer.read(animable.start_time);
+				animable.time = animable.start_time;
+				e_char path[MAX_PATH_LENGTH];
+				serializer.readString(path, TlengthOf(path));
+				animable.animation = path[0] == '\0' ? nullptr : static_cast<Animation*>(animation_manager->load(ArchivePath(path)));
+				serializer.readString(path, TlengthOf(path));
+				animable.skeleton = path[0] == '\0' ? nullptr : static_cast<SkeletonResource*>(skeleton_manager->load(ArchivePath(path)));
+				m_com_man.addComponent(game_object, COMPONENT_ANIMABLE_TYPE, this, {game_object.index});
+			}
+		}
+
+
 		e_void SceneManager::serialize(WriteBinary& serializer)
 		{
 			serializeCameras(serializer);
@@ -1188,6 +1457,7 @@ namespace egal
 			serializeBoneAttachments(serializer);
 			serializeEnvironmentProbes(serializer);
 			serializeDecals(serializer);
+			serializeAnimables(serializer);
 		}
 
 
@@ -1214,51 +1484,145 @@ namespace egal
 
 		e_void SceneManager::deserializeEntityInstances(ReadBinary& serializer)
 		{
+			e_int32 version = 0;
+			serializer.read(version);
+			if (version != ENTITY_INSTANCES_VERSION)
+			{
+				log_error("Renderer Unsupported entity instances version %d.", version);
+				return;
+			}
+
 			e_int32 size = 0;
 			serializer.read(size);
-			m_entity_instances.reserve(size);
-			for (e_int32 i = 0; i < size; ++i)
+			m_entity_instances.resize(size);
+			for (auto& r : m_entity_instances)
 			{
-				auto& r = m_entity_instances.emplace();
-				serializer.read(r.game_object);
-				serializer.read(r.flags);
-				r.flags &= EntityInstance::PERSISTENT_FLAGS;
-				ASSERT(r.game_object.index == i || !r.game_object.isValid());
+				r.game_object = INVALID_GAME_OBJECT;
 				r.entity = nullptr;
 				r.pose = nullptr;
 				r.meshes = nullptr;
+				r.flags = 0;
 				r.mesh_count = 0;
+				r.skin_offset = -1;
+			}
+
+			e_int32 path_count = 0;
+			e_int32 strings_size = 0;
+			serializer.read(path_count);
+			serializer.read(strings_size);
+			const e_char* strings = (const e_char*)serializer.skip(strings_size);
+			TArrary<const e_char*> path_strings(m_allocator);
+			path_strings.resize(path_count);
+			for (e_int32 i = 0, offset = 0; i < path_count; ++i)
+			{
+				path_strings[i] = strings + offset;
+				offset += StringUnitl::stringLength(strings + offset) + 1;
+			}
 
-				if(r.game_object != INVALID_GAME_OBJECT)
+			/** normalizing, hashing and interning the paths runs on the job system, resource managers are only touched here */
+			ArchivePath* paths = path_count > 0 ? (ArchivePath*)m_allocator.allocate(path_count * sizeof(ArchivePath)) : nullptr;
+			if (path_count > 0)
+			{
+				JobSystem::JobDecl jobs[64];
+				JobSystem::LambdaJob job_storage[64];
+				e_int32 max_jobs = (e_int32)TlengthOf(jobs);
+				e_int32 step = Math::maximum(64, (path_count + max_jobs - 1) / max_jobs);
+				e_int32 job_count = 0;
+				for (e_int32 from = 0; from < path_count; from += step)
 				{
-					r.matrix = m_com_man.getMatrix(r.game_object);
+					e_int32 to = Math::minimum(path_count, from + step);
+					JobSystem::fromLambda(
+						[paths, &path_strings, from, to]()
+						{
+							for (e_int32 i = from; i < to; ++i)
+							{
+								_new(paths + i) ArchivePath(path_strings[i]);
+							}
+						},
+						&job_storage[job_count],
+						&jobs[job_count],
+						nullptr);
+					++job_count;
+				}
 
-					e_uint32 path;
-					serializer.read(path);
+				volatile e_int32 counter = 0;
+				JobSystem::runJobs(jobs, job_count, &counter);
+				JobSystem::wait(&counter);
+			}
 
-					ComponentHandle cmp = { r.game_object.index };
-					if (path != 0)
+			ResourceManagerBase* entity_manager = m_engine.getResourceManager().get(RESOURCE_ENTITY_TYPE);
+			TArrary<ComponentHandle> ready_instances(m_allocator);
+			e_int32 group_count = 0;
+			serializer.read(group_count);
+			for (e_int32 i = 0; i < group_count; ++i)
+			{
+				e_int32 path_idx = -1;
+				e_int32 count = 0;
+				serializer.read(path_idx);
+				serializer.read(count);
+				const GameObject* game_objects = (const GameObject*)serializer.skip(count * sizeof(GameObject));
+				const e_uint8* flags = (const e_uint8*)serializer.skip(count);
+
+				/** one resource reference per instance, like setEntity, but the entity is looked up once per group */
+				Entity* entity = path_idx >= 0 ? static_cast<Entity*>(entity_manager->load(paths[path_idx])) : nullptr;
+				if (entity)
+				{
+					for (e_int32 j = 1; j < count; ++j)
 					{
-						auto* entity = static_cast<Entity*>(m_engine.getResourceManager().get( RESOURCE_ENTITY_TYPE)->load(ArchivePath(path)));
-						setEntity(cmp, entity);
+						entity_manager->load(*entity);
 					}
+					getEntityLoadedCallback(entity).m_ref_count += count;
+				}
 
-					e_int32 material_count;
-					serializer.read(material_count);
-					if (material_count > 0)
-					{
-						allocateCustomMeshes(r, material_count);
-						for (e_int32 j = 0; j < material_count; ++j)
-						{
-							e_char path[MAX_PATH_LENGTH];
-							serializer.readString(path, TlengthOf(path));
-							setEntityInstanceMaterial(cmp, j, ArchivePath(path));
-						}
-					}
+				ready_instances.clear();
+				for (e_int32 j = 0; j < count; ++j)
+				{
+					ASSERT(game_objects[j].index < size);
+					EntityInstance& r = m_entity_instances[game_objects[j].index];
+					r.game_object = game_objects[j];
+					r.flags = flags[j] & EntityInstance::PERSISTENT_FLAGS;
+					r.matrix = m_com_man.getMatrix(r.game_object);
+					r.entity = entity;
+					if (entity && keepSkin(r)) entity->setKeepSkin();
+					if (entity && entity->isReady()) ready_instances.push_back({ r.game_object.index });
+				}
+				if (!ready_instances.empty())
+				{
+					entitiesLoaded(entity, &ready_instances[0], ready_instances.size());
+				}
+			}
 
-					m_com_man.addComponent(r.game_object, COMPONENT_ENTITY_INSTANCE_TYPE, this, cmp);
+			e_int32 custom_count = 0;
+			serializer.read(custom_count);
+			for (e_int32 i = 0; i < custom_count; ++i)
+			{
+				GameObject game_object;
+				e_int32 material_count = 0;
+				serializer.read(game_object);
+				serializer.read(material_count);
+				const e_int32* material_paths = (const e_int32*)serializer.skip(material_count * sizeof(e_int32));
+
+				ComponentHandle cmp = { game_object.index };
+				EntityInstance& r = m_entity_instances[cmp.index];
+				if (!r.entity || material_count <= 0) continue;
+				allocateCustomMeshes(r, material_count);
+				for (e_int32 j = 0; j < material_count; ++j)
+				{
+					setEntityInstanceMaterial(cmp, j, paths[material_paths[j]]);
 				}
 			}
+
+			for (e_int32 i = 0; i < path_count; ++i)
+			{
+				paths[i].~ArchivePath();
+			}
+			if (paths) m_allocator.deallocate(paths);
+
+			for (auto& r : m_entity_instances)
+			{
+				if (r.game_object == INVALID_GAME_OBJECT) continue;
+				m_com_man.addComponent(r.game_object, COMPONENT_ENTITY_INSTANCE_TYPE, this, { r.game_object.index });
+			}
 		}
 
 		e_void SceneManager::deserializeLights(ReadBinary& serializer)
@@ -1268,7 +1632,6 @@ namespace egal
 			m_point_lights.resize(size);
 			for (e_int32 i = 0; i < size; ++i)
 			{
-				m_light_influenced_geometry.emplace(m_allocator);
 				PointLight& light = m_point_lights[i];
 				serializer.read(light);
 				ComponentHandle cmp = { light.m_game_object.index };
@@ -1311,6 +1674,7 @@ namespace egal
 			deserializeBoneAttachments(serializer);
 			deserializeEnvironmentProbes(serializer);
 			deserializeDecals(serializer);
+			deserializeAnimables(serializer);
 		}
 
 
@@ -1329,6 +1693,24 @@ namespace egal
 		}
 
 
+		e_void SceneManager::releaseAnimable(Animable& animable)
+		{
+			if (animable.animation) animable.animation->getResourceManager().unload(*animable.animation);
+			if (animable.skeleton) animable.skeleton->getResourceManager().unload(*animable.skeleton);
+			_delete(m_allocator, animable.sampler);
+			_delete(m_allocator, animable.cache);
+		}
+
+
+		e_void SceneManager::destroyAnimable(ComponentHandle component)
+		{
+			GameObject game_object = {component.index};
+			releaseAnimable(m_animables[game_object]);
+			m_animables.erase(game_object);
+			m_com_man.destroyComponent(game_object, COMPONENT_ANIMABLE_TYPE, this, component);
+		}
+
+
 		e_void SceneManager::destroyEnvironmentProbe(ComponentHandle component)
 		{
 			GameObject entity = {component.index};
@@ -1343,19 +1725,6 @@ namespace egal
 
 		e_void SceneManager::destroyEntityInstance(ComponentHandle component)
 		{
-			for (e_int32 i = 0; i < m_light_influenced_geometry.size(); ++i)
-			{
-				TArrary<ComponentHandle>& influenced_geometry = m_light_influenced_geometry[i];
-				for (e_int32 j = 0; j < influenced_geometry.size(); ++j)
-				{
-					if (influenced_geometry[j] == component)
-					{
-						influenced_geometry.erase(j);
-						break;
-					}
-				}
-			}
-
 			setEntity(component, nullptr);
 			auto& entity_instance = m_entity_instances[component.index];
 			GameObject entity = entity_instance.game_object;
@@ -1394,7 +1763,6 @@ namespace egal
 			GameObject entity = m_point_lights[index].m_game_object;
 			m_point_lights.eraseFast(index);
 			m_point_lights_map.erase(component);
-			m_light_influenced_geometry.eraseFast(index);
 			if (index < m_point_lights.size())
 			{
 				m_point_lights_map[{m_point_lights[index].m_game_object.index}] = index;
@@ -1515,6 +1883,16 @@ namespace egal
 				m_entity_instances[index].entity && m_entity_instances[index].entity->isReady())
 			{
 				EntityInstance& r = m_entity_instances[index];
+				if (!r.pose)
+				{
+					if (!(r.flags & EntityInstance::DYNAMIC_CASTER))
+					{
+						invalidateShadowCaster(r, r.matrix);
+						r.flags |= EntityInstance::DYNAMIC_CASTER;
+						m_moving_casters.push_back(cmp);
+					}
+					r.moved_frame = m_frame_index;
+				}
 				r.matrix = m_com_man.getMatrix(game_object);
 				if (r.entity && r.entity->isReady())
 				{
@@ -1522,26 +1900,6 @@ namespace egal
 					float3 position = m_com_man.getPosition(game_object);
 					m_culling_system->updateBoundingSphere({position, radius}, cmp);
 				}
-
-				e_float bounding_radius = r.entity ? r.entity->getBoundingRadius() : 1;
-				for (e_int32 light_idx = 0, c = m_point_lights.size(); light_idx < c; ++light_idx)
-				{
-					for (e_int32 j = 0, c2 = m_light_influenced_geometry[light_idx].size(); j < c2; ++j)
-					{
-						if(m_light_influenced_geometry[light_idx][j] == cmp)
-						{
-							m_light_influenced_geometry[light_idx].eraseFast(j);
-							break;
-						}
-					}
-
-					float3 pos = m_com_man.getPosition(r.game_object);
-					Frustum frustum = getPointLightFrustum(light_idx);
-					if(frustum.isSphereInside(pos, bounding_radius))
-					{
-						m_light_influenced_geometry[light_idx].push_back(cmp);
-					}
-				}
 			}
 
 			e_int32 decal_idx = m_decals.find(game_object);
@@ -1550,15 +1908,6 @@ namespace egal
 				updateDecalInfo(m_decals.at(decal_idx));
 			}
 
-			for (e_int32 i = 0, c = m_point_lights.size(); i < c; ++i)
-			{
-				if (m_point_lights[i].m_game_object == game_object)
-				{
-					detectLightInfluencedGeometry({ m_point_lights[i].m_game_object.index });
-					break;
-				}
-			}
-
 			e_bool was_updating = m_is_updating_attachments;
 			m_is_updating_attachments = true;
 			for (auto& attachment : m_bone_attachments)
@@ -1639,10 +1988,10 @@ namespace egal
 		e_void SceneManager::unlockPose(ComponentHandle cmp, e_bool changed)
 		{
 			if (!changed) return;
-			if (cmp.index < m_entity_instances.size()
-				&& (m_entity_instances[cmp.index].flags & EntityInstance::IS_BONE_ATTACHMENT_PARENT) == 0)
+			if (cmp.index < m_entity_instances.size())
 			{
-				return;
+				m_entity_instances[cmp.index].flags |= EntityInstance::SKIN_DIRTY;
+				if ((m_entity_instances[cmp.index].flags & EntityInstance::IS_BONE_ATTACHMENT_PARENT) == 0) return;
 			}
 
 			GameObject parent = {cmp.index};
@@ -1656,6 +2005,84 @@ namespace egal
 		}
 
 
+		e_void SceneManager::updateSkinMatrices()
+		{
+			PROFILE_FUNCTION();
+
+			/** palettes are packed in instance order, an instance whose slot moved is recomputed as well */
+			m_dirty_skins.clear();
+			e_int32 total = 0;
+			for (e_int32 i = 0, c = m_entity_instances.size(); i < c; ++i)
+			{
+				EntityInstance& r = m_entity_instances[i];
+				if (!r.pose || !r.entity || !r.entity->isReady())
+				{
+					r.skin_offset = -1;
+					continue;
+				}
+				if (r.skin_offset != total)
+				{
+					r.skin_offset = total;
+					r.flags |= EntityInstance::SKIN_DIRTY;
+				}
+				total += r.pose->count;
+				if (r.flags & EntityInstance::SKIN_DIRTY)
+				{
+					r.flags &= ~EntityInstance::SKIN_DIRTY;
+					m_dirty_skins.push_back(i);
+				}
+			}
+			m_skin_matrices.resize(total);
+			if (m_dirty_skins.empty()) return;
+
+			JobSystem::JobDecl jobs[64];
+			JobSystem::LambdaJob job_storage[64];
+			e_int32 max_jobs = (e_int32)TlengthOf(jobs);
+			e_int32 step = Math::maximum(16, (m_dirty_skins.size() + max_jobs - 1) / max_jobs);
+			e_int32 job_count = 0;
+			for (e_int32 from = 0; from < m_dirty_skins.size(); from += step)
+			{
+				e_int32 to = Math::minimum(m_dirty_skins.size(), from + step);
+				JobSystem::fromLambda(
+					[this, from, to]()
+					{
+						for (e_int32 i = from; i < to; ++i)
+						{
+							const EntityInstance& r = m_entity_instances[m_dirty_skins[i]];
+							r.entity->computeSkinMatrices(*r.pose, &m_skin_matrices[r.skin_offset]);
+						}
+					},
+					&job_storage[job_count],
+					&jobs[job_count],
+					&m_engine.getFrameAllocator());
+				++job_count;
+			}
+
+			volatile e_int32 counter = 0;
+			JobSystem::runJobs(jobs, job_count, &counter);
+			JobSystem::wait(&counter);
+		}
+
+
+		const float4x4* SceneManager::getSkinMatrices(ComponentHandle cmp) const
+		{
+			/** a pose changed since the last update keeps its previous palette, a pose without one is drawn in bind pose */
+			const EntityInstance& r = m_entity_instances[cmp.index];
+			if (r.skin_offset >= 0) return &m_skin_matrices[r.skin_offset];
+
+			struct BindPose
+			{
+				BindPose()
+				{
+					for (float4x4& mtx : matrices) mtx = float4x4::IDENTITY;
+				}
+				float4x4 matrices[Entity::Bone::MAX_COUNT];
+			};
+			static const BindPose bind_pose;
+			return bind_pose.matrices;
+		}
+
+
 		GameObject SceneManager::getEntityInstanceGameObject(ComponentHandle cmp) { return m_entity_instances[cmp.index].game_object; }
 
 
@@ -1673,16 +2100,60 @@ namespace egal
 
 			Sphere sphere(m_com_man.getPosition(entity_instance.game_object), entity_instance.entity->getBoundingRadius());
 			e_uint64 layer_mask = getLayerMask(entity_instance);
-			if(!m_culling_system->isAdded(cmp)) m_culling_system->addStatic(cmp, sphere, layer_mask);
+			if (!m_culling_system->isAdded(cmp))
+			{
+				m_culling_system->addStatic(cmp, sphere, layer_mask);
+				invalidateShadowCaster(entity_instance, entity_instance.matrix);
+			}
 		}
 
 
 		e_void SceneManager::hideEntityInstance(ComponentHandle cmp)
 		{
+			if (m_culling_system->isAdded(cmp))
+			{
+				const EntityInstance& entity_instance = m_entity_instances[cmp.index];
+				invalidateShadowCaster(entity_instance, entity_instance.matrix);
+			}
 			m_culling_system->removeStatic(cmp);
 		}
 
 
+		e_bool SceneManager::isStaticShadowCaster(ComponentHandle cmp) const
+		{
+			const EntityInstance& r = m_entity_instances[cmp.index];
+			return !r.pose && !(r.flags & EntityInstance::DYNAMIC_CASTER);
+		}
+
+
+		e_void SceneManager::invalidateShadowCaster(const EntityInstance& r, const float4x4& matrix)
+		{
+			if (!r.entity || r.pose || (r.flags & EntityInstance::DYNAMIC_CASTER)) return;
+
+			e_float radius = r.entity->getBoundingRadius() * matrix.getXVector().length();
+			m_pending_shadow_caster_changes.push_back(Sphere(matrix.getTranslation(), radius));
+		}
+
+
+		e_void SceneManager::updateMovingShadowCasters()
+		{
+			for (e_int32 i = m_moving_casters.size() - 1; i >= 0; --i)
+			{
+				EntityInstance& r = m_entity_instances[m_moving_casters[i].index];
+				if (!r.game_object.isValid() || !(r.flags & EntityInstance::DYNAMIC_CASTER))
+				{
+					m_moving_casters.eraseFast(i);
+					continue;
+				}
+				if (m_frame_index - r.moved_frame < SHADOW_STATIC_FRAMES) continue;
+
+				r.flags &= ~EntityInstance::DYNAMIC_CASTER;
+				invalidateShadowCaster(r, r.matrix);
+				m_moving_casters.eraseFast(i);
+			}
+		}
+
+
 		ArchivePath SceneManager::getEntityInstancePath(ComponentHandle cmp)
 		{
 			return m_entity_instances[cmp.index].entity ? m_entity_instances[cmp.index].entity->getPath() : ArchivePath("");
@@ -1828,17 +2299,22 @@ namespace egal
 		e_void SceneManager::getPointLightInfluencedGeometry(ComponentHandle light_cmp,
 			const Frustum& frustum,
 			TArrary<EntityInstanceMesh>& infos)
+		{
+			getPointLightInfluencedGeometry(light_cmp, &frustum, 1, &infos);
+		}
+
+
+		e_void SceneManager::getPointLightInfluencedGeometry(ComponentHandle light_cmp, TArrary<EntityInstanceMesh>& infos)
 		{
 			PROFILE_FUNCTION();
 
 			e_int32 light_index = m_point_lights_map[light_cmp];
-			for (e_int32 j = 0, cj = m_light_influenced_geometry[light_index].size(); j < cj; ++j)
+			const CullingSystem::Results& results = m_culling_system->cull(getPointLightFrustum(light_index), ~0ULL);
+			for (const CullingSystem::Subresults& subresults : results)
 			{
-				ComponentHandle entity_instance_cmp = m_light_influenced_geometry[light_index][j];
-				EntityInstance& entity_instance = m_entity_instances[entity_instance_cmp.index];
-				const Sphere& sphere = m_culling_system->getSphere(entity_instance_cmp);
-				if (frustum.isSphereInside(sphere.position, sphere.radius))
+				for (ComponentHandle entity_instance_cmp : subresults)
 				{
+					const EntityInstance& entity_instance = m_entity_instances[entity_instance_cmp.index];
 					for (e_int32 k = 0, kc = entity_instance.entity->getMeshCount(); k < kc; ++k)
 					{
 						auto& info = infos.emplace();
@@ -1850,20 +2326,32 @@ namespace egal
 		}
 
 
-		e_void SceneManager::getPointLightInfluencedGeometry(ComponentHandle light_cmp, TArrary<EntityInstanceMesh>& infos)
+		e_void SceneManager::getPointLightInfluencedGeometry(ComponentHandle light_cmp,
+			const Frustum* faces,
+			e_int32 face_count,
+			TArrary<EntityInstanceMesh>* infos)
 		{
 			PROFILE_FUNCTION();
 
 			e_int32 light_index = m_point_lights_map[light_cmp];
-			auto& geoms = m_light_influenced_geometry[light_index];
-			for (e_int32 j = 0, cj = geoms.size(); j < cj; ++j)
+			const CullingSystem::Results& results = m_culling_system->cull(getPointLightFrustum(light_index), ~0ULL);
+			for (const CullingSystem::Subresults& subresults : results)
 			{
-				const EntityInstance& entity_instance = m_entity_instances[geoms[j].index];
-				for (e_int32 k = 0, kc = entity_instance.entity->getMeshCount(); k < kc; ++k)
+				for (ComponentHandle entity_instance_cmp : subresults)
 				{
-					auto& info = infos.emplace();
-					info.mesh = &entity_instance.entity->getMesh(k);
-					info.entity_instance = geoms[j];
+					EntityInstance& entity_instance = m_entity_instances[entity_instance_cmp.index];
+					const Sphere& sphere = m_culling_system->getSphere(entity_instance_cmp);
+					for (e_int32 face = 0; face < face_count; ++face)
+					{
+						if (!faces[face].isSphereInside(sphere.position, sphere.radius)) continue;
+
+						for (e_int32 k = 0, kc = entity_instance.entity->getMeshCount(); k < kc; ++k)
+						{
+							auto& info = infos[face].emplace();
+							info.mesh = &entity_instance.entity->getMesh(k);
+							info.entity_instance = entity_instance_cmp;
+						}
+					}
 				}
 			}
 		}
@@ -1901,19 +2389,65 @@ namespace egal
 		}
 
 
+		e_bool SceneManager::rasterizeOccluders(const TArrary<TArrary<ComponentHandle>>& visible, ComponentHandle camera, e_uint64 layer_mask)
+		{
+			PROFILE_FUNCTION();
+			const Camera& cam = m_cameras[{camera.index}];
+			OcclusionBuffer::Camera occlusion_camera;
+			occlusion_camera.view = m_com_man.getMatrix(cam.game_object);
+			occlusion_camera.view.fastInverse();
+			occlusion_camera.fov = cam.fov;
+			occlusion_camera.ratio = cam.screen_height > 0 ? cam.screen_width / cam.screen_height : 1;
+			occlusion_camera.near_plane = cam.near_flip;
+			occlusion_camera.ortho_size = cam.ortho_size;
+			occlusion_camera.is_ortho = cam.is_ortho;
+			m_occlusion_buffer->begin(occlusion_camera);
+
+			/** only occluders which passed frustum culling can hide anything in it */
+			for (const TArrary<ComponentHandle>& subresult : visible)
+			{
+				for (ComponentHandle cmp : subresult)
+				{
+					const EntityInstance& r = m_entity_instances[cmp.index];
+					if ((r.flags & EntityInstance::OCCLUDER) == 0 || !r.meshes) continue;
+
+					LODMeshIndices lod = r.entity->getLODMeshIndices(0);
+					for (e_int32 j = lod.from; j <= lod.to; ++j)
+					{
+						const Mesh& mesh = r.meshes[j];
+						if ((mesh.layer_mask & layer_mask) == 0) continue;
+						m_occlusion_buffer->addOccluder(mesh, r.matrix);
+					}
+				}
+			}
+
+			if (m_occlusion_buffer->getTriangleCount() == 0) return false;
+			m_occlusion_buffer->rasterize();
+			return true;
+		}
+
+
 		TArrary<TArrary<EntityInstanceMesh>>& SceneManager::getEntityInstanceInfos(const Frustum& frustum,
 			const float3& lod_ref_point,
 			ComponentHandle camera,
-			e_uint64 layer_mask)
+			e_uint64 layer_mask,
+			e_bool occlusion_culling)
 		{
-			for (auto& i : m_temporary_infos) 
-				i.clear();
+			IAllocator& frame_allocator = m_engine.getFrameAllocator();
+			/** infos of the previous call may live in an already rewound frame arena, start from fresh buffers */
+			for (auto& i : m_temporary_infos)
+			{
+				TArrary<EntityInstanceMesh> fresh(frame_allocator);
+				fresh.reserve(i.size());
+				i.swap(fresh);
+			}
 
 			const CullingSystem::Results& results = m_culling_system->cull(frustum, layer_mask);
+			e_bool is_occlusion_active = occlusion_culling && camera.isValid() && rasterizeOccluders(results, camera, layer_mask);
 
 			while (m_temporary_infos.size() < results.size())
 			{
-				m_temporary_infos.emplace(m_allocator);
+				m_temporary_infos.emplace(frame_allocator);
 			}
 
 			while (m_temporary_infos.size() > results.size())
@@ -1929,13 +2463,12 @@ namespace egal
 			for (e_int32 subresult_index = 0; subresult_index < results.size(); ++subresult_index)
 			{
 				TArrary<EntityInstanceMesh>& subinfos = m_temporary_infos[subresult_index];
-				subinfos.clear();
 
 				JobSystem::fromLambda(
-					[&layer_mask, &subinfos, this, &results, subresult_index, lod_ref_point, camera]() 
+					[&layer_mask, &subinfos, this, &results, subresult_index, lod_ref_point, camera, is_occlusion_active]() 
 					{
-						//PROFILE_BLOCK("Temporary Info Job");
-						//PROFILE_INT("EntityInstance count", results[subresult_index].size());
+						PROFILE_BLOCK("Temporary Info Job");
+						PROFILE_INT("EntityInstance count", results[subresult_index].size());
 						if (results[subresult_index].empty()) 
 							return;
 
@@ -1944,8 +2477,15 @@ namespace egal
 						e_float final_lod_multiplier = m_lod_multiplier * lod_multiplier;
 						const ComponentHandle* RESTRICT raw_subresults = &results[subresult_index][0];
 						EntityInstance* RESTRICT entity_instances = &m_entity_instances[0];
+						e_int32 occluded_count = 0;
 						for (e_int32 i = 0, c = results[subresult_index].size(); i < c; ++i)
 						{
+							if (is_occlusion_active && m_occlusion_buffer->isOccluded(m_culling_system->getSphere(raw_subresults[i])))
+							{
+								++occluded_count;
+								continue;
+							}
+
 							const EntityInstance* RESTRICT entity_instance = &entity_instances[raw_subresults[i].index];
 							e_float squared_distance = (entity_instance->matrix.getTranslation() - ref_point).squaredLength();
 							squared_distance *= final_lod_multiplier;
@@ -1964,10 +2504,11 @@ namespace egal
 								info.depth				 = squared_distance;
 							}
 						}
+						PROFILE_INT("occluded", occluded_count);
 					},
 				&job_storage[subresult_index], 
 				&jobs[subresult_index], 
-				nullptr);
+				&frame_allocator);
 			}
 			JobSystem::runJobs(jobs, results.size(), &counter);
 			JobSystem::wait(&counter);
@@ -2064,9 +2605,6 @@ namespace egal
 		e_void SceneManager::setCameraOrtho(ComponentHandle camera, e_bool is_ortho) { m_cameras[{camera.index}].is_ortho = is_ortho; }
 
 
-		const TArrary<DebugTriangle>& SceneManager::getDebugTriangles() const { return m_debug_triangles; }
-		const TArrary<DebugLine>& SceneManager::getDebugLines() const { return m_debug_lines; }
-		const TArrary<DebugPoint>& SceneManager::getDebugPoints() const { return m_debug_points; }
 
 
 		e_void SceneManager::addDebugSphere(const float3& center,
@@ -2225,12 +2763,12 @@ namespace egal
 			e_uint32 color,
 			e_float life)
 		{
-			DebugTriangle& tri = m_debug_triangles.emplace();
-			tri.p0 = p0;
-			tri.p1 = p1;
-			tri.p2 = p2;
-			tri.color = ARGBToABGR(color);
-			tri.life = life;
+			e_uint32 abgr = ARGBToABGR(color);
+			DebugVertex vertices[] = {
+				{ p0.x, p0.y, p0.z, abgr, 0, 0 },
+				{ p1.x, p1.y, p1.z, abgr, 0, 0 },
+				{ p2.x, p2.y, p2.z, abgr, 0, 0 } };
+			m_debug_draw_buffer->add(DebugDrawBuffer::TRIANGLES, vertices, TlengthOf(vertices), life);
 		}
 
 
@@ -2517,10 +3055,8 @@ namespace egal
 
 		e_void SceneManager::addDebugPoint(const float3& pos, e_uint32 color, e_float life)
 		{
-			DebugPoint& point = m_debug_points.emplace();
-			point.pos = pos;
-			point.color = ARGBToABGR(color);
-			point.life = life;
+			DebugVertex vertex = { pos.x, pos.y, pos.z, ARGBToABGR(color), 0, 0 };
+			m_debug_draw_buffer->add(DebugDrawBuffer::POINTS, &vertex, 1, life);
 		}
 
 
@@ -2551,11 +3087,11 @@ namespace egal
 
 		e_void SceneManager::addDebugLine(const float3& from, const float3& to, e_uint32 color, e_float life)
 		{
-			DebugLine& line = m_debug_lines.emplace();
-			line.from = from;
-			line.to = to;
-			line.color = ARGBToABGR(color);
-			line.life = life;
+			e_uint32 abgr = ARGBToABGR(color);
+			DebugVertex vertices[] = {
+				{ from.x, from.y, from.z, abgr, 0, 0 },
+				{ to.x, to.y, to.z, abgr, 0, 0 } };
+			m_debug_draw_buffer->add(DebugDrawBuffer::LINES, vertices, TlengthOf(vertices), life);
 		}
 
 
@@ -2575,42 +3111,132 @@ namespace egal
 		}
 
 
-		RayCastEntityHit SceneManager::castRay(const float3& origin, const float3& dir, ComponentHandle ignored_entity_instance)
+		e_void SceneManager::castRayInstance(e_int32 sphere_idx,
+			const float3& origin,
+			const float3& dir,
+			ComponentHandle ignored_entity_instance,
+			RayCastEntityHit& hit)
+		{
+			ComponentHandle cmp = m_culling_system->getSphereOwner(sphere_idx);
+			if (cmp == ignored_entity_instance) return;
+
+			const EntityInstance& r = m_entity_instances[cmp.index];
+			if (!r.entity) return;
+
+			const Sphere& sphere = m_culling_system->getSphereByIndex(sphere_idx);
+			float3 intersection;
+			if (!Math::getRaySphereIntersection(origin, dir, sphere.position, sphere.radius, intersection)) return;
+
+			/** picking needs the current pose, a stale palette makes castRay compute its own */
+			const float4x4* skin_matrices = r.pose && r.skin_offset >= 0 && !(r.flags & EntityInstance::SKIN_DIRTY)
+				? &m_skin_matrices[r.skin_offset]
+				: nullptr;
+			RayCastEntityHit new_hit = r.entity->castRay(origin, dir, r.matrix, r.pose, skin_matrices);
+			if (new_hit.m_is_hit && (!hit.m_is_hit || new_hit.m_t < hit.m_t))
+			{
+				new_hit.m_component = cmp;
+				new_hit.m_game_object = r.game_object;
+				new_hit.m_component_type = COMPONENT_ENTITY_INSTANCE_TYPE;
+				hit = new_hit;
+			}
+		}
+
+
+		e_void SceneManager::castRays(const float3* origins,
+			const float3* dirs,
+			e_int32 count,
+			ComponentHandle ignored_entity_instance,
+			RayCastEntityHit* hits)
 		{
 			PROFILE_FUNCTION();
-			RayCastEntityHit hit;
-			hit.m_is_hit = false;
-			hit.m_origin = origin;
-			hit.m_dir = dir;
-			e_float cur_dist = FLT_MAX;
-			ComponentManager& com_man = getComponentManager();
-			for (e_int32 i = 0; i < m_entity_instances.size(); ++i)
-			{
-				auto& r = m_entity_instances[i];
-				if (ignored_entity_instance.index == i || !r.entity) continue;
-
-				const float3& pos = r.matrix.getTranslation();
-				e_float scale = com_man.getScale(r.game_object);
-				e_float radius = r.entity->getBoundingRadius() * scale;
-				e_float dist = (pos - origin).length();
-				if (dist - radius > cur_dist) continue;
-			
-				float3 intersection;
-				if (Math::getRaySphereIntersection(origin, dir, pos, radius, intersection))
+
+			m_culling_system->updateBVH();
+			for (e_int32 i = 0; i < count; ++i)
+			{
+				hits[i].m_is_hit = false;
+				hits[i].m_origin = origins[i];
+				hits[i].m_dir = dirs[i];
+			}
+
+			/** the hierarchy is read only from here on, packets are independent */
+			const BVH& bvh = m_culling_system->getBVH();
+			auto cast_packets = [this, &bvh, origins, dirs, count, ignored_entity_instance, hits](e_int32 from, e_int32 to)
+			{
+				for (e_int32 first = from; first < to; first += 4)
 				{
-					RayCastEntityHit new_hit = r.entity->castRay(origin, dir, r.matrix, r.pose);
-					if (new_hit.m_is_hit && (!hit.m_is_hit || new_hit.m_t < hit.m_t))
+					float3 packet_origins[4];
+					float3 packet_dirs[4];
+					e_float t_max[4];
+					for (e_int32 i = 0; i < 4; ++i)
 					{
-						new_hit.m_component = {i};
-						new_hit.m_game_object = r.game_object;
-						new_hit.m_component_type = COMPONENT_ENTITY_INSTANCE_TYPE;
-						hit = new_hit;
-						hit.m_is_hit = true;
-						cur_dist = dir.length() * hit.m_t;
+						e_bool is_used = first + i < count;
+						packet_origins[i] = is_used ? origins[first + i] : float3(0, 0, 0);
+						packet_dirs[i] = is_used ? dirs[first + i] : float3(0, 0, 1);
+						t_max[i] = is_used ? FLT_MAX : -1;
 					}
+
+					auto callback = [&](e_int32 sphere_idx, e_int32 ray_mask, e_float* max_t)
+					{
+						for (e_int32 i = 0; i < 4; ++i)
+						{
+							if ((ray_mask & (1 << i)) == 0) continue;
+
+							RayCastEntityHit& hit = hits[first + i];
+							castRayInstance(sphere_idx, packet_origins[i], packet_dirs[i], ignored_entity_instance, hit);
+							if (hit.m_is_hit) max_t[i] = hit.m_t;
+						}
+					};
+					bvh.castRayPacket(packet_origins, packet_dirs, t_max, callback);
 				}
+			};
+
+			/** small batches are not worth the job overhead */
+			static const e_int32 RAYS_PER_JOB = 64;
+			if (count <= RAYS_PER_JOB)
+			{
+				cast_packets(0, count);
+				return;
+			}
+
+			JobSystem::JobDecl jobs[64];
+			JobSystem::LambdaJob job_storage[64];
+			e_int32 max_jobs = (e_int32)TlengthOf(jobs);
+			e_int32 step = Math::maximum(RAYS_PER_JOB, (count + max_jobs - 1) / max_jobs);
+			step = (step + 3) & ~3;
+			e_int32 job_count = 0;
+			for (e_int32 from = 0; from < count; from += step)
+			{
+				e_int32 to = Math::minimum(count, from + step);
+				JobSystem::fromLambda([&cast_packets, from, to]() { cast_packets(from, to); },
+					&job_storage[job_count],
+					&jobs[job_count],
+					&m_engine.getFrameAllocator());
+				++job_count;
 			}
 
+			volatile e_int32 counter = 0;
+			JobSystem::runJobs(jobs, job_count, &counter);
+			JobSystem::wait(&counter);
+		}
+
+
+		RayCastEntityHit SceneManager::castRay(const float3& origin, const float3& dir, ComponentHandle ignored_entity_instance)
+		{
+			PROFILE_FUNCTION();
+			RayCastEntityHit hit;
+			hit.m_is_hit = false;
+			hit.m_origin = origin;
+			hit.m_dir = dir;
+
+			/** instances are visited front to back through the culling spheres, a hit cuts off everything behind it */
+			m_culling_system->updateBVH();
+			auto callback = [&](e_int32 sphere_idx, e_float& t_max)
+			{
+				castRayInstance(sphere_idx, origin, dir, ignored_entity_instance, hit);
+				if (hit.m_is_hit) t_max = hit.m_t;
+			};
+			m_culling_system->getBVH().castRay(origin, dir, FLT_MAX, callback);
+
 			//for (auto* terrain : m_terrains)
 			//{
 			//	RayCastEntityHit terrain_hit = terrain->castRay(origin, dir);
@@ -2925,10 +3551,15 @@ namespace egal
 			_delete(m_allocator, r.pose);
 			r.pose = nullptr;
 
-			for (e_int32 i = 0; i < m_point_lights.size(); ++i)
+			/** the reloaded entity can have different bones, the remap and joint binding are rebuilt on the next sample */
+			e_int32 animable_idx = m_animables.find(r.game_object);
+			if (animable_idx >= 0)
 			{
-				m_light_influenced_geometry[i].eraseItemFast(component);
+				m_animables.at(animable_idx).cache->invalidate();
+				m_animables.at(animable_idx).bound_entity = nullptr;
 			}
+
+			if (m_culling_system->isAdded(component)) invalidateShadowCaster(r, r.matrix);
 			m_culling_system->removeStatic(component);
 		}
 
@@ -2950,21 +3581,58 @@ namespace egal
 
 		e_void SceneManager::entityLoaded(Entity* entity, ComponentHandle component)
 		{
-			auto& rm = m_engine.getResourceManager();
-			auto* material_manager = static_cast<MaterialManager*>(rm.get(RESOURCE_MATERIAL_TYPE));
-
 			auto& r = m_entity_instances[component.index];
 
 			e_float bounding_radius = r.entity->getBoundingRadius();
 			e_float scale = m_com_man.getScale(r.game_object);
 			Sphere sphere(r.matrix.getTranslation(), bounding_radius * scale);
 			m_culling_system->addStatic(component, sphere, getLayerMask(r));
+			setupLoadedEntityInstance(entity, component);
+			invalidateShadowCaster(r, r.matrix);
+		}
+
+
+		e_void SceneManager::entitiesLoaded(Entity* entity, const ComponentHandle* components, e_int32 count)
+		{
+			CullingSystem::InputSpheres spheres(m_allocator);
+			CullingSystem::Subresults instances(m_allocator);
+			CullingSystem::LayerMasks layer_masks(m_allocator);
+			spheres.resize(count);
+			instances.resize(count);
+			layer_masks.resize(count);
+
+			e_float bounding_radius = entity->getBoundingRadius();
+			for (e_int32 i = 0; i < count; ++i)
+			{
+				auto& r = m_entity_instances[components[i].index];
+				e_float scale = m_com_man.getScale(r.game_object);
+				spheres[i] = Sphere(r.matrix.getTranslation(), bounding_radius * scale);
+				instances[i] = components[i];
+				layer_masks[i] = getLayerMask(r);
+			}
+			m_culling_system->insert(spheres, instances, layer_masks);
+
+			for (e_int32 i = 0; i < count; ++i)
+			{
+				setupLoadedEntityInstance(entity, components[i]);
+				invalidateShadowCaster(m_entity_instances[components[i].index], m_entity_instances[components[i].index].matrix);
+			}
+		}
+
+
+		e_void SceneManager::setupLoadedEntityInstance(Entity* entity, ComponentHandle component)
+		{
+			auto& rm = m_engine.getResourceManager();
+			auto* material_manager = static_cast<MaterialManager*>(rm.get(RESOURCE_MATERIAL_TYPE));
+
+			auto& r = m_entity_instances[component.index];
 			ASSERT(!r.pose);
 			if (entity->getBoneCount() > 0)
 			{
 				r.pose = _aligned_new(m_allocator, Pose)(m_allocator);
 				r.pose->resize(entity->getBoneCount());
 				entity->getPose(*r.pose);
+				r.flags |= EntityInstance::SKIN_DIRTY;
 				e_int32 skinned_define_idx = m_renderer.getShaderDefineIdx("SKINNED");
 				for (e_int32 i = 0; i < entity->getMeshCount(); ++i)
 				{
@@ -2998,18 +3666,6 @@ namespace egal
 			{
 				updateBoneAttachment(m_bone_attachments[r.game_object]);
 			}
-
-			for (e_int32 i = 0; i < m_point_lights.size(); ++i)
-			{
-				PointLight& light = m_point_lights[i];
-				float3 t = r.matrix.getTranslation();
-				e_float radius = r.entity->getBoundingRadius();
-				if ((t - m_com_man.getPosition(light.m_game_object)).squaredLength() <
-					(radius + light.m_range) * (radius + light.m_range))
-				{
-					m_light_influenced_geometry[i].push_back(component);
-				}
-			}
 		}
 
 
@@ -3027,13 +3683,18 @@ namespace egal
 
 		e_void SceneManager::EntityLoaded(Entity* entity)
 		{
+			TArrary<ComponentHandle> instances(m_allocator);
 			for (e_int32 i = 0, c = m_entity_instances.size(); i < c; ++i)
 			{
 				if (m_entity_instances[i].game_object != INVALID_GAME_OBJECT && m_entity_instances[i].entity == entity)
 				{
-					entityLoaded(entity, {i});
+					instances.push_back({i});
 				}
 			}
+			if (!instances.empty())
+			{
+				entitiesLoaded(entity, &instances[0], instances.size());
+			}
 		}
 
 
@@ -3113,6 +3774,26 @@ namespace egal
 		}
 
 
+		e_bool SceneManager::isEntityInstanceOccluder(ComponentHandle cmp)
+		{
+			return (m_entity_instances[cmp.index].flags & (e_uint8)EntityInstance::OCCLUDER) != 0;
+		}
+
+
+		e_void SceneManager::setEntityInstanceOccluder(ComponentHandle cmp, e_bool is_occluder)
+		{
+			auto& r = m_entity_instances[cmp.index];
+			if (is_occluder)
+			{
+				r.flags |= (e_uint8)EntityInstance::OCCLUDER;
+			}
+			else
+			{
+				r.flags &= ~(e_uint8)EntityInstance::OCCLUDER;
+			}
+		}
+
+
 		e_void SceneManager::setEntityInstanceMaterial(ComponentHandle cmp, e_int32 index, const ArchivePath& path)
 		{
 			auto& r = m_entity_instances[cmp.index];
@@ -3165,6 +3846,7 @@ namespace egal
 
 				if (old_entity->isReady())
 				{
+					invalidateShadowCaster(entity_instance, entity_instance.matrix);
 					m_culling_system->removeStatic(component);
 				}
 				old_entity->getResourceManager().unload(*old_entity);
@@ -3191,24 +3873,6 @@ namespace egal
 		IAllocator& SceneManager::getAllocator() { return m_allocator; }
 
 
-		e_void SceneManager::detectLightInfluencedGeometry(ComponentHandle cmp)
-		{
-			e_int32 light_idx = m_point_lights_map[cmp];
-			Frustum frustum = getPointLightFrustum(light_idx);
-			const CullingSystem::Results& results = m_culling_system->cull(frustum, ~0ULL);
-			auto& influenced_geometry = m_light_influenced_geometry[light_idx];
-			influenced_geometry.clear();
-			for (e_int32 i = 0; i < results.size(); ++i)
-			{
-				const CullingSystem::Subresults& subresult = results[i];
-				influenced_geometry.reserve(influenced_geometry.size() + subresult.size());
-				for (e_int32 j = 0, c = subresult.size(); j < c; ++j)
-				{
-					influenced_geometry.push_back(subresult[j]);
-				}
-			}
-		}
-
 		e_float SceneManager::getLightFOV(ComponentHandle cmp)
 		{
 			return m_point_lights[m_point_lights_map[cmp]].m_fov;
@@ -3246,7 +3910,6 @@ namespace egal
 		ComponentHandle SceneManager::createPointLight(GameObject entity)
 		{
 			PointLight& light = m_point_lights.emplace();
-			m_light_influenced_geometry.emplace(m_allocator);
 			light.m_game_object = entity;
 			light.m_diffuse_color.set(1, 1, 1);
 			light.m_diffuse_intensity = 1;
@@ -3261,8 +3924,6 @@ namespace egal
 
 			m_com_man.addComponent(entity, COMPONENT_POINT_LIGHT_TYPE, this, cmp);
 
-			detectLightInfluencedGeometry(cmp);
-
 			return cmp;
 		}
 
@@ -3325,6 +3986,60 @@ namespace egal
 		}
 
 
+		ComponentHandle SceneManager::createAnimable(GameObject game_object)
+		{
+			Animable& animable = m_animables.insert(game_object);
+			initAnimable(animable, game_object, m_allocator);
+
+			ComponentHandle cmp = { game_object.index };
+			m_com_man.addComponent(game_object, COMPONENT_ANIMABLE_TYPE, this, cmp);
+			return cmp;
+		}
+
+
+		ArchivePath SceneManager::getAnimableAnimation(ComponentHandle cmp)
+		{
+			const Animable& animable = m_animables[{cmp.index}];
+			return animable.animation ? animable.animation->getPath() : ArchivePath("");
+		}
+
+
+		e_void SceneManager::setAnimableAnimation(ComponentHandle cmp, const ArchivePath& path)
+		{
+			Animable& animable = m_animables[{cmp.index}];
+			if (animable.animation) animable.animation->getResourceManager().unload(*animable.animation);
+			ResourceManagerBase* animation_manager = m_engine.getResourceManager().get(RESOURCE_ANIMATION_TYPE);
+			animable.animation = path.isValid() ? static_cast<Animation*>(animation_manager->load(path)) : nullptr;
+			animable.cache->invalidate();
+			animable.time = 0;
+		}
+
+
+		ArchivePath SceneManager::getAnimableSkeleton(ComponentHandle cmp)
+		{
+			const Animable& animable = m_animables[{cmp.index}];
+			return animable.skeleton ? animable.skeleton->getPath() : ArchivePath("");
+		}
+
+
+		e_void SceneManager::setAnimableSkeleton(ComponentHandle cmp, const ArchivePath& path)
+		{
+			Animable& animable = m_animables[{cmp.index}];
+			if (animable.skeleton) animable.skeleton->getResourceManager().unload(*animable.skeleton);
+			ResourceManagerBase* skeleton_manager = m_engine.getResourceManager().get(RESOURCE_SKELETON_TYPE);
+			animable.skeleton = path.isValid() ? static_cast<SkeletonResource*>(skeleton_manager->load(path)) : nullptr;
+			animable.bound_entity = nullptr;
+		}
+
+
+		e_float SceneManager::getAnimableTime(ComponentHandle cmp) { return m_animables[{cmp.index}].time; }
+		e_void SceneManager::setAnimableTime(ComponentHandle cmp, e_float time) { m_animables[{cmp.index}].time = time; }
+		e_float SceneManager::getAnimableTimeScale(ComponentHandle cmp) { return m_animables[{cmp.index}].time_scale; }
+		e_void SceneManager::setAnimableTimeScale(ComponentHandle cmp, e_float time_scale) { m_animables[{cmp.index}].time_scale = time_scale; }
+		e_float SceneManager::getAnimableStartTime(ComponentHandle cmp) { return m_animables[{cmp.index}].start_time; }
+		e_void SceneManager::setAnimableStartTime(ComponentHandle cmp, e_float time) { m_animables[{cmp.index}].start_time = time; }
+
+
 		ComponentHandle SceneManager::createEntityInstance(GameObject game_object)
 		{
 			while(game_object.index >= m_entity_instances.size())
@@ -3333,6 +4048,7 @@ namespace egal
 				r.game_object = INVALID_GAME_OBJECT;
 				r.entity = nullptr;
 				r.pose = nullptr;
+				r.skin_offset = -1;
 			}
 			auto& r = m_entity_instances[game_object.index];
 			r.game_object = game_object;
@@ -3341,6 +4057,7 @@ namespace egal
 			r.pose = nullptr;
 			r.flags = 0;
 			r.mesh_count = 0;
+			r.skin_offset = -1;
 			r.matrix = m_com_man.getMatrix(game_object);
 			ComponentHandle cmp = { game_object.index};
 			m_com_man.addComponent(game_object, COMPONENT_ENTITY_INSTANCE_TYPE, this, cmp);
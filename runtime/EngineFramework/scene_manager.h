@@ -19,6 +19,12 @@ namespace egal
 	class Texture;
 	class Shader;
 	class CullingSystem;
+	class OcclusionBuffer;
+	class DebugDrawBuffer;
+	class Animation;
+	class AnimationSampler;
+	class SkeletonResource;
+	struct AnimationSamplingCache;
 
 
 
@@ -95,6 +101,24 @@ namespace egal
 		RigidTransform	relative_transform;
 	};
 
+	/** plays an animation on the entity instance of the same game object */
+	struct Animable
+	{
+		GameObject				game_object;
+		Animation*				animation;
+		/** skeleton the runtime clips of animation were built for */
+		SkeletonResource*		skeleton;
+		/** SoA evaluation of runtime clips */
+		AnimationSampler*		sampler;
+		/** entity the sampler joints are bound to */
+		Entity*					bound_entity;
+		/** bone remap and key cursors of this instance, used by legacy clips */
+		AnimationSamplingCache*	cache;
+		e_float					time;
+		e_float					time_scale;
+		e_float					start_time;
+	};
+
 	struct TerrainInfo
 	{
 		float4x4	m_world_matrix;
@@ -113,8 +137,13 @@ namespace egal
 			CUSTOM_MESHES = 1 << 0,
 			KEEP_SKIN = 1 << 1,
 			IS_BONE_ATTACHMENT_PARENT = 1 << 2,
+			SKIN_DIRTY = 1 << 3,
+			/** moved within the last SHADOW_STATIC_FRAMES frames, cached shadow cascades do not treat it as static */
+			DYNAMIC_CASTER = 1 << 4,
+			/** lod 0 is rasterized into the cpu occlusion buffer and hides instances behind it */
+			OCCLUDER = 1 << 5,
 
-			RUNTIME_FLAGS = CUSTOM_MESHES,
+			RUNTIME_FLAGS = CUSTOM_MESHES | SKIN_DIRTY | DYNAMIC_CASTER,
 			PERSISTENT_FLAGS = e_uint8(~RUNTIME_FLAGS)
 		};
 
@@ -125,6 +154,8 @@ namespace egal
 		Mesh*		meshes;
 		e_uint8		flags;
 		e_int8		mesh_count;
+		e_int32		skin_offset;
+		e_uint32	moved_frame;	/** valid while DYNAMIC_CASTER is set */
 	};
 
 	struct EntityInstanceMesh
@@ -147,31 +178,6 @@ namespace egal
 		e_float				type_distance;
 	};
 
-	struct DebugTriangle
-	{
-		float3		p0;
-		float3		p1;
-		float3		p2;
-		e_uint32	color;
-		e_float		life;
-	};
-
-	struct DebugLine
-	{
-		float3		from;
-		float3		to;
-		e_uint32	color;
-		e_float		life;
-	};
-
-
-	struct DebugPoint
-	{
-		float3	 pos;
-		e_uint32 color;
-		e_float  life;
-	};
-
 	class SceneManager : public Singleton<SceneManager>
 	{
 	public:
@@ -228,6 +234,7 @@ namespace egal
 		e_void destroyCamera(ComponentHandle component);
 		e_void destroyTerrain(ComponentHandle component);
 		e_void destroyParticleEmitter(ComponentHandle component);
+		e_void destroyAnimable(ComponentHandle component);
 
 		e_void frame(e_float time_delta, e_bool paused);
 		e_void lateUpdate(e_float time_delta, e_bool paused);
@@ -247,6 +254,8 @@ namespace egal
 		e_void serializeTerrain(ISerializer& serializer, ComponentHandle cmp);
 		e_void deserializeTerrain(IDeserializer& serializer, GameObject entity, e_int32 version);
 		e_void serializeEnvironmentProbe(ISerializer& serializer, ComponentHandle cmp);
+		e_void serializeAnimable(ISerializer& serializer, ComponentHandle cmp);
+		e_void deserializeAnimable(IDeserializer& serializer, GameObject game_object, e_int32 /*scene_version*/);
 
 
 		ComponentHandle getComponent(GameObject entity, ComponentType type);
@@ -266,9 +275,14 @@ namespace egal
 		e_void serializeEnvironmentProbes(WriteBinary& serializer);
 		e_void deserializeEnvironmentProbes(ReadBinary& serializer);
 		e_void deserializeBoneAttachments(ReadBinary& serializer);
+		e_void serializeAnimables(WriteBinary& serializer);
+		e_void deserializeAnimables(ReadBinary& serializer);
 		void clear();
 
 		RayCastEntityHit castRay(const float3& origin, const float3& dir, ComponentHandle ignore);
+		/** casts count rays at once, rays are traversed in packets of four spread over the job system */
+		e_void castRays(const float3* origins, const float3* dirs, e_int32 count, ComponentHandle ignore, RayCastEntityHit* hits);
+		e_void castRayInstance(e_int32 sphere_idx, const float3& origin, const float3& dir, ComponentHandle ignore, RayCastEntityHit& hit);
 		RayCastEntityHit castRayTerrain(ComponentHandle terrain, const float3& origin, const float3& dir);
 		e_void getRay(ComponentHandle camera, const float2& screen_pos, float3& origin, float3& dir);
 
@@ -284,6 +298,9 @@ namespace egal
 		e_void entityUnloaded(Entity*, ComponentHandle component);
 		e_void freeCustomMeshes(EntityInstance& r, MaterialManager* manager);
 		e_void entityLoaded(Entity* entity, ComponentHandle component);
+		/** same as entityLoaded for many instances of one entity, the instances go to the culling system in one batch */
+		e_void entitiesLoaded(Entity* entity, const ComponentHandle* components, e_int32 count);
+		e_void setupLoadedEntityInstance(Entity* entity, ComponentHandle component);
 		e_void EntityUnloaded(Entity* entity);
 		e_void EntityLoaded(Entity* entity);
 		EntityLoadedCallback& getEntityLoadedCallback(Entity* entity);
@@ -293,9 +310,10 @@ namespace egal
 		EngineRoot& getEngine() const;
 		IAllocator& getAllocator();
 
-		e_void detectLightInfluencedGeometry(ComponentHandle cmp);
 		Pose* lockPose(ComponentHandle cmp);
 		e_void unlockPose(ComponentHandle cmp, e_bool changed);
+		e_void updateSkinMatrices();
+		const float4x4* getSkinMatrices(ComponentHandle cmp) const;
 
 		ComponentHandle getActiveGlobalLight();
 		e_void setActiveGlobalLight(ComponentHandle cmp);
@@ -365,9 +383,7 @@ namespace egal
 		e_void setBoneAttachmentRotation(ComponentHandle cmp, const float3& rot);
 		e_void setBoneAttachmentRotationQuat(ComponentHandle cmp, const Quaternion& rot);
 
-		const TArrary<DebugTriangle>& getDebugTriangles() const;
-		const TArrary<DebugLine>& getDebugLines() const;
-		const TArrary<DebugPoint>& getDebugPoints() const;
+		const DebugDrawBuffer& getDebugDrawBuffer() const { return *m_debug_draw_buffer; }
 		e_void setGlobalLODMultiplier(e_float multiplier);
 		e_float getGlobalLODMultiplier() const;
 
@@ -404,6 +420,8 @@ namespace egal
 		EntityInstance* getEntityInstances();
 		e_bool getEntityInstanceKeepSkin(ComponentHandle cmp);
 		e_void setEntityInstanceKeepSkin(ComponentHandle cmp, e_bool keep);
+		e_bool isEntityInstanceOccluder(ComponentHandle cmp);
+		e_void setEntityInstanceOccluder(ComponentHandle cmp, e_bool is_occluder);
 		ArchivePath getEntityInstancePath(ComponentHandle cmp);
 		e_void setEntityInstanceMaterial(ComponentHandle cmp, e_int32 index, const ArchivePath& path);
 		ArchivePath getEntityInstanceMaterial(ComponentHandle cmp, e_int32 index);
@@ -411,7 +429,15 @@ namespace egal
 		e_int32 getEntityInstanceMaterialsCount(ComponentHandle cmp);
 		e_void setEntityInstancePath(ComponentHandle cmp, const ArchivePath& path);
 		e_void setTerrainHeightAt(ComponentHandle cmp, e_int32 x, e_int32 z, e_float height);
-		TArrary<TArrary<EntityInstanceMesh>>& getEntityInstanceInfos(const Frustum& frustum, const float3& lod_ref_point, ComponentHandle camera, e_uint64 layer_mask);
+		/** occlusion_culling drops instances hidden behind occluders seen from camera, frustum must be the camera frustum */
+		TArrary<TArrary<EntityInstanceMesh>>& getEntityInstanceInfos(const Frustum& frustum,
+			const float3& lod_ref_point,
+			ComponentHandle camera,
+			e_uint64 layer_mask,
+			e_bool occlusion_culling);
+		e_bool isStaticShadowCaster(ComponentHandle cmp) const;
+		/** bounds of static casters added, removed, moved or settled since the previous frame */
+		const TArrary<Sphere>& getShadowCasterChanges() const { return m_shadow_caster_changes; }
 		e_void getEntityInstanceGameObjects(const Frustum& frustum, TArrary<GameObject>& entities);
 		e_float getCameraLODMultiplier(ComponentHandle camera);
 		GameObject getEntityInstanceGameObject(ComponentHandle cmp);
@@ -431,10 +457,28 @@ namespace egal
 		ComponentHandle createBoneAttachment(GameObject game_object);
 		ComponentHandle createEntityInstance(GameObject game_object);
 
+		ComponentHandle createAnimable(GameObject game_object);
+		ArchivePath getAnimableAnimation(ComponentHandle cmp);
+		e_void setAnimableAnimation(ComponentHandle cmp, const ArchivePath& path);
+		ArchivePath getAnimableSkeleton(ComponentHandle cmp);
+		e_void setAnimableSkeleton(ComponentHandle cmp, const ArchivePath& path);
+		e_float getAnimableTime(ComponentHandle cmp);
+		e_void setAnimableTime(ComponentHandle cmp, e_float time);
+		e_float getAnimableTimeScale(ComponentHandle cmp);
+		e_void setAnimableTimeScale(ComponentHandle cmp, e_float time_scale);
+		e_float getAnimableStartTime(ComponentHandle cmp);
+		e_void setAnimableStartTime(ComponentHandle cmp, e_float time);
+		/** samples every animable into the pose of its entity instance on the job system and advances its time */
+		e_void updateAnimables(e_float time_delta);
+		e_void releaseAnimable(Animable& animable);
+
 		e_int32 getClosestPointLights(const float3& pos, ComponentHandle* lights, e_int32 max_lights);
 		e_void getPointLights(const Frustum& frustum, TArrary<ComponentHandle>& lights);
+		/** influenced geometry is culled against the light bounds on every call, nothing is kept per light */
 		e_void getPointLightInfluencedGeometry(ComponentHandle light_cmp, TArrary<EntityInstanceMesh>& infos);
 		e_void getPointLightInfluencedGeometry(ComponentHandle light_cmp, const Frustum& frustum, TArrary<EntityInstanceMesh>& infos);
+		/** puts each influenced caster into the list of every face frustum it overlaps */
+		e_void getPointLightInfluencedGeometry(ComponentHandle light_cmp, const Frustum* faces, e_int32 face_count, TArrary<EntityInstanceMesh>* infos);
 		e_void setLightCastShadows(ComponentHandle cmp, e_bool cast_shadows);
 		e_bool getLightCastShadows(ComponentHandle cmp);
 		e_float getLightAttenuation(ComponentHandle cmp);
@@ -481,14 +525,18 @@ namespace egal
 		ComponentHandle getNearestEnvironmentProbe(const float3& pos) const;
 		e_uint64 getEnvironmentProbeGUID(ComponentHandle cmp) const;
 		e_void entityStateChanged(Resource::State old_state, Resource::State new_state, Resource& resource);
+		e_void invalidateShadowCaster(const EntityInstance& r, const float4x4& matrix);
+		e_void updateMovingShadowCasters();
+		e_bool rasterizeOccluders(const TArrary<TArrary<ComponentHandle>>& visible, ComponentHandle camera, e_uint64 layer_mask);
 	private:
 		IAllocator&					m_allocator;
 		ComponentManager&			m_com_man;
 		Renderer&					m_renderer;
 		EngineRoot&					m_engine;
 		CullingSystem*				m_culling_system;
+		OcclusionBuffer*			m_occlusion_buffer;
+		DebugDrawBuffer*			m_debug_draw_buffer;
 
-		TArrary<TArrary<ComponentHandle>>	m_light_influenced_geometry;
 		ComponentHandle						m_active_global_light_cmp;
 		THashMap<ComponentHandle, e_int32>	m_point_lights_map;
 
@@ -500,14 +548,17 @@ namespace egal
 		THashMap<GameObject, Camera>				m_cameras;
 		TArraryMap<GameObject, BoneAttachment>		m_bone_attachments;
 		TArraryMap<GameObject, EnvironmentProbe>	m_environment_probes;
+		TArraryMap<GameObject, Animable>			m_animables;
 
 
 		TArraryMap<Entity*, EntityLoadedCallback>		m_entity_loaded_callbacks;
 		TArrary<TArrary<EntityInstanceMesh>>			m_temporary_infos;
-
-		TArrary<DebugTriangle>	m_debug_triangles;
-		TArrary<DebugLine>		m_debug_lines;
-		TArrary<DebugPoint>		m_debug_points;
+		TArrary<float4x4>								m_skin_matrices;
+		TArrary<e_int32>								m_dirty_skins;
+		TArrary<ComponentHandle>						m_moving_casters;
+		TArrary<Sphere>									m_shadow_caster_changes;
+		TArrary<Sphere>									m_pending_shadow_caster_changes;
+		e_uint32										m_frame_index;
 
 		e_float m_time;
 		e_float m_lod_multiplier;
@@ -34,7 +34,8 @@ namespace egal
 		, m_frame_scale_time(1.0f)
 		, m_p_engine_root(nullptr)
 	{
-		g_allocator = &m_main_allocator;
+		/** everything goes through the tracking allocator so memory tags and budgets see it */
+		g_allocator = &m_allocator;
 
 		/** ȳʼļϵͳ */
 		init_file_system(m_allocator);